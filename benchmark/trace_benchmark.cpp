@@ -0,0 +1,2332 @@
+
+#include <VulkanPT/accumulation.hpp>
+#include <VulkanPT/bvh.hpp>
+#include <VulkanPT/compressed_bvh.hpp>
+#include <VulkanPT/curve.hpp>
+#include <VulkanPT/debug.hpp>
+#include <VulkanPT/denoiser.hpp>
+#include <VulkanPT/displacement.hpp>
+#include <VulkanPT/environment.hpp>
+#include <VulkanPT/hash.hpp>
+#include <VulkanPT/light_bvh.hpp>
+#include <VulkanPT/path_guiding.hpp>
+#include <VulkanPT/path_termination.hpp>
+#include <VulkanPT/radiance_cache.hpp>
+#include <VulkanPT/restir.hpp>
+#include <VulkanPT/sampler.hpp>
+#include <VulkanPT/scene_cache.hpp>
+#include <VulkanPT/texture.hpp>
+#include <VulkanPT/texture_compression.hpp>
+#include <VulkanPT/virtual_texture.hpp>
+#include <VulkanPT/volume.hpp>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <functional>
+#include <memory>
+#include <random>
+#include <type_traits>
+#include <vector>
+
+using namespace PathTracer;
+
+// Procedural test scene: a ground quad with a grid of tessellated spheres.
+static void MakeScene(std::vector<glm::vec3>& positions, std::vector<uint32_t>& indices)
+{
+  const int grid = 12;
+  const int rings = 24;
+  const int segments = 48;
+
+  positions = { { -50.0f, 0.0f, -50.0f }, { 50.0f, 0.0f, -50.0f },
+                { 50.0f, 0.0f, 50.0f }, { -50.0f, 0.0f, 50.0f } };
+  indices = { 0, 1, 2, 0, 2, 3 };
+
+  for (int gx = 0; gx < grid; ++gx)
+  {
+    for (int gz = 0; gz < grid; ++gz)
+    {
+      glm::vec3 center((gx - grid / 2) * 3.0f, 1.0f, (gz - grid / 2) * 3.0f);
+      uint32_t base = static_cast<uint32_t>(positions.size());
+
+      for (int ring = 0; ring <= rings; ++ring)
+      {
+        float theta = 3.14159265f * ring / rings;
+        for (int segment = 0; segment <= segments; ++segment)
+        {
+          float phi = 2.0f * 3.14159265f * segment / segments;
+          positions.push_back(center + glm::vec3(std::sin(theta) * std::cos(phi), std::cos(theta),
+                                                 std::sin(theta) * std::sin(phi)));
+        }
+      }
+
+      for (int ring = 0; ring < rings; ++ring)
+      {
+        for (int segment = 0; segment < segments; ++segment)
+        {
+          uint32_t a = base + ring * (segments + 1) + segment;
+          uint32_t b = a + segments + 1;
+          indices.insert(indices.end(), { a, b, a + 1, a + 1, b, b + 1 });
+        }
+      }
+    }
+  }
+}
+
+// Primary rays are emitted in 4x2 pixel blocks so consecutive rays are coherent.
+static std::vector<Ray> MakePrimaryRays(uint32_t width, uint32_t height)
+{
+  glm::vec3 eye(0.0f, 12.0f, -30.0f);
+  glm::vec3 forward = glm::normalize(glm::vec3(0.0f, 0.0f, 0.0f) - eye);
+  glm::vec3 right = glm::normalize(glm::cross(glm::vec3(0.0f, 1.0f, 0.0f), forward));
+  glm::vec3 up = glm::cross(forward, right);
+  float aspect = static_cast<float>(width) / height;
+
+  std::vector<Ray> rays;
+  rays.reserve(static_cast<size_t>(width) * height);
+  for (uint32_t by = 0; by < height; by += 2)
+  {
+    for (uint32_t bx = 0; bx < width; bx += 4)
+    {
+      for (uint32_t y = by; y < std::min(by + 2, height); ++y)
+      {
+        for (uint32_t x = bx; x < std::min(bx + 4, width); ++x)
+        {
+          float px = (2.0f * (x + 0.5f) / width - 1.0f) * aspect * 0.5f;
+          float py = (1.0f - 2.0f * (y + 0.5f) / height) * 0.5f;
+          Ray ray;
+          ray.origin = eye;
+          ray.direction = glm::normalize(forward + right * px + up * py);
+          rays.push_back(ray);
+        }
+      }
+    }
+  }
+  return rays;
+}
+
+// Correctness checks failed so far, any makes the benchmark exit non-zero.
+static int failures = 0;
+
+static void Check(bool passed, const char* what)
+{
+  if (passed) return;
+  printf("FAILED: %s\n", what);
+  failures++;
+}
+
+static double Measure(const std::function<void()>& function)
+{
+  function();
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  const int repeats = 3;
+  for (int i = 0; i < repeats; ++i) function();
+  std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+  return elapsed.count() / repeats;
+}
+
+static void CompareModes(const char* name, const BVH& bvh, const std::vector<Ray>& rays)
+{
+  std::vector<Hit> reference(rays.size());
+  std::vector<Hit> hits(rays.size());
+
+  double single = Measure([&]() { bvh.Trace(rays.data(), reference.data(), rays.size(), TraceMode::Single); });
+  printf("%-10s single     %8.2f Mrays/s\n", name, rays.size() / single * 1e-6);
+
+  auto report = [&](const char* mode, double seconds)
+  {
+    size_t mismatches = 0;
+    for (size_t i = 0; i < rays.size(); ++i)
+    {
+      if (hits[i].Valid() != reference[i].Valid() ||
+          (hits[i].Valid() && std::fabs(hits[i].t - reference[i].t) > 1e-4f * reference[i].t))
+        mismatches++;
+    }
+    printf("%-10s %-10s %8.2f Mrays/s  %.2fx  %zu mismatches\n", name, mode,
+           rays.size() / seconds * 1e-6, single / seconds, mismatches);
+    Check(mismatches == 0, "trace modes disagree with single rays");
+  };
+
+  report("packet4", Measure([&]() { bvh.TracePackets<4>(rays.data(), hits.data(), rays.size()); }));
+  report("packet8", Measure([&]() { bvh.TracePackets<8>(rays.data(), hits.data(), rays.size()); }));
+  report("packet16", Measure([&]() { bvh.TracePackets<16>(rays.data(), hits.data(), rays.size()); }));
+  report("stream8", Measure([&]() { bvh.TraceStream<8>(rays.data(), hits.data(), rays.size()); }));
+  report("stream16", Measure([&]() { bvh.TraceStream<16>(rays.data(), hits.data(), rays.size()); }));
+  report("auto", Measure([&]() { bvh.Trace(rays.data(), hits.data(), rays.size(), TraceMode::Auto); }));
+}
+
+static void CompareOcclusion(const char* name, const BVH& bvh, const std::vector<Ray>& rays)
+{
+  std::unique_ptr<bool[]> occluded(new bool[rays.size()]);
+  std::unique_ptr<bool[]> occluded_reference(new bool[rays.size()]);
+  const TraceMode modes[] = { TraceMode::Single, TraceMode::Packet, TraceMode::Stream, TraceMode::Auto };
+  const char* mode_names[] = { "single", "packet", "stream", "auto" };
+  double single = 0.0;
+  for (int mode = 0; mode < 4; ++mode)
+  {
+    bool* output = mode == 0 ? occluded_reference.get() : occluded.get();
+    double seconds = Measure([&]() { bvh.TraceOcclusion(rays.data(), output, rays.size(), modes[mode]); });
+    if (mode == 0) single = seconds;
+
+    size_t mismatches = 0;
+    for (size_t i = 0; mode > 0 && i < rays.size(); ++i) mismatches += occluded[i] != occluded_reference[i];
+    printf("%-10s %-10s %8.2f Mrays/s  %.2fx  %zu mismatches\n", name, mode_names[mode],
+           rays.size() / seconds * 1e-6, single / seconds, mismatches);
+    Check(mismatches == 0, "occlusion modes disagree with single rays");
+  }
+}
+
+// Round trip through the binary scene cache, the mapped BVH must trace the same hits.
+static void CompareCache(const std::vector<glm::vec3>& positions, const std::vector<uint32_t>& indices,
+                         const BVH& bvh, const std::vector<Ray>& rays)
+{
+  Scene scene;
+  scene.positions = positions;
+  scene.indices = indices;
+  scene.material_indices.assign(indices.size() / 3, 0);
+  scene.materials.resize(1);
+  scene.bvh = bvh;
+
+  const std::string path = "trace_benchmark.vptscene";
+  const uint64_t source_hash = HashBytes(positions.data(), positions.size() * sizeof(glm::vec3));
+  double write = Measure([&]() { SceneCache::Write(path, scene, source_hash); });
+
+  Scene cached;
+  SceneCache cache;
+  bool stale = cache.Open(path, source_hash + 1);
+  double load = Measure([&]()
+  {
+    cache.Open(path, source_hash);
+    cache.Load(cached);
+  });
+
+  std::vector<Hit> reference(rays.size());
+  std::vector<Hit> hits(rays.size());
+  bvh.Trace(rays.data(), reference.data(), rays.size(), TraceMode::Single);
+  cached.bvh.Trace(rays.data(), hits.data(), rays.size(), TraceMode::Single);
+  size_t mismatches = 0;
+  for (size_t i = 0; i < rays.size(); ++i) mismatches += hits[i].primitive != reference[i].primitive;
+
+  // a loader streaming the scene hands out the bytes the cache maps later
+  auto collect = [](std::vector<std::vector<uint8_t>>& sections) -> SceneStreamFunction
+  {
+    sections.assign(static_cast<size_t>(SceneSection::Count), {});
+    return [&sections](SceneSection section, const void* data, uint64_t offset, uint64_t size, uint64_t total_size)
+    {
+      std::vector<uint8_t>& bytes = sections[static_cast<size_t>(section)];
+      bytes.resize(total_size);
+      std::memcpy(bytes.data() + offset, data, size);
+    };
+  };
+  std::vector<std::vector<uint8_t>> streamed, mapped;
+  SceneCache::StreamScene(collect(streamed), scene);
+  cache.Stream(collect(mapped));
+
+  printf("scene cache %.1f MB  write %.1f ms  open and load %.1f ms  stale hash %s  stream %s  %zu mismatches\n",
+         cache.getFile().getSize() / (1024.0 * 1024.0), write * 1e3, load * 1e3, stale ? "accepted" : "rejected",
+         streamed == mapped ? "matches" : "differs", mismatches);
+  Check(!stale && streamed == mapped && mismatches == 0, "scene cache round trip");
+  cache.Close();
+  std::remove(path.c_str());
+}
+
+// Rays from the center of every sphere through its vertices and edge midpoints
+// must all hit, any miss is a ray that slipped between neighbouring triangles.
+template <typename Kernel>
+static void CompareKernel(const std::vector<glm::vec3>& positions, const std::vector<uint32_t>& indices,
+                          const std::vector<Ray>& rays, const std::vector<Ray>& bounce)
+{
+  BVHT<Kernel> bvh;
+  bvh.Build(positions, indices);
+
+  std::vector<Hit> hits(std::max(rays.size(), bounce.size()));
+  double single = Measure([&]() { bvh.Trace(bounce.data(), hits.data(), bounce.size(), TraceMode::Single); });
+  double packet = Measure([&]() { bvh.Trace(bounce.data(), hits.data(), bounce.size(), TraceMode::Packet); });
+
+  size_t leaks[2] = { 0, 0 };
+  const TraceMode modes[] = { TraceMode::Single, TraceMode::Packet };
+  for (int mode = 0; mode < 2; ++mode)
+  {
+    bvh.Trace(rays.data(), hits.data(), rays.size(), modes[mode]);
+    for (size_t i = 0; i < rays.size(); ++i) leaks[mode] += !hits[i].Valid();
+  }
+
+  printf("%-16s single %8.2f Mrays/s  packet%d %8.2f Mrays/s  leaks %zu / %zu of %zu\n", Kernel::name,
+         bounce.size() / single * 1e-6, packet_width, bounce.size() / packet * 1e-6, leaks[0], leaks[1],
+         rays.size());
+  // Moller-Trumbore is expected to leak, that is what the comparison shows
+  if (std::is_same<Kernel, WatertightKernel>::value) Check(leaks[0] == 0 && leaks[1] == 0, "watertight kernel leaks");
+}
+
+static std::vector<Ray> MakeLeakRays(const std::vector<glm::vec3>& positions, const std::vector<uint32_t>& indices)
+{
+  // the first two triangles are the ground, every sphere after it has the same triangle count
+  const size_t sphere_triangles = 24 * 48 * 2;
+  std::vector<Ray> rays;
+  for (size_t first = 6; first < indices.size(); first += sphere_triangles * 3)
+  {
+    glm::vec3 center(0.0f);
+    for (size_t i = first; i < first + sphere_triangles * 3; ++i) center += positions[indices[i]];
+    center /= static_cast<float>(sphere_triangles * 3);
+
+    for (size_t i = first; i < first + sphere_triangles * 3; i += 3)
+    {
+      for (int corner = 0; corner < 3; ++corner)
+      {
+        glm::vec3 a = positions[indices[i + corner]];
+        glm::vec3 b = positions[indices[i + (corner + 1) % 3]];
+        Ray ray;
+        ray.origin = center;
+        ray.direction = glm::normalize(a - center);
+        rays.push_back(ray);
+        ray.direction = glm::normalize((a + b) * 0.5f - center);
+        rays.push_back(ray);
+      }
+    }
+  }
+  return rays;
+}
+
+// Attribute memory of the quantized streams against the cost of decoding them
+// at every hit, and how far the snapped geometry moves the hits.
+static void CompareQuantization(const std::vector<glm::vec3>& positions, const std::vector<uint32_t>& indices,
+                                const std::vector<Ray>& rays)
+{
+  Scene scene;
+  scene.positions = positions;
+  scene.indices = indices;
+  scene.normals.assign(positions.size(), glm::vec3(0.0f));
+  scene.uvs.resize(positions.size());
+  for (size_t i = 0; i < indices.size(); i += 3)
+  {
+    glm::vec3 a = positions[indices[i]], b = positions[indices[i + 1]], c = positions[indices[i + 2]];
+    glm::vec3 normal = glm::cross(b - a, c - a);
+    for (int corner = 0; corner < 3; ++corner) scene.normals[indices[i + corner]] += normal;
+  }
+  for (size_t i = 0; i < positions.size(); ++i)
+  {
+    if (glm::length(scene.normals[i]) > 0.0f) scene.normals[i] = glm::normalize(scene.normals[i]);
+    scene.uvs[i] = glm::vec2(positions[i].x, positions[i].z) * 0.25f;
+  }
+
+  Scheduler scheduler(1, false);
+  Scene quantized = scene;
+  QuantizationStats stats = QuantizeScene(quantized, scheduler);
+  scene.BuildBVH();
+  quantized.BuildBVH();
+
+  std::vector<Hit> reference(rays.size());
+  std::vector<Hit> hits(rays.size());
+  scene.bvh.Trace(rays.data(), reference.data(), rays.size(), TraceMode::Single);
+  quantized.bvh.Trace(rays.data(), hits.data(), rays.size(), TraceMode::Single);
+  size_t mismatches = 0;
+  for (size_t i = 0; i < rays.size(); ++i) mismatches += hits[i].Valid() != reference[i].Valid();
+
+  // the decoded fetch must reproduce the snapped float streams exactly
+  std::vector<SurfacePoint> points(hits.size());
+  std::vector<SurfacePoint> decoded(hits.size());
+  double fetch = Measure([&]()
+  {
+    for (size_t i = 0; i < hits.size(); ++i) points[i] = quantized.Interpolate(hits[i]);
+  });
+  double decode = Measure([&]()
+  {
+    for (size_t i = 0; i < hits.size(); ++i) decoded[i] = quantized.Interpolate(hits[i], true);
+  });
+  size_t decode_mismatches = 0;
+  for (size_t i = 0; i < hits.size(); ++i)
+  {
+    decode_mismatches += points[i].position != decoded[i].position || points[i].normal != decoded[i].normal ||
+                         points[i].uv != decoded[i].uv;
+  }
+
+  printf("quantized attributes %.1f -> %.1f MB (%.0f%% saved)  max error %.2g position, %.2g rad normal, %.2g uv\n",
+         stats.float_bytes / (1024.0 * 1024.0), stats.quantized_bytes / (1024.0 * 1024.0),
+         100.0 * (1.0 - static_cast<double>(stats.quantized_bytes) / stats.float_bytes), stats.max_position_error,
+         stats.max_normal_error, stats.max_uv_error);
+  printf("quantized shading fetch %8.2f Mhits/s  float %8.2f Mhits/s  %.2fx  %zu hit changes  %zu decode mismatches\n",
+         hits.size() / decode * 1e-6, hits.size() / fetch * 1e-6, fetch / decode, mismatches, decode_mismatches);
+  Check(mismatches == 0 && decode_mismatches == 0, "quantized scene");
+}
+
+// Eight-wide compressed nodes against the binary tree: same hits, fewer bytes per ray.
+static void CompareCompressed(const BVH& bvh, const std::vector<Ray>& rays, const char* name)
+{
+  CompressedBVH compressed;
+  double build = Measure([&]() { compressed.Build(bvh); });
+
+  std::vector<Hit> reference(rays.size());
+  std::vector<Hit> hits(rays.size());
+  TraversalStats binary_stats, compressed_stats;
+  for (size_t i = 0; i < rays.size(); ++i)
+  {
+    bvh.Intersect(rays[i], reference[i], &binary_stats);
+    compressed.Intersect(rays[i], hits[i], &compressed_stats);
+  }
+  size_t mismatches = 0;
+  for (size_t i = 0; i < rays.size(); ++i)
+  {
+    if (hits[i].Valid() != reference[i].Valid() ||
+        (hits[i].Valid() && std::fabs(hits[i].t - reference[i].t) > 1e-4f * reference[i].t))
+      mismatches++;
+  }
+
+  double binary = Measure([&]() { bvh.Trace(rays.data(), hits.data(), rays.size(), TraceMode::Single); });
+  double wide = Measure([&]() { compressed.Trace(rays.data(), hits.data(), rays.size()); });
+  double ray_count = static_cast<double>(rays.size());
+  printf("%-10s binary   %8.2f Mrays/s  %6.0f node + %6.0f leaf bytes/ray\n", name, rays.size() / binary * 1e-6,
+         binary_stats.node_bytes / ray_count, binary_stats.block_bytes / ray_count);
+  printf("%-10s wide8    %8.2f Mrays/s  %6.0f node + %6.0f leaf bytes/ray  %zu mismatches\n", name,
+         rays.size() / wide * 1e-6, compressed_stats.node_bytes / ray_count, compressed_stats.block_bytes / ray_count,
+         mismatches);
+  Check(mismatches == 0, "compressed BVH disagrees with the binary one");
+  printf("%-10s nodes %.1f -> %.1f MB  build %.1f ms\n", name,
+         bvh.getNodes().size() * sizeof(BVHNode) / (1024.0 * 1024.0),
+         compressed.getNodes().size() * sizeof(CompressedBVHNode) / (1024.0 * 1024.0), build * 1e3);
+}
+
+// Texture fetches at the primary hits and one bounce further, at full
+// resolution against the mip level the ray cone picks.
+// Scene of the procedural geometry with smooth normals and planar uvs.
+static void MakeTexturedScene(const std::vector<glm::vec3>& positions, const std::vector<uint32_t>& indices,
+                              Scene& scene)
+{
+  scene.positions = positions;
+  scene.indices = indices;
+  scene.normals.assign(positions.size(), glm::vec3(0.0f));
+  scene.uvs.resize(positions.size());
+  for (size_t i = 0; i < indices.size(); i += 3)
+  {
+    glm::vec3 a = positions[indices[i]], b = positions[indices[i + 1]], c = positions[indices[i + 2]];
+    glm::vec3 normal = glm::cross(b - a, c - a);
+    for (int corner = 0; corner < 3; ++corner) scene.normals[indices[i + corner]] += normal;
+  }
+  for (size_t i = 0; i < positions.size(); ++i)
+  {
+    if (glm::length(scene.normals[i]) > 0.0f) scene.normals[i] = glm::normalize(scene.normals[i]);
+    scene.uvs[i] = glm::vec2(positions[i].x, positions[i].z) * 0.05f;
+  }
+  scene.BuildBVH();
+}
+
+static void CompareTextureLod(const std::vector<glm::vec3>& positions, const std::vector<uint32_t>& indices,
+                              const std::vector<Ray>& rays, const std::vector<Ray>& bounce, uint32_t height)
+{
+  Scene scene;
+  MakeTexturedScene(positions, indices, scene);
+
+  const uint32_t size = 4096;
+  Image image;
+  image.width = size;
+  image.height = size;
+  image.texels.resize(static_cast<size_t>(size) * size * 4);
+  for (uint32_t y = 0; y < size; ++y)
+  {
+    for (uint32_t x = 0; x < size; ++x)
+    {
+      uint8_t* texel = &image.texels[(static_cast<size_t>(y) * size + x) * 4];
+      uint8_t value = ((x >> 3) ^ (y >> 3)) & 1 ? 230 : 20;
+      texel[0] = value;
+      texel[1] = static_cast<uint8_t>(x * 255 / size);
+      texel[2] = static_cast<uint8_t>(y * 255 / size);
+      texel[3] = 255;
+    }
+  }
+  Texture texture;
+  double generate = Measure([&]() { Image copy = image; GenerateMipmaps(std::move(copy), true, texture); });
+
+  // the benchmark camera has tan(fov / 2) = 0.5
+  RayCone camera = PrimaryRayCone(2.0f * std::atan(0.5f), height);
+  std::vector<Hit> hits(rays.size());
+  std::vector<Hit> bounce_hits(bounce.size());
+  scene.bvh.Trace(rays.data(), hits.data(), rays.size(), TraceMode::Single);
+  scene.bvh.Trace(bounce.data(), bounce_hits.data(), bounce.size(), TraceMode::Single);
+
+  // bounce[i] starts at the i-th valid primary hit
+  std::vector<glm::vec2> uvs;
+  std::vector<float> lods;
+  double lod_sums[2] = { 0.0, 0.0 };
+  size_t lod_counts[2] = { 0, 0 };
+  auto add = [&](const glm::vec2& uv, float lod, int depth)
+  {
+    uvs.push_back(uv);
+    lods.push_back(lod);
+    lod_sums[depth] += std::min(std::max(lod, 0.0f), static_cast<float>(texture.LevelCount() - 1));
+    lod_counts[depth]++;
+  };
+  for (size_t i = 0, b = 0; i < rays.size(); ++i)
+  {
+    if (!hits[i].Valid()) continue;
+    SurfacePoint point = scene.Interpolate(hits[i]);
+    float cos_theta = glm::dot(rays[i].direction, point.geometric_normal);
+    RayCone cone = camera.Propagate(hits[i].t);
+    add(point.uv, TextureLod(cone, point.uv_density, cos_theta, texture), 0);
+
+    const Hit& bounce_hit = bounce_hits[b];
+    const Ray& bounce_ray = bounce[b++];
+    if (!bounce_hit.Valid()) continue;
+    cone = cone.Bounce(SurfaceSpreadAngle(point.curvature, cone.width, cos_theta));
+    SurfacePoint next = scene.Interpolate(bounce_hit);
+    add(next.uv, TextureLod(cone.Propagate(bounce_hit.t), next.uv_density,
+                            glm::dot(bounce_ray.direction, next.geometric_normal), texture), 1);
+  }
+
+  // in image order and shuffled the way incoherent paths fetch
+  std::vector<glm::vec4> colors(uvs.size());
+  double full[2], cone[2];
+  for (int order = 0; order < 2; ++order)
+  {
+    if (order == 1)
+    {
+      std::vector<uint32_t> permutation(uvs.size());
+      for (uint32_t i = 0; i < permutation.size(); ++i) permutation[i] = i;
+      std::shuffle(permutation.begin(), permutation.end(), std::mt19937(11));
+      std::vector<glm::vec2> shuffled_uvs(uvs.size());
+      std::vector<float> shuffled_lods(lods.size());
+      for (size_t i = 0; i < permutation.size(); ++i)
+      {
+        shuffled_uvs[i] = uvs[permutation[i]];
+        shuffled_lods[i] = lods[permutation[i]];
+      }
+      uvs.swap(shuffled_uvs);
+      lods.swap(shuffled_lods);
+    }
+
+    full[order] = Measure([&]()
+    {
+      for (size_t i = 0; i < uvs.size(); ++i) colors[i] = texture.Sample(uvs[i], 0.0f);
+    });
+    cone[order] = Measure([&]()
+    {
+      for (size_t i = 0; i < uvs.size(); ++i) colors[i] = texture.Sample(uvs[i], lods[i]);
+    });
+  }
+
+  printf("mipmaps %ux%u %u levels %.1f ms  mean lod %.2f primary %.2f bounce\n", size, size,
+         texture.LevelCount(), generate * 1e3, lod_sums[0] / std::max<size_t>(lod_counts[0], 1),
+         lod_sums[1] / std::max<size_t>(lod_counts[1], 1));
+  const char* orders[] = { "coherent", "shuffled" };
+  for (int order = 0; order < 2; ++order)
+  {
+    printf("texture fetch %-9s lod 0 %8.2f Msamples/s  ray cone %8.2f Msamples/s  %.2fx\n", orders[order],
+           uvs.size() / full[order] * 1e-6, uvs.size() / cone[order] * 1e-6, full[order] / cone[order]);
+  }
+}
+
+// Encode time, size and quality of the BC formats on a mip chain, and what a
+// repeated load pays when the chain comes from the texture cache.
+static void CompareTextureCompression()
+{
+  const uint32_t size = 1024;
+  Image image;
+  image.width = size;
+  image.height = size;
+  image.texels.resize(static_cast<size_t>(size) * size * 4);
+  std::mt19937 rng(5);
+  for (uint32_t y = 0; y < size; ++y)
+  {
+    for (uint32_t x = 0; x < size; ++x)
+    {
+      uint8_t* texel = &image.texels[(static_cast<size_t>(y) * size + x) * 4];
+      texel[0] = static_cast<uint8_t>(128.0f + 90.0f * std::sin(x * 0.02f) * std::cos(y * 0.03f) + (rng() & 15));
+      texel[1] = static_cast<uint8_t>((x + y) * 255 / (2 * size));
+      texel[2] = ((x >> 5) ^ (y >> 5)) & 1 ? 200 : 40;
+      texel[3] = 255;
+    }
+  }
+
+  Scheduler scheduler;
+  Texture chain;
+  Image copy = image;
+  GenerateMipmaps(std::move(copy), false, chain);
+
+  const TextureFormat formats[] = { TextureFormat::BC1, TextureFormat::BC5, TextureFormat::BC7 };
+  const char* names[] = { "BC1", "BC5", "BC7" };
+  const int channels[] = { 3, 2, 4 };
+  for (int i = 0; i < 3; ++i)
+  {
+    Texture compressed, decoded;
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    CompressTexture(chain, formats[i], compressed, scheduler);
+    std::chrono::duration<double> encode = std::chrono::steady_clock::now() - start;
+    DecompressTexture(compressed, decoded);
+
+    double error = 0.0;
+    const std::vector<uint8_t>& reference = chain.levels[0].texels;
+    for (size_t texel = 0; texel < reference.size(); texel += 4)
+    {
+      for (int channel = 0; channel < channels[i]; ++channel)
+      {
+        double difference = reference[texel + channel] - decoded.levels[0].texels[texel + channel];
+        error += difference * difference;
+      }
+    }
+    error /= static_cast<double>(reference.size() / 4 * channels[i]);
+    printf("%s %ux%u chain  encode %7.1f ms  %.1f -> %.1f MB (%.0f:1)  PSNR %.1f dB\n", names[i], size, size,
+           encode.count() * 1e3, chain.Size() / (1024.0 * 1024.0), compressed.Size() / (1024.0 * 1024.0),
+           static_cast<double>(chain.Size()) / compressed.Size(), 10.0 * std::log10(255.0 * 255.0 / error));
+  }
+
+  TextureCompressionSettings settings;
+  settings.cache_directory = "trace_benchmark.vpttex";
+  double times[2];
+  for (int run = 0; run < 2; ++run)
+  {
+    Scene scene;
+    scene.images.push_back(image);
+    scene.materials.resize(1);
+    scene.materials[0].base_color_texture = 0;
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    CompressTextures(scene, scheduler, settings);
+    times[run] = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  }
+  std::error_code error;
+  std::filesystem::remove_all(settings.cache_directory, error);
+  printf("texture ingest  mipmaps + encode %.1f ms  cached %.1f ms\n", times[0] * 1e3, times[1] * 1e3);
+}
+
+// Streams tiles of textures far larger than memory for the primary hits of
+// a few frames, then for a second view on other textures that evicts the
+// working set of the first.
+static void CompareVirtualTexture(const std::vector<glm::vec3>& positions, const std::vector<uint32_t>& indices,
+                                  const std::vector<Ray>& rays, uint32_t height)
+{
+  Scene scene;
+  MakeTexturedScene(positions, indices, scene);
+
+  // every texel of a level is computed, as if it was read from disk
+  auto texel = [](uint32_t texture, uint32_t level, uint32_t x, uint32_t y, uint8_t* out)
+  {
+    uint32_t hash = static_cast<uint32_t>(HashCombine(texture, level));
+    out[0] = ((x >> 4) ^ (y >> 4)) & 1 ? 220 : 30;
+    out[1] = static_cast<uint8_t>(hash);
+    out[2] = static_cast<uint8_t>(level * 15);
+    out[3] = 255;
+  };
+  const uint32_t texture_count = 64;
+  const uint32_t size = 65536;
+  std::atomic<uint64_t> tile_loads { 0 };
+  VirtualTextureSettings settings;
+  settings.pool_tiles = 2048;
+  VirtualTextureCache cache(settings, [&](uint32_t texture, uint32_t level, uint32_t page_x, uint32_t page_y,
+                                          uint8_t* tile)
+  {
+    const uint32_t level_size = std::max(size >> level, 1u);
+    for (uint32_t y = 0; y < virtual_tile_size; ++y)
+    {
+      for (uint32_t x = 0; x < virtual_tile_size; ++x)
+      {
+        int64_t u = static_cast<int64_t>(page_x) * virtual_page_size + x - virtual_page_border;
+        int64_t v = static_cast<int64_t>(page_y) * virtual_page_size + y - virtual_page_border;
+        texel(texture, level, static_cast<uint32_t>((u + level_size) % level_size),
+              static_cast<uint32_t>((v + level_size) % level_size), tile + (y * virtual_tile_size + x) * 4);
+      }
+    }
+    tile_loads++;
+    return true;
+  });
+  for (uint32_t texture = 0; texture < texture_count; ++texture) cache.AddTexture(size, size, virtual_max_levels, true);
+  if (!cache.Start()) return;
+
+  // each triangle picks one of the textures of a view
+  const uint32_t view_textures = 16;
+  RayCone camera = PrimaryRayCone(2.0f * std::atan(0.5f), height);
+  std::vector<Hit> hits(rays.size());
+  scene.bvh.Trace(rays.data(), hits.data(), rays.size(), TraceMode::Single);
+  std::vector<uint32_t> textures;
+  std::vector<glm::vec2> uvs;
+  std::vector<float> lods;
+  for (size_t i = 0; i < rays.size(); ++i)
+  {
+    if (!hits[i].Valid()) continue;
+    SurfacePoint point = scene.Interpolate(hits[i]);
+    float cos_theta = glm::dot(rays[i].direction, point.geometric_normal);
+    textures.push_back(static_cast<uint32_t>(HashCombine(0, hits[i].primitive)) % view_textures);
+    uvs.push_back(point.uv);
+    lods.push_back(TextureLod(camera.Propagate(hits[i].t), point.uv_density, cos_theta, size, size));
+  }
+
+  double virtual_bytes = 0.0;
+  for (uint32_t level = 0; level < virtual_max_levels; ++level)
+    virtual_bytes += static_cast<double>(std::max(size >> level, 1u)) * std::max(size >> level, 1u) * 4.0;
+  printf("virtual textures %u x %ux%u (%.0f GB)  pool %u tiles (%.1f MB)  %u pages\n", texture_count, size, size,
+         virtual_bytes * texture_count / (1024.0 * 1024.0 * 1024.0), settings.pool_tiles,
+         settings.pool_tiles * static_cast<double>(virtual_tile_bytes) / (1024.0 * 1024.0), cache.getPageCount());
+
+  std::vector<glm::vec4> colors(uvs.size());
+  const int frames = 6;
+  for (int view = 0; view < 2; ++view)
+  {
+    const uint32_t first_texture = view * view_textures;
+    for (int frame = 0; frame < frames; ++frame)
+    {
+      VirtualTextureStats before = cache.getStats();
+      std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+      for (size_t i = 0; i < uvs.size(); ++i) colors[i] = cache.Sample(first_texture + textures[i], uvs[i], lods[i]);
+      std::chrono::duration<double> sample = std::chrono::steady_clock::now() - start;
+      cache.Update();
+      cache.Flush();
+
+      if (frame != 0 && frame != frames - 1) continue;
+      size_t exact = 0;
+      for (size_t i = 0; i < uvs.size(); ++i)
+      {
+        uint32_t level = static_cast<uint32_t>(std::min(std::max(lods[i], 0.0f), virtual_max_levels - 1.0f));
+        if (cache.ResidentLevel(first_texture + textures[i], uvs[i], level) == level) exact++;
+      }
+      const VirtualTextureStats& stats = cache.getStats();
+      printf("virtual texture view %d frame %d  %6.2f Msamples/s  loads %4llu  evictions %4llu  resident %4u  "
+             "at requested level %5.1f%%\n", view, frame, uvs.size() / sample.count() * 1e-6,
+             static_cast<unsigned long long>(stats.loads - before.loads),
+             static_cast<unsigned long long>(stats.evictions - before.evictions), stats.resident,
+             100.0 * exact / std::max<size_t>(uvs.size(), 1));
+    }
+  }
+
+  // stored tiles of a real chain read back through the mapping
+  Image image;
+  image.width = 1000;
+  image.height = 600;
+  image.texels.resize(static_cast<size_t>(image.width) * image.height * 4);
+  for (uint32_t y = 0; y < image.height; ++y)
+  {
+    for (uint32_t x = 0; x < image.width; ++x)
+      texel(1, 0, x, y, &image.texels[(static_cast<size_t>(y) * image.width + x) * 4]);
+  }
+  Texture chain;
+  GenerateMipmaps(std::move(image), true, chain);
+  const std::string path = "trace_benchmark.vpttiles";
+  TileFile file;
+  bool match = TileFile::Write(path, chain) && file.Open(path);
+  std::vector<uint8_t> stored(virtual_tile_bytes), expected(virtual_tile_bytes);
+  uint64_t file_tiles = 0;
+  for (uint32_t level = 0; match && level < chain.LevelCount(); ++level)
+  {
+    for (uint32_t y = 0; match && y < PagesAcross(chain.getHeight(), level); ++y)
+    {
+      for (uint32_t x = 0; match && x < PagesAcross(chain.getWidth(), level); ++x)
+      {
+        ExtractTile(chain.levels[level], x, y, expected.data());
+        match = file.ReadTile(level, x, y, stored.data()) && stored == expected;
+        file_tiles++;
+      }
+    }
+  }
+  file = TileFile();
+  std::error_code error;
+  std::filesystem::remove(path, error);
+  printf("tile file %llu tiles %s\n", static_cast<unsigned long long>(file_tiles), match ? "match" : "MISMATCH");
+  Check(match, "tile file round trip");
+}
+
+// Irradiance under a sky with a small bright sun, estimated with cosine
+// weighted hemisphere samples and with samples from the environment.
+static void CompareEnvironmentSampling()
+{
+  EnvironmentMap map;
+  map.width = 2048;
+  map.height = 1024;
+  map.texels.resize(static_cast<size_t>(map.width) * map.height);
+  const glm::vec3 sun = glm::normalize(glm::vec3(0.3f, 0.5f, -0.8f));
+  for (uint32_t y = 0; y < map.height; ++y)
+  {
+    for (uint32_t x = 0; x < map.width; ++x)
+    {
+      glm::vec3 direction = EnvironmentDirection(glm::vec2((x + 0.5f) / map.width, (y + 0.5f) / map.height));
+      glm::vec3 sky = direction.y > 0.0f ? glm::mix(glm::vec3(0.8f, 0.9f, 1.0f), glm::vec3(0.2f, 0.4f, 0.9f),
+                                                    direction.y) : glm::vec3(0.1f);
+      map.texels[static_cast<size_t>(y) * map.width + x] = glm::dot(direction, sun) > 0.99996f ?
+                                                           glm::vec3(60000.0f, 55000.0f, 50000.0f) : sky;
+    }
+  }
+
+  // piecewise constant radiance integrates exactly over the texels
+  const glm::vec3 normal(0.0f, 1.0f, 0.0f);
+  double reference = 0.0;
+  for (uint32_t y = 0; y < map.height; ++y)
+  {
+    double solid_angle = 2.0 * environment_pi / map.width *
+                         (std::cos(y * environment_pi / map.height) - std::cos((y + 1) * environment_pi / map.height));
+    for (uint32_t x = 0; x < map.width; ++x)
+    {
+      glm::vec3 direction = EnvironmentDirection(glm::vec2((x + 0.5f) / map.width, (y + 0.5f) / map.height));
+      reference += Accumulator::Luminance(map.texels[static_cast<size_t>(y) * map.width + x]) *
+                   std::max(glm::dot(direction, normal), 0.0f) * solid_angle;
+    }
+  }
+
+  Scheduler scheduler;
+  EnvironmentLight light;
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  light.Build(std::move(map), scheduler);
+  std::chrono::duration<double> build = std::chrono::steady_clock::now() - start;
+
+  const uint32_t trials = 2048;
+  const uint32_t samples = 16;
+  std::mt19937 rng(3);
+  std::uniform_real_distribution<float> uniform(0.0f, 1.0f);
+  double errors[2] = { 0.0, 0.0 };
+  double seconds[2] = { 0.0, 0.0 };
+  uint32_t pdf_mismatches = 0;
+  for (int method = 0; method < 2; ++method)
+  {
+    start = std::chrono::steady_clock::now();
+    for (uint32_t trial = 0; trial < trials; ++trial)
+    {
+      double estimate = 0.0;
+      for (uint32_t i = 0; i < samples; ++i)
+      {
+        glm::vec2 u(uniform(rng), uniform(rng));
+        if (method == 0)
+        {
+          float phi = 2.0f * environment_pi * u.x;
+          float cos_theta = std::sqrt(u.y);
+          float sin_theta = std::sqrt(1.0f - u.y);
+          glm::vec3 direction(sin_theta * std::cos(phi), cos_theta, sin_theta * std::sin(phi));
+          estimate += environment_pi * Accumulator::Luminance(light.Radiance(direction));
+          continue;
+        }
+        EnvironmentSample sample = light.Sample(u);
+        if (!(sample.pdf > 0.0f)) continue;
+        estimate += Accumulator::Luminance(sample.radiance) * std::max(glm::dot(sample.direction, normal), 0.0f) /
+                    sample.pdf;
+        // both see the same texel, so they agree exactly
+        if (light.Pdf(sample.direction) != sample.pdf || light.Radiance(sample.direction) != sample.radiance)
+          pdf_mismatches++;
+      }
+      double error = estimate / samples - reference;
+      errors[method] += error * error;
+    }
+    seconds[method] = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  }
+
+  const char* names[] = { "cosine", "environment" };
+  printf("environment %ux%u alias tables %.1f ms  irradiance %.1f\n", light.getMap().width, light.getMap().height,
+         build.count() * 1e3, reference);
+  for (int method = 0; method < 2; ++method)
+  {
+    printf("environment %-11s %u spp  relative rmse %7.4f  %6.1f Msamples/s\n", names[method], samples,
+           std::sqrt(errors[method] / trials) / reference, trials * samples / seconds[method] * 1e-6);
+  }
+  printf("environment Pdf or Radiance differs from Sample for %u of %u samples  variance reduction %.0fx\n",
+         pdf_mismatches, trials * samples, errors[0] / errors[1]);
+  Check(pdf_mismatches == 0, "environment Pdf or Radiance differs from Sample");
+}
+
+// Unshadowed direct light from thousands of small emitters at the primary
+// hits, one light picked per estimate uniformly, by power or by the light BVH.
+// Point lights and small panels scattered above the scene, spanning four
+// orders of magnitude in power.
+static std::vector<Light> MakeManyLights(uint32_t count, std::mt19937& rng)
+{
+  std::uniform_real_distribution<float> uniform(0.0f, 1.0f);
+  std::vector<Light> lights;
+  for (uint32_t i = 0; i < count; ++i)
+  {
+    glm::vec3 position(uniform(rng) * 100.0f - 50.0f, 1.0f + uniform(rng) * 29.0f, uniform(rng) * 100.0f - 50.0f);
+    glm::vec3 color = glm::vec3(uniform(rng), uniform(rng), uniform(rng)) * std::pow(100.0f, uniform(rng));
+    if (i % 2 == 0)
+    {
+      lights.push_back(MakePointLight(position, color));
+      continue;
+    }
+    // small panels facing down or sideways
+    glm::vec3 tangent = glm::normalize(glm::vec3(uniform(rng) - 0.5f, 0.0f, uniform(rng) - 0.5f));
+    glm::vec3 bitangent = i % 4 == 1 ? glm::cross(tangent, glm::vec3(0.0f, 1.0f, 0.0f)) : glm::vec3(0.0f, -1.0f, 0.0f);
+    Light light;
+    light.type = LightType::Triangle;
+    light.position = position;
+    light.edge1 = tangent * 0.5f;
+    light.edge2 = bitangent * 0.5f;
+    light.emission = color * 10.0f;
+    lights.push_back(light);
+  }
+  return lights;
+}
+
+static void CompareLightSampling(const std::vector<glm::vec3>& positions, const std::vector<uint32_t>& indices,
+                                 const std::vector<Ray>& rays)
+{
+  Scene scene;
+  MakeTexturedScene(positions, indices, scene);
+  std::vector<Hit> hits(rays.size());
+  scene.bvh.Trace(rays.data(), hits.data(), rays.size(), TraceMode::Single);
+  // normals facing the camera, as shading sees them
+  std::vector<SurfacePoint> points;
+  for (size_t i = 0; i < hits.size(); i += 37)
+  {
+    if (!hits[i].Valid()) continue;
+    points.push_back(scene.Interpolate(hits[i]));
+    if (glm::dot(points.back().normal, rays[i].direction) > 0.0f) points.back().normal = -points.back().normal;
+  }
+
+  std::mt19937 rng(13);
+  std::uniform_real_distribution<float> uniform(0.0f, 1.0f);
+  std::vector<Light> lights = MakeManyLights(8192, rng);
+
+  auto contribution = [&](const Light& light, const SurfacePoint& point)
+  {
+    glm::vec3 center = light.position;
+    float scale = 1.0f;
+    if (light.type == LightType::Triangle)
+    {
+      center += (light.edge1 + light.edge2) / 3.0f;
+      glm::vec3 normal = glm::cross(light.edge1, light.edge2);
+      glm::vec3 to_point = point.position - center;
+      scale = std::max(glm::dot(normal, to_point), 0.0f) * 0.5f / std::max(glm::length(to_point), 1e-6f);
+    }
+    glm::vec3 to_light = center - point.position;
+    float distance_squared = std::max(glm::dot(to_light, to_light), 1e-4f);
+    float cos_theta = std::max(glm::dot(point.normal, to_light), 0.0f) / std::sqrt(distance_squared);
+    return Accumulator::Luminance(light.emission) * scale * cos_theta / distance_squared;
+  };
+
+  Scheduler scheduler;
+  LightBVH bvh;
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  bvh.Build(lights, scheduler);
+  double build = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+  std::vector<float> power(lights.size());
+  for (size_t i = 0; i < lights.size(); ++i)
+  {
+    float area = lights[i].type == LightType::Point ? 4.0f :
+                 0.5f * glm::length(glm::cross(lights[i].edge1, lights[i].edge2));
+    power[i] = Accumulator::Luminance(lights[i].emission) * area;
+  }
+  std::vector<AliasEntry> power_table(lights.size());
+  BuildAliasTable(power.data(), static_cast<uint32_t>(lights.size()), power_table.data());
+
+  const uint32_t count = static_cast<uint32_t>(lights.size());
+  const uint32_t estimates = 16;
+  uint32_t pmf_mismatches = 0;
+  auto evaluate = [&](int method, double& seconds)
+  {
+    double error = 0.0, total = 0.0;
+    std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+    for (const SurfacePoint& point : points)
+    {
+      double reference = 0.0;
+      for (const Light& light : lights) reference += contribution(light, point);
+      for (uint32_t i = 0; i < estimates; ++i)
+      {
+        float u = uniform(rng);
+        uint32_t light = 0;
+        float pmf = 1.0f / count;
+        if (method == 1)
+        {
+          float remainder;
+          light = SampleAliasTable(power_table.data(), count, u, remainder);
+          pmf = power_table[light].pdf / count;
+        }
+        else if (method == 2)
+        {
+          if (!bvh.Sample(point.position, point.normal, u, light, pmf)) continue;
+          if (std::abs(bvh.Pmf(point.position, point.normal, light) - pmf) > 1e-3f * pmf) pmf_mismatches++;
+        }
+        else light = std::min(static_cast<uint32_t>(u * count), count - 1);
+        double estimate = contribution(lights[light], point) / pmf;
+        error += (estimate - reference) * (estimate - reference);
+      }
+      total += reference;
+    }
+    seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+    return std::sqrt(error / (points.size() * estimates)) / (total / points.size());
+  };
+
+  const char* names[] = { "uniform", "power", "light BVH" };
+  double seconds;
+  printf("light BVH %zu lights, %zu nodes, build %.1f ms on %u threads\n", lights.size(), bvh.getNodes().size(),
+         build * 1e3, scheduler.getThreadCount());
+  for (int method = 0; method < 3; ++method)
+    printf("light selection %-9s  relative rmse %8.3f\n", names[method], evaluate(method, seconds));
+
+  // point lights drift, the refitted tree against a fresh one
+  for (Light& light : lights)
+  {
+    if (light.type == LightType::Point)
+      light.position += glm::vec3(uniform(rng) - 0.5f, 0.0f, uniform(rng) - 0.5f) * 4.0f;
+  }
+  start = std::chrono::steady_clock::now();
+  bvh.Refit(lights, scheduler);
+  double refit = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  double refit_error = evaluate(2, seconds);
+  bvh.Build(lights, scheduler);
+  double rebuild_error = evaluate(2, seconds);
+  printf("light BVH refit %.2f ms  relative rmse refitted %.3f  rebuilt %.3f  pmf mismatches %u\n", refit * 1e3,
+         refit_error, rebuild_error, pmf_mismatches);
+  Check(pmf_mismatches == 0, "light BVH Pmf differs from Sample");
+}
+
+// Primary hits row by row with normals facing the camera.
+static std::vector<ReSTIRSurface> MakePrimarySurfaces(const Scene& scene, uint32_t width, uint32_t height)
+{
+  // primary rays come in 4x2 blocks
+  std::vector<Ray> rays = MakePrimaryRays(width, height);
+  std::vector<Hit> hits(rays.size());
+  scene.bvh.Trace(rays.data(), hits.data(), rays.size(), TraceMode::Single);
+  std::vector<ReSTIRSurface> surfaces(rays.size());
+  for (uint32_t y = 0; y < height; ++y)
+  {
+    for (uint32_t x = 0; x < width; ++x)
+    {
+      size_t ray = ((y / 2) * (width / 4) + x / 4) * 8 + (y % 2) * 4 + x % 4;
+      if (!hits[ray].Valid()) continue;
+      SurfacePoint point = scene.Interpolate(hits[ray]);
+      ReSTIRSurface& surface = surfaces[static_cast<size_t>(y) * width + x];
+      surface.position = point.position;
+      surface.depth = hits[ray].t;
+      surface.normal = glm::dot(point.normal, rays[ray].direction) > 0.0f ? -point.normal : point.normal;
+      surface.valid = 1;
+    }
+  }
+  return surfaces;
+}
+
+// Direct light from many lights at equal frames: one light BVH sample per
+// pixel, RIS without reuse and ReSTIR after a few frames of a static view,
+// against a converged RIS image.
+static void CompareReSTIR(const std::vector<glm::vec3>& positions, const std::vector<uint32_t>& indices)
+{
+  const uint32_t width = 96, height = 54;
+  Scene scene;
+  MakeTexturedScene(positions, indices, scene);
+  std::vector<ReSTIRSurface> surfaces = MakePrimarySurfaces(scene, width, height);
+
+  std::mt19937 rng(29);
+  std::vector<Light> lights = MakeManyLights(8192, rng);
+  Scheduler scheduler;
+  LightBVH light_bvh;
+  light_bvh.Build(lights, scheduler);
+  ReSTIRDI::ReprojectFunction identity = [](uint32_t x, uint32_t y, const ReSTIRSurface&, uint32_t& px, uint32_t& py)
+  {
+    px = x;
+    py = y;
+    return true;
+  };
+
+  ReSTIRSettings independent;
+  independent.temporal_reuse = false;
+  independent.spatial_passes = 0;
+  std::vector<glm::vec3> frame;
+  std::vector<double> reference(surfaces.size(), 0.0);
+  ReSTIRDI converged(width, height, independent);
+  const uint32_t reference_frames = 32;
+  for (uint32_t i = 0; i < reference_frames; ++i)
+  {
+    converged.Render(surfaces, lights, light_bvh, scene.bvh, nullptr, scheduler, frame);
+    for (size_t p = 0; p < frame.size(); ++p) reference[p] += Accumulator::Luminance(frame[p]) / reference_frames;
+  }
+  double mean = 0.0;
+  for (double value : reference) mean += value / reference.size();
+
+  auto run = [&](const char* name, ReSTIRSettings settings, uint32_t frames)
+  {
+    ReSTIRDI restir(width, height, settings);
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    for (uint32_t i = 0; i < frames; ++i)
+      restir.Render(surfaces, lights, light_bvh, scene.bvh, identity, scheduler, frame);
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    double error = 0.0, sum = 0.0;
+    for (size_t p = 0; p < frame.size(); ++p)
+    {
+      double value = Accumulator::Luminance(frame[p]);
+      error += (value - reference[p]) * (value - reference[p]);
+      sum += value;
+    }
+    printf("restir %-22s relative rmse %6.3f  mean %6.3f  %.2f shadow rays/pixel  %6.2f ms/frame\n", name,
+           std::sqrt(error / frame.size()) / mean, sum / frame.size() / mean,
+           static_cast<double>(restir.getShadowRays()) / (static_cast<double>(frames) * frame.size()),
+           seconds * 1e3 / frames);
+  };
+
+  ReSTIRSettings single = independent;
+  single.initial_candidates = 1;
+  ReSTIRSettings temporal;
+  temporal.spatial_passes = 0;
+  // the default radius is meant for full resolution
+  ReSTIRSettings spatial;
+  spatial.temporal_reuse = false;
+  spatial.spatial_radius = 5.0f;
+  ReSTIRSettings full = spatial;
+  full.temporal_reuse = true;
+  ReSTIRSettings spatial_biased = spatial, full_biased = full;
+  spatial_biased.spatial_visibility = false;
+  full_biased.spatial_visibility = false;
+  run("1 sample", single, 1);
+  run("RIS 32", independent, 1);
+  run("spatial", spatial, 1);
+  run("spatial, no visibility", spatial_biased, 1);
+  run("temporal x8", temporal, 8);
+  run("temporal+spatial x8", full, 8);
+  run("t+s x8, no visibility", full_biased, 8);
+}
+
+// Ambient occlusion within 3 units of the primary hits, cosine weighted.
+static void RenderAmbientOcclusion(const Scene& scene, const std::vector<ReSTIRSurface>& surfaces, uint32_t width,
+                                   const SamplerTables& tables, SamplerType type, uint32_t samples, uint32_t seed,
+                                   Scheduler& scheduler, std::vector<float>& image)
+{
+  image.assign(surfaces.size(), 0.0f);
+  scheduler.ParallelFor(static_cast<uint32_t>(surfaces.size() / width), [&](uint32_t y, uint32_t)
+  {
+    for (uint32_t x = 0; x < width; ++x)
+    {
+      const ReSTIRSurface& surface = surfaces[static_cast<size_t>(y) * width + x];
+      if (!surface.valid) continue;
+      glm::vec3 helper = std::abs(surface.normal.x) > 0.9f ? glm::vec3(0.0f, 1.0f, 0.0f) : glm::vec3(1.0f, 0.0f, 0.0f);
+      glm::vec3 tangent = glm::normalize(glm::cross(helper, surface.normal));
+      glm::vec3 bitangent = glm::cross(surface.normal, tangent);
+      uint32_t open = 0;
+      for (uint32_t i = 0; i < samples; ++i)
+      {
+        Sampler sampler(tables, type, x, y, i, seed);
+        glm::vec2 u = sampler.Get2D();
+        float radius = std::sqrt(u.x), phi = 6.28318531f * u.y;
+        Ray ray;
+        ray.origin = surface.position + surface.normal * 1e-3f;
+        ray.direction = tangent * (radius * std::cos(phi)) + bitangent * (radius * std::sin(phi)) +
+                        surface.normal * std::sqrt(std::max(0.0f, 1.0f - u.x));
+        ray.tmax = 3.0f;
+        if (!scene.bvh.Occluded(ray)) open++;
+      }
+      image[static_cast<size_t>(y) * width + x] = static_cast<float>(open) / samples;
+    }
+  });
+}
+
+// Ambient occlusion of the primary hits with white noise, Owen-scrambled
+// Sobol and blue-noise dithered Sobol. Besides the error the table shows it
+// after a 5x5 box filter, which is what is left of it once the eye or a
+// denoiser averages neighbours and where blue noise pays off.
+static void CompareSamplers(const std::vector<glm::vec3>& positions, const std::vector<uint32_t>& indices)
+{
+  const uint32_t width = 128, height = 72;
+  Scene scene;
+  MakeTexturedScene(positions, indices, scene);
+  std::vector<ReSTIRSurface> surfaces = MakePrimarySurfaces(scene, width, height);
+
+  SamplerTables tables;
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  tables.Build();
+  double build = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  printf("sampler tables %zu Sobol words, %ux%u blue noise, build %.1f ms\n", tables.sobol.size(),
+         tables.blue_noise_size, tables.blue_noise_size, build * 1e3);
+
+  Scheduler scheduler;
+  auto render = [&](SamplerType type, uint32_t samples, std::vector<float>& image)
+  { RenderAmbientOcclusion(scene, surfaces, width, tables, type, samples, 0, scheduler, image); };
+
+  std::vector<float> reference, image;
+  render(SamplerType::Sobol, 1024, reference);
+  auto errors = [&](double& rmse, double& filtered)
+  {
+    rmse = filtered = 0.0;
+    for (size_t i = 0; i < image.size(); ++i) rmse += (image[i] - reference[i]) * (image[i] - reference[i]);
+    for (int32_t y = 0; y < static_cast<int32_t>(height); ++y)
+    {
+      for (int32_t x = 0; x < static_cast<int32_t>(width); ++x)
+      {
+        double sum = 0.0;
+        int count = 0;
+        for (int32_t dy = -2; dy <= 2; ++dy)
+        {
+          for (int32_t dx = -2; dx <= 2; ++dx)
+          {
+            int32_t sx = x + dx, sy = y + dy;
+            if (sx < 0 || sy < 0 || sx >= static_cast<int32_t>(width) || sy >= static_cast<int32_t>(height))
+              continue;
+            size_t i = static_cast<size_t>(sy) * width + sx;
+            sum += image[i] - reference[i];
+            count++;
+          }
+        }
+        filtered += (sum / count) * (sum / count);
+      }
+    }
+    rmse = std::sqrt(rmse / image.size());
+    filtered = std::sqrt(filtered / image.size());
+  };
+
+  const char* names[] = { "independent", "sobol", "blue noise" };
+  for (uint32_t samples : { 1u, 4u, 16u })
+  {
+    for (uint32_t type = 0; type < 3; ++type)
+    {
+      render(static_cast<SamplerType>(type), samples, image);
+      double rmse, filtered;
+      errors(rmse, filtered);
+      printf("sampler %-11s %2u spp  ao rmse %.4f  filtered rmse %.4f\n", names[type], samples, rmse, filtered);
+    }
+  }
+}
+
+// SVGF on one sample of ambient occlusion per frame over a checkered
+// albedo, static view. Shows error against 1024 spp for the raw frame, the
+// running mean of all frames so far and the denoiser, then the cost of the
+// filter at a larger resolution.
+static void CompareDenoiser(const std::vector<glm::vec3>& positions, const std::vector<uint32_t>& indices)
+{
+  Scene scene;
+  MakeTexturedScene(positions, indices, scene);
+  SamplerTables tables;
+  tables.Build();
+  Scheduler scheduler;
+
+  auto make_guides = [](const std::vector<ReSTIRSurface>& surfaces, uint32_t width, uint32_t height)
+  {
+    std::vector<DenoiseGuide> guides(surfaces.size());
+    for (uint32_t y = 0; y < height; ++y)
+    {
+      for (uint32_t x = 0; x < width; ++x)
+      {
+        const size_t pixel = static_cast<size_t>(y) * width + x;
+        const ReSTIRSurface& surface = surfaces[pixel];
+        if (!surface.valid) continue;
+        DenoiseGuide& guide = guides[pixel];
+        guide.normal = surface.normal;
+        guide.depth = surface.depth;
+        guide.albedo = glm::vec3(((x / 8 + y / 8) & 1) ? 0.8f : 0.3f);
+        guide.valid = 1;
+        // smallest one-sided difference per axis, like fwidth without the
+        // jumps at silhouettes
+        float gradient[2] = { 0.0f, 0.0f };
+        const int32_t offsets[2][2] = { { 1, 0 }, { 0, 1 } };
+        for (int axis = 0; axis < 2; ++axis)
+        {
+          float best = infinity;
+          for (int32_t sign : { -1, 1 })
+          {
+            int32_t sx = static_cast<int32_t>(x) + sign * offsets[axis][0];
+            int32_t sy = static_cast<int32_t>(y) + sign * offsets[axis][1];
+            if (sx < 0 || sy < 0 || sx >= static_cast<int32_t>(width) || sy >= static_cast<int32_t>(height)) continue;
+            const ReSTIRSurface& neighbor = surfaces[static_cast<size_t>(sy) * width + sx];
+            if (neighbor.valid) best = std::min(best, std::abs(neighbor.depth - surface.depth));
+          }
+          gradient[axis] = best == infinity ? 0.0f : best;
+        }
+        guide.depth_gradient = gradient[0] + gradient[1];
+      }
+    }
+    return guides;
+  };
+
+  auto shade = [](const std::vector<DenoiseGuide>& guides, const std::vector<float>& occlusion)
+  {
+    std::vector<glm::vec3> color(guides.size(), glm::vec3(0.0f));
+    for (size_t i = 0; i < guides.size(); ++i) color[i] = guides[i].albedo * occlusion[i];
+    return color;
+  };
+
+  {
+    const uint32_t width = 128, height = 72;
+    std::vector<ReSTIRSurface> surfaces = MakePrimarySurfaces(scene, width, height);
+    std::vector<DenoiseGuide> guides = make_guides(surfaces, width, height);
+    std::vector<float> occlusion;
+    RenderAmbientOcclusion(scene, surfaces, width, tables, SamplerType::Sobol, 1024, 0, scheduler, occlusion);
+    std::vector<glm::vec3> reference = shade(guides, occlusion);
+
+    auto rmse = [&](const std::vector<glm::vec3>& image)
+    {
+      double error = 0.0;
+      for (size_t i = 0; i < image.size(); ++i)
+      {
+        float difference = Accumulator::Luminance(image[i] - reference[i]);
+        error += difference * difference;
+      }
+      return std::sqrt(error / image.size());
+    };
+
+    Denoiser denoiser(width, height);
+    std::vector<glm::vec3> mean(reference.size(), glm::vec3(0.0f)), filtered;
+    for (uint32_t frame = 0; frame < 8; ++frame)
+    {
+      RenderAmbientOcclusion(scene, surfaces, width, tables, SamplerType::Independent, 1, frame, scheduler, occlusion);
+      std::vector<glm::vec3> noisy = shade(guides, occlusion);
+      for (size_t i = 0; i < noisy.size(); ++i) mean[i] += (noisy[i] - mean[i]) / (frame + 1.0f);
+      denoiser.Denoise(noisy, guides, scheduler, filtered);
+      if (frame == 0 || frame == 3 || frame == 7)
+        printf("denoiser frame %u  rmse raw %.4f  mean %.4f  svgf %.4f\n", frame + 1, rmse(noisy), rmse(mean),
+               rmse(filtered));
+    }
+  }
+
+  const uint32_t width = 640, height = 360;
+  std::vector<ReSTIRSurface> surfaces = MakePrimarySurfaces(scene, width, height);
+  std::vector<DenoiseGuide> guides = make_guides(surfaces, width, height);
+  std::vector<float> occlusion;
+  RenderAmbientOcclusion(scene, surfaces, width, tables, SamplerType::Independent, 1, 0, scheduler, occlusion);
+  std::vector<glm::vec3> noisy = shade(guides, occlusion), filtered;
+  Denoiser denoiser(width, height);
+  double seconds = Measure([&]() { denoiser.Denoise(noisy, guides, scheduler, filtered); });
+  printf("denoiser %ux%u  %.2f ms/frame on %u threads, %d iterations\n", width, height, seconds * 1e3,
+         scheduler.getThreadCount(), static_cast<int>(denoiser.getSettings().atrous_iterations));
+}
+
+// A closed room lit only by a lamp recessed into the ceiling: the light
+// sits at the top of a shaft of 1 x 1 x 1, so from most of the room the
+// little light that matters arrives through the shaft opening. Emissive
+// triangles come last, from light_first on.
+struct InteriorScene
+{
+  std::vector<glm::vec3> positions;
+  std::vector<uint32_t> indices;
+  uint32_t light_first { 0 };
+  BVH bvh;
+};
+
+static void MakeInterior(InteriorScene& scene)
+{
+  std::vector<glm::vec3>& positions = scene.positions;
+  std::vector<uint32_t>& indices = scene.indices;
+  positions.clear();
+  indices.clear();
+  auto add_quad = [&](const glm::vec3& a, const glm::vec3& b, const glm::vec3& c, const glm::vec3& d)
+  {
+    uint32_t base = static_cast<uint32_t>(positions.size());
+    positions.insert(positions.end(), { a, b, c, d });
+    indices.insert(indices.end(), { base, base + 1, base + 2, base, base + 2, base + 3 });
+  };
+
+  const float x = 5.0f, y = 4.0f, z = 5.0f, h = 0.5f;
+  add_quad({ -x, 0.0f, -z }, { x, 0.0f, -z }, { x, 0.0f, z }, { -x, 0.0f, z });
+  add_quad({ -x, 0.0f, -z }, { -x, y, -z }, { x, y, -z }, { x, 0.0f, -z });
+  add_quad({ -x, 0.0f, z }, { x, 0.0f, z }, { x, y, z }, { -x, y, z });
+  add_quad({ -x, 0.0f, -z }, { -x, 0.0f, z }, { -x, y, z }, { -x, y, -z });
+  add_quad({ x, 0.0f, -z }, { x, y, -z }, { x, y, z }, { x, 0.0f, z });
+  // ceiling around the shaft and the shaft walls
+  add_quad({ -x, y, -z }, { -x, y, z }, { -h, y, z }, { -h, y, -z });
+  add_quad({ h, y, -z }, { h, y, z }, { x, y, z }, { x, y, -z });
+  add_quad({ -h, y, -z }, { -h, y, -h }, { h, y, -h }, { h, y, -z });
+  add_quad({ -h, y, h }, { -h, y, z }, { h, y, z }, { h, y, h });
+  add_quad({ -h, y, -h }, { -h, y + 1.0f, -h }, { h, y + 1.0f, -h }, { h, y, -h });
+  add_quad({ -h, y, h }, { h, y, h }, { h, y + 1.0f, h }, { -h, y + 1.0f, h });
+  add_quad({ -h, y, -h }, { -h, y, h }, { -h, y + 1.0f, h }, { -h, y + 1.0f, -h });
+  add_quad({ h, y, -h }, { h, y + 1.0f, -h }, { h, y + 1.0f, h }, { h, y, h });
+
+  scene.light_first = static_cast<uint32_t>(indices.size() / 3);
+  add_quad({ -h, y + 1.0f, -h }, { h, y + 1.0f, -h }, { h, y + 1.0f, h }, { -h, y + 1.0f, h });
+  scene.bvh.Build(positions, indices);
+}
+
+// What a path uses besides the scene, all optional. Guiding records and
+// cache updates happen when the path is complete.
+struct InteriorPathOptions
+{
+  PathGuiding* guiding { nullptr };
+  bool record_guiding { false };
+  RadianceCache* cache { nullptr };
+};
+
+// Position and normal facing the ray where it hit the interior.
+static void InteriorSurface(const InteriorScene& scene, const Ray& ray, const Hit& hit, glm::vec3& position,
+                            glm::vec3& normal)
+{
+  const glm::vec3 a = scene.positions[scene.indices[hit.primitive * 3]];
+  normal = glm::normalize(glm::cross(scene.positions[scene.indices[hit.primitive * 3 + 1]] - a,
+                                     scene.positions[scene.indices[hit.primitive * 3 + 2]] - a));
+  if (glm::dot(normal, ray.direction) > 0.0f) normal = -normal;
+  position = ray.origin + ray.direction * hit.t;
+}
+
+// Cosine distributed direction around normal, density cos / pi.
+static glm::vec3 CosineDirection(const glm::vec3& normal, const glm::vec2& u)
+{
+  glm::vec3 helper = std::abs(normal.x) > 0.9f ? glm::vec3(0.0f, 1.0f, 0.0f) : glm::vec3(1.0f, 0.0f, 0.0f);
+  glm::vec3 tangent = glm::normalize(glm::cross(helper, normal));
+  glm::vec3 bitangent = glm::cross(normal, tangent);
+  float r = std::sqrt(u.x), phi = 6.28318531f * u.y;
+  return tangent * (r * std::cos(phi)) + bitangent * (r * std::sin(phi)) +
+         normal * std::sqrt(std::max(0.0f, 1.0f - u.x));
+}
+
+// Primary rays of the interior seen from the front wall.
+struct InteriorCamera
+{
+  glm::vec3 eye { 0.0f, 2.0f, -4.8f };
+  glm::vec3 forward { glm::normalize(glm::vec3(0.0f, 1.5f, 0.0f) - eye) };
+  glm::vec3 right { glm::normalize(glm::cross(glm::vec3(0.0f, 1.0f, 0.0f), forward)) };
+  glm::vec3 up { glm::cross(forward, right) };
+
+  Ray Generate(uint32_t x, uint32_t y, uint32_t width, uint32_t height, const glm::vec2& jitter) const
+  {
+    float sx = ((x + jitter.x) / width * 2.0f - 1.0f) * width / height;
+    float sy = 1.0f - (y + jitter.y) / height * 2.0f;
+    Ray ray;
+    ray.origin = eye;
+    ray.direction = glm::normalize(forward + right * (sx * 0.6f) + up * (sy * 0.6f));
+    return ray;
+  }
+};
+
+// Diffuse path of at most max_depth bounces without next event estimation,
+// so light is only found by scattering into it. With guiding, directions
+// come from the BSDF or the guide by one-sample MIS. An enabled radiance
+// cache ends most paths at their second hit, the rest go on and feed it.
+static glm::vec3 TraceInteriorPath(const InteriorScene& scene, Ray ray, Sampler& sampler,
+                                   const InteriorPathOptions& options, uint64_t& rays)
+{
+  // radiance is what arrived through direction, weight the BSDF over the pdf
+  struct Vertex
+  {
+    glm::vec3 position;
+    glm::vec3 normal;
+    glm::vec3 direction;
+    float pdf;
+    float weight;
+    float throughput;
+    float radiance;
+  };
+  const uint32_t max_depth = 8;
+  const float albedo = 0.5f, emission = 50.0f;
+  Vertex vertices[max_depth];
+  uint32_t vertex_count = 0;
+  float throughput = 1.0f, radiance = 0.0f;
+  auto add = [&](float value)
+  {
+    radiance += throughput * value;
+    for (uint32_t i = 0; i < vertex_count; ++i) vertices[i].radiance += throughput * value / vertices[i].throughput;
+  };
+
+  PathGuiding* guiding = options.guiding;
+  RadianceCache* cache = options.cache && options.cache->getSettings().enabled ? options.cache : nullptr;
+  const bool update_cache = cache && sampler.Get1D() < cache->getSettings().update_fraction;
+  for (uint32_t depth = 0; depth <= max_depth; ++depth)
+  {
+    Hit hit;
+    rays++;
+    if (!scene.bvh.Intersect(ray, hit)) break;
+    if (hit.primitive >= scene.light_first)
+    {
+      add(emission);
+      break;
+    }
+    if (depth == max_depth) break;
+
+    glm::vec3 position, normal;
+    InteriorSurface(scene, ray, hit, position, normal);
+
+    glm::vec3 cached;
+    if (cache && !update_cache && depth == 1 && cache->Lookup(position, normal, cached))
+    {
+      add(cached.x);
+      break;
+    }
+
+    const float choice = sampler.Get1D();
+    const glm::vec2 u = sampler.Get2D();
+    const float fraction = guiding && guiding->Trained(position) ? guiding->getSettings().bsdf_fraction : 1.0f;
+    glm::vec3 direction;
+    float guide_pdf = 0.0f;
+    if (choice < fraction)
+    {
+      direction = CosineDirection(normal, u);
+      if (fraction < 1.0f) guide_pdf = guiding->Pdf(position, direction);
+    }
+    else direction = guiding->Sample(position, u, guide_pdf);
+
+    const float cosine = glm::dot(normal, direction);
+    if (!(cosine > 0.0f)) break;
+    const float pdf = fraction * cosine / 3.14159265f + (1.0f - fraction) * guide_pdf;
+    const float weight = albedo * cosine / (3.14159265f * pdf);
+    throughput *= weight;
+    vertices[vertex_count++] = Vertex { position, normal, direction, pdf, weight, throughput, 0.0f };
+
+    ray.origin = position + normal * 1e-3f;
+    ray.direction = direction;
+    ray.tmin = 0.0f;
+    ray.tmax = infinity;
+  }
+
+  for (uint32_t i = 0; options.record_guiding && i < vertex_count; ++i)
+    guiding->Record(vertices[i].position, vertices[i].direction, vertices[i].radiance / vertices[i].pdf);
+  for (uint32_t i = 0; update_cache && i < vertex_count; ++i)
+    cache->Update(vertices[i].position, vertices[i].normal, glm::vec3(vertices[i].weight * vertices[i].radiance));
+  return glm::vec3(radiance);
+}
+
+// samples paths per pixel of the interior, seed decorrelates calls
+static void RenderInterior(const InteriorScene& scene, const SamplerTables& tables,
+                           const InteriorPathOptions& options, uint32_t width, uint32_t height, uint32_t samples,
+                           uint32_t seed, Scheduler& scheduler, std::vector<float>& image, uint64_t* rays = nullptr)
+{
+  const InteriorCamera camera;
+  if (options.cache) options.cache->BeginFrame(camera.eye);
+
+  image.assign(static_cast<size_t>(width) * height, 0.0f);
+  std::vector<uint64_t> row_rays(height, 0);
+  scheduler.ParallelFor(height, [&](uint32_t y, uint32_t)
+  {
+    for (uint32_t x = 0; x < width; ++x)
+    {
+      float sum = 0.0f;
+      for (uint32_t i = 0; i < samples; ++i)
+      {
+        Sampler sampler(tables, SamplerType::Independent, x, y, i, seed);
+        Ray ray = camera.Generate(x, y, width, height, sampler.Get2D());
+        sum += TraceInteriorPath(scene, ray, sampler, options, row_rays[y]).x;
+      }
+      image[static_cast<size_t>(y) * width + x] = sum / samples;
+    }
+  });
+  if (rays)
+  {
+    for (uint64_t count : row_rays) *rays += count;
+  }
+}
+
+static double MeanSquaredError(const std::vector<float>& image, const std::vector<float>& reference)
+{
+  double error = 0.0;
+  for (size_t i = 0; i < image.size(); ++i) error += (image[i] - reference[i]) * (image[i] - reference[i]);
+  return error / image.size();
+}
+
+// Online training of path guiding in the lamp-lit room, iterations of 1 to
+// 128 samples per pixel, then the same number of samples with and without
+// guiding against a converged guided image.
+static void CompareGuiding(const InteriorScene& scene, const SamplerTables& tables)
+{
+  const uint32_t width = 96, height = 54;
+  Scheduler scheduler;
+
+  // the paper's c is meant for a million paths per sample
+  GuidingSettings settings;
+  settings.spatial_threshold = 2000.0f;
+  PathGuiding guiding(scene.bvh.Bounds(), settings);
+  InteriorPathOptions options;
+  options.guiding = &guiding;
+  options.record_guiding = true;
+  std::vector<float> image;
+  uint32_t training = 0;
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  for (uint32_t iteration = 0; iteration < 8; ++iteration)
+  {
+    RenderInterior(scene, tables, options, width, height, 1u << iteration, 100 + iteration, scheduler, image);
+    guiding.EndIteration(scheduler);
+    training += 1u << iteration;
+  }
+  double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  printf("guiding trained %u spp in %.1f ms, %u spatial leaves, %u directional nodes\n", training, seconds * 1e3,
+         guiding.getLeafCount(), guiding.getDirectionalNodeCount());
+
+  options.record_guiding = false;
+  std::vector<float> reference;
+  RenderInterior(scene, tables, options, width, height, 1024, 1, scheduler, reference);
+
+  const uint32_t samples = 128;
+  RenderInterior(scene, tables, InteriorPathOptions(), width, height, samples, 2, scheduler, image);
+  double unguided = MeanSquaredError(image, reference);
+  RenderInterior(scene, tables, options, width, height, samples, 2, scheduler, image);
+  double guided = MeanSquaredError(image, reference);
+  printf("guiding %u spp  rmse bsdf %.4f  guided %.4f, bsdf sampling needs %.1fx the samples (%.1fx with training)\n",
+         samples, std::sqrt(unguided), std::sqrt(guided), unguided / guided,
+         unguided / guided * samples / (samples + training));
+}
+
+// Preview of a static view over 32 frames of 2 paths per pixel, with paths
+// cut into the radiance cache after their first bounce and without the
+// cache: rays per path and the error of the running mean against a
+// converged image, which includes the bias of the cache.
+static void CompareRadianceCache(const InteriorScene& scene, const SamplerTables& tables)
+{
+  const uint32_t width = 96, height = 54, frames = 32, samples = 2;
+  Scheduler scheduler;
+  std::vector<float> reference, image;
+  RenderInterior(scene, tables, InteriorPathOptions(), width, height, 1024, 1, scheduler, reference);
+
+  RadianceCacheSettings settings;
+  settings.enabled = true;
+  settings.table_size = 1u << 16;
+  RadianceCache cache(settings);
+  for (int enabled = 0; enabled < 2; ++enabled)
+  {
+    InteriorPathOptions options;
+    if (enabled) options.cache = &cache;
+    std::vector<float> mean(reference.size(), 0.0f);
+    uint64_t rays = 0, frame_rays = 0;
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    printf("radiance cache %-3s", enabled ? "on" : "off");
+    for (uint32_t frame = 0; frame < frames; ++frame)
+    {
+      frame_rays = 0;
+      RenderInterior(scene, tables, options, width, height, samples, 10 + frame, scheduler, image, &frame_rays);
+      rays += frame_rays;
+      if (enabled) cache.EndFrame(scheduler);
+      for (size_t i = 0; i < image.size(); ++i) mean[i] += (image[i] - mean[i]) / (frame + 1.0f);
+      if ((frame + 1) & frame) continue;
+      printf("  f%u %.2f rays rmse %.3f", frame + 1, static_cast<double>(frame_rays) / (width * height * samples),
+             std::sqrt(MeanSquaredError(mean, reference)));
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    const double paths = static_cast<double>(width) * height * samples * frames;
+    printf("\nradiance cache %-3s %.2f rays/path, %.1f ms/frame", enabled ? "on" : "off", rays / paths,
+           seconds * 1e3 / frames);
+    if (enabled) printf(", %u of %u slots", cache.getOccupiedSlots(), cache.getSettings().table_size);
+    printf("\n");
+  }
+}
+
+// Diffuse interior path under a termination policy, split branches recurse.
+// expected comes from a trained radiance cache, pixel is the cached
+// radiance at the first hit, both 0 where the cache has nothing.
+struct TerminatedPath
+{
+  const InteriorScene& scene;
+  const TerminationSettings& settings;
+  const RadianceCache* estimates;
+  Sampler& sampler;
+  PathStatistics& statistics;
+  uint32_t thread;
+  uint32_t rays;
+  uint32_t splits;
+
+  float Trace(Ray ray, uint32_t depth, float throughput, float pixel)
+  {
+    const float albedo = 0.5f, emission = 50.0f;
+    Hit hit;
+    rays++;
+    const bool found = scene.bvh.Intersect(ray, hit);
+    if (!found || hit.primitive >= scene.light_first)
+    {
+      statistics.AddPath(thread, depth + 1, PathEnd::Escaped);
+      return found ? emission : 0.0f;
+    }
+
+    glm::vec3 position, normal, cached(0.0f);
+    InteriorSurface(scene, ray, hit, position, normal);
+    const float expected = estimates && estimates->Lookup(position, normal, cached) ? cached.x : 0.0f;
+    if (depth == 0) pixel = expected;
+    const TerminationDecision decision = DecideTermination(settings, depth, throughput, expected, pixel,
+                                                           sampler.Get1D());
+    if (!decision.paths)
+    {
+      statistics.AddPath(thread, depth + 1, decision.end);
+      return 0.0f;
+    }
+
+    // cosine sampling leaves the albedo as the weight of a bounce
+    splits += decision.paths - 1;
+    const float weight = albedo * decision.weight;
+    float radiance = 0.0f;
+    for (uint32_t i = 0; i < decision.paths; ++i)
+    {
+      Ray next;
+      next.origin = position + normal * 1e-3f;
+      next.direction = CosineDirection(normal, sampler.Get2D());
+      radiance += weight * Trace(next, depth + 1, throughput * weight, pixel);
+    }
+    return radiance;
+  }
+};
+
+// Equal sample counts of the room under the termination policies against a
+// converged unbiased image, with rays per sample, how paths ended and
+// the efficiency, inverse error times rays per sample, relative to tracing
+// 8 bounces. Counting rays rather than time keeps it reproducible.
+static void CompareTermination(const InteriorScene& scene, const SamplerTables& tables)
+{
+  const uint32_t width = 96, height = 54, samples = 64;
+  const InteriorCamera camera;
+  Scheduler scheduler;
+
+  // a cache filled from every vertex supplies the estimates of the
+  // efficiency mode, the pass a renderer would learn them in
+  RadianceCacheSettings cache_settings;
+  cache_settings.enabled = true;
+  cache_settings.table_size = 1u << 16;
+  cache_settings.update_fraction = 1.0f;
+  RadianceCache cache(cache_settings);
+  InteriorPathOptions training;
+  training.cache = &cache;
+  std::vector<float> image;
+  for (uint32_t frame = 0; frame < 16; ++frame)
+  {
+    RenderInterior(scene, tables, training, width, height, 4, 200 + frame, scheduler, image);
+    cache.EndFrame(scheduler);
+  }
+
+  auto render = [&](const TerminationSettings& settings, uint32_t count, uint32_t seed, PathStatistics& statistics,
+                    std::vector<float>& result)
+  {
+    result.assign(static_cast<size_t>(width) * height, 0.0f);
+    scheduler.ParallelFor(height, [&](uint32_t y, uint32_t thread)
+    {
+      for (uint32_t x = 0; x < width; ++x)
+      {
+        float sum = 0.0f;
+        for (uint32_t i = 0; i < count; ++i)
+        {
+          Sampler sampler(tables, SamplerType::Independent, x, y, i, seed);
+          Ray ray = camera.Generate(x, y, width, height, sampler.Get2D());
+          TerminatedPath path { scene, settings, &cache, sampler, statistics, thread, 0, 0 };
+          sum += path.Trace(ray, 0, 1.0f, 0.0f);
+          statistics.AddSample(thread, path.rays, path.splits);
+        }
+        result[static_cast<size_t>(y) * width + x] = sum / count;
+      }
+    });
+  };
+
+  TerminationSettings unbiased;
+  unbiased.depth_policy = DepthPolicy::Roulette;
+  unbiased.max_depth = 8;
+  std::vector<float> reference;
+  PathStatistics reference_statistics(scheduler.getThreadCount());
+  render(unbiased, 1024, 1, reference_statistics, reference);
+  double reference_mean = 0.0;
+  for (float value : reference) reference_mean += value;
+
+  struct Policy
+  {
+    const char* name;
+    RouletteMode roulette;
+    DepthPolicy depth_policy;
+    uint32_t max_depth;
+  };
+  const Policy policies[] = { { "depth 8", RouletteMode::Off, DepthPolicy::Truncate, 8 },
+                              { "depth 3", RouletteMode::Off, DepthPolicy::Truncate, 3 },
+                              { "throughput", RouletteMode::Throughput, DepthPolicy::Roulette, 8 },
+                              { "efficiency", RouletteMode::Efficiency, DepthPolicy::Roulette, 8 } };
+  double baseline = 0.0;
+  for (const Policy& policy : policies)
+  {
+    TerminationSettings settings;
+    settings.roulette = policy.roulette;
+    settings.depth_policy = policy.depth_policy;
+    settings.max_depth = policy.max_depth;
+    PathStatistics statistics(scheduler.getThreadCount());
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    render(settings, samples, 2, statistics, image);
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    const double error = MeanSquaredError(image, reference);
+    double mean = 0.0;
+    for (float value : image) mean += value;
+    const PathTotals total = statistics.Total();
+    const double efficiency = 1.0 / (error * total.RaysPerSample());
+    if (baseline == 0.0) baseline = efficiency;
+
+    const double paths = static_cast<double>(total.Paths());
+    printf("termination %-10s %5.2f rays/sample  length %.2f  rmse %.4f  bias %+5.1f%%  %6.1f ms  "
+           "efficiency %.2fx  ends: roulette %.0f%% depth %.0f%%  splits %.2f/sample\n",
+           policy.name, total.RaysPerSample(), total.MeanLength(), std::sqrt(error),
+           (mean / reference_mean - 1.0) * 100.0, seconds * 1e3, efficiency / baseline,
+           total.ends[static_cast<uint32_t>(PathEnd::Roulette)] * 100.0 / paths,
+           total.ends[static_cast<uint32_t>(PathEnd::Depth)] * 100.0 / paths,
+           static_cast<double>(total.splits) / total.samples);
+    printf("termination %-10s lengths", policy.name);
+    for (uint32_t i = 1; i <= 12; ++i) printf(" %u:%.1f%%", i, total.lengths[i] * 100.0 / paths);
+    printf("\n");
+  }
+}
+
+// A smoke plume of puffs with voxel noise, stored as a sparse volume and
+// tracked along camera rays. Transmittance by ratio tracking and collision
+// probability by delta tracking are compared against ray marching with
+// fine steps, with the majorant grid and with one majorant for the box.
+// Then a panning camera renders through a pool holding a quarter of the
+// bricks.
+static void CompareVolume(const SamplerTables& tables)
+{
+  DensityGrid grid;
+  grid.width = grid.height = grid.depth = 128;
+  grid.origin = glm::vec3(-1.0f);
+  grid.voxel_size = 2.0f / 128.0f;
+  grid.density.resize(static_cast<size_t>(128) * 128 * 128);
+  for (uint32_t z = 0; z < 128; ++z)
+  {
+    for (uint32_t y = 0; y < 128; ++y)
+    {
+      for (uint32_t x = 0; x < 128; ++x)
+      {
+        const glm::vec3 p = grid.origin + (glm::vec3(x, y, z) + 0.5f) * grid.voxel_size;
+        float density = 0.0f;
+        for (int k = 0; k < 7; ++k)
+        {
+          const glm::vec3 center(0.2f * std::sin(1.3f * k), -0.7f + 0.23f * k, 0.15f * std::cos(0.9f * k));
+          const float radius = 0.12f + 0.03f * k;
+          density += std::exp(-glm::dot(p - center, p - center) / (radius * radius));
+        }
+        density *= 0.7f + 0.3f * UnitFloat(PcgHash(x + PcgHash(y + PcgHash(z))));
+        grid.density[(static_cast<size_t>(z) * 128 + y) * 128 + x] = density > 0.02f ? density : 0.0f;
+      }
+    }
+  }
+
+  const std::string path = "trace_benchmark.vptvolume";
+  SparseVolume reference_volume;
+  if (!SparseVolume::Write(path, grid) || !reference_volume.Open(path)) return;
+  const uint32_t cell_count = static_cast<uint32_t>(reference_volume.getCells().count);
+  printf("volume 128^3, %u of %u bricks, file %.2f MB, dense %.2f MB\n", reference_volume.getBrickCount(),
+         cell_count, std::filesystem::file_size(path) / 1048576.0, grid.density.size() * sizeof(float) / 1048576.0);
+
+  const float sigma = 12.0f;
+  const uint32_t width = 64, height = 64;
+  Scheduler scheduler;
+  // views from 3 units away along the z axis, zoom narrows them
+  auto camera_ray = [&](float pan, float zoom, uint32_t x, uint32_t y)
+  {
+    const glm::vec3 eye(pan, 0.0f, -3.0f);
+    Ray ray;
+    ray.origin = eye;
+    ray.direction = glm::normalize(glm::vec3(((x + 0.5f) / width * 2.0f - 1.0f) * 0.4f / zoom,
+                                             (1.0f - (y + 0.5f) / height * 2.0f) * 0.4f / zoom, 1.0f));
+    return ray;
+  };
+  // every brick resident, marched in eighths of a voxel
+  auto reference = [&](float pan, float zoom, std::vector<float>& result)
+  {
+    result.assign(static_cast<size_t>(width) * height, 0.0f);
+    for (int pass = 0; pass < 2; ++pass)
+    {
+      scheduler.ParallelFor(height, [&](uint32_t y, uint32_t)
+      {
+        for (uint32_t x = 0; x < width; ++x)
+        {
+          Ray ray = camera_ray(pan, zoom, x, y);
+          const float step = grid.voxel_size / 8.0f;
+          float depth = 0.0f;
+          for (float t = 2.0f; t < 4.8f; t += step)
+            depth += reference_volume.Density(ray.origin + ray.direction * (t + 0.5f * step)) * step;
+          result[static_cast<size_t>(y) * width + x] = std::exp(-sigma * depth);
+        }
+      });
+      reference_volume.Update();
+    }
+  };
+  auto rmse = [](const std::vector<float>& a, const std::vector<float>& b)
+  {
+    double error = 0.0;
+    for (size_t i = 0; i < a.size(); ++i) error += (a[i] - b[i]) * (a[i] - b[i]);
+    return std::sqrt(error / a.size());
+  };
+  std::vector<float> expected;
+  reference(0.0f, 1.0f, expected);
+
+  const uint32_t samples = 16;
+  for (int majorant_grid = 1; majorant_grid >= 0; --majorant_grid)
+  {
+    VolumeSettings settings;
+    settings.majorant_grid = majorant_grid != 0;
+    SparseVolume volume;
+    volume.Open(path, settings);
+    std::vector<float> transmittance, collision;
+    std::vector<TrackingStats> ratio_stats(height), delta_stats(height);
+    double ratio_seconds = 0.0, delta_seconds = 0.0;
+    for (int pass = 0; pass < 2; ++pass)
+    {
+      transmittance.assign(static_cast<size_t>(width) * height, 0.0f);
+      collision.assign(static_cast<size_t>(width) * height, 0.0f);
+      std::fill(ratio_stats.begin(), ratio_stats.end(), TrackingStats());
+      std::fill(delta_stats.begin(), delta_stats.end(), TrackingStats());
+      std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+      scheduler.ParallelFor(height, [&](uint32_t y, uint32_t)
+      {
+        for (uint32_t x = 0; x < width; ++x)
+        {
+          for (uint32_t i = 0; i < samples; ++i)
+          {
+            Sampler sampler(tables, SamplerType::Independent, x, y, i, 3);
+            transmittance[static_cast<size_t>(y) * width + x] +=
+              volume.Transmittance(camera_ray(0.0f, 1.0f, x, y), sigma, sampler, &ratio_stats[y]) / samples;
+          }
+        }
+      });
+      std::chrono::steady_clock::time_point middle = std::chrono::steady_clock::now();
+      scheduler.ParallelFor(height, [&](uint32_t y, uint32_t)
+      {
+        for (uint32_t x = 0; x < width; ++x)
+        {
+          for (uint32_t i = 0; i < samples; ++i)
+          {
+            Sampler sampler(tables, SamplerType::Independent, x, y, i, 4);
+            float t;
+            if (!volume.SampleCollision(camera_ray(0.0f, 1.0f, x, y), sigma, sampler, t, &delta_stats[y]))
+              collision[static_cast<size_t>(y) * width + x] += 1.0f / samples;
+          }
+        }
+      });
+      ratio_seconds = std::chrono::duration<double>(middle - start).count();
+      delta_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - middle).count();
+      // the first pass requested the bricks, the second reads them
+      volume.Update();
+    }
+
+    uint64_t ratio_lookups = 0, ratio_cells = 0, delta_lookups = 0;
+    for (uint32_t y = 0; y < height; ++y)
+    {
+      ratio_lookups += ratio_stats[y].lookups;
+      ratio_cells += ratio_stats[y].cells;
+      delta_lookups += delta_stats[y].lookups;
+    }
+    const double paths = static_cast<double>(width) * height * samples;
+    printf("volume %-13s ratio tracking %5.1f lookups %5.1f cells/ray %6.1f ms rmse %.4f  "
+           "delta tracking %5.1f lookups/ray %6.1f ms rmse %.4f\n", majorant_grid ? "majorant grid" : "box majorant",
+           ratio_lookups / paths, ratio_cells / paths, ratio_seconds * 1e3, rmse(transmittance, expected),
+           delta_lookups / paths, delta_seconds * 1e3, rmse(collision, expected));
+  }
+
+  // a quarter of the bricks fit, a zoomed view pans across the plume and
+  // each frame renders and then updates
+  VolumeSettings settings;
+  settings.pool_bricks = reference_volume.getBrickCount() / 4;
+  SparseVolume volume;
+  volume.Open(path, settings);
+  std::vector<float> image(static_cast<size_t>(width) * height);
+  for (uint32_t frame = 0; frame < 8; ++frame)
+  {
+    const float pan = -0.6f + 0.15f * frame;
+    reference(pan, 4.0f, expected);
+    scheduler.ParallelFor(height, [&](uint32_t y, uint32_t)
+    {
+      for (uint32_t x = 0; x < width; ++x)
+      {
+        float sum = 0.0f;
+        for (uint32_t i = 0; i < samples; ++i)
+        {
+          Sampler sampler(tables, SamplerType::Independent, x, y, i, 5 + frame);
+          sum += volume.Transmittance(camera_ray(pan, 4.0f, x, y), sigma, sampler);
+        }
+        image[static_cast<size_t>(y) * width + x] = sum / samples;
+      }
+    });
+    const double error = rmse(image, expected);
+    volume.Update();
+    const VolumeStats& stats = volume.getStats();
+    printf("volume pool frame %u  rmse %.4f  resident %u of %u  loads %llu  evictions %llu  pool %.0f KB\n", frame,
+           error, stats.resident, volume.getBrickCount(), static_cast<unsigned long long>(stats.loads),
+           static_cast<unsigned long long>(stats.evictions), volume.getPool().size() / 1024.0);
+  }
+
+  volume = SparseVolume();
+  reference_volume = SparseVolume();
+  std::error_code error;
+  std::filesystem::remove(path, error);
+}
+
+// Hair on a head: strands of cubic segments as curves, split into pieces or
+// not, against the same strands tessellated into tubes of triangles.
+static void CompareCurves()
+{
+  const uint32_t strand_count = 5000;
+  const uint32_t segments_per_strand = 4;
+  std::mt19937 rng(11);
+  std::uniform_real_distribution<float> uniform(0.0f, 1.0f);
+
+  CurveSet curves;
+  for (uint32_t strand = 0; strand < strand_count; ++strand)
+  {
+    // roots on the upper half of a unit sphere, growing out and drooping
+    const float z = uniform(rng) * 1.2f - 0.2f;
+    const float phi = 2.0f * 3.14159265f * uniform(rng);
+    const float ring = std::sqrt(std::max(1.0f - z * z, 0.0f));
+    const glm::vec3 root(ring * std::cos(phi), z, ring * std::sin(phi));
+    const glm::vec3 curl(uniform(rng) - 0.5f, uniform(rng) - 0.5f, uniform(rng) - 0.5f);
+    const uint32_t point_count = segments_per_strand * 3 + 1;
+    for (uint32_t i = 0; i < point_count; ++i)
+    {
+      const float s = static_cast<float>(i) / (point_count - 1);
+      const glm::vec3 position = root * (1.0f + 0.6f * s) + glm::vec3(0.0f, -0.9f * s * s, 0.0f) +
+                                 curl * (0.3f * std::sin(9.0f * s));
+      if (i % 3 == 0 && i + 1 < point_count) curves.segments.push_back(static_cast<uint32_t>(curves.points.size()));
+      curves.points.push_back(glm::vec4(position, 0.004f * (1.0f - 0.75f * s)));
+    }
+  }
+
+  // tubes of four sides, as many steps per segment as the curve test takes
+  // with four pieces
+  const uint32_t steps = 4 * curve_linear_steps, sides = 4;
+  std::vector<glm::vec3> positions;
+  std::vector<uint32_t> indices;
+  for (size_t segment = 0; segment < curves.segments.size(); ++segment)
+  {
+    const glm::vec4* p = &curves.points[curves.segments[segment]];
+    const uint32_t first = static_cast<uint32_t>(positions.size());
+    for (uint32_t step = 0; step <= steps; ++step)
+    {
+      const float u = static_cast<float>(step) / steps, v = 1.0f - u;
+      const glm::vec4 point = p[0] * (v * v * v) + p[1] * (3.0f * u * v * v) + p[2] * (3.0f * u * u * v) +
+                              p[3] * (u * u * u);
+      const glm::vec3 tangent = glm::normalize(glm::vec3((p[1] - p[0]) * (v * v) + (p[2] - p[1]) * (2.0f * u * v) +
+                                                         (p[3] - p[2]) * (u * u)));
+      const glm::vec3 side = glm::normalize(glm::cross(tangent, std::fabs(tangent.y) < 0.9f ?
+                                                       glm::vec3(0.0f, 1.0f, 0.0f) : glm::vec3(1.0f, 0.0f, 0.0f)));
+      const glm::vec3 up = glm::cross(tangent, side);
+      for (uint32_t k = 0; k < sides; ++k)
+      {
+        const float angle = 2.0f * 3.14159265f * k / sides;
+        positions.push_back(glm::vec3(point) + (side * std::cos(angle) + up * std::sin(angle)) * point.w);
+      }
+    }
+    for (uint32_t step = 0; step < steps; ++step)
+    {
+      for (uint32_t k = 0; k < sides; ++k)
+      {
+        const uint32_t a = first + step * sides + k, b = first + step * sides + (k + 1) % sides;
+        const uint32_t c = a + sides, d = b + sides;
+        indices.insert(indices.end(), { a, b, d, a, d, c });
+      }
+    }
+  }
+
+  // a view of the whole head from the front
+  const uint32_t width = 256, height = 256;
+  std::vector<Ray> rays(static_cast<size_t>(width) * height);
+  for (uint32_t y = 0; y < height; ++y)
+  {
+    for (uint32_t x = 0; x < width; ++x)
+    {
+      Ray& ray = rays[static_cast<size_t>(y) * width + x];
+      ray.origin = glm::vec3(0.0f, 0.0f, 5.0f);
+      ray.direction = glm::normalize(glm::vec3((x + 0.5f) / width * 2.0f - 1.0f, 1.0f - (y + 0.5f) / height * 2.0f,
+                                               -2.2f));
+    }
+  }
+
+  BVH triangles;
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  triangles.Build(positions, indices);
+  const double triangle_build = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  std::vector<Hit> triangle_hits(rays.size());
+  const double triangle_seconds = Measure([&]()
+  {
+    for (size_t i = 0; i < rays.size(); ++i)
+    {
+      triangle_hits[i] = Hit {};
+      triangles.Intersect(rays[i], triangle_hits[i]);
+    }
+  });
+  const size_t triangle_bytes = positions.size() * sizeof(glm::vec3) + indices.size() * sizeof(uint32_t) +
+                                triangles.getNodes().size() * sizeof(BVHNode) +
+                                triangles.getBlocks().size() * sizeof(TriangleBlock<triangle_block_width>);
+  printf("curves %zu segments, tubes %zu triangles: build %.1f ms  %.2f Mrays/s  %.2f MB\n",
+         curves.segments.size(), indices.size() / 3, triangle_build * 1e3, rays.size() / triangle_seconds * 1e-6,
+         triangle_bytes / 1048576.0);
+
+  for (CurveType type : { CurveType::Round, CurveType::Ribbon })
+  {
+    curves.type = type;
+    for (uint32_t splits : { 1u, 4u })
+    {
+      CurveBuildSettings settings;
+      settings.splits = splits;
+      CurveBVH bvh;
+      const double build = Measure([&]() { bvh.Build(curves, settings); });
+      std::vector<Hit> hits(rays.size());
+      TraversalStats stats;
+      const double seconds = Measure([&]()
+      {
+        stats = TraversalStats {};
+        for (size_t i = 0; i < rays.size(); ++i)
+        {
+          hits[i] = Hit {};
+          bvh.Intersect(rays[i], hits[i], &stats);
+        }
+      });
+
+      // coverage against the tubes, and depth where both hit the same strand
+      size_t covered = 0, agree = 0, same = 0;
+      double depth = 0.0;
+      for (size_t i = 0; i < rays.size(); ++i)
+      {
+        covered += hits[i].Valid() ? 1 : 0;
+        agree += hits[i].Valid() == triangle_hits[i].Valid() ? 1 : 0;
+        if (hits[i].Valid() && triangle_hits[i].Valid() &&
+            hits[i].primitive == triangle_hits[i].primitive / (steps * sides * 2))
+        {
+          same++;
+          depth += std::fabs(hits[i].t - triangle_hits[i].t);
+        }
+      }
+      const size_t curve_bytes = bvh.getMemoryBytes() + curves.points.size() * sizeof(glm::vec4) +
+                                 curves.segments.size() * sizeof(uint32_t);
+      printf("curves %-6s %u split%s: build %6.1f ms  %.2f Mrays/s  %5.1f KB/ray  %.2f MB (%.1fx less)  "
+             "hits %.1f%%  agree %.1f%%  depth error %.5f\n", type == CurveType::Round ? "round" : "ribbon", splits,
+             splits > 1 ? "s" : " ", build * 1e3, rays.size() / seconds * 1e-6,
+             (stats.node_bytes + stats.block_bytes) / 1024.0 / stats.rays, curve_bytes / 1048576.0,
+             static_cast<double>(triangle_bytes) / curve_bytes, 100.0 * covered / rays.size(),
+             100.0 * agree / rays.size(), same ? depth / same : 0.0);
+      // single pieces bound bent segments loosely enough to differ on a few percent
+      Check(agree >= (splits > 1 ? 0.99 : 0.95) * rays.size(), "curve coverage disagrees with the tubes");
+    }
+  }
+}
+
+// Displaced terrain: a coarse control grid of hills with a fine height map,
+// tessellated eagerly into one BVH, or lazily through caches of different
+// budgets while the camera flies across it.
+static void CompareDisplacement()
+{
+  const uint32_t grid = 65;
+  std::vector<glm::vec3> control(grid * grid);
+  for (uint32_t y = 0; y < grid; ++y)
+  {
+    for (uint32_t x = 0; x < grid; ++x)
+    {
+      const float px = (x / (grid - 1.0f) - 0.5f) * 64.0f, pz = (y / (grid - 1.0f) - 0.5f) * 64.0f;
+      control[y * grid + x] = glm::vec3(px, 1.5f * std::sin(0.4f * px) * std::cos(0.3f * pz), pz);
+    }
+  }
+
+  // octaves of hashed value noise, 16 texels per face
+  DisplacementMap map;
+  map.width = map.height = 1024;
+  map.heights.resize(static_cast<size_t>(map.width) * map.height);
+  for (uint32_t y = 0; y < map.height; ++y)
+  {
+    for (uint32_t x = 0; x < map.width; ++x)
+    {
+      float height = 0.0f, amplitude = 0.5f;
+      for (uint32_t octave = 0, size = 64; size >= 2; ++octave, size /= 2, amplitude *= 0.5f)
+      {
+        const uint32_t cx = x / size, cy = y / size;
+        const float tx = (x % size + 0.5f) / size, ty = (y % size + 0.5f) / size;
+        auto corner = [&](uint32_t i, uint32_t j)
+        { return UnitFloat(PcgHash(cx + i + PcgHash(cy + j + PcgHash(octave)))) - 0.5f; };
+        height += amplitude * ((corner(0, 0) * (1.0f - tx) + corner(1, 0) * tx) * (1.0f - ty) +
+                               (corner(0, 1) * (1.0f - tx) + corner(1, 1) * tx) * ty);
+      }
+      map.heights[static_cast<size_t>(y) * map.width + x] = height;
+    }
+  }
+
+  const std::vector<SubdivisionPatch> patches = GridPatches(control, grid, grid);
+  TessellationSettings settings;
+  settings.displacement_scale = 1.5f;
+
+  // every patch diced into one BVH up front
+  DisplacedSurface reference;
+  reference.Build(patches, map, settings);
+  std::vector<glm::vec3> positions;
+  std::vector<uint32_t> indices;
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  for (uint32_t patch = 0; patch < patches.size(); ++patch)
+  {
+    const uint32_t rate = reference.Rate(patch), first = static_cast<uint32_t>(positions.size());
+    for (uint32_t y = 0; y <= rate; ++y)
+    {
+      for (uint32_t x = 0; x <= rate; ++x)
+        positions.push_back(reference.Position(patch, glm::vec2(x, y) / static_cast<float>(rate)));
+    }
+    for (uint32_t y = 0; y < rate; ++y)
+    {
+      for (uint32_t x = 0; x < rate; ++x)
+      {
+        const uint32_t a = first + y * (rate + 1) + x, b = a + 1, c = a + rate + 1, d = c + 1;
+        indices.insert(indices.end(), { a, b, d, a, d, c });
+      }
+    }
+  }
+  BVH eager;
+  eager.Build(positions, indices);
+  const double eager_build = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  const size_t eager_bytes = eager.getNodes().size() * sizeof(BVHNode) +
+                             eager.getBlocks().size() * sizeof(TriangleBlock<triangle_block_width>);
+
+  // a camera flying low over the terrain and looking down ahead of it, so
+  // that each frame sees a stretch of it; frames render in 16x16 tiles
+  const uint32_t width = 256, height = 144, frames = 8, tile = 16;
+  const uint32_t tiles_x = width / tile, tiles = tiles_x * (height / tile);
+  auto camera_ray = [&](uint32_t frame, uint32_t x, uint32_t y)
+  {
+    Ray ray;
+    ray.origin = glm::vec3(-24.0f + 6.0f * frame, 6.0f, 20.0f - 2.0f * frame);
+    ray.direction = glm::normalize(glm::vec3(((x + 0.5f) / width * 2.0f - 1.0f) * 0.8f,
+                                             -0.8f - ((y + 0.5f) / height - 0.5f) * 0.45f, -1.0f));
+    return ray;
+  };
+  // end_frame runs between frames, when no ray is tracing
+  auto render = [&](Scheduler& scheduler, const std::function<void(const Ray&, Hit&)>& intersect,
+                    const std::function<void()>& end_frame, std::vector<Hit>& hits)
+  {
+    for (uint32_t frame = 0; frame < frames; ++frame)
+    {
+      scheduler.ParallelFor(tiles, [&](uint32_t task, uint32_t)
+      {
+        for (uint32_t y = task / tiles_x * tile; y < (task / tiles_x + 1) * tile; ++y)
+        {
+          for (uint32_t x = task % tiles_x * tile; x < (task % tiles_x + 1) * tile; ++x)
+            intersect(camera_ray(frame, x, y), hits[(static_cast<size_t>(frame) * height + y) * width + x]);
+        }
+      });
+      end_frame();
+    }
+  };
+
+  Scheduler scheduler;
+  std::vector<Hit> expected(static_cast<size_t>(width) * height * frames);
+  start = std::chrono::steady_clock::now();
+  render(scheduler, [&](const Ray& ray, Hit& hit) { eager.Intersect(ray, hit); }, [] {}, expected);
+  const double eager_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  printf("displacement %zu patches, eager %zu triangles: build %.0f ms  trace %.1f ms  %.1f MB\n", patches.size(),
+         indices.size() / 3, eager_build * 1e3, eager_seconds * 1e3, eager_bytes / 1048576.0);
+
+  // unbounded, then an eighth and a thirty-second of what the eager BVH takes
+  for (size_t budget : { eager_bytes * 4, eager_bytes / 8, eager_bytes / 32 })
+  {
+    settings.cache_bytes = budget;
+    DisplacedSurface surface;
+    surface.Build(patches, map, settings);
+    std::vector<Hit> hits(expected.size());
+    start = std::chrono::steady_clock::now();
+    render(scheduler, [&](const Ray& ray, Hit& hit) { surface.Intersect(ray, hit); }, [&] { surface.EndFrame(); },
+           hits);
+    const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    size_t mismatches = 0;
+    for (size_t i = 0; i < hits.size(); ++i)
+    {
+      if (hits[i].Valid() != expected[i].Valid() ||
+          (hits[i].Valid() && std::fabs(hits[i].t - expected[i].t) > 1e-4f * expected[i].t))
+        mismatches++;
+    }
+    const TessellationStats stats = surface.getStats();
+    printf("displacement cache %6.1f MB: trace %6.1f ms  diced %5llu  evicted %5llu  resident %4u  peak %5.1f MB  "
+           "%zu mismatches\n", budget / 1048576.0, seconds * 1e3, static_cast<unsigned long long>(stats.tessellations),
+           static_cast<unsigned long long>(stats.evictions), stats.resident, stats.peak_bytes / 1048576.0, mismatches);
+    Check(mismatches == 0, "lazy tessellation disagrees with the eager one");
+  }
+}
+
+static const char* const sections[] = { "modes", "shadow", "cache", "kernels", "quantization", "compressed",
+                                         "texture", "environment", "lights", "restir", "samplers", "denoiser",
+                                         "guiding", "radiance", "termination", "volume", "curves", "displacement" };
+
+// Sections named on the command line run, all of them without arguments.
+static bool Selected(int argc, char** argv, const char* section)
+{
+  if (argc < 2) return true;
+  for (int i = 1; i < argc; ++i)
+  {
+    if (std::strcmp(argv[i], section) == 0) return true;
+  }
+  return false;
+}
+
+int main(int argc, char** argv)
+{
+  for (int i = 1; i < argc; ++i)
+  {
+    if (std::find_if(std::begin(sections), std::end(sections),
+                     [&](const char* section) { return std::strcmp(argv[i], section) == 0; }) == std::end(sections))
+    {
+      printf("unknown section %s, usage: %s [section...] with sections", argv[i], argv[0]);
+      for (const char* section : sections) printf(" %s", section);
+      printf("\n");
+      return 2;
+    }
+  }
+
+  Debug::Configure("warning");
+
+  std::vector<glm::vec3> positions;
+  std::vector<uint32_t> indices;
+  MakeScene(positions, indices);
+
+  BVH bvh;
+  double build = Measure([&]() { bvh.Build(positions, indices); });
+  printf("%zu triangles, %zu nodes, build %.1f ms\n", indices.size() / 3, bvh.getNodes().size(), build * 1e3);
+
+  const uint32_t width = 640;
+  const uint32_t height = 360;
+  std::vector<Ray> primary = MakePrimaryRays(width, height);
+  std::vector<Hit> primary_hits(primary.size());
+  bvh.Trace(primary.data(), primary_hits.data(), primary.size(), TraceMode::Single);
+
+  // shadow rays toward a point light and cosine weighted bounces from every hit point
+  glm::vec3 light(10.0f, 20.0f, -5.0f);
+  std::mt19937 rng(7);
+  std::uniform_real_distribution<float> uniform(0.0f, 1.0f);
+  std::vector<Ray> shadow;
+  std::vector<Ray> bounce;
+  for (size_t i = 0; i < primary.size(); ++i)
+  {
+    if (!primary_hits[i].Valid()) continue;
+    glm::vec3 point = primary[i].origin + primary[i].direction * primary_hits[i].t;
+
+    Ray shadow_ray;
+    shadow_ray.origin = point;
+    shadow_ray.direction = glm::normalize(light - point);
+    shadow_ray.tmin = 1e-3f;
+    shadow_ray.tmax = glm::length(light - point);
+    shadow.push_back(shadow_ray);
+
+    float phi = 2.0f * 3.14159265f * uniform(rng);
+    float cos_theta = std::sqrt(uniform(rng));
+    float sin_theta = std::sqrt(1.0f - cos_theta * cos_theta);
+    glm::vec3 direction(sin_theta * std::cos(phi), cos_theta, sin_theta * std::sin(phi));
+    if (uniform(rng) < 0.5f) direction = -direction;
+
+    Ray bounce_ray;
+    bounce_ray.origin = point;
+    bounce_ray.direction = direction;
+    bounce_ray.tmin = 1e-3f;
+    bounce.push_back(bounce_ray);
+  }
+
+  if (Selected(argc, argv, "modes"))
+  {
+    CompareModes("primary", bvh, primary);
+    CompareModes("bounce", bvh, bounce);
+
+    // the same bounces in arbitrary order, as they come out of path compaction
+    std::vector<Ray> scattered = bounce;
+    std::shuffle(scattered.begin(), scattered.end(), rng);
+    CompareModes("scattered", bvh, scattered);
+  }
+
+  if (Selected(argc, argv, "shadow"))
+  {
+    CompareOcclusion("shadow", bvh, shadow);
+    std::vector<Ray> scattered = shadow;
+    std::shuffle(scattered.begin(), scattered.end(), rng);
+    CompareOcclusion("shadow-scattered", bvh, scattered);
+  }
+
+  if (Selected(argc, argv, "cache")) CompareCache(positions, indices, bvh, primary);
+
+  if (Selected(argc, argv, "kernels"))
+  {
+    std::vector<Ray> leak_rays = MakeLeakRays(positions, indices);
+    CompareKernel<MollerTrumboreKernel>(positions, indices, leak_rays, bounce);
+    CompareKernel<WatertightKernel>(positions, indices, leak_rays, bounce);
+  }
+
+  if (Selected(argc, argv, "quantization")) CompareQuantization(positions, indices, primary);
+
+  if (Selected(argc, argv, "compressed"))
+  {
+    CompareCompressed(bvh, primary, "primary");
+    CompareCompressed(bvh, bounce, "bounce");
+  }
+
+  if (Selected(argc, argv, "texture"))
+  {
+    CompareTextureLod(positions, indices, primary, bounce, height);
+    CompareTextureCompression();
+    CompareVirtualTexture(positions, indices, primary, height);
+  }
+  if (Selected(argc, argv, "environment")) CompareEnvironmentSampling();
+  if (Selected(argc, argv, "lights")) CompareLightSampling(positions, indices, primary);
+  if (Selected(argc, argv, "restir")) CompareReSTIR(positions, indices);
+  if (Selected(argc, argv, "samplers")) CompareSamplers(positions, indices);
+  if (Selected(argc, argv, "denoiser")) CompareDenoiser(positions, indices);
+
+  InteriorScene interior;
+  MakeInterior(interior);
+  SamplerTables interior_tables;
+  interior_tables.Build(16);
+  if (Selected(argc, argv, "guiding")) CompareGuiding(interior, interior_tables);
+  if (Selected(argc, argv, "radiance")) CompareRadianceCache(interior, interior_tables);
+  if (Selected(argc, argv, "termination")) CompareTermination(interior, interior_tables);
+  if (Selected(argc, argv, "volume")) CompareVolume(interior_tables);
+  if (Selected(argc, argv, "curves")) CompareCurves();
+  if (Selected(argc, argv, "displacement")) CompareDisplacement();
+
+  if (failures > 0) printf("%d correctness checks failed\n", failures);
+  return failures > 0 ? 1 : 0;
+}
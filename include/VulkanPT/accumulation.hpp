@@ -0,0 +1,121 @@
+
+#ifndef ACCUMULATION_HPP
+#define ACCUMULATION_HPP
+
+#include <glm/glm.hpp>
+#include <cstdint>
+#include <vector>
+
+namespace PathTracer
+{
+  // Per-pixel running mean with a Welford variance estimate on luminance.
+  // The layout is std430 compatible so the same buffer can back a storage buffer.
+  struct AccumulationPixel
+  {
+    glm::vec3 mean { 0.0f };
+    uint32_t count { 0 };
+    float luminance_mean { 0.0f };
+    float luminance_m2 { 0.0f };
+    uint32_t padding[2] { 0, 0 };
+  };
+  static_assert(sizeof(AccumulationPixel) == 32, "AccumulationPixel must match the std430 layout");
+
+  struct TileState
+  {
+    uint32_t x { 0 };
+    uint32_t y { 0 };
+    uint32_t width { 0 };
+    uint32_t height { 0 };
+    uint32_t min_count { 0 };
+    float error { 0.0f };
+    bool converged { false };
+  };
+
+  // One entry per tile that still needs samples in the next pass,
+  // samples are per pixel.
+  struct TileBudget
+  {
+    uint32_t tile { 0 };
+    uint32_t samples { 0 };
+  };
+
+  class Accumulator
+  {
+   public:
+    Accumulator(uint32_t in_width, uint32_t in_height, uint32_t in_tile_size = 16);
+
+    void Reset();
+
+    void AddSample(uint32_t x, uint32_t y, const glm::vec3& radiance)
+    {
+      AccumulationPixel& pixel = pixels[static_cast<size_t>(y) * width + x];
+      pixel.count++;
+      float inverse_count = 1.0f / static_cast<float>(pixel.count);
+      pixel.mean += (radiance - pixel.mean) * inverse_count;
+
+      float luminance = Luminance(radiance);
+      float delta = luminance - pixel.luminance_mean;
+      pixel.luminance_mean += delta * inverse_count;
+      pixel.luminance_m2 += delta * (luminance - pixel.luminance_mean);
+    }
+
+    const AccumulationPixel& Pixel(uint32_t x, uint32_t y) const
+    { return pixels[static_cast<size_t>(y) * width + x]; }
+
+    glm::vec3 Mean(uint32_t x, uint32_t y) const { return Pixel(x, y).mean; }
+    float Variance(uint32_t x, uint32_t y) const;
+
+    // Standard error of the mean relative to the pixel brightness.
+    float RelativeError(uint32_t x, uint32_t y) const;
+
+    // Recomputes the error of a single tile, returns the updated state.
+    const TileState& UpdateTile(uint32_t tile, uint32_t min_samples, float error_threshold);
+
+    uint64_t TotalSamples() const;
+
+    const std::vector<AccumulationPixel>& getPixels() const { return pixels; }
+    const std::vector<TileState>& getTiles() const { return tiles; }
+    uint32_t getWidth() const { return width; }
+    uint32_t getHeight() const { return height; }
+    uint32_t getTileSize() const { return tile_size; }
+
+    static float Luminance(const glm::vec3& color)
+    { return glm::dot(color, glm::vec3(0.2126f, 0.7152f, 0.0722f)); }
+
+   private:
+    uint32_t width;
+    uint32_t height;
+    uint32_t tile_size;
+
+    std::vector<AccumulationPixel> pixels;
+    std::vector<TileState> tiles;
+  };
+
+  struct AdaptiveSettings
+  {
+    uint32_t min_samples { 16 };
+    uint32_t max_samples { 4096 };
+    uint32_t samples_per_pass { 4 };
+    float error_threshold { 0.01f };
+  };
+
+  class AdaptiveSampler
+  {
+   public:
+    AdaptiveSampler(AdaptiveSettings in_settings = AdaptiveSettings()) : settings{ in_settings } {}
+
+    // Re-evaluates every tile and spreads the pass budget over the tiles that
+    // are not converged yet, proportionally to their remaining error. Tiles
+    // below min_samples always get the uniform share.
+    std::vector<TileBudget> PlanPass(Accumulator& accumulator) const;
+
+    bool Converged(const Accumulator& accumulator) const;
+
+    const AdaptiveSettings& getSettings() const { return settings; }
+
+   private:
+    AdaptiveSettings settings;
+  };
+
+} // namespace PathTracer
+#endif // ACCUMULATION_HPP
@@ -5,6 +5,9 @@
 #include <VulkanPT/config.hpp>
 #include <VulkanPT/window.hpp>
 #include <VulkanPT/frame.hpp>
+#include <memory>
+
+namespace VulkanInit { struct ValidationMessageLog; }
 
 class Application
 {
@@ -27,6 +30,7 @@ class Application
 
   vk::Instance instance { nullptr };
   vk::DebugUtilsMessengerEXT debug_messenger { nullptr };
+  std::unique_ptr<VulkanInit::ValidationMessageLog> validation_log;
   vk::DispatchLoaderDynamic dispatch_loader;
   vk::SurfaceKHR surface;
 
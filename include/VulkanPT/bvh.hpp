@@ -0,0 +1,184 @@
+
+#ifndef BVH_HPP
+#define BVH_HPP
+
+#include <VulkanPT/ray.hpp>
+#include <VulkanPT/triangle.hpp>
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+namespace PathTracer
+{
+  // Ize, "Robust BVH Ray Traversal": widening the far slab distance by 2 gamma(3)
+  // covers the rounding in the slab tests, otherwise rays through vertices
+  // that lie on a box face can miss the box the watertight test would hit.
+  constexpr float robust_far_scale = 1.0f + 2.0f * 3.0f * 0.5f * std::numeric_limits<float>::epsilon();
+
+  // keeps 0 * inf out of the slab tests
+  inline float SafeInverse(float value)
+  { return 1.0f / (std::fabs(value) > 1e-12f ? value : std::copysign(1e-12f, value)); }
+
+  inline glm::vec3 SafeInverse(const glm::vec3& value)
+  { return glm::vec3(SafeInverse(value.x), SafeInverse(value.y), SafeInverse(value.z)); }
+
+  // Bytes single ray traversal read, for comparing node layouts.
+  struct TraversalStats
+  {
+    uint64_t rays { 0 };
+    uint64_t node_bytes { 0 };
+    uint64_t block_bytes { 0 };
+  };
+
+  // 32 bytes, count > 0 marks a leaf whose count triangles are packed into the
+  // triangle blocks starting at left_first, inner nodes store their left child
+  // at left_first and the right one after it.
+  struct BVHNode
+  {
+    glm::vec3 bounds_min { 0.0f };
+    uint32_t left_first { 0 };
+    glm::vec3 bounds_max { 0.0f };
+    uint32_t count { 0 };
+
+    bool IsLeaf() const { return count > 0; }
+  };
+  static_assert(sizeof(BVHNode) == 32, "BVHNode must stay 32 bytes");
+
+  // Single rays, packets of packet_width consecutive rays, or a stream that
+  // is sorted into coherent packets first. All modes find the same closest
+  // hit, only exact ties between triangles may resolve differently. Auto
+  // picks one of the others per call from a sample of the rays.
+  enum class TraceMode { Auto, Single, Packet, Stream };
+
+  // Two native vectors of rays, 8 with SSE and 16 with AVX, which beat one
+  // on primary rays in the trace benchmark.
+  constexpr int packet_width = 2 * triangle_block_width;
+
+  template <int N>
+  struct RayPacket
+  {
+    alignas(32) float origin[3][N];
+    alignas(32) float direction[3][N];
+    alignas(32) float tmin[N];
+    alignas(32) float tmax[N];
+    uint32_t valid { 0 };
+
+    void Set(int lane, const Ray& ray)
+    {
+      for (int axis = 0; axis < 3; ++axis)
+      {
+        origin[axis][lane] = ray.origin[axis];
+        direction[axis][lane] = ray.direction[axis];
+      }
+      tmin[lane] = ray.tmin;
+      tmax[lane] = ray.tmax;
+      valid |= 1u << lane;
+    }
+  };
+
+  struct BVHBuildSettings
+  {
+    uint32_t max_leaf_size { triangle_block_width };
+    uint32_t bins { 16 };
+    float traversal_cost { 1.0f };
+    // Primitives a leaf tests at once. Leaf costs count blocks of this many,
+    // so that leaves fill their blocks rather than split down to single
+    // primitives in mostly empty ones.
+    uint32_t leaf_block_width { 1 };
+  };
+
+  // Slab test of one node, tnear is where the ray enters it.
+  inline bool IntersectNode(const BVHNode& node, const glm::vec3& origin, const glm::vec3& inverse_direction,
+                            float tmin, float tmax, float& tnear)
+  {
+    glm::vec3 t0 = (node.bounds_min - origin) * inverse_direction;
+    glm::vec3 t1 = (node.bounds_max - origin) * inverse_direction;
+    glm::vec3 tsmall = glm::min(t0, t1);
+    glm::vec3 tbig = glm::max(t0, t1);
+
+    tnear = std::max(tmin, std::max(tsmall.x, std::max(tsmall.y, tsmall.z)));
+    float tfar = std::min(tmax, std::min(tbig.x, std::min(tbig.y, tbig.z)) * robust_far_scale);
+    return tnear <= tfar;
+  }
+
+  // Nearest of the lanes in mask, the kernels only report hits inside (tmin, tmax).
+  template <int W>
+  inline int NearestLane(const SimdMask<W>& mask, const SimdFloat<W>& t)
+  {
+    SimdFloat<W> masked = Select(mask, t, SimdFloat<W>(infinity));
+    uint32_t nearest = (mask & (masked == SimdFloat<W>(ReduceMin(masked)))).Bits();
+    int lane = 0;
+    while (!((nearest >> lane) & 1u)) lane++;
+    return lane;
+  }
+
+  // Binned SAH build over the bounds of any kind of primitive, costs are
+  // relative to intersecting one of them. Leaves reference count entries of
+  // primitive_indices from left_first on, which the caller packs into its
+  // own leaf blocks.
+  void BuildNodes(std::vector<BVHNode>& nodes, std::vector<uint32_t>& primitive_indices,
+                  const std::vector<AABB>& primitive_bounds, const std::vector<glm::vec3>& centroids,
+                  const BVHBuildSettings& settings);
+
+  // Whether every lane of blocks is unused or one of primitive_count primitives.
+  bool ValidPrimitives(const std::vector<TriangleBlock<triangle_block_width>>& blocks, size_t primitive_count);
+
+  // The triangle kernel decides both the leaf data layout and the
+  // intersection test, so it is fixed per instantiation.
+  template <typename Kernel>
+  class BVHT
+  {
+   public:
+    void Build(const std::vector<glm::vec3>& positions, const std::vector<uint32_t>& indices,
+               BVHBuildSettings settings = BVHBuildSettings());
+
+    // Takes a tree built earlier with the same kernel, e.g. from a scene cache.
+    void Assign(const BVHNode* in_nodes, size_t node_count, const TriangleBlock<triangle_block_width>* in_blocks,
+                size_t block_count)
+    {
+      nodes.assign(in_nodes, in_nodes + node_count);
+      blocks.assign(in_blocks, in_blocks + block_count);
+    }
+
+    // Whether a tree that was assigned from a file references only its own
+    // nodes and blocks and primitive_count primitives, with children after
+    // their parents and no deeper than the traversal stack allows.
+    bool Validate(size_t primitive_count) const;
+
+    bool Intersect(const Ray& ray, Hit& hit, TraversalStats* stats = nullptr) const;
+    bool Occluded(const Ray& ray) const;
+
+    // Packet entry points, hits and the returned occlusion bits are per lane.
+    template <int N>
+    void IntersectPacket(const RayPacket<N>& packet, Hit* hits) const;
+    template <int N>
+    uint32_t OccludedPacket(const RayPacket<N>& packet) const;
+
+    void Trace(const Ray* rays, Hit* hits, size_t count, TraceMode mode = TraceMode::Auto) const;
+    void TraceOcclusion(const Ray* rays, bool* occluded, size_t count, TraceMode mode = TraceMode::Auto) const;
+
+    // Both take packets of N consecutive rays, exposed for benchmarking widths.
+    template <int N>
+    void TracePackets(const Ray* rays, Hit* hits, size_t count) const;
+    template <int N>
+    void TraceStream(const Ray* rays, Hit* hits, size_t count) const;
+
+    AABB Bounds() const;
+    const std::vector<BVHNode>& getNodes() const { return nodes; }
+    const std::vector<TriangleBlock<triangle_block_width>>& getBlocks() const { return blocks; }
+
+   private:
+    // Mode Auto stands for, from a sample of the packets Packet mode would
+    // form and of the distances between consecutive ray origins.
+    TraceMode ChooseMode(const Ray* rays, size_t count, bool any_hit) const;
+    // Ray indices ordered by origin cell, direction octant and direction.
+    std::vector<uint32_t> SortStream(const Ray* rays, size_t count) const;
+
+    std::vector<BVHNode> nodes;
+    std::vector<TriangleBlock<triangle_block_width>> blocks;
+  };
+
+  using BVH = BVHT<DefaultTriangleKernel>;
+
+} // namespace PathTracer
+#endif // BVH_HPP
@@ -0,0 +1,69 @@
+
+#ifndef COMPRESSED_BVH_HPP
+#define COMPRESSED_BVH_HPP
+
+#include <VulkanPT/bvh.hpp>
+
+namespace PathTracer
+{
+  constexpr uint32_t compressed_bvh_width = 8;
+
+  // 80 bytes for eight children, std430. Ylitie, Karras and Laine, "Efficient
+  // Incoherent Ray Traversal on GPUs Through Compressed Wide BVHs" (HPG 2017).
+  // Child boxes are 8-bit offsets on a grid of power of two cells starting at
+  // origin, so decoding origin + q * 2^exponent has an exact product and the
+  // boxes are always conservative.
+  //
+  // meta is 0 for empty slots, 0x80 | i for the inner child child_base + i,
+  // and for leaves (blocks << 5) | offset: the 1-3 triangle blocks starting
+  // at block_base + offset.
+  struct CompressedBVHNode
+  {
+    glm::vec3 origin { 0.0f };
+    int8_t exponent[3] { 0, 0, 0 };
+    uint8_t inner_mask { 0 };
+    uint32_t child_base { 0 };
+    uint32_t block_base { 0 };
+    uint8_t meta[compressed_bvh_width] {};
+    uint8_t bounds_min[3][compressed_bvh_width] {};
+    uint8_t bounds_max[3][compressed_bvh_width] {};
+  };
+  static_assert(sizeof(CompressedBVHNode) == 80, "CompressedBVHNode must stay 80 bytes");
+
+  // Eight-wide collapse of a binary BVH built with the same kernel. Leaves
+  // are copied so the blocks of every node are contiguous, the source tree
+  // isn't needed afterwards. The CPU traversal is the reference for the
+  // device kernel and checks the encoding against the binary tree.
+  template <typename Kernel>
+  class CompressedBVHT
+  {
+   public:
+    void Build(const BVHT<Kernel>& bvh);
+    void Assign(const CompressedBVHNode* in_nodes, size_t node_count,
+                const TriangleBlock<triangle_block_width>* in_blocks, size_t block_count)
+    {
+      nodes.assign(in_nodes, in_nodes + node_count);
+      blocks.assign(in_blocks, in_blocks + block_count);
+    }
+
+    // Same checks as BVHT::Validate for the wide nodes.
+    bool Validate(size_t primitive_count) const;
+
+    bool Intersect(const Ray& ray, Hit& hit, TraversalStats* stats = nullptr) const;
+    bool Occluded(const Ray& ray) const;
+    void Trace(const Ray* rays, Hit* hits, size_t count) const;
+    void TraceOcclusion(const Ray* rays, bool* occluded, size_t count) const;
+
+    bool Empty() const { return nodes.empty(); }
+    const std::vector<CompressedBVHNode>& getNodes() const { return nodes; }
+    const std::vector<TriangleBlock<triangle_block_width>>& getBlocks() const { return blocks; }
+
+   private:
+    std::vector<CompressedBVHNode> nodes;
+    std::vector<TriangleBlock<triangle_block_width>> blocks;
+  };
+
+  using CompressedBVH = CompressedBVHT<DefaultTriangleKernel>;
+
+} // namespace PathTracer
+#endif // COMPRESSED_BVH_HPP
@@ -0,0 +1,42 @@
+
+#ifndef CPU_RENDERER_HPP
+#define CPU_RENDERER_HPP
+
+#include <VulkanPT/accumulation.hpp>
+#include <VulkanPT/path_termination.hpp>
+#include <VulkanPT/scheduler.hpp>
+#include <functional>
+
+namespace PathTracer
+{
+  class CpuRenderer
+  {
+   public:
+    // Returns the radiance of one sample, sample is its index within the pixel.
+    using SampleFunction = std::function<glm::vec3(uint32_t x, uint32_t y, uint32_t sample,
+                                                   uint32_t thread)>;
+
+    CpuRenderer(uint32_t in_width, uint32_t in_height,
+                AdaptiveSettings settings = AdaptiveSettings(), uint32_t thread_count = 0);
+
+    // Traces one adaptive pass over the open tiles, returns false once the
+    // whole image converged and nothing was traced. The path statistics are
+    // logged when it converges, or on Reset if it never did.
+    bool RenderPass(const SampleFunction& sample);
+    void Reset();
+
+    Accumulator& getAccumulator() { return accumulator; }
+    Scheduler& getScheduler() { return scheduler; }
+    // Filled by the sample function through its thread index.
+    PathStatistics& getPathStatistics() { return path_statistics; }
+
+   private:
+    Scheduler scheduler;
+    Accumulator accumulator;
+    AdaptiveSampler sampler;
+    PathStatistics path_statistics;
+    bool statistics_reported { false };
+  };
+
+} // namespace PathTracer
+#endif // CPU_RENDERER_HPP
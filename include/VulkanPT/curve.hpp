@@ -0,0 +1,117 @@
+
+#ifndef CURVE_HPP
+#define CURVE_HPP
+
+#include <VulkanPT/bvh.hpp>
+#include <vector>
+
+namespace PathTracer
+{
+  // Linear steps every piece of a segment is tested as.
+  constexpr int curve_linear_steps = 4;
+
+  enum class CurveType : uint32_t
+  {
+    // Tube around the curve, normals point away from its axis.
+    Round,
+    // Flat strip of the same width that always faces the ray, cheaper and
+    // close enough for strands thinner than a pixel.
+    Ribbon
+  };
+
+  // Cubic Bezier segments of four consecutive points from each entry of
+  // segments on, xyz the position and w the radius. Segments of a strand
+  // share their end points.
+  struct CurveSet
+  {
+    CurveType type { CurveType::Round };
+    std::vector<glm::vec4> points;
+    std::vector<uint32_t> segments;
+  };
+
+  // N pieces of segments in SoA form as stored in curve BVH leaves. A piece
+  // is the range [u0, u0 + du] of its segment as a Bezier curve of its own,
+  // points are indexed by control point, xyzr and lane. Unused lanes are NaN
+  // like in triangle blocks.
+  template <int N>
+  struct CurveBlock
+  {
+    alignas(32) float points[4][4][N];
+    alignas(32) float u0[N];
+    alignas(32) float du[N];
+    uint32_t primitive[N];
+
+    void Clear()
+    {
+      const float nan = std::numeric_limits<float>::quiet_NaN();
+      for (int point = 0; point < 4; ++point)
+      {
+        for (int axis = 0; axis < 4; ++axis)
+        {
+          for (int lane = 0; lane < N; ++lane) points[point][axis][lane] = nan;
+        }
+      }
+      for (int lane = 0; lane < N; ++lane)
+      {
+        u0[lane] = du[lane] = 0.0f;
+        primitive[lane] = invalid_index;
+      }
+    }
+  };
+
+  // 80 bytes, std430. One piece as the compute shader reads it, a leaf holds
+  // its count pieces from left_first times the block width on.
+  struct GpuCurvePiece
+  {
+    glm::vec4 points[4];
+    uint32_t segment { invalid_index };
+    float u0 { 0.0f };
+    float du { 0.0f };
+    CurveType type { CurveType::Round };
+  };
+  static_assert(sizeof(GpuCurvePiece) == 80, "GpuCurvePiece must match the std430 layout");
+
+  struct CurveBuildSettings
+  {
+    // Pieces every segment is split into before the build, each with its own
+    // bounds, which hug bent strands far tighter than one box per segment.
+    uint32_t splits { 4 };
+    BVHBuildSettings bvh { triangle_block_width, 16, 1.0f, triangle_block_width };
+  };
+
+  // BVH over curve pieces with its own leaf blocks, traversed like the
+  // triangle one. Pieces are intersected a block at a time in a ray aligned
+  // frame: each lane evaluates its piece at the ends of curve_linear_steps
+  // steps and takes the closest point of every step to the ray against the
+  // radius there. Hits report the segment as primitive, u along it and v
+  // across the width from -1 to 1.
+  class CurveBVH
+  {
+   public:
+    void Build(const CurveSet& in_curves, CurveBuildSettings settings = CurveBuildSettings());
+
+    bool Intersect(const Ray& ray, Hit& hit, TraversalStats* stats = nullptr) const;
+    bool Occluded(const Ray& ray) const;
+
+    glm::vec3 Position(uint32_t segment, float u) const;
+    // Shading normal at a hit, facing against the ray for ribbons.
+    glm::vec3 Normal(const Ray& ray, const Hit& hit) const;
+
+    // Pieces in leaf order for the device.
+    std::vector<GpuCurvePiece> GpuPieces() const;
+
+    AABB Bounds() const;
+    const CurveSet& getCurves() const { return curves; }
+    const std::vector<BVHNode>& getNodes() const { return nodes; }
+    const std::vector<CurveBlock<triangle_block_width>>& getBlocks() const { return blocks; }
+    size_t getMemoryBytes() const
+    { return nodes.size() * sizeof(BVHNode) + blocks.size() * sizeof(CurveBlock<triangle_block_width>); }
+
+   private:
+    CurveSet curves;
+    std::vector<BVHNode> nodes;
+    std::vector<CurveBlock<triangle_block_width>> blocks;
+  };
+
+} // namespace PathTracer
+#endif // CURVE_HPP
@@ -2,14 +2,66 @@
 #ifndef DEBUG_HPP
 #define DEBUG_HPP
 
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+// Compile-time floor for log levels, anything below it is discarded together
+// with its arguments. Release builds keep warnings and errors.
+#ifndef VPT_LOG_LEVEL
+#ifdef DEBUG
+#define VPT_LOG_LEVEL 0
+#else
+#define VPT_LOG_LEVEL 1
+#endif // DEBUG
+#endif // VPT_LOG_LEVEL
+
+// Compile-time category mask, one bit per Debug::Category.
+#ifndef VPT_LOG_CATEGORIES
+#define VPT_LOG_CATEGORIES 0xFFFFFFFFu
+#endif // VPT_LOG_CATEGORIES
+
 class Debug
 {
  public:
-  static void Log(const char* message, ...);
-  static void Warning(const char* message, ...);
-  static void Error(const char* message, ...);
+  enum class Level : uint8_t { Log = 0, Warning = 1, Error = 2, None = 3 };
+
+  enum class Category : uint8_t
+  {
+    General = 0,
+    Vulkan,
+    BVH,
+    IO,
+    Scheduler,
+    Count
+  };
+
+  static constexpr bool Compiled(Level level, Category category)
+  {
+    return static_cast<int>(level) >= VPT_LOG_LEVEL &&
+           ((VPT_LOG_CATEGORIES >> static_cast<uint32_t>(category)) & 1u) != 0;
+  }
+
+  static bool Enabled(Level level, Category category)
+  {
+    return static_cast<uint8_t>(level) >=
+           levels[static_cast<size_t>(category)].load(std::memory_order_relaxed);
+  }
+
+  static void SetLevel(Category category, Level level);
+  static void SetLevel(Level level);
+  static Level GetLevel(Category category);
+  static const char* CategoryName(Category category);
+
+  // Parses "level" or "category=level" entries separated by commas,
+  // e.g. "warning,vulkan=log,bvh=none".
+  static void Configure(const char* spec);
+
+  static void Write(Level level, Category category, const char* message, ...);
 
  private:
+  static std::atomic<uint8_t> levels[static_cast<size_t>(Category::Count)];
+
   Debug() = delete;
   Debug(const Debug& other) = delete;
   Debug(Debug&& other) = delete;
@@ -18,4 +70,23 @@ class Debug
   ~Debug() = delete;
 };
 
+// The level check is constexpr, so disabled levels never evaluate their
+// arguments, and the runtime check happens before any formatting work.
+#define DEBUG_WRITE(level, category, ...)                                 \
+  do                                                                      \
+  {                                                                       \
+    if constexpr (Debug::Compiled(level, category))                       \
+    {                                                                     \
+      if (Debug::Enabled(level, category))                                \
+        Debug::Write(level, category, __VA_ARGS__);                       \
+    }                                                                     \
+  } while (0)
+
+#define DEBUG_LOG(category, ...) \
+  DEBUG_WRITE(Debug::Level::Log, Debug::Category::category, __VA_ARGS__)
+#define DEBUG_WARNING(category, ...) \
+  DEBUG_WRITE(Debug::Level::Warning, Debug::Category::category, __VA_ARGS__)
+#define DEBUG_ERROR(category, ...) \
+  DEBUG_WRITE(Debug::Level::Error, Debug::Category::category, __VA_ARGS__)
+
 #endif // DEBUG_HPP
@@ -0,0 +1,107 @@
+
+#ifndef DENOISER_HPP
+#define DENOISER_HPP
+
+#include <VulkanPT/scheduler.hpp>
+#include <glm/glm.hpp>
+#include <cstdint>
+#include <vector>
+
+namespace PathTracer
+{
+  // 48 bytes, std430. Guides of one pixel written with the primary hit:
+  // normal and linear depth, albedo for demodulation, how fast depth changes
+  // across the pixel (|dz/dx| + |dz/dy|) and the offset in pixels to where
+  // the surface was in the previous frame.
+  struct DenoiseGuide
+  {
+    glm::vec3 normal { 0.0f };
+    float depth { 0.0f };
+    glm::vec3 albedo { 1.0f };
+    float depth_gradient { 0.0f };
+    glm::vec2 motion { 0.0f };
+    uint32_t valid { 0 };
+    uint32_t padding { 0 };
+  };
+  static_assert(sizeof(DenoiseGuide) == 48, "DenoiseGuide must match the std430 layout");
+
+  struct DenoiserSettings
+  {
+    // Blend factors of new frames into the color and moment histories, the
+    // history length caps how far back the average reaches.
+    float color_alpha { 0.2f };
+    float moments_alpha { 0.2f };
+    uint32_t history_limit { 32 };
+    // Pixels with less history estimate their variance spatially.
+    uint32_t spatial_variance_history { 4 };
+    uint32_t atrous_iterations { 5 };
+    // Output of this iteration becomes the color history.
+    uint32_t feedback_iteration { 0 };
+    // Edge stopping: luminance difference in standard deviations, power of
+    // the normal cosine and depth difference in gradients.
+    float sigma_luminance { 4.0f };
+    uint32_t normal_power { 128 };
+    float sigma_depth { 1.0f };
+    // Filter illumination instead of color so texture detail survives.
+    bool demodulate_albedo { true };
+  };
+
+  // Spatiotemporal variance-guided filtering, after Schied et al.,
+  // "Spatiotemporal Variance-Guided Filtering: Real-Time Reconstruction for
+  // Path-Traced Global Illumination" (2017). Samples are accumulated over
+  // reprojected history together with the first two moments of luminance,
+  // and the variance from these steers an edge-avoiding a-trous wavelet
+  // filter of growing step.
+  //
+  // The CPU backend runs it directly. The filter passes work on padded
+  // planes so every tap is a plain SIMD load, rows run in parallel. The
+  // device version is the same passes as compute dispatches, see
+  // VulkanUtils::DenoiserBuffers for its storage.
+  class Denoiser
+  {
+   public:
+    Denoiser(uint32_t in_width, uint32_t in_height, DenoiserSettings in_settings = DenoiserSettings());
+
+    // color holds the noisy radiance of this frame row by row, output
+    // receives the filtered radiance. Pixels without a valid guide pass
+    // through unfiltered.
+    void Denoise(const std::vector<glm::vec3>& color, const std::vector<DenoiseGuide>& guides,
+                 Scheduler& scheduler, std::vector<glm::vec3>& output);
+    // Drops the history, e.g. after a camera cut.
+    void Reset();
+
+    const DenoiserSettings& getSettings() const { return settings; }
+    // accumulated frames per pixel after the last Denoise
+    const std::vector<float>& getHistoryLength() const { return history_length[current]; }
+
+   private:
+    void Accumulate(const std::vector<glm::vec3>& color, const std::vector<DenoiseGuide>& guides,
+                    Scheduler& scheduler);
+    void EstimateVariance(Scheduler& scheduler);
+    void FilterPass(uint32_t step, uint32_t source, Scheduler& scheduler);
+    size_t Index(uint32_t x, uint32_t y) const { return static_cast<size_t>(y) * stride + border + x; }
+
+    uint32_t width;
+    uint32_t height;
+    DenoiserSettings settings;
+    // padded planes, border columns stay invalid so taps need no bounds
+    uint32_t border;
+    uint32_t stride;
+    std::vector<float> normal[3];
+    std::vector<float> depth;
+    std::vector<float> depth_scale;
+    std::vector<float> valid;
+    std::vector<float> illumination[2][3];
+    std::vector<float> variance[2];
+    std::vector<float> luminance[2];
+    std::vector<float> luminance_scale;
+    // unpadded history of this and the previous frame
+    std::vector<glm::vec3> history_color[2];
+    std::vector<glm::vec2> history_moments[2];
+    std::vector<float> history_length[2];
+    std::vector<DenoiseGuide> previous_guides;
+    uint32_t current { 0 };
+  };
+
+} // namespace PathTracer
+#endif // DENOISER_HPP
@@ -11,11 +11,11 @@ namespace VulkanInit
                                    const std::vector<const char*>& requested_extensions)
   {
     std::set<std::string> required_extensions(requested_extensions.begin(), requested_extensions.end());
-    Debug::Log("Device can support extensions:");
+    DEBUG_LOG(Vulkan, "Device can support extensions:");
 
     for (vk::ExtensionProperties& extension : device.enumerateDeviceExtensionProperties())
     {
-      Debug::Log("%s", extension.extensionName);
+      DEBUG_LOG(Vulkan, "%s", extension.extensionName);
       required_extensions.erase(extension.extensionName);
     }
 
@@ -24,18 +24,18 @@ namespace VulkanInit
 
   bool IsSuitable(const vk::PhysicalDevice& device)
   {
-    Debug::Log("Checking if device is suitable!");
+    DEBUG_LOG(Vulkan, "Checking if device is suitable!");
 
     const std::vector<const char*> requested_extensions = { VK_KHR_SWAPCHAIN_EXTENSION_NAME };
-    Debug::Log("Requesting device extensions:");
+    DEBUG_LOG(Vulkan, "Requesting device extensions:");
     for (const char* extension : requested_extensions)
-      Debug::Log("%s", extension);
+      DEBUG_LOG(Vulkan, "%s", extension);
 
     if (bool extension_supported = CheckDeviceExtensionSupport(device, requested_extensions))
-      Debug::Log("Device can support the requested extension!");
+      DEBUG_LOG(Vulkan, "Device can support the requested extension!");
     else
     {
-      Debug::Log("Device can't support the requested extension!");
+      DEBUG_LOG(Vulkan, "Device can't support the requested extension!");
       return false;
     }
     
@@ -44,10 +44,10 @@ namespace VulkanInit
 
   vk::PhysicalDevice ChoosePhysicalDevice(vk::Instance& in_instance)
   {
-    Debug::Log("Choosing physical device...");
+    DEBUG_LOG(Vulkan, "Choosing physical device...");
 
     std::vector<vk::PhysicalDevice> available_devices = in_instance.enumeratePhysicalDevices();
-    Debug::Log("There are %i physical devices available on this system!", available_devices.size());
+    DEBUG_LOG(Vulkan, "There are %zu physical devices available on this system!", available_devices.size());
 
     for (vk::PhysicalDevice device : available_devices)
     {
@@ -95,12 +95,12 @@ namespace VulkanInit
     try
     {
       vk::Device device = physical_device.createDevice(device_info);
-      Debug::Log("GPU has been successfully abstracted!");
+      DEBUG_LOG(Vulkan, "GPU has been successfully abstracted!");
       return device;
     }
     catch (vk::SystemError err)
     {
-      Debug::Error("Device creation failed!");
+      DEBUG_ERROR(Vulkan, "Device creation failed!");
       return nullptr;
     }
 
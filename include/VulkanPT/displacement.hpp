@@ -0,0 +1,139 @@
+
+#ifndef DISPLACEMENT_HPP
+#define DISPLACEMENT_HPP
+
+#include <VulkanPT/bvh.hpp>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace PathTracer
+{
+  // Regular Catmull-Clark face as the 4x4 control points around it, rows
+  // along v, whose limit surface is the uniform bicubic B-spline patch.
+  // uv_min and uv_size place the patch in the displacement map.
+  struct SubdivisionPatch
+  {
+    glm::vec3 points[16];
+    glm::vec2 uv_min { 0.0f };
+    glm::vec2 uv_size { 1.0f };
+  };
+
+  // Patches of the faces of a width by height grid of control points, x
+  // fastest. Points beyond the boundary are extrapolated so that the limit
+  // surface ends on the boundary points, and the faces share the unit
+  // square of the displacement map.
+  std::vector<SubdivisionPatch> GridPatches(const std::vector<glm::vec3>& points, uint32_t width, uint32_t height);
+
+  // Heights along the surface normal, rows along v, bilinear with clamping.
+  struct DisplacementMap
+  {
+    uint32_t width { 0 };
+    uint32_t height { 0 };
+    std::vector<float> heights;
+
+    float Sample(const glm::vec2& uv) const;
+  };
+
+  struct TessellationSettings
+  {
+    // Triangles and BVHs resident at once. Beyond it the least recently
+    // used tessellations are dropped down to 7/8 of the budget.
+    size_t cache_bytes { static_cast<size_t>(256) << 20 };
+    // Quads along each side of a patch, one per map texel it spans up to
+    // this many. Patches of different rates can crack along shared edges.
+    uint32_t max_rate { 64 };
+    float displacement_scale { 1.0f };
+  };
+
+  struct TessellationStats
+  {
+    uint64_t tessellations { 0 };
+    uint64_t evictions { 0 };
+    uint32_t resident { 0 };
+    size_t resident_bytes { 0 };
+    // evicted and waiting for EndFrame, counted in the peak
+    size_t retired_bytes { 0 };
+    size_t peak_bytes { 0 };
+  };
+
+  // Displaced subdivision surface tessellated on demand. The BVH over the
+  // patches is built up front from bounds that hold any displacement of
+  // each patch. When a ray first reaches a patch it is diced into a grid,
+  // displaced and given a BVH of its own, which goes into a cache of fixed
+  // size shared by the threads. Each patch publishes its tessellation
+  // through an atomic pointer, so a hit in the cache takes no lock and
+  // touches no reference count. Evicted tessellations are only freed by
+  // EndFrame, so eviction never pulls one from under a ray still tracing
+  // it. Two threads missing on the same patch at once both dice it and
+  // keep the first. Hits report the patch as primitive and u, v on the patch.
+  class DisplacedSurface
+  {
+   public:
+    ~DisplacedSurface();
+
+    void Build(std::vector<SubdivisionPatch> in_patches, DisplacementMap in_map,
+               TessellationSettings in_settings = TessellationSettings());
+
+    // Any thread, not concurrent with Build or ClearCache.
+    bool Intersect(const Ray& ray, Hit& hit);
+    bool Occluded(const Ray& ray);
+
+    // Displaced surface at uv on a patch, the tessellation samples it.
+    glm::vec3 Position(uint32_t patch, const glm::vec2& uv) const;
+    // Normal of the displaced surface by central differences.
+    glm::vec3 Normal(const Hit& hit) const;
+    // Quads along each side of a patch.
+    uint32_t Rate(uint32_t patch) const;
+
+    // Frees the tessellations evicted since the last call. Between frames,
+    // not concurrent with any tracing.
+    void EndFrame();
+    void ClearCache();
+
+    TessellationStats getStats() const;
+    size_t getPatchCount() const { return patches.size(); }
+    const std::vector<BVHNode>& getNodes() const { return nodes; }
+    const TessellationSettings& getSettings() const { return settings; }
+
+   private:
+    struct Tessellation
+    {
+      BVH bvh;
+      uint32_t rate { 0 };
+      size_t bytes { 0 };
+    };
+
+    struct Slot
+    {
+      std::atomic<const Tessellation*> tessellation { nullptr };
+      std::atomic<uint64_t> last_use { 0 };
+    };
+
+    // Tessellation of a patch, diced on a miss, valid until EndFrame.
+    const Tessellation& Acquire(uint32_t patch);
+    std::unique_ptr<const Tessellation> Tessellate(uint32_t patch) const;
+    // Limit surface without displacement and its normal.
+    void Evaluate(uint32_t patch, const glm::vec2& uv, glm::vec3& position, glm::vec3& normal) const;
+    // Ray against one patch, updates hit and returns true when closer.
+    bool IntersectPatch(uint32_t patch, const Ray& ray, Hit& hit);
+
+    TessellationSettings settings;
+    std::vector<SubdivisionPatch> patches;
+    DisplacementMap map;
+    std::vector<BVHNode> nodes;
+    std::vector<uint32_t> patch_order;
+
+    std::unique_ptr<Slot[]> slots;
+    // bumped per tessellation, the stamp of the last use of a slot
+    std::atomic<uint64_t> clock { 1 };
+    // guards resident, retired and the counters, and the stores to the slots
+    mutable std::mutex mutex;
+    std::vector<uint32_t> resident;
+    std::vector<std::unique_ptr<const Tessellation>> retired;
+    TessellationStats stats;
+  };
+
+} // namespace PathTracer
+#endif // DISPLACEMENT_HPP
@@ -0,0 +1,125 @@
+
+#ifndef ENVIRONMENT_HPP
+#define ENVIRONMENT_HPP
+
+#include <VulkanPT/scheduler.hpp>
+#include <glm/glm.hpp>
+#include <algorithm>
+#include <cmath>
+#include <string>
+#include <vector>
+
+namespace PathTracer
+{
+  constexpr float environment_pi = 3.14159265358979f;
+
+  // One bucket of Walker's alias method, 16 bytes for std430. A uniform
+  // index keeps itself below threshold and takes alias above it. pdf is the
+  // probability of the bucket relative to the uniform 1 / n.
+  struct AliasEntry
+  {
+    float threshold { 1.0f };
+    uint32_t alias { 0 };
+    float pdf { 1.0f };
+    uint32_t padding { 0 };
+  };
+  static_assert(sizeof(AliasEntry) == 16, "AliasEntry must match the std430 layout");
+
+  // Vose's construction, O(n). Zero or non-finite totals give a uniform table.
+  void BuildAliasTable(const float* weights, uint32_t count, AliasEntry* table);
+
+  // Picks a bucket with one uniform number and returns the leftover of it,
+  // rescaled to [0, 1), to place the sample inside the bucket.
+  inline uint32_t SampleAliasTable(const AliasEntry* table, uint32_t count, float u, float& remainder)
+  {
+    float scaled = u * static_cast<float>(count);
+    uint32_t index = std::min(static_cast<uint32_t>(scaled), count - 1);
+    float fraction = std::min(scaled - static_cast<float>(index), 0.99999994f);
+    const AliasEntry& entry = table[index];
+    if (fraction < entry.threshold)
+    {
+      remainder = fraction / entry.threshold;
+      return index;
+    }
+    remainder = std::min((fraction - entry.threshold) / (1.0f - entry.threshold), 0.99999994f);
+    return entry.alias;
+  }
+
+  // Equirectangular HDR radiance, linear RGB, rows from +y (up) to -y. u
+  // turns around y starting at -z.
+  struct EnvironmentMap
+  {
+    uint32_t width { 0 };
+    uint32_t height { 0 };
+    std::vector<glm::vec3> texels;
+
+    bool Valid() const { return width > 0 && height > 0; }
+  };
+
+  // Radiance .hdr (RGBE), flat or run length encoded scanlines, -Y H +X W.
+  bool DecodeRadianceHDR(const uint8_t* data, size_t size, EnvironmentMap& map);
+  bool LoadEnvironmentMap(const std::string& path, EnvironmentMap& map);
+
+  inline glm::vec2 EnvironmentUV(const glm::vec3& direction)
+  {
+    float u = 0.5f + std::atan2(direction.x, -direction.z) * (0.5f / environment_pi);
+    float v = std::acos(std::min(std::max(direction.y, -1.0f), 1.0f)) / environment_pi;
+    return { u - std::floor(u), v };
+  }
+
+  inline glm::vec3 EnvironmentDirection(const glm::vec2& uv)
+  {
+    float phi = (uv.x - 0.5f) * 2.0f * environment_pi;
+    float theta = uv.y * environment_pi;
+    float sin_theta = std::sin(theta);
+    return { sin_theta * std::sin(phi), std::cos(theta), -sin_theta * std::cos(phi) };
+  }
+
+  struct EnvironmentSample
+  {
+    glm::vec3 direction;
+    glm::vec3 radiance;
+    // solid angle density
+    float pdf;
+  };
+
+  // Importance sampling of an environment map in proportion to luminance
+  // times the solid angle of each texel: a marginal table over rows and one
+  // conditional table per row, so a sample costs two lookups regardless of
+  // the resolution. Radiance is piecewise constant over texels, which makes
+  // Pdf exact for MIS. The GPU backend reads the same tables from storage
+  // buffers and has to mirror Sample and Pdf.
+  class EnvironmentLight
+  {
+   public:
+    // Rows are built in parallel, the marginal table after them.
+    void Build(EnvironmentMap&& in_map, Scheduler& scheduler, float in_intensity = 1.0f);
+
+    bool Valid() const { return map.Valid(); }
+
+    EnvironmentSample Sample(const glm::vec2& u) const;
+    float Pdf(const glm::vec3& direction) const;
+    glm::vec3 Radiance(const glm::vec3& direction) const;
+
+    const EnvironmentMap& getMap() const { return map; }
+    const std::vector<AliasEntry>& getMarginal() const { return marginal; }
+    // width entries per row, row after row
+    const std::vector<AliasEntry>& getConditional() const { return conditional; }
+    float getIntensity() const { return intensity; }
+    // Luminance integrated over the sphere, sum of texel luminance times solid angle.
+    float getPower() const { return power; }
+
+   private:
+    uint32_t Texel(const glm::vec2& uv) const;
+    // Solid angle density of a texel at latitude v, shared by Sample and Pdf.
+    float TexelPdf(uint32_t texel, float v) const;
+
+    EnvironmentMap map;
+    std::vector<AliasEntry> marginal;
+    std::vector<AliasEntry> conditional;
+    float intensity { 1.0f };
+    float power { 0.0f };
+  };
+
+} // namespace PathTracer
+#endif // ENVIRONMENT_HPP
@@ -0,0 +1,42 @@
+
+#ifndef GLTF_LOADER_HPP
+#define GLTF_LOADER_HPP
+
+#include <VulkanPT/scene.hpp>
+#include <VulkanPT/scheduler.hpp>
+#include <string>
+
+namespace PathTracer
+{
+  struct GltfLoadSettings
+  {
+    // glTF scene to instantiate, invalid_index picks the file's default scene.
+    uint32_t scene { invalid_index };
+    bool build_bvh { true };
+    // Also builds the compressed eight-wide BVH the device traversal uses.
+    bool compress_bvh { false };
+    // Reads and refreshes the scene cache next to the file.
+    bool use_cache { true };
+    bool decode_images { true };
+    // Moves the decoded images into mip chains, see Scene::GenerateMipmaps.
+    bool mipmaps { true };
+    // Encodes the mip chains to BC1/BC5/BC7, see CompressTextures.
+    bool compress_textures { false };
+    // Defaults to TextureCacheDirectoryFor the scene, only used with use_cache.
+    std::string texture_cache_directory;
+    // Stores 16-bit positions and uvs and octahedral normals, see QuantizeScene.
+    bool quantize { false };
+    // Optional, receives every section as soon as it is final.
+    SceneStreamFunction stream;
+  };
+
+  // glTF 2.0, both .gltf with external or data URI buffers and binary .glb.
+  // Buffers are mapped and accessors are read in place, tightly packed float
+  // and uint32 data is copied straight out of the mapping. Every mesh node
+  // becomes an instance whose triangles are flattened into world space, with
+  // metallic-roughness materials, emissive strength, ior and transmission.
+  bool LoadGltf(const std::string& path, Scene& scene, Scheduler& scheduler,
+                const GltfLoadSettings& settings = GltfLoadSettings());
+
+} // namespace PathTracer
+#endif // GLTF_LOADER_HPP
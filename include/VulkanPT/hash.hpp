@@ -0,0 +1,52 @@
+
+#ifndef HASH_HPP
+#define HASH_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+namespace PathTracer
+{
+  // 64-bit content hash for cache keys, not cryptographic. Mixes 8 bytes per
+  // step so hashing a large mapped scene stays well below the parse cost.
+  inline uint64_t HashBytes(const void* data, size_t size, uint64_t seed = 0)
+  {
+    const uint64_t multiplier = 0x9E3779B97F4A7C15ull;
+    const unsigned char* bytes = static_cast<const unsigned char*>(data);
+    uint64_t hash = seed ^ (size * multiplier);
+
+    auto mix = [&](uint64_t word)
+    {
+      word *= 0xBF58476D1CE4E5B9ull;
+      word ^= word >> 31;
+      hash = (hash ^ word) * multiplier;
+      hash ^= hash >> 29;
+    };
+
+    size_t offset = 0;
+    for (; offset + 8 <= size; offset += 8)
+    {
+      uint64_t word;
+      std::memcpy(&word, bytes + offset, 8);
+      mix(word);
+    }
+
+    if (offset < size)
+    {
+      uint64_t word = 0;
+      std::memcpy(&word, bytes + offset, size - offset);
+      mix(word);
+    }
+
+    hash ^= hash >> 32;
+    hash *= 0xD6E8FEB86659FD93ull;
+    hash ^= hash >> 32;
+    return hash;
+  }
+
+  inline uint64_t HashCombine(uint64_t hash, uint64_t value)
+  { return HashBytes(&value, sizeof(value), hash); }
+
+} // namespace PathTracer
+#endif // HASH_HPP
@@ -0,0 +1,40 @@
+
+#ifndef IMAGE_HPP
+#define IMAGE_HPP
+
+#include <VulkanPT/scheduler.hpp>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+namespace PathTracer
+{
+  // 8-bit RGBA texels, rows top to bottom.
+  struct Image
+  {
+    uint32_t width { 0 };
+    uint32_t height { 0 };
+    std::vector<uint8_t> texels;
+
+    bool Valid() const { return width > 0 && height > 0; }
+  };
+
+  // PNG is decoded natively, everything else (JPEG, ...) goes to the decoder
+  // installed here, e.g. a wrapper around a platform or third party codec.
+  using ImageDecoder = std::function<bool(const uint8_t* data, size_t size, Image& image)>;
+  void SetImageDecoder(ImageDecoder decoder);
+
+  bool DecodeImage(const uint8_t* data, size_t size, Image& image);
+  bool LoadImageFile(const std::string& path, Image& image);
+  // One task per image, failed images stay empty.
+  void LoadImageFiles(const std::vector<std::string>& paths, std::vector<Image>& images, Scheduler& scheduler);
+
+  // zlib stream to raw bytes, used by PNG and anything else storing deflate data.
+  // Fails rather than let output grow past max_size bytes.
+  bool Inflate(const uint8_t* data, size_t size, std::vector<uint8_t>& output, size_t max_size = SIZE_MAX,
+               bool zlib_header = true);
+
+} // namespace PathTracer
+#endif // IMAGE_HPP
@@ -12,9 +12,9 @@ namespace VulkanInit
   {
     // check extensions support
     std::vector<vk::ExtensionProperties> supported_extensions = vk::enumerateInstanceExtensionProperties();
-    Debug::Log("This device can support the following extensions:");
+    DEBUG_LOG(Vulkan, "This device can support the following extensions:");
     for (vk::ExtensionProperties supported_extension : supported_extensions)
-      Debug::Log("%s", supported_extension.extensionName);
+      DEBUG_LOG(Vulkan, "%s", supported_extension.extensionName);
 
     bool found;
     for (const char* extension : in_extensions)
@@ -25,21 +25,21 @@ namespace VulkanInit
         if (strcmp(extension, supported_extension.extensionName) == 0)
         {
           found = true;
-          Debug::Log("Extension %s is supported!", extension);
+          DEBUG_LOG(Vulkan, "Extension %s is supported!", extension);
         }
       }
       if (!found)
       {
-        Debug::Log("Extension %s is not supported!", extension);
+        DEBUG_LOG(Vulkan, "Extension %s is not supported!", extension);
         return false;
       }
     }
 
     // check layers support
     std::vector<vk::LayerProperties> supported_layers = vk::enumerateInstanceLayerProperties();
-    Debug::Log("This device can support the following layers:");
+    DEBUG_LOG(Vulkan, "This device can support the following layers:");
     for (vk::LayerProperties supported_layer : supported_layers)
-      Debug::Log("%s", supported_layer.layerName);
+      DEBUG_LOG(Vulkan, "%s", supported_layer.layerName);
 
     for (const char* layer : in_layers)
     {
@@ -49,12 +49,12 @@ namespace VulkanInit
         if (strcmp(layer, supported_layer.layerName) == 0)
         {
           found = true;
-          Debug::Log("Layer %s is supported!", layer);
+          DEBUG_LOG(Vulkan, "Layer %s is supported!", layer);
         }
       }
       if (!found)
       {
-        Debug::Log("Layer %s is not supported!", layer);
+        DEBUG_LOG(Vulkan, "Layer %s is not supported!", layer);
         return false;
       }
     }
@@ -64,15 +64,15 @@ namespace VulkanInit
 
   vk::Instance MakeInstance(const char* application_name)
   {
-    Debug::Log("Creating and instance\n");
+    DEBUG_LOG(Vulkan, "Creating and instance\n");
 
     uint32_t version { 0 };
     vkEnumerateInstanceVersion(&version);
  
-    Debug::Log("System can support vulkan Variant: %i\n", VK_API_VERSION_VARIANT(version));
-    Debug::Log("Major: %i\n", VK_API_VERSION_MAJOR(version));
-    Debug::Log("Minor: %i\n", VK_API_VERSION_MINOR(version));
-    Debug::Log("Patch: %i\n", VK_API_VERSION_PATCH(version));
+    DEBUG_LOG(Vulkan, "System can support vulkan Variant: %i\n", VK_API_VERSION_VARIANT(version));
+    DEBUG_LOG(Vulkan, "Major: %i\n", VK_API_VERSION_MAJOR(version));
+    DEBUG_LOG(Vulkan, "Minor: %i\n", VK_API_VERSION_MINOR(version));
+    DEBUG_LOG(Vulkan, "Patch: %i\n", VK_API_VERSION_PATCH(version));
 
     version &= ~(0xFFFU);
     version = VK_MAKE_API_VERSION(0, 1, 0, 0);
@@ -89,9 +89,9 @@ namespace VulkanInit
     extensions.push_back("VK_EXT_debug_utils");
 #endif // DEBUG
 
-    Debug::Log("extensions to be requested:\n");
+    DEBUG_LOG(Vulkan, "extensions to be requested:\n");
     for (const char* extension_name : extensions)
-      Debug::Log(" %s \n", extension_name);
+      DEBUG_LOG(Vulkan, " %s \n", extension_name);
 
     std::vector<const char*> layers;
 
@@ -110,7 +110,7 @@ namespace VulkanInit
     try { return vk::createInstance(create_info, nullptr); }
     catch (vk::SystemError err)
     {
-      Debug::Error("Failed to create Instance!");
+      DEBUG_ERROR(Vulkan, "Failed to create Instance!");
       return nullptr;
     }
   }
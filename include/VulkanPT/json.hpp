@@ -0,0 +1,61 @@
+
+#ifndef JSON_HPP
+#define JSON_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace PathTracer
+{
+  // Small DOM for scene description files. Lookups of missing keys or
+  // indices return a shared null value, so chains like
+  // json["materials"][0]["name"] never need intermediate checks.
+  class JsonValue
+  {
+   public:
+    enum class Type : uint8_t { Null, Bool, Number, String, Array, Object };
+
+    static bool Parse(const char* text, size_t size, JsonValue& value, std::string* error = nullptr);
+
+    Type getType() const { return type; }
+    bool IsNull() const { return type == Type::Null; }
+    bool IsNumber() const { return type == Type::Number; }
+    bool IsString() const { return type == Type::String; }
+    bool IsArray() const { return type == Type::Array; }
+    bool IsObject() const { return type == Type::Object; }
+
+    const JsonValue& operator[](const char* key) const;
+    const JsonValue& operator[](size_t index) const;
+    bool Has(const char* key) const { return !(*this)[key].IsNull(); }
+    // elements of an array or members of an object
+    size_t Size() const { return type == Type::Array ? array.size() : (type == Type::Object ? object.size() : 0); }
+
+    double Number(double fallback = 0.0) const { return type == Type::Number ? number : fallback; }
+    // fallback as well for NaN, infinities and numbers outside the int64_t range
+    int64_t Int(int64_t fallback = 0) const
+    {
+      const double limit = 9223372036854775808.0;
+      return type == Type::Number && number >= -limit && number < limit ? static_cast<int64_t>(number) : fallback;
+    }
+    bool Bool(bool fallback = false) const { return type == Type::Bool ? boolean : fallback; }
+    const std::string& String() const { return string; }
+
+    const std::vector<JsonValue>& getArray() const { return array; }
+    const std::vector<std::pair<std::string, JsonValue>>& getObject() const { return object; }
+
+   private:
+    friend class JsonParser;
+
+    Type type { Type::Null };
+    bool boolean { false };
+    double number { 0.0 };
+    std::string string;
+    std::vector<JsonValue> array;
+    std::vector<std::pair<std::string, JsonValue>> object;
+  };
+
+} // namespace PathTracer
+#endif // JSON_HPP
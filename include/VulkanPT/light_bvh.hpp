@@ -0,0 +1,115 @@
+
+#ifndef LIGHT_BVH_HPP
+#define LIGHT_BVH_HPP
+
+#include <VulkanPT/ray.hpp>
+#include <VulkanPT/scheduler.hpp>
+#include <vector>
+
+namespace PathTracer
+{
+  struct Scene;
+
+  enum class LightType : uint32_t
+  {
+    Triangle = 0,
+    Point
+  };
+
+  // 64 bytes, std430. Triangles store a vertex and two edges and emit
+  // radiance from their front side, point lights store their position and
+  // intensity.
+  struct Light
+  {
+    glm::vec3 position { 0.0f };
+    LightType type { LightType::Point };
+    glm::vec3 edge1 { 0.0f };
+    // scene triangle of triangle lights
+    uint32_t primitive { invalid_index };
+    glm::vec3 edge2 { 0.0f };
+    // bit 0 for triangles emitting from both sides
+    uint32_t flags { 0 };
+    glm::vec3 emission { 0.0f };
+    uint32_t padding { 0 };
+  };
+  static_assert(sizeof(Light) == 64, "Light must match the std430 layout");
+
+  inline Light MakePointLight(const glm::vec3& position, const glm::vec3& intensity)
+  {
+    Light light;
+    light.position = position;
+    light.type = LightType::Point;
+    light.emission = intensity;
+    return light;
+  }
+
+  // One light per triangle with a non-zero emission factor. triangle_lights
+  // maps every scene triangle to its light or invalid_index, which MIS needs
+  // when a path hits an emitter.
+  void CollectEmissiveTriangles(const Scene& scene, std::vector<Light>& lights,
+                                std::vector<uint32_t>& triangle_lights);
+
+  // 64 bytes, std430. Besides the box a node bounds the emitted directions by
+  // a cone around axis: normals lie within theta_o of it and emit up to
+  // theta_e beyond. Leaves hold one light at left_first, inner nodes their
+  // children at left_first and left_first + 1.
+  struct LightBVHNode
+  {
+    glm::vec3 bounds_min { 0.0f };
+    uint32_t left_first { 0 };
+    glm::vec3 bounds_max { 0.0f };
+    uint32_t count { 0 };
+    glm::vec3 axis { 0.0f, 0.0f, 1.0f };
+    float cos_theta_o { 1.0f };
+    float cos_theta_e { 1.0f };
+    float power { 0.0f };
+    uint32_t parent { invalid_index };
+    // bit 0 when a light below emits from both sides
+    uint32_t flags { 0 };
+
+    bool IsLeaf() const { return count > 0; }
+  };
+  static_assert(sizeof(LightBVHNode) == 64, "LightBVHNode must match the std430 layout");
+
+  // Conservative estimate of what a node contributes at p, after Conty
+  // Estevez and Kulla, "Importance Sampling of Many Lights with Adaptive Tree
+  // Splitting" (2018). n is the shading normal, zero inside media. The GPU
+  // kernel has to mirror it for the pmfs to match.
+  float LightImportance(const LightBVHNode& node, const glm::vec3& p, const glm::vec3& n);
+
+  struct LightBVHSettings
+  {
+    uint32_t bins { 12 };
+    // Subtrees of at most this many lights are built as parallel tasks,
+    // 0 picks a size that gives every thread a few of them.
+    uint32_t task_size { 0 };
+  };
+
+  // Stochastic traversal picks one child per level in proportion to the
+  // importance of both, so the pmf of a light is the product of the choices
+  // on its way down and Pmf recomputes it from the parent links.
+  class LightBVH
+  {
+   public:
+    // Lights without power are left out and never sampled.
+    void Build(const std::vector<Light>& lights, Scheduler& scheduler,
+               LightBVHSettings settings = LightBVHSettings());
+    // Recomputes bounds and cones bottom-up after lights moved or changed
+    // their emission, keeping the topology. Lights that had no power at
+    // Build time need a rebuild to be sampled.
+    void Refit(const std::vector<Light>& lights, Scheduler& scheduler);
+
+    bool Sample(const glm::vec3& p, const glm::vec3& n, float u, uint32_t& light, float& pmf) const;
+    float Pmf(const glm::vec3& p, const glm::vec3& n, uint32_t light) const;
+
+    const std::vector<LightBVHNode>& getNodes() const { return nodes; }
+    // leaf node of every light, invalid_index for lights left out
+    const std::vector<uint32_t>& getLightLeaves() const { return light_leaves; }
+
+   private:
+    std::vector<LightBVHNode> nodes;
+    std::vector<uint32_t> light_leaves;
+  };
+
+} // namespace PathTracer
+#endif // LIGHT_BVH_HPP
@@ -3,30 +3,166 @@
 #define LOGGING_HPP
 
 #include <VulkanPT/config.hpp>
+#include <VulkanPT/profiler.hpp>
+#include <algorithm>
+#include <chrono>
+#include <mutex>
+#include <unordered_map>
 
 namespace VulkanInit
 {
+  // Deduplicates validation messages by id, so a message repeated every frame
+  // is printed a few times and then only counted for the shutdown summary.
+  // The first occurrence of every message is printed even when the per second
+  // cap is saturated, so that no distinct message only shows up in Summary.
+  struct ValidationMessageLog
+  {
+    struct Entry
+    {
+      std::string name;
+      int32_t id { 0 };
+      VkDebugUtilsMessageSeverityFlagBitsEXT severity { VK_DEBUG_UTILS_MESSAGE_SEVERITY_VERBOSE_BIT_EXT };
+      VkDebugUtilsMessageTypeFlagsEXT type { 0 };
+      uint64_t count { 0 };
+      uint64_t suppressed { 0 };
+    };
+
+    uint32_t repeat_limit { 3 };
+    uint32_t messages_per_second { 20 };
+
+    std::mutex mutex;
+    std::unordered_map<uint64_t, Entry> entries;
+    std::chrono::steady_clock::time_point window_start { std::chrono::steady_clock::now() };
+    uint32_t window_messages { 0 };
+
+    static uint64_t Key(const VkDebugUtilsMessengerCallbackDataEXT* data)
+    {
+      // FNV-1a over the id name, messages without any id fall back to their text
+      const char* text = data->pMessageIdName;
+      if (!text && data->messageIdNumber == 0) text = data->pMessage;
+
+      uint64_t hash = 14695981039346656037ull;
+      if (text)
+      {
+        for (const char* c = text; *c; ++c)
+          hash = (hash ^ static_cast<uint8_t>(*c)) * 1099511628211ull;
+      }
+      return hash ^ (static_cast<uint64_t>(static_cast<uint32_t>(data->messageIdNumber)) << 1);
+    }
+
+    // Returns true when the message should be printed.
+    bool Record(VkDebugUtilsMessageSeverityFlagBitsEXT severity,
+                VkDebugUtilsMessageTypeFlagsEXT type,
+                const VkDebugUtilsMessengerCallbackDataEXT* data)
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+
+      Entry& entry = entries[Key(data)];
+      if (entry.count == 0)
+      {
+        entry.name = data->pMessageIdName ? data->pMessageIdName : "unnamed";
+        entry.id = data->messageIdNumber;
+        entry.severity = severity;
+        entry.type = type;
+      }
+      entry.count++;
+
+      std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+      if (now - window_start >= std::chrono::seconds(1))
+      {
+        window_start = now;
+        window_messages = 0;
+      }
+
+      const bool first = entry.count == 1;
+      if (!first && (entry.count > repeat_limit || window_messages >= messages_per_second))
+      {
+        entry.suppressed++;
+        return false;
+      }
+
+      window_messages++;
+      return true;
+    }
+
+    void Summary()
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      if (entries.empty()) return;
+
+      std::vector<const Entry*> sorted;
+      for (const auto& [key, entry] : entries) sorted.push_back(&entry);
+      std::sort(sorted.begin(), sorted.end(),
+                [](const Entry* a, const Entry* b) { return a->count > b->count; });
+
+      DEBUG_WARNING(Vulkan, "Validation summary: %zu distinct messages", sorted.size());
+      for (const Entry* entry : sorted)
+      {
+        const unsigned long long count = entry->count, suppressed = entry->suppressed;
+        const uint32_t id = static_cast<uint32_t>(entry->id);
+        switch (entry->severity)
+        {
+        case VK_DEBUG_UTILS_MESSAGE_SEVERITY_ERROR_BIT_EXT:
+          DEBUG_ERROR(Vulkan, "%s (0x%08x): %llu times, %llu suppressed", entry->name.c_str(), id, count, suppressed);
+          break;
+        case VK_DEBUG_UTILS_MESSAGE_SEVERITY_WARNING_BIT_EXT:
+          DEBUG_WARNING(Vulkan, "%s (0x%08x): %llu times, %llu suppressed", entry->name.c_str(), id, count, suppressed);
+          break;
+        default:
+          DEBUG_LOG(Vulkan, "%s (0x%08x): %llu times, %llu suppressed", entry->name.c_str(), id, count, suppressed);
+          break;
+        }
+      }
+    }
+  };
+
   VKAPI_ATTR VkBool32 VKAPI_CALL debugCallback(VkDebugUtilsMessageSeverityFlagBitsEXT message_severity,
                                                VkDebugUtilsMessageTypeFlagsEXT message_type,
                                                const VkDebugUtilsMessengerCallbackDataEXT* pCallbackData,
                                                void* pUserData)
   {
-    Debug::Error("Validation layer: %s", pCallbackData->pMessage);
+    if (message_type & VK_DEBUG_UTILS_MESSAGE_TYPE_PERFORMANCE_BIT_EXT)
+    {
+      Profiler::Count("vulkan.performance_warnings");
+      if (pCallbackData->pMessageIdName)
+        Profiler::Count(std::string("vulkan.performance.") + pCallbackData->pMessageIdName);
+    }
+
+    ValidationMessageLog* message_log = static_cast<ValidationMessageLog*>(pUserData);
+    if (message_log && !message_log->Record(message_severity, message_type, pCallbackData))
+      return VK_FALSE;
+
+    switch (message_severity)
+    {
+    case VK_DEBUG_UTILS_MESSAGE_SEVERITY_ERROR_BIT_EXT:
+      DEBUG_ERROR(Vulkan, "Validation layer: %s", pCallbackData->pMessage); break;
+    case VK_DEBUG_UTILS_MESSAGE_SEVERITY_WARNING_BIT_EXT:
+      DEBUG_WARNING(Vulkan, "Validation layer: %s", pCallbackData->pMessage); break;
+    default:
+      DEBUG_LOG(Vulkan, "Validation layer: %s", pCallbackData->pMessage); break;
+    }
+
     return VK_FALSE;
   }
 
   vk::DebugUtilsMessengerEXT MakeDebugMessenger(vk::Instance& in_instance,
-                                                vk::DispatchLoaderDynamic& in_distach_loader)
+                                                vk::DispatchLoaderDynamic& in_distach_loader,
+                                                ValidationMessageLog* message_log)
   {
+    // verbose loader chatter would only go through the deduplication and eat
+    // into the rate limit, so it is subscribed to only when it gets printed
+    vk::DebugUtilsMessageSeverityFlagsEXT severities = vk::DebugUtilsMessageSeverityFlagBitsEXT::eWarning |
+                                                       vk::DebugUtilsMessageSeverityFlagBitsEXT::eError;
+    if (Debug::Compiled(Debug::Level::Log, Debug::Category::Vulkan) &&
+        Debug::Enabled(Debug::Level::Log, Debug::Category::Vulkan))
+      severities |= vk::DebugUtilsMessageSeverityFlagBitsEXT::eVerbose;
+
     vk::DebugUtilsMessengerCreateInfoEXT create_info = vk::DebugUtilsMessengerCreateInfoEXT(
-                                                vk::DebugUtilsMessengerCreateFlagsEXT(),
-                                                vk::DebugUtilsMessageSeverityFlagBitsEXT::eVerbose |
-                                                vk::DebugUtilsMessageSeverityFlagBitsEXT::eWarning |
-                                                vk::DebugUtilsMessageSeverityFlagBitsEXT::eError,
+                                                vk::DebugUtilsMessengerCreateFlagsEXT(), severities,
                                                 vk::DebugUtilsMessageTypeFlagBitsEXT::eGeneral |
                                                 vk::DebugUtilsMessageTypeFlagBitsEXT::eValidation |
                                                 vk::DebugUtilsMessageTypeFlagBitsEXT::ePerformance,
-                                                debugCallback, nullptr);
+                                                debugCallback, message_log);
 
     return in_instance.createDebugUtilsMessengerEXT(create_info, nullptr, in_distach_loader);
   }
@@ -35,15 +171,15 @@ namespace VulkanInit
   {
     vk::PhysicalDeviceProperties properties = device.getProperties();
 
-    Debug::Log("Device name: %s", properties.deviceName);
-    Debug::Log("Device type:");
+    DEBUG_LOG(Vulkan, "Device name: %s", properties.deviceName);
+    DEBUG_LOG(Vulkan, "Device type:");
     switch (properties.deviceType)
     {
-    case vk::PhysicalDeviceType::eCpu: Debug::Log("CPU"); break;
-    case vk::PhysicalDeviceType::eDiscreteGpu: Debug::Log("Discrete GPU"); break;
-    case vk::PhysicalDeviceType::eIntegratedGpu: Debug::Log("Integrated GPU"); break;
-    case vk::PhysicalDeviceType::eVirtualGpu: Debug::Log("Virtual GPU"); break;
-    default: Debug::Log("Other"); break;
+    case vk::PhysicalDeviceType::eCpu: DEBUG_LOG(Vulkan, "CPU"); break;
+    case vk::PhysicalDeviceType::eDiscreteGpu: DEBUG_LOG(Vulkan, "Discrete GPU"); break;
+    case vk::PhysicalDeviceType::eIntegratedGpu: DEBUG_LOG(Vulkan, "Integrated GPU"); break;
+    case vk::PhysicalDeviceType::eVirtualGpu: DEBUG_LOG(Vulkan, "Virtual GPU"); break;
+    default: DEBUG_LOG(Vulkan, "Other"); break;
     }
   }
 
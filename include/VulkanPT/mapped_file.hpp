@@ -0,0 +1,59 @@
+
+#ifndef MAPPED_FILE_HPP
+#define MAPPED_FILE_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace PathTracer
+{
+  // Non-owning typed view into mapped or otherwise borrowed memory.
+  template <typename T>
+  struct ArrayView
+  {
+    const T* data { nullptr };
+    size_t count { 0 };
+
+    const T* begin() const { return data; }
+    const T* end() const { return data + count; }
+    const T& operator[](size_t index) const { return data[index]; }
+    size_t SizeBytes() const { return count * sizeof(T); }
+    bool Empty() const { return count == 0; }
+  };
+
+  // Read-only memory mapping of a whole file, pages are loaded on first touch.
+  class MappedFile
+  {
+   public:
+    MappedFile() = default;
+    ~MappedFile();
+
+    MappedFile(const MappedFile& other) = delete;
+    MappedFile& operator=(const MappedFile& other) = delete;
+    MappedFile(MappedFile&& other) noexcept;
+    MappedFile& operator=(MappedFile&& other) noexcept;
+
+    bool Open(const std::string& path);
+    void Close();
+
+    bool IsOpen() const { return data != nullptr; }
+    const uint8_t* getData() const { return data; }
+    size_t getSize() const { return size; }
+
+   private:
+    const uint8_t* data { nullptr };
+    size_t size { 0 };
+#if defined(_WIN32)
+    void* file { nullptr };
+    void* mapping { nullptr };
+#else
+    int file { -1 };
+#endif
+  };
+
+  // Hash of a file's content, 0 if it can't be read.
+  uint64_t HashFile(const std::string& path, uint64_t seed = 0);
+
+} // namespace PathTracer
+#endif // MAPPED_FILE_HPP
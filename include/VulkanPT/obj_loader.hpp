@@ -0,0 +1,40 @@
+
+#ifndef OBJ_LOADER_HPP
+#define OBJ_LOADER_HPP
+
+#include <VulkanPT/scene.hpp>
+#include <VulkanPT/scheduler.hpp>
+#include <string>
+
+namespace PathTracer
+{
+  struct ObjLoadSettings
+  {
+    // Files are split at line boundaries into chunks of roughly this size.
+    size_t chunk_size { 4u << 20 };
+    bool build_bvh { true };
+    // Also builds the compressed eight-wide BVH the device traversal uses.
+    bool compress_bvh { false };
+    // Reads and refreshes the scene cache next to the OBJ.
+    bool use_cache { true };
+    bool decode_images { true };
+    // Moves the decoded images into mip chains, see Scene::GenerateMipmaps.
+    bool mipmaps { true };
+    // Encodes the mip chains to BC1/BC5/BC7, see CompressTextures.
+    bool compress_textures { false };
+    // Defaults to TextureCacheDirectoryFor the scene, only used with use_cache.
+    std::string texture_cache_directory;
+    // Stores 16-bit positions and uvs and octahedral normals, see QuantizeScene.
+    bool quantize { false };
+    // Optional, receives every section as soon as it is final.
+    SceneStreamFunction stream;
+  };
+
+  // Wavefront OBJ with MTL materials. Polygons are triangulated as fans and
+  // every distinct position/uv/normal triple becomes one vertex, numbered in
+  // order of first use so the result doesn't depend on the thread count.
+  bool LoadObj(const std::string& path, Scene& scene, Scheduler& scheduler,
+               const ObjLoadSettings& settings = ObjLoadSettings());
+
+} // namespace PathTracer
+#endif // OBJ_LOADER_HPP
@@ -0,0 +1,167 @@
+
+#ifndef PATH_GUIDING_HPP
+#define PATH_GUIDING_HPP
+
+#include <VulkanPT/ray.hpp>
+#include <VulkanPT/scheduler.hpp>
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <vector>
+
+namespace PathTracer
+{
+  // Float that threads add to without locks. Copies are plain loads, so
+  // trees holding them can live in vectors while nobody records.
+  struct AtomicFloat
+  {
+    std::atomic<float> value { 0.0f };
+
+    AtomicFloat() = default;
+    AtomicFloat(const AtomicFloat& other) : value{ other.Load() } {}
+    AtomicFloat& operator=(const AtomicFloat& other)
+    {
+      value.store(other.Load(), std::memory_order_relaxed);
+      return *this;
+    }
+
+    float Load() const { return value.load(std::memory_order_relaxed); }
+    void Store(float amount) { value.store(amount, std::memory_order_relaxed); }
+    void Add(float amount)
+    {
+      float current = Load();
+      while (!value.compare_exchange_weak(current, current + amount, std::memory_order_relaxed)) {}
+    }
+  };
+
+  // Equal-area cylindrical mapping between directions and the unit square,
+  // cos(theta) along x and phi along y. Densities differ by 4 pi.
+  inline glm::vec2 DirectionToSquare(const glm::vec3& direction)
+  {
+    float phi = std::atan2(direction.y, direction.x) * (0.5f / 3.14159265f);
+    return glm::vec2(std::min(std::max((direction.z + 1.0f) * 0.5f, 0.0f), 1.0f), phi < 0.0f ? phi + 1.0f : phi);
+  }
+
+  inline glm::vec3 SquareToDirection(const glm::vec2& point)
+  {
+    float cos_theta = 2.0f * point.x - 1.0f;
+    float sin_theta = std::sqrt(std::max(1.0f - cos_theta * cos_theta, 0.0f));
+    float phi = 2.0f * 3.14159265f * point.y;
+    return glm::vec3(sin_theta * std::cos(phi), sin_theta * std::sin(phi), cos_theta);
+  }
+
+  // One level of a directional quadtree. Quadrant q covers the half of x
+  // given by bit 0 and the half of y given by bit 1, children index the
+  // node refining it or are 0 for leaf quadrants.
+  struct DirectionalNode
+  {
+    AtomicFloat sums[4];
+    uint32_t children[4] { 0, 0, 0, 0 };
+  };
+
+  // Piecewise constant distribution over the square, refined where energy
+  // concentrates.
+  class DirectionalTree
+  {
+   public:
+    DirectionalTree() : nodes(1) {}
+
+    // Splats a sample into the leaf quadrant containing point, from any
+    // thread.
+    void Record(glm::vec2 point, float value);
+    // Sums children into the quadrants above them once recording ended.
+    void Build();
+    // Tree for the next iteration with zero sums: quadrants holding more
+    // than threshold of the total split, ones below it merge.
+    DirectionalTree Refine(float threshold, uint32_t max_depth) const;
+
+    // Point on the square and its density there, uniform while empty.
+    glm::vec2 Sample(glm::vec2 u, float& pdf) const;
+    float Pdf(glm::vec2 point) const;
+
+    float getTotal() const;
+    uint32_t getNodeCount() const { return static_cast<uint32_t>(nodes.size()); }
+
+   private:
+    float Build(uint32_t node);
+    void Refine(uint32_t source, float energy, float total, uint32_t depth, float threshold, uint32_t max_depth,
+                uint32_t target, std::vector<DirectionalNode>& refined) const;
+
+    std::vector<DirectionalNode> nodes;
+  };
+
+  struct GuidingSettings
+  {
+    // Spatial leaves split once an iteration recorded more than this times
+    // sqrt(2^iteration) samples in them, c of the paper.
+    float spatial_threshold { 12000.0f };
+    // Directional quadrants with more than this share of the energy split,
+    // rho of the paper.
+    float directional_threshold { 0.01f };
+    uint32_t max_directional_depth { 20 };
+    // Chance of sampling the BSDF instead of the guide, which keeps
+    // directions the guide missed reachable.
+    float bsdf_fraction { 0.5f };
+  };
+
+  // Online learned incident radiance for guiding, after Mueller et al.,
+  // "Practical Path Guiding for Efficient Light-Transport Simulation"
+  // (2017). A binary tree over space halves the scene box along alternating
+  // axes, every leaf holds a directional quadtree. Training runs in
+  // iterations of doubling sample counts: paths guided by the trees of the
+  // last iteration record radiance into new ones, and EndIteration refines
+  // both trees from what was recorded.
+  class PathGuiding
+  {
+   public:
+    PathGuiding(const AABB& in_bounds, GuidingSettings in_settings = GuidingSettings());
+
+    // Direction towards incident radiance at position and its solid angle
+    // density.
+    glm::vec3 Sample(const glm::vec3& position, const glm::vec2& u, float& pdf) const;
+    float Pdf(const glm::vec3& position, const glm::vec3& direction) const;
+    // False where nothing was learned yet, the BSDF alone samples better
+    // than a uniform guide there.
+    bool Trained(const glm::vec3& position) const { return leaves[FindLeaf(position)].sampling.getTotal() > 0.0f; }
+    // Radiance arriving at position from direction, divided by the density
+    // the direction was sampled with. Lock-free, from any thread.
+    void Record(const glm::vec3& position, const glm::vec3& direction, float radiance_over_pdf);
+    // Between iterations, with nothing recording.
+    void EndIteration(Scheduler& scheduler);
+
+    const GuidingSettings& getSettings() const { return settings; }
+    uint32_t getIteration() const { return iteration; }
+    uint32_t getLeafCount() const { return static_cast<uint32_t>(leaves.size()); }
+    uint32_t getDirectionalNodeCount() const;
+
+   private:
+    struct SpatialNode
+    {
+      // first of two children, 0 for leaves
+      uint32_t children { 0 };
+      uint32_t axis { 0 };
+      uint32_t leaf { 0 };
+    };
+
+    struct Leaf
+    {
+      DirectionalTree sampling;
+      DirectionalTree building;
+      std::atomic<uint32_t> samples { 0 };
+
+      Leaf() = default;
+      Leaf(const Leaf& other)
+        : sampling{ other.sampling }, building{ other.building }, samples{ other.samples.load() } {}
+    };
+
+    uint32_t FindLeaf(const glm::vec3& position) const;
+
+    AABB bounds;
+    GuidingSettings settings;
+    std::vector<SpatialNode> nodes;
+    std::vector<Leaf> leaves;
+    uint32_t iteration { 0 };
+  };
+
+} // namespace PathTracer
+#endif // PATH_GUIDING_HPP
@@ -0,0 +1,144 @@
+
+#ifndef PATH_TERMINATION_HPP
+#define PATH_TERMINATION_HPP
+
+#include <cstdint>
+#include <vector>
+
+namespace PathTracer
+{
+  // Bounces no policy traces past, and the bins of the path length
+  // histograms, the last one holding every longer path.
+  constexpr uint32_t path_depth_limit = 64;
+  constexpr uint32_t path_length_bins = 32;
+
+  enum class RouletteMode : uint32_t
+  {
+    Off,
+    // Survival follows the throughput of the path.
+    Throughput,
+    // Keeps the expected contribution of every path close to the pixel
+    // value: weak paths play roulette and strong ones split.
+    Efficiency
+  };
+
+  enum class DepthPolicy : uint32_t
+  {
+    // Paths end at max_depth and lose what lies beyond, which darkens.
+    Truncate,
+    // Past max_depth paths survive with tail_survival per bounce, unbiased
+    // up to path_depth_limit.
+    Roulette
+  };
+
+  // 32 bytes, std430, the device reads the same struct.
+  struct TerminationSettings
+  {
+    RouletteMode roulette { RouletteMode::Throughput };
+    DepthPolicy depth_policy { DepthPolicy::Truncate };
+    // Vertices scattering without roulette, and the bounces the depth
+    // policy starts at.
+    uint32_t min_depth { 3 };
+    uint32_t max_depth { 16 };
+    float min_survival { 0.05f };
+    float tail_survival { 0.5f };
+    // Efficiency mode: ratio between the bounds of the weight window, s of
+    // Vorba and Krivanek, and the most paths one vertex splits into.
+    float window { 5.0f };
+    uint32_t max_split { 4 };
+  };
+  static_assert(sizeof(TerminationSettings) == 32, "TerminationSettings must match the std430 layout");
+
+  enum class PathEnd : uint32_t
+  {
+    // Left the scene or hit a light without scattering on.
+    Escaped,
+    // Zero throughput or a direction below the surface.
+    Absorbed,
+    Roulette,
+    Depth,
+    Count
+  };
+
+  // Paths continuing from a vertex, 0 when it ends there for the reason in
+  // end, and the factor on the throughput of each of them.
+  struct TerminationDecision
+  {
+    uint32_t paths { 1 };
+    float weight { 1.0f };
+    PathEnd end { PathEnd::Count };
+  };
+
+  // Russian roulette and splitting before scattering at vertex depth, 0 for
+  // the first hit. throughput is the luminance of the path up to the vertex.
+  // The efficiency mode weighs it by expected, an estimate of the radiance
+  // leaving the vertex along the path, against pixel, an estimate of the
+  // pixel value, after Vorba and Krivanek, "Adjoint-Driven Russian Roulette
+  // and Splitting in Light Transport Simulation" (2016). Without either
+  // estimate it falls back to the throughput. u is uniform in [0, 1).
+  TerminationDecision DecideTermination(const TerminationSettings& settings, uint32_t depth, float throughput,
+                                        float expected, float pixel, float u);
+
+  // 160 bytes, std430. What the device adds up with atomics over a frame,
+  // read back into PathStatistics.
+  struct PathCounters
+  {
+    uint32_t samples { 0 };
+    uint32_t rays { 0 };
+    uint32_t splits { 0 };
+    uint32_t segments { 0 };
+    uint32_t ends[static_cast<uint32_t>(PathEnd::Count)] { 0, 0, 0, 0 };
+    uint32_t lengths[path_length_bins] {};
+  };
+  static_assert(sizeof(PathCounters) == 160, "PathCounters must match the std430 layout");
+
+  struct PathTotals
+  {
+    uint64_t samples { 0 };
+    uint64_t rays { 0 };
+    uint64_t splits { 0 };
+    uint64_t segments { 0 };
+    uint64_t ends[static_cast<uint32_t>(PathEnd::Count)] { 0, 0, 0, 0 };
+    uint64_t lengths[path_length_bins] {};
+
+    uint64_t Paths() const;
+    double RaysPerSample() const { return samples ? static_cast<double>(rays) / samples : 0.0; }
+    double MeanLength() const { return Paths() ? static_cast<double>(segments) / Paths() : 0.0; }
+  };
+
+  // Per-thread path counters of a render, so that the sample function of a
+  // tile adds to them without synchronization.
+  class PathStatistics
+  {
+   public:
+    explicit PathStatistics(uint32_t thread_count = 1) : threads(thread_count) {}
+
+    // One camera sample, every ray it traced and the paths splitting added
+    // to it.
+    void AddSample(uint32_t thread, uint32_t rays, uint32_t splits = 0)
+    {
+      threads[thread].totals.samples++;
+      threads[thread].totals.rays += rays;
+      threads[thread].totals.splits += splits;
+    }
+    // One path or branch of a split one, length in segments from the camera.
+    void AddPath(uint32_t thread, uint32_t length, PathEnd end);
+    // Device counters of a frame.
+    void Add(const PathCounters& counters);
+
+    PathTotals Total() const;
+    void Reset();
+    // Logs rays per sample, how paths ended and the length histogram.
+    void Report() const;
+
+   private:
+    struct alignas(64) Thread
+    {
+      PathTotals totals;
+    };
+
+    std::vector<Thread> threads;
+  };
+
+} // namespace PathTracer
+#endif // PATH_TERMINATION_HPP
@@ -0,0 +1,46 @@
+
+#ifndef PROFILER_HPP
+#define PROFILER_HPP
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+class Profiler
+{
+ public:
+  // Named event counters and accumulated timings, safe to call from any thread.
+  static void Count(const std::string& name, uint64_t amount = 1);
+  static void AddTime(const std::string& name, double milliseconds);
+
+  static uint64_t GetCount(const std::string& name);
+  static double GetTime(const std::string& name);
+
+  static void Report();
+  static void Reset();
+
+  class Scope
+  {
+   public:
+    Scope(const char* in_name) : name{ in_name }, start{ std::chrono::steady_clock::now() } {}
+    ~Scope()
+    {
+      std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+      Profiler::AddTime(name, elapsed.count());
+    }
+
+   private:
+    const char* name;
+    std::chrono::steady_clock::time_point start;
+  };
+
+ private:
+  Profiler() = delete;
+  Profiler(const Profiler& other) = delete;
+  Profiler(Profiler&& other) = delete;
+  Profiler& operator=(const Profiler& other) = delete;
+  Profiler& operator=(Profiler&& other) = delete;
+  ~Profiler() = delete;
+};
+
+#endif // PROFILER_HPP
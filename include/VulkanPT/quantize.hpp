@@ -0,0 +1,90 @@
+
+#ifndef QUANTIZE_HPP
+#define QUANTIZE_HPP
+
+#include <VulkanPT/ray.hpp>
+#include <algorithm>
+#include <cmath>
+
+namespace PathTracer
+{
+  // Vertices sharing one QuantizationInfo. Loaders append meshes whole, so a
+  // block covers a mesh or a piece of one and its bounds are far tighter
+  // than the scene's, a shader reads the info of vertex i at i >> 16.
+  constexpr uint32_t quantization_block_vertices = 1u << 16;
+
+  // 48 bytes, std430, one per block of vertices. Decoding is a multiply
+  // followed by an add, shaders must keep them separate (precise) to
+  // reproduce the CPU values bit for bit.
+  struct QuantizationInfo
+  {
+    glm::vec3 position_offset { 0.0f };
+    uint32_t vertex_count { 0 };
+    glm::vec3 position_scale { 0.0f };
+    uint32_t first_vertex { 0 };
+    glm::vec2 uv_offset { 0.0f };
+    glm::vec2 uv_scale { 0.0f };
+  };
+  static_assert(sizeof(QuantizationInfo) == 48, "QuantizationInfo must stay 48 bytes");
+
+  // Three 16-bit unorm coordinates relative to the bounds of the vertex
+  // block, padded to 8 bytes so it binds as R16G16B16A16_UNORM.
+  struct QuantizedPosition
+  {
+    uint16_t x, y, z, w;
+  };
+
+  struct QuantizationStats
+  {
+    uint64_t float_bytes { 0 };
+    uint64_t quantized_bytes { 0 };
+    float max_position_error { 0.0f };
+    // radians
+    float max_normal_error { 0.0f };
+    float max_uv_error { 0.0f };
+  };
+
+  inline glm::vec3 DecodePosition(const QuantizationInfo& info, const QuantizedPosition& position)
+  {
+    return info.position_offset + glm::vec3(position.x, position.y, position.z) * info.position_scale;
+  }
+
+  // Two 16-bit unorm coordinates relative to the uv bounds of the block.
+  inline glm::vec2 DecodeUV(const QuantizationInfo& info, uint32_t uv)
+  {
+    return info.uv_offset + glm::vec2(static_cast<float>(uv & 0xFFFF), static_cast<float>(uv >> 16)) * info.uv_scale;
+  }
+
+  // Encodes a zero vector, used for vertices without a normal. The encoder
+  // clamps to +-32767, so -32768 never shows up otherwise.
+  constexpr uint32_t octahedral_zero = 0x80008000u;
+
+  // Octahedral unit vector as two 16-bit snorms, x in the low half.
+  inline glm::vec3 DecodeOctahedral(uint32_t packed)
+  {
+    if (packed == octahedral_zero) return glm::vec3(0.0f);
+    float x = std::max(static_cast<float>(static_cast<int16_t>(packed & 0xFFFF)) / 32767.0f, -1.0f);
+    float y = std::max(static_cast<float>(static_cast<int16_t>(packed >> 16)) / 32767.0f, -1.0f);
+    glm::vec3 normal(x, y, 1.0f - std::abs(x) - std::abs(y));
+    float fold = std::max(-normal.z, 0.0f);
+    normal.x += normal.x >= 0.0f ? -fold : fold;
+    normal.y += normal.y >= 0.0f ? -fold : fold;
+    return glm::normalize(normal);
+  }
+
+  // Picks the closest of the four neighbouring grid points, not just the
+  // rounded one, which halves the worst case error.
+  uint32_t EncodeOctahedral(const glm::vec3& normal);
+
+  struct Scene;
+  class Scheduler;
+
+  // Fills the quantized streams of scene and replaces its float positions,
+  // normals and uvs with their decoded values, so the BVH and every CPU
+  // kernel see exactly what a shader decoding the quantized data sees.
+  QuantizationStats QuantizeScene(Scene& scene, Scheduler& scheduler);
+  // Restores the float streams from the quantized ones, e.g. after a cache load.
+  void DequantizeScene(Scene& scene);
+
+} // namespace PathTracer
+#endif // QUANTIZE_HPP
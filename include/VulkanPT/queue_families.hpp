@@ -20,7 +20,7 @@ namespace VulkanUtils
   {
     QueueFamilyIndices indices;
     std::vector<vk::QueueFamilyProperties> queue_families = device.getQueueFamilyProperties();
-    Debug::Log("System can support %i queue families!", queue_families.size());
+    DEBUG_LOG(Vulkan, "System can support %zu queue families!", queue_families.size());
 
     int index = 0;
     for (vk::QueueFamilyProperties queue_family : queue_families)
@@ -28,13 +28,13 @@ namespace VulkanUtils
       if (queue_family.queueFlags & vk::QueueFlagBits::eGraphics)
       {
         indices.graphics_family = index;
-        Debug::Log("Queue Family %i is suitable for graphics!", index);
+        DEBUG_LOG(Vulkan, "Queue Family %i is suitable for graphics!", index);
       }
 
       if (device.getSurfaceSupportKHR(index, surface))
       {
         indices.present_family = index;
-        Debug::Log("Queue Family %i is suitable for presenting!", index);
+        DEBUG_LOG(Vulkan, "Queue Family %i is suitable for presenting!", index);
       }
 
       if (indices.IsComplete()) break;
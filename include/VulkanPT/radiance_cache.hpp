@@ -0,0 +1,95 @@
+
+#ifndef RADIANCE_CACHE_HPP
+#define RADIANCE_CACHE_HPP
+
+#include <VulkanPT/ray.hpp>
+#include <VulkanPT/scheduler.hpp>
+#include <atomic>
+#include <memory>
+#include <vector>
+
+namespace PathTracer
+{
+  // Fixed point steps per unit of radiance in the sums of a frame.
+  constexpr float radiance_cache_scale = 256.0f;
+
+  // 32 bytes, std430. Resolved radiance leaving the surfaces of one cell,
+  // the number of samples behind it and the frame it last got new ones.
+  // checksum tells cells sharing a slot apart and is 0 for free slots.
+  struct RadianceCacheEntry
+  {
+    glm::vec3 radiance { 0.0f };
+    float sample_count { 0.0f };
+    uint32_t checksum { 0 };
+    uint32_t last_frame { 0 };
+    uint32_t padding[2] { 0, 0 };
+  };
+  static_assert(sizeof(RadianceCacheEntry) == 32, "RadianceCacheEntry must match the std430 layout");
+
+  struct RadianceCacheSettings
+  {
+    // Off renders full paths. Meant to be switched per session, a preview
+    // then trades a little bias for far fewer rays per pixel.
+    bool enabled { false };
+    // Slots of the table, rounded up to a power of two.
+    uint32_t table_size { 1u << 20 };
+    // Slots tried after the hashed one before giving up.
+    uint32_t max_probes { 8 };
+    // Edge of the cells up to lod_distance from the camera, beyond it the
+    // cells double every time the distance does.
+    float cell_size { 0.1f };
+    float lod_distance { 4.0f };
+    // Share of paths that skip the cache and feed it.
+    float update_fraction { 0.125f };
+    // Lookups need this many samples in a cell.
+    float min_samples { 4.0f };
+    // Samples the running average keeps, and frames without new ones
+    // before a cell is dropped.
+    float max_samples { 256.0f };
+    uint32_t max_age { 32 };
+    // Samples are clamped here before fixed point accumulation.
+    float max_radiance { 64.0f };
+  };
+
+  // World-space radiance cache by spatial hashing into a fixed table, after
+  // Binder et al., "Massively Parallel Path Space Filtering" (2019). Cells
+  // are keyed by position, level of detail and the dominant axis of the
+  // normal. Updates add fixed point sums with atomics, so that the compute
+  // version can do the same with atomicAdd, and EndFrame folds them into
+  // the entries.
+  class RadianceCache
+  {
+   public:
+    explicit RadianceCache(RadianceCacheSettings in_settings = RadianceCacheSettings());
+
+    void BeginFrame(const glm::vec3& in_camera) { camera = in_camera; }
+    // Averages the sums of the frame into the entries and evicts stale
+    // cells, with nothing updating.
+    void EndFrame(Scheduler& scheduler);
+    void Clear();
+
+    // Radiance leaving position, false while the cell has too few samples.
+    bool Lookup(const glm::vec3& position, const glm::vec3& normal, glm::vec3& radiance) const;
+    // Adds a sample of the radiance leaving position from any thread, false
+    // when the probed slots are taken by other cells.
+    bool Update(const glm::vec3& position, const glm::vec3& normal, const glm::vec3& radiance);
+
+    const RadianceCacheSettings& getSettings() const { return settings; }
+    const std::vector<RadianceCacheEntry>& getEntries() const { return entries; }
+    uint32_t getOccupiedSlots() const;
+
+   private:
+    void Hash(const glm::vec3& position, const glm::vec3& normal, uint32_t& slot, uint32_t& checksum) const;
+
+    RadianceCacheSettings settings;
+    uint32_t mask;
+    glm::vec3 camera { 0.0f };
+    uint32_t frame { 0 };
+    std::vector<RadianceCacheEntry> entries;
+    // claimed checksums and the sums of this frame, rgb and count per slot
+    std::unique_ptr<std::atomic<uint32_t>[]> checksums;
+    std::unique_ptr<std::atomic<uint32_t>[]> sums;
+  };
+
+} // namespace PathTracer
+#endif // RADIANCE_CACHE_HPP
@@ -0,0 +1,62 @@
+
+#ifndef RAY_HPP
+#define RAY_HPP
+
+#include <glm/glm.hpp>
+#include <cstdint>
+#include <limits>
+
+namespace PathTracer
+{
+  constexpr uint32_t invalid_index = 0xFFFFFFFFu;
+  constexpr float infinity = std::numeric_limits<float>::infinity();
+
+  struct Ray
+  {
+    glm::vec3 origin { 0.0f };
+    float tmin { 0.0f };
+    glm::vec3 direction { 0.0f, 0.0f, 1.0f };
+    float tmax { infinity };
+  };
+
+  struct Hit
+  {
+    float t { infinity };
+    float u { 0.0f };
+    float v { 0.0f };
+    uint32_t primitive { invalid_index };
+
+    bool Valid() const { return primitive != invalid_index; }
+  };
+
+  struct AABB
+  {
+    glm::vec3 min { infinity };
+    glm::vec3 max { -infinity };
+
+    void Grow(const glm::vec3& point)
+    {
+      min = glm::min(min, point);
+      max = glm::max(max, point);
+    }
+
+    void Grow(const AABB& other)
+    {
+      min = glm::min(min, other.min);
+      max = glm::max(max, other.max);
+    }
+
+    bool Empty() const { return min.x > max.x; }
+    glm::vec3 Extent() const { return max - min; }
+    glm::vec3 Center() const { return (min + max) * 0.5f; }
+
+    float Area() const
+    {
+      if (Empty()) return 0.0f;
+      glm::vec3 extent = Extent();
+      return 2.0f * (extent.x * extent.y + extent.y * extent.z + extent.z * extent.x);
+    }
+  };
+
+} // namespace PathTracer
+#endif // RAY_HPP
@@ -0,0 +1,123 @@
+
+#ifndef RESTIR_HPP
+#define RESTIR_HPP
+
+#include <VulkanPT/bvh.hpp>
+#include <VulkanPT/light_bvh.hpp>
+#include <VulkanPT/scheduler.hpp>
+#include <algorithm>
+#include <functional>
+#include <vector>
+
+namespace PathTracer
+{
+  // 32 bytes, std430. One light sample that survived resampling: the light
+  // and the two numbers placing the point on it, the running sum of the
+  // resampling weights, the target value at the pixel owning the reservoir,
+  // the number of candidates it stands for and its contribution weight W.
+  struct Reservoir
+  {
+    uint32_t light { invalid_index };
+    float weight_sum { 0.0f };
+    float target { 0.0f };
+    float count { 0.0f };
+    glm::vec2 uv { 0.0f };
+    float contribution_weight { 0.0f };
+    uint32_t padding { 0 };
+  };
+  static_assert(sizeof(Reservoir) == 32, "Reservoir must match the std430 layout");
+
+  // 32 bytes, std430. The primary hit of a pixel, what reuse compares to
+  // decide whether a neighbour's sample is worth taking.
+  struct ReSTIRSurface
+  {
+    glm::vec3 position { 0.0f };
+    float depth { 0.0f };
+    glm::vec3 normal { 0.0f };
+    uint32_t valid { 0 };
+  };
+  static_assert(sizeof(ReSTIRSurface) == 32, "ReSTIRSurface must match the std430 layout");
+
+  struct ReSTIRSettings
+  {
+    // Candidates drawn from the light BVH per pixel and frame.
+    uint32_t initial_candidates { 32 };
+    bool temporal_reuse { true };
+    // History is capped at this many times the candidates of one frame,
+    // which bounds how long stale samples survive.
+    float temporal_history { 20.0f };
+    uint32_t spatial_passes { 1 };
+    uint32_t spatial_neighbors { 5 };
+    float spatial_radius { 30.0f };
+    // Neighbours weigh a reused sample only where they see it, a shadow ray
+    // per pair. Without it spatial reuse darkens where shadows vary.
+    bool spatial_visibility { true };
+    // Reuse only between surfaces whose normals and depths agree.
+    float normal_threshold { 0.9f };
+    float depth_threshold { 0.1f };
+  };
+
+  // Reservoir-based spatiotemporal importance resampling of direct light,
+  // after Bitterli et al., "Spatiotemporal reservoir resampling for
+  // real-time ray tracing with dynamic direct lighting" (2020). The target
+  // is the unshadowed light reaching a diffuse surface. Candidates come from
+  // the light BVH and the survivor of every pixel is tested for visibility
+  // before reuse. Reused samples are weighed by the balance heuristic over
+  // the surfaces involved, with the visibility of neighbours when
+  // spatial_visibility is set, which keeps spatial reuse unbiased.
+  //
+  // This is the CPU reference of the device passes: candidates and temporal
+  // reuse, spatial passes ping-ponging between two buffers, then shading.
+  // Only temporal results become history, spatial ones are shaded and
+  // dropped. See ReSTIRBufferIndex for the device side.
+  class ReSTIRDI
+  {
+   public:
+    // Maps a pixel of this frame to the pixel its surface covered in the
+    // previous frame, false when it was off screen.
+    using ReprojectFunction = std::function<bool(uint32_t x, uint32_t y, const ReSTIRSurface& surface,
+                                                 uint32_t& previous_x, uint32_t& previous_y)>;
+
+    ReSTIRDI(uint32_t in_width, uint32_t in_height, ReSTIRSettings in_settings = ReSTIRSettings());
+
+    // surfaces holds the primary hits of this frame, row by row. radiance
+    // receives the light reaching each surface, to be multiplied by the
+    // albedo over pi of diffuse materials.
+    void Render(const std::vector<ReSTIRSurface>& surfaces, const std::vector<Light>& lights,
+                const LightBVH& light_bvh, const BVH& bvh, const ReprojectFunction& reproject,
+                Scheduler& scheduler, std::vector<glm::vec3>& radiance);
+    // Drops the history, e.g. after a camera cut or a scene change.
+    void Reset();
+
+    // reservoirs shaded by the last frame
+    const std::vector<Reservoir>& getReservoirs() const
+    { return settings.spatial_passes ? spatial[(settings.spatial_passes - 1) & 1] : reservoirs[current]; }
+    const ReSTIRSettings& getSettings() const { return settings; }
+    uint32_t getFrame() const { return frame; }
+    uint64_t getShadowRays() const { return shadow_rays; }
+
+   private:
+    uint32_t width;
+    uint32_t height;
+    ReSTIRSettings settings;
+    // temporal results of this and the previous frame
+    std::vector<Reservoir> reservoirs[2];
+    std::vector<Reservoir> spatial[2];
+    std::vector<ReSTIRSurface> previous_surfaces;
+    uint32_t current { 0 };
+    uint32_t frame { 0 };
+    uint64_t shadow_rays { 0 };
+  };
+
+  // Reservoir buffers of the device with frames_in_flight frames recorded
+  // ahead: every frame owns a history buffer and two spatial buffers and
+  // reads the history of the frame before it in the temporal pass, so there
+  // are at least two sets even with a single frame in flight. buffer is 0
+  // for the history and 1 + pass % 2 for spatial passes.
+  inline uint32_t ReSTIRBufferSets(uint32_t frames_in_flight) { return std::max(frames_in_flight, 2u); }
+
+  inline uint32_t ReSTIRBufferIndex(uint32_t frame, uint32_t frames_in_flight, uint32_t buffer)
+  { return (frame % ReSTIRBufferSets(frames_in_flight)) * 3 + buffer; }
+
+} // namespace PathTracer
+#endif // RESTIR_HPP
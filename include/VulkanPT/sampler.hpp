@@ -0,0 +1,159 @@
+
+#ifndef SAMPLER_HPP
+#define SAMPLER_HPP
+
+#include <glm/glm.hpp>
+#include <cstdint>
+#include <vector>
+
+namespace PathTracer
+{
+  // Everything below works on 32-bit integers so that the GLSL samplers can
+  // mirror it bit for bit and both backends see the same sequences.
+
+  // Sobol dimensions used together before the sampler pads with a freshly
+  // shuffled block, higher dimensions of one sequence project badly.
+  constexpr uint32_t sobol_block_dimensions = 4;
+  // Dimensions of the precomputed Sobol matrices, 32 words each. Padding
+  // reuses the same block, so no more are ever read.
+  constexpr uint32_t sobol_dimensions = sobol_block_dimensions;
+
+  // PCG hash, also the seed mixer of every sampler.
+  inline uint32_t PcgHash(uint32_t value)
+  {
+    uint32_t state = value * 747796405u + 2891336453u;
+    uint32_t word = ((state >> ((state >> 28u) + 4u)) ^ state) * 277803737u;
+    return (word >> 22u) ^ word;
+  }
+
+  inline uint32_t ReverseBits(uint32_t value)
+  {
+    value = ((value >> 1) & 0x55555555u) | ((value & 0x55555555u) << 1);
+    value = ((value >> 2) & 0x33333333u) | ((value & 0x33333333u) << 2);
+    value = ((value >> 4) & 0x0F0F0F0Fu) | ((value & 0x0F0F0F0Fu) << 4);
+    value = ((value >> 8) & 0x00FF00FFu) | ((value & 0x00FF00FFu) << 8);
+    return (value >> 16) | (value << 16);
+  }
+
+  // Hash-based Owen scrambling, after Burley, "Practical Hash-based Owen
+  // Scrambling" (2020). Each bit is flipped depending on the bits above it
+  // only, which keeps the stratification of the input.
+  inline uint32_t OwenScramble(uint32_t value, uint32_t seed)
+  {
+    value = ReverseBits(value);
+    value += seed;
+    value ^= value * 0x6C50B47Cu;
+    value ^= value * 0xB82F1E52u;
+    value ^= value * 0xC7AFE638u;
+    value ^= value * 0x8D22F6E6u;
+    return ReverseBits(value);
+  }
+
+  // 24 bits are what a float in [0, 1) can hold.
+  inline float UnitFloat(uint32_t value) { return static_cast<float>(value >> 8) * (1.0f / 16777216.0f); }
+
+  // Direction numbers of Joe and Kuo, "Constructing Sobol sequences with
+  // better two-dimensional projections" (2008), expanded into one 32x32
+  // binary matrix per dimension, column j multiplying bit j of the index.
+  void BuildSobolMatrices(std::vector<uint32_t>& matrices);
+
+  inline uint32_t SobolSample(const uint32_t* matrices, uint32_t index, uint32_t dimension)
+  {
+    const uint32_t* columns = matrices + dimension * 32;
+    uint32_t result = 0;
+    for (uint32_t bit = 0; index; ++bit, index >>= 1)
+    {
+      if (index & 1) result ^= columns[bit];
+    }
+    return result;
+  }
+
+  // Blue-noise dither array of size x size texels by the void-and-cluster
+  // method, Ulichney, "The void-and-cluster method for dither array
+  // generation" (1993). Texels hold (rank + 0.5) / texels in 32-bit fixed
+  // point, any threshold selects an evenly spread subset. O(texels^2), meant
+  // for sizes up to 128.
+  void BuildBlueNoise(uint32_t size, uint32_t seed, std::vector<uint32_t>& ranks);
+
+  // Built once and shared by all samplers, the same arrays are uploaded for
+  // the device samplers.
+  struct SamplerTables
+  {
+    std::vector<uint32_t> sobol;
+    std::vector<uint32_t> blue_noise;
+    uint32_t blue_noise_size { 0 };
+
+    void Build(uint32_t in_blue_noise_size = 64, uint32_t seed = 0);
+  };
+
+  enum class SamplerType : uint32_t
+  {
+    // hashed white noise, the baseline
+    Independent = 0,
+    // Owen-scrambled Sobol, shuffled and scrambled per pixel
+    Sobol,
+    // one Owen-scrambled Sobol sequence for all pixels, shifted per pixel
+    // by blue noise so that errors of neighbours differ as much as possible
+    BlueNoise
+  };
+
+  // Sample values of one pixel sample, drawn dimension after dimension.
+  // Sobol dimensions come in blocks of sobol_block_dimensions, every block
+  // shuffles the sample index on its own so blocks don't correlate.
+  class Sampler
+  {
+   public:
+    Sampler(const SamplerTables& in_tables, SamplerType in_type, uint32_t x, uint32_t y, uint32_t in_sample,
+            uint32_t seed = 0)
+      : tables{ in_tables }, type{ in_type }, sample{ in_sample }, pixel_x{ x }, pixel_y{ y }
+    {
+      pixel_seed = PcgHash(x + PcgHash(y + PcgHash(seed)));
+      sequence_seed = type == SamplerType::BlueNoise ? PcgHash(seed) : pixel_seed;
+    }
+
+    float Get1D() { return Value(dimension++); }
+
+    glm::vec2 Get2D()
+    {
+      // both values from the same block keep their joint stratification
+      if (dimension % sobol_block_dimensions == sobol_block_dimensions - 1) dimension++;
+      glm::vec2 result(Value(dimension), Value(dimension + 1));
+      dimension += 2;
+      return result;
+    }
+
+    uint32_t getDimension() const { return dimension; }
+
+   private:
+    float Value(uint32_t index) const
+    {
+      if (type == SamplerType::Independent)
+        return UnitFloat(PcgHash(pixel_seed ^ PcgHash(sample + PcgHash(index))));
+
+      const uint32_t block = index / sobol_block_dimensions;
+      const uint32_t block_seed = PcgHash(sequence_seed + block * 0x9E3779B9u);
+      const uint32_t shuffled = OwenScramble(sample, block_seed);
+      const uint32_t value = OwenScramble(SobolSample(tables.sobol.data(), shuffled, index % sobol_block_dimensions),
+                                          PcgHash(block_seed ^ index));
+      if (type == SamplerType::Sobol) return UnitFloat(value);
+
+      // toroidal shift by a blue-noise texel, offset per dimension so that
+      // the dimensions don't share their dither
+      const uint32_t size = tables.blue_noise_size;
+      const uint32_t offset = PcgHash(index + 0x632BE5ABu);
+      const uint32_t texel = ((pixel_y + (offset >> 16)) % size) * size + (pixel_x + (offset & 0xFFFFu)) % size;
+      return UnitFloat(value + tables.blue_noise[texel]);
+    }
+
+    const SamplerTables& tables;
+    SamplerType type;
+    uint32_t sample;
+    uint32_t pixel_x;
+    uint32_t pixel_y;
+    uint32_t pixel_seed;
+    uint32_t sequence_seed;
+    uint32_t dimension { 0 };
+  };
+
+} // namespace PathTracer
+#endif // SAMPLER_HPP
@@ -0,0 +1,130 @@
+
+#ifndef SCENE_HPP
+#define SCENE_HPP
+
+#include <VulkanPT/bvh.hpp>
+#include <VulkanPT/compressed_bvh.hpp>
+#include <VulkanPT/image.hpp>
+#include <VulkanPT/quantize.hpp>
+#include <VulkanPT/texture.hpp>
+#include <functional>
+#include <string>
+#include <vector>
+
+namespace PathTracer
+{
+  // 64 bytes, laid out for std430 so material tables upload as they are.
+  // Texture indices are -1 when unused.
+  struct Material
+  {
+    glm::vec4 base_color { 1.0f };
+    glm::vec3 emission { 0.0f };
+    float roughness { 1.0f };
+    float metallic { 0.0f };
+    float ior { 1.5f };
+    float transmission { 0.0f };
+    float alpha_cutoff { 0.0f };
+    int32_t base_color_texture { -1 };
+    int32_t metallic_roughness_texture { -1 };
+    int32_t normal_texture { -1 };
+    int32_t emission_texture { -1 };
+  };
+  static_assert(sizeof(Material) == 64, "Material must stay 64 bytes");
+
+  // Texture paths are stored as one blob of NUL terminated strings. Quantized
+  // scenes leave the float attribute sections empty.
+  enum class SceneSection : uint32_t
+  {
+    Positions = 0,
+    Normals,
+    UVs,
+    Indices,
+    MaterialIndices,
+    Materials,
+    BVHNodes,
+    TriangleBlocks,
+    CompressedBVHNodes,
+    CompressedTriangleBlocks,
+    Instances,
+    Quantization,
+    QuantizedPositions,
+    QuantizedNormals,
+    QuantizedUVs,
+    Textures,
+    Count
+  };
+
+  // Receives the final bytes of a section while a scene is still loading, in
+  // order and possibly in several slices. total_size is the size of the whole
+  // section so the receiver can allocate its destination on the first slice.
+  using SceneStreamFunction = std::function<void(SceneSection section, const void* data, uint64_t offset,
+                                                 uint64_t size, uint64_t total_size)>;
+
+  // 80 bytes, std430. Instanced triangles are stored in world space in the
+  // scene streams, the instance keeps where they came from for two-level
+  // builds and per-instance data.
+  struct Instance
+  {
+    glm::mat4 transform { 1.0f };
+    uint32_t mesh { 0 };
+    uint32_t first_triangle { 0 };
+    uint32_t triangle_count { 0 };
+    uint32_t node { 0 };
+  };
+  static_assert(sizeof(Instance) == 80, "Instance must stay 80 bytes");
+
+  // Interpolated attributes at a hit, the input of shading. uv_density and
+  // curvature are per triangle and feed TextureLod and SurfaceSpreadAngle.
+  struct SurfacePoint
+  {
+    glm::vec3 position { 0.0f };
+    glm::vec3 normal { 0.0f };
+    glm::vec3 geometric_normal { 0.0f };
+    glm::vec2 uv { 0.0f };
+    // 0.5 * log2(uv area / world area)
+    float uv_density { 0.0f };
+    float curvature { 0.0f };
+    uint32_t material { invalid_index };
+  };
+
+  // Flat triangle scene, normals and uvs are either empty or per vertex and
+  // material_indices holds one entry per triangle. Quantized scenes also keep
+  // 16-bit copies of the attributes, the float streams then hold their
+  // decoded values.
+  struct Scene
+  {
+    std::vector<glm::vec3> positions;
+    std::vector<glm::vec3> normals;
+    std::vector<glm::vec2> uvs;
+    std::vector<uint32_t> indices;
+    std::vector<uint32_t> material_indices;
+    std::vector<Material> materials;
+    std::vector<Instance> instances;
+    // texture sources, images holds their decoded texels once loaded
+    std::vector<std::string> textures;
+    std::vector<Image> images;
+    // mip chains of images, GenerateMipmaps moves each image into level 0
+    std::vector<Texture> mip_chains;
+    // one per quantization_block_vertices vertices
+    std::vector<QuantizationInfo> quantization;
+    std::vector<QuantizedPosition> quantized_positions;
+    std::vector<uint32_t> quantized_normals;
+    std::vector<uint32_t> quantized_uvs;
+    BVH bvh;
+    // optional device layout of bvh, empty unless built
+    CompressedBVH compressed_bvh;
+
+    uint32_t TriangleCount() const { return static_cast<uint32_t>(indices.size() / 3); }
+    bool Quantized() const { return !quantized_positions.empty(); }
+    void BuildBVH(BVHBuildSettings settings = BVHBuildSettings()) { bvh.Build(positions, indices, settings); }
+    void BuildCompressedBVH() { compressed_bvh.Build(bvh); }
+    // One task per image. Base color and emission textures are sRGB.
+    void GenerateMipmaps(Scheduler& scheduler);
+
+    // Shading fetch, decodes the quantized streams when asked to, which is
+    // what the device kernels do, otherwise reads the float ones.
+    SurfacePoint Interpolate(const Hit& hit, bool decode_quantized = false) const;
+  };
+
+} // namespace PathTracer
+#endif // SCENE_HPP
@@ -0,0 +1,97 @@
+
+#ifndef SCENE_CACHE_HPP
+#define SCENE_CACHE_HPP
+
+#include <VulkanPT/mapped_file.hpp>
+#include <VulkanPT/scene.hpp>
+#include <string>
+
+namespace PathTracer
+{
+  struct SceneCacheHeader
+  {
+    char magic[8];
+    uint32_t version;
+    uint32_t section_count;
+    uint64_t source_hash;
+    uint64_t file_size;
+    // BVH leaves are only valid for the kernel and block width that built them
+    uint64_t kernel_hash;
+    uint32_t block_width;
+    uint32_t reserved;
+  };
+
+  struct SceneCacheSection
+  {
+    uint32_t type;
+    uint32_t stride;
+    uint64_t offset;
+    uint64_t count;
+  };
+
+  // Versioned binary scene that is mapped instead of parsed. Every section
+  // starts at a multiple of alignment, which covers minStorageBufferOffsetAlignment
+  // and nonCoherentAtomSize on all devices, so the mapped bytes can be copied
+  // into one staging buffer as they are and bound at the section offsets.
+  class SceneCache
+  {
+   public:
+    static constexpr uint32_t version = 6;
+    static constexpr uint64_t alignment = 256;
+
+    static std::string PathFor(const std::string& source_path) { return source_path + ".vptscene"; }
+
+    // Writes to a temporary file first so readers never map a partial cache.
+    static bool Write(const std::string& path, const Scene& scene, uint64_t source_hash);
+
+    // Fails if the file is missing, corrupt, from another version or built
+    // from sources with a different content hash.
+    bool Open(const std::string& path, uint64_t source_hash);
+    void Close() { file.Close(); }
+
+    // Copies the sections into scene, the BVH is taken over without a rebuild.
+    // Images are not cached, they are decoded from their sources again.
+    bool Load(Scene& scene) const;
+
+    // Hands every section straight from the mapping to stream, no copies.
+    void Stream(const SceneStreamFunction& stream) const;
+
+    // Hands the sections of a scene still loading to stream in 16 MB slices,
+    // the bytes Write stores for them, so float attributes are skipped for
+    // quantized scenes. Loaders send each stage once it is done, letting
+    // uploads overlap the rest of the load.
+    static void StreamScene(const SceneStreamFunction& stream, const Scene& scene);
+    static void StreamSections(const SceneStreamFunction& stream, const Scene& scene, const SceneSection* sections,
+                               size_t count);
+    template <size_t N>
+    static void StreamSections(const SceneStreamFunction& stream, const Scene& scene, const SceneSection (&sections)[N])
+    { StreamSections(stream, scene, sections, N); }
+
+    // The stages both loaders stream, the float or the quantized attributes
+    // with the indices first and the BVH once it is built.
+    static constexpr SceneSection vertex_sections[] = {
+      SceneSection::Positions, SceneSection::Normals, SceneSection::UVs, SceneSection::Quantization,
+      SceneSection::QuantizedPositions, SceneSection::QuantizedNormals, SceneSection::QuantizedUVs,
+      SceneSection::Indices };
+    static constexpr SceneSection bvh_sections[] = {
+      SceneSection::BVHNodes, SceneSection::TriangleBlocks, SceneSection::CompressedBVHNodes,
+      SceneSection::CompressedTriangleBlocks };
+
+    template <typename T>
+    ArrayView<T> getSection(SceneSection type) const
+    {
+      const SceneCacheSection& section = sections[static_cast<uint32_t>(type)];
+      if (section.stride != sizeof(T) || section.count == 0) return {};
+      return { reinterpret_cast<const T*>(file.getData() + section.offset), static_cast<size_t>(section.count) };
+    }
+
+    const SceneCacheSection& getSectionInfo(SceneSection type) const { return sections[static_cast<uint32_t>(type)]; }
+    const MappedFile& getFile() const { return file; }
+
+   private:
+    MappedFile file;
+    SceneCacheSection sections[static_cast<uint32_t>(SceneSection::Count)] {};
+  };
+
+} // namespace PathTracer
+#endif // SCENE_CACHE_HPP
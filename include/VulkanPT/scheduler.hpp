@@ -0,0 +1,91 @@
+
+#ifndef SCHEDULER_HPP
+#define SCHEDULER_HPP
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace PathTracer
+{
+  // Interleaves the bits of x and y, nearby tiles end up close in the order.
+  inline uint32_t MortonEncode(uint32_t x, uint32_t y)
+  {
+    auto spread = [](uint32_t v)
+    {
+      v &= 0x0000FFFF;
+      v = (v | (v << 8)) & 0x00FF00FF;
+      v = (v | (v << 4)) & 0x0F0F0F0F;
+      v = (v | (v << 2)) & 0x33333333;
+      v = (v | (v << 1)) & 0x55555555;
+      return v;
+    };
+    return spread(x) | (spread(y) << 1);
+  }
+
+  struct ThreadStats
+  {
+    uint64_t tasks { 0 };
+    uint64_t steals { 0 };
+    uint64_t work { 0 };
+    double busy_milliseconds { 0.0 };
+    uint32_t numa_node { 0 };
+  };
+
+  // Persistent worker pool with one deque per thread. Tasks are handed out in
+  // contiguous runs so each thread starts on a coherent block, owners pop from
+  // the back and idle threads steal from the front of a victim's deque,
+  // preferring victims on their own NUMA node.
+  class Scheduler
+  {
+   public:
+    using Task = std::function<void(uint32_t task, uint32_t thread)>;
+
+    Scheduler(uint32_t thread_count = 0, bool pin_threads = true);
+    ~Scheduler();
+
+    // Runs every task in tasks and blocks until all of them finished.
+    // Tasks must not call back into the same scheduler.
+    void Run(const std::vector<uint32_t>& tasks, const Task& function);
+    void ParallelFor(uint32_t count, const Task& function);
+
+    // Per-thread throughput counter, e.g. samples traced by a tile.
+    void AddWork(uint32_t thread, uint64_t amount) { workers[thread]->stats.work += amount; }
+
+    uint32_t getThreadCount() const { return static_cast<uint32_t>(workers.size()); }
+    const ThreadStats& getStats(uint32_t thread) const { return workers[thread]->stats; }
+    void ResetStats();
+    void ReportStats() const;
+
+   private:
+    struct Worker
+    {
+      std::thread thread;
+      std::mutex mutex;
+      std::deque<uint32_t> queue;
+      ThreadStats stats;
+    };
+
+    void WorkerLoop(uint32_t index);
+    bool Pop(uint32_t index, uint32_t& task);
+    bool Steal(uint32_t index, uint32_t& task);
+    void Execute(uint32_t index, uint32_t task, bool stolen);
+
+    std::vector<std::unique_ptr<Worker>> workers;
+
+    std::mutex job_mutex;
+    std::condition_variable job_start;
+    std::condition_variable job_done;
+    const Task* job { nullptr };
+    uint64_t generation { 0 };
+    uint32_t finished_workers { 0 };
+    bool stopping { false };
+  };
+
+} // namespace PathTracer
+#endif // SCHEDULER_HPP
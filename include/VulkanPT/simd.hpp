@@ -0,0 +1,439 @@
+
+#ifndef SIMD_HPP
+#define SIMD_HPP
+
+#include <cmath>
+#include <cstdint>
+
+#if defined(_M_X64) || defined(__x86_64__) || defined(__SSE2__)
+#define VPT_SSE 1
+#include <immintrin.h>
+#endif
+
+#if defined(__AVX__)
+#define VPT_AVX 1
+#endif
+
+namespace PathTracer
+{
+  // N-wide float and mask types. The generic version is plain loops the
+  // compiler can vectorize, 4 and 8 wide map to SSE and AVX when available
+  // and 8 without AVX and 16 to pairs of those.
+  template <int N>
+  struct SimdMask
+  {
+    bool v[N];
+
+    SimdMask() = default;
+    explicit SimdMask(bool value) { for (int i = 0; i < N; ++i) v[i] = value; }
+
+    static SimdMask FromBits(uint32_t bits)
+    {
+      SimdMask result;
+      for (int i = 0; i < N; ++i) result.v[i] = (bits >> i) & 1u;
+      return result;
+    }
+
+    uint32_t Bits() const
+    {
+      uint32_t bits = 0;
+      for (int i = 0; i < N; ++i) bits |= static_cast<uint32_t>(v[i]) << i;
+      return bits;
+    }
+
+    bool operator[](int i) const { return v[i]; }
+    bool Any() const { return Bits() != 0; }
+    bool All() const { return Bits() == (N == 32 ? 0xFFFFFFFFu : (1u << N) - 1u); }
+    bool None() const { return Bits() == 0; }
+
+    SimdMask operator&(const SimdMask& b) const
+    { SimdMask r; for (int i = 0; i < N; ++i) r.v[i] = v[i] && b.v[i]; return r; }
+    SimdMask operator|(const SimdMask& b) const
+    { SimdMask r; for (int i = 0; i < N; ++i) r.v[i] = v[i] || b.v[i]; return r; }
+    SimdMask operator^(const SimdMask& b) const
+    { SimdMask r; for (int i = 0; i < N; ++i) r.v[i] = v[i] != b.v[i]; return r; }
+    SimdMask operator~() const
+    { SimdMask r; for (int i = 0; i < N; ++i) r.v[i] = !v[i]; return r; }
+  };
+
+  template <int N>
+  struct SimdFloat
+  {
+    float v[N];
+
+    SimdFloat() = default;
+    SimdFloat(float value) { for (int i = 0; i < N; ++i) v[i] = value; }
+
+    static SimdFloat Load(const float* data)
+    { SimdFloat r; for (int i = 0; i < N; ++i) r.v[i] = data[i]; return r; }
+    void Store(float* data) const { for (int i = 0; i < N; ++i) data[i] = v[i]; }
+
+    float operator[](int i) const { return v[i]; }
+
+#define VPT_SIMD_BINARY(op)                                                      \
+    SimdFloat operator op(const SimdFloat& b) const                              \
+    { SimdFloat r; for (int i = 0; i < N; ++i) r.v[i] = v[i] op b.v[i]; return r; }
+    VPT_SIMD_BINARY(+)
+    VPT_SIMD_BINARY(-)
+    VPT_SIMD_BINARY(*)
+    VPT_SIMD_BINARY(/)
+#undef VPT_SIMD_BINARY
+
+#define VPT_SIMD_COMPARE(op)                                                     \
+    SimdMask<N> operator op(const SimdFloat& b) const                            \
+    { SimdMask<N> r; for (int i = 0; i < N; ++i) r.v[i] = v[i] op b.v[i]; return r; }
+    VPT_SIMD_COMPARE(<)
+    VPT_SIMD_COMPARE(<=)
+    VPT_SIMD_COMPARE(>)
+    VPT_SIMD_COMPARE(>=)
+    VPT_SIMD_COMPARE(==)
+#undef VPT_SIMD_COMPARE
+
+    SimdFloat operator-() const { SimdFloat r; for (int i = 0; i < N; ++i) r.v[i] = -v[i]; return r; }
+  };
+
+  template <int N>
+  inline SimdFloat<N> Min(const SimdFloat<N>& a, const SimdFloat<N>& b)
+  { SimdFloat<N> r; for (int i = 0; i < N; ++i) r.v[i] = a.v[i] < b.v[i] ? a.v[i] : b.v[i]; return r; }
+
+  template <int N>
+  inline SimdFloat<N> Max(const SimdFloat<N>& a, const SimdFloat<N>& b)
+  { SimdFloat<N> r; for (int i = 0; i < N; ++i) r.v[i] = a.v[i] > b.v[i] ? a.v[i] : b.v[i]; return r; }
+
+  template <int N>
+  inline SimdFloat<N> Abs(const SimdFloat<N>& a)
+  { SimdFloat<N> r; for (int i = 0; i < N; ++i) r.v[i] = std::fabs(a.v[i]); return r; }
+
+  template <int N>
+  inline SimdFloat<N> Sqrt(const SimdFloat<N>& a)
+  { SimdFloat<N> r; for (int i = 0; i < N; ++i) r.v[i] = std::sqrt(a.v[i]); return r; }
+
+  template <int N>
+  inline SimdFloat<N> Select(const SimdMask<N>& mask, const SimdFloat<N>& a, const SimdFloat<N>& b)
+  { SimdFloat<N> r; for (int i = 0; i < N; ++i) r.v[i] = mask.v[i] ? a.v[i] : b.v[i]; return r; }
+
+  template <int N>
+  inline float ReduceMin(const SimdFloat<N>& a)
+  { float r = a.v[0]; for (int i = 1; i < N; ++i) r = a.v[i] < r ? a.v[i] : r; return r; }
+
+  template <int N>
+  inline float ReduceMax(const SimdFloat<N>& a)
+  { float r = a.v[0]; for (int i = 1; i < N; ++i) r = a.v[i] > r ? a.v[i] : r; return r; }
+
+  template <int N>
+  inline SimdFloat<N> Exp(const SimdFloat<N>& a)
+  { SimdFloat<N> r; for (int i = 0; i < N; ++i) r.v[i] = std::exp(a.v[i]); return r; }
+
+  // Flushes denormal results and inputs to zero while alive, for filters
+  // whose products of small weights would otherwise crawl through microcode.
+  // The mode is per thread, so take it inside every task.
+  struct DenormalsAreZero
+  {
+#ifdef VPT_SSE
+    unsigned int previous;
+    DenormalsAreZero() : previous{ _mm_getcsr() } { _mm_setcsr(previous | 0x8040u); }
+    ~DenormalsAreZero() { _mm_setcsr(previous); }
+#endif
+  };
+
+#ifdef VPT_SSE
+  template <>
+  struct SimdMask<4>
+  {
+    __m128 v;
+
+    SimdMask() = default;
+    SimdMask(__m128 in_v) : v{ in_v } {}
+    explicit SimdMask(bool value) : v{ _mm_castsi128_ps(_mm_set1_epi32(value ? -1 : 0)) } {}
+
+    static SimdMask FromBits(uint32_t bits)
+    {
+      __m128i lanes = _mm_and_si128(_mm_set1_epi32(static_cast<int>(bits)), _mm_setr_epi32(1, 2, 4, 8));
+      return _mm_castsi128_ps(_mm_cmpeq_epi32(lanes, _mm_setr_epi32(1, 2, 4, 8)));
+    }
+
+    uint32_t Bits() const { return static_cast<uint32_t>(_mm_movemask_ps(v)); }
+    bool operator[](int i) const { return (Bits() >> i) & 1u; }
+    bool Any() const { return Bits() != 0; }
+    bool All() const { return Bits() == 0xF; }
+    bool None() const { return Bits() == 0; }
+
+    SimdMask operator&(const SimdMask& b) const { return _mm_and_ps(v, b.v); }
+    SimdMask operator|(const SimdMask& b) const { return _mm_or_ps(v, b.v); }
+    SimdMask operator^(const SimdMask& b) const { return _mm_xor_ps(v, b.v); }
+    SimdMask operator~() const { return _mm_xor_ps(v, _mm_castsi128_ps(_mm_set1_epi32(-1))); }
+  };
+
+  template <>
+  struct SimdFloat<4>
+  {
+    __m128 v;
+
+    SimdFloat() = default;
+    SimdFloat(__m128 in_v) : v{ in_v } {}
+    SimdFloat(float value) : v{ _mm_set1_ps(value) } {}
+
+    static SimdFloat Load(const float* data) { return _mm_loadu_ps(data); }
+    void Store(float* data) const { _mm_storeu_ps(data, v); }
+
+    float operator[](int i) const { alignas(16) float lanes[4]; _mm_store_ps(lanes, v); return lanes[i]; }
+
+    SimdFloat operator+(const SimdFloat& b) const { return _mm_add_ps(v, b.v); }
+    SimdFloat operator-(const SimdFloat& b) const { return _mm_sub_ps(v, b.v); }
+    SimdFloat operator*(const SimdFloat& b) const { return _mm_mul_ps(v, b.v); }
+    SimdFloat operator/(const SimdFloat& b) const { return _mm_div_ps(v, b.v); }
+    SimdFloat operator-() const { return _mm_xor_ps(v, _mm_set1_ps(-0.0f)); }
+
+    SimdMask<4> operator<(const SimdFloat& b) const { return _mm_cmplt_ps(v, b.v); }
+    SimdMask<4> operator<=(const SimdFloat& b) const { return _mm_cmple_ps(v, b.v); }
+    SimdMask<4> operator>(const SimdFloat& b) const { return _mm_cmpgt_ps(v, b.v); }
+    SimdMask<4> operator>=(const SimdFloat& b) const { return _mm_cmpge_ps(v, b.v); }
+    SimdMask<4> operator==(const SimdFloat& b) const { return _mm_cmpeq_ps(v, b.v); }
+  };
+
+  template <>
+  inline SimdFloat<4> Min(const SimdFloat<4>& a, const SimdFloat<4>& b) { return _mm_min_ps(a.v, b.v); }
+  template <>
+  inline SimdFloat<4> Max(const SimdFloat<4>& a, const SimdFloat<4>& b) { return _mm_max_ps(a.v, b.v); }
+  template <>
+  inline SimdFloat<4> Abs(const SimdFloat<4>& a) { return _mm_andnot_ps(_mm_set1_ps(-0.0f), a.v); }
+  template <>
+  inline SimdFloat<4> Sqrt(const SimdFloat<4>& a) { return _mm_sqrt_ps(a.v); }
+
+  template <>
+  inline SimdFloat<4> Select(const SimdMask<4>& mask, const SimdFloat<4>& a, const SimdFloat<4>& b)
+  { return _mm_or_ps(_mm_and_ps(mask.v, a.v), _mm_andnot_ps(mask.v, b.v)); }
+
+  template <>
+  inline float ReduceMin(const SimdFloat<4>& a)
+  {
+    __m128 shuffled = _mm_min_ps(a.v, _mm_shuffle_ps(a.v, a.v, _MM_SHUFFLE(2, 3, 0, 1)));
+    shuffled = _mm_min_ps(shuffled, _mm_shuffle_ps(shuffled, shuffled, _MM_SHUFFLE(1, 0, 3, 2)));
+    return _mm_cvtss_f32(shuffled);
+  }
+
+  template <>
+  inline float ReduceMax(const SimdFloat<4>& a)
+  {
+    __m128 shuffled = _mm_max_ps(a.v, _mm_shuffle_ps(a.v, a.v, _MM_SHUFFLE(2, 3, 0, 1)));
+    shuffled = _mm_max_ps(shuffled, _mm_shuffle_ps(shuffled, shuffled, _MM_SHUFFLE(1, 0, 3, 2)));
+    return _mm_cvtss_f32(shuffled);
+  }
+
+  // 2^n times a Taylor polynomial of 2^f with f in [-0.5, 0.5], relative
+  // error below 1e-5. Arguments are clamped to the normal float range.
+  inline __m128 Exp2Polynomial(__m128 f)
+  {
+    __m128 p = _mm_set1_ps(1.3333558e-3f);
+    p = _mm_add_ps(_mm_mul_ps(p, f), _mm_set1_ps(9.6181291e-3f));
+    p = _mm_add_ps(_mm_mul_ps(p, f), _mm_set1_ps(5.5504109e-2f));
+    p = _mm_add_ps(_mm_mul_ps(p, f), _mm_set1_ps(2.4022651e-1f));
+    p = _mm_add_ps(_mm_mul_ps(p, f), _mm_set1_ps(6.9314718e-1f));
+    return _mm_add_ps(_mm_mul_ps(p, f), _mm_set1_ps(1.0f));
+  }
+
+  inline __m128 Exp2Scale(__m128i n)
+  { return _mm_castsi128_ps(_mm_slli_epi32(_mm_add_epi32(n, _mm_set1_epi32(127)), 23)); }
+
+  template <>
+  inline SimdFloat<4> Exp(const SimdFloat<4>& a)
+  {
+    __m128 x = _mm_min_ps(_mm_max_ps(a.v, _mm_set1_ps(-87.0f)), _mm_set1_ps(88.0f));
+    __m128 t = _mm_mul_ps(x, _mm_set1_ps(1.44269504f));
+    __m128i n = _mm_cvtps_epi32(t);
+    __m128 f = _mm_sub_ps(t, _mm_cvtepi32_ps(n));
+    return _mm_mul_ps(Exp2Polynomial(f), Exp2Scale(n));
+  }
+#endif // VPT_SSE
+
+#ifdef VPT_AVX
+  template <>
+  struct SimdMask<8>
+  {
+    __m256 v;
+
+    SimdMask() = default;
+    SimdMask(__m256 in_v) : v{ in_v } {}
+    explicit SimdMask(bool value) : v{ _mm256_castsi256_ps(_mm256_set1_epi32(value ? -1 : 0)) } {}
+
+    static SimdMask FromBits(uint32_t bits)
+    {
+      __m128 low = SimdMask<4>::FromBits(bits).v;
+      __m128 high = SimdMask<4>::FromBits(bits >> 4).v;
+      return _mm256_insertf128_ps(_mm256_castps128_ps256(low), high, 1);
+    }
+
+    uint32_t Bits() const { return static_cast<uint32_t>(_mm256_movemask_ps(v)); }
+    bool operator[](int i) const { return (Bits() >> i) & 1u; }
+    bool Any() const { return Bits() != 0; }
+    bool All() const { return Bits() == 0xFF; }
+    bool None() const { return Bits() == 0; }
+
+    SimdMask operator&(const SimdMask& b) const { return _mm256_and_ps(v, b.v); }
+    SimdMask operator|(const SimdMask& b) const { return _mm256_or_ps(v, b.v); }
+    SimdMask operator^(const SimdMask& b) const { return _mm256_xor_ps(v, b.v); }
+    SimdMask operator~() const { return _mm256_xor_ps(v, _mm256_castsi256_ps(_mm256_set1_epi32(-1))); }
+  };
+
+  template <>
+  struct SimdFloat<8>
+  {
+    __m256 v;
+
+    SimdFloat() = default;
+    SimdFloat(__m256 in_v) : v{ in_v } {}
+    SimdFloat(float value) : v{ _mm256_set1_ps(value) } {}
+
+    static SimdFloat Load(const float* data) { return _mm256_loadu_ps(data); }
+    void Store(float* data) const { _mm256_storeu_ps(data, v); }
+
+    float operator[](int i) const { alignas(32) float lanes[8]; _mm256_store_ps(lanes, v); return lanes[i]; }
+
+    SimdFloat operator+(const SimdFloat& b) const { return _mm256_add_ps(v, b.v); }
+    SimdFloat operator-(const SimdFloat& b) const { return _mm256_sub_ps(v, b.v); }
+    SimdFloat operator*(const SimdFloat& b) const { return _mm256_mul_ps(v, b.v); }
+    SimdFloat operator/(const SimdFloat& b) const { return _mm256_div_ps(v, b.v); }
+    SimdFloat operator-() const { return _mm256_xor_ps(v, _mm256_set1_ps(-0.0f)); }
+
+    SimdMask<8> operator<(const SimdFloat& b) const { return _mm256_cmp_ps(v, b.v, _CMP_LT_OQ); }
+    SimdMask<8> operator<=(const SimdFloat& b) const { return _mm256_cmp_ps(v, b.v, _CMP_LE_OQ); }
+    SimdMask<8> operator>(const SimdFloat& b) const { return _mm256_cmp_ps(v, b.v, _CMP_GT_OQ); }
+    SimdMask<8> operator>=(const SimdFloat& b) const { return _mm256_cmp_ps(v, b.v, _CMP_GE_OQ); }
+    SimdMask<8> operator==(const SimdFloat& b) const { return _mm256_cmp_ps(v, b.v, _CMP_EQ_OQ); }
+  };
+
+  template <>
+  inline SimdFloat<8> Min(const SimdFloat<8>& a, const SimdFloat<8>& b) { return _mm256_min_ps(a.v, b.v); }
+  template <>
+  inline SimdFloat<8> Max(const SimdFloat<8>& a, const SimdFloat<8>& b) { return _mm256_max_ps(a.v, b.v); }
+  template <>
+  inline SimdFloat<8> Abs(const SimdFloat<8>& a) { return _mm256_andnot_ps(_mm256_set1_ps(-0.0f), a.v); }
+  template <>
+  inline SimdFloat<8> Sqrt(const SimdFloat<8>& a) { return _mm256_sqrt_ps(a.v); }
+
+  template <>
+  inline SimdFloat<8> Select(const SimdMask<8>& mask, const SimdFloat<8>& a, const SimdFloat<8>& b)
+  { return _mm256_blendv_ps(b.v, a.v, mask.v); }
+
+  template <>
+  inline float ReduceMin(const SimdFloat<8>& a)
+  {
+    SimdFloat<4> halves = _mm_min_ps(_mm256_castps256_ps128(a.v), _mm256_extractf128_ps(a.v, 1));
+    return ReduceMin(halves);
+  }
+
+  template <>
+  inline float ReduceMax(const SimdFloat<8>& a)
+  {
+    SimdFloat<4> halves = _mm_max_ps(_mm256_castps256_ps128(a.v), _mm256_extractf128_ps(a.v, 1));
+    return ReduceMax(halves);
+  }
+
+  // integer shifts of 256-bit vectors need AVX2, the scale goes by halves
+  template <>
+  inline SimdFloat<8> Exp(const SimdFloat<8>& a)
+  {
+    __m256 x = _mm256_min_ps(_mm256_max_ps(a.v, _mm256_set1_ps(-87.0f)), _mm256_set1_ps(88.0f));
+    __m256 t = _mm256_mul_ps(x, _mm256_set1_ps(1.44269504f));
+    __m256 rounded = _mm256_round_ps(t, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+    __m256 f = _mm256_sub_ps(t, rounded);
+    __m256i n = _mm256_cvtps_epi32(rounded);
+    __m256 scale = _mm256_insertf128_ps(_mm256_castps128_ps256(Exp2Scale(_mm256_castsi256_si128(n))),
+                                        Exp2Scale(_mm256_extractf128_si256(n, 1)), 1);
+    __m256 p = _mm256_set1_ps(1.3333558e-3f);
+    p = _mm256_add_ps(_mm256_mul_ps(p, f), _mm256_set1_ps(9.6181291e-3f));
+    p = _mm256_add_ps(_mm256_mul_ps(p, f), _mm256_set1_ps(5.5504109e-2f));
+    p = _mm256_add_ps(_mm256_mul_ps(p, f), _mm256_set1_ps(2.4022651e-1f));
+    p = _mm256_add_ps(_mm256_mul_ps(p, f), _mm256_set1_ps(6.9314718e-1f));
+    p = _mm256_add_ps(_mm256_mul_ps(p, f), _mm256_set1_ps(1.0f));
+    return _mm256_mul_ps(p, scale);
+  }
+#endif // VPT_AVX
+
+  // Twice a narrower width as two halves of it, so that packets wider than
+  // the native vectors still run on native instructions instead of the loops.
+#define VPT_SIMD_PAIR(N, H)                                                                                   \
+  template <>                                                                                                 \
+  struct SimdMask<N>                                                                                          \
+  {                                                                                                           \
+    SimdMask<H> low, high;                                                                                    \
+                                                                                                              \
+    SimdMask() = default;                                                                                     \
+    SimdMask(const SimdMask<H>& in_low, const SimdMask<H>& in_high) : low{ in_low }, high{ in_high } {}       \
+    explicit SimdMask(bool value) : low(value), high(value) {}                                                \
+                                                                                                              \
+    static SimdMask FromBits(uint32_t bits)                                                                   \
+    { return SimdMask(SimdMask<H>::FromBits(bits), SimdMask<H>::FromBits(bits >> H)); }                       \
+                                                                                                              \
+    uint32_t Bits() const { return low.Bits() | high.Bits() << H; }                                           \
+    bool operator[](int i) const { return (Bits() >> i) & 1u; }                                               \
+    bool Any() const { return Bits() != 0; }                                                                  \
+    bool All() const { return low.All() && high.All(); }                                                      \
+    bool None() const { return Bits() == 0; }                                                                 \
+                                                                                                              \
+    SimdMask operator&(const SimdMask& b) const { return SimdMask(low & b.low, high & b.high); }              \
+    SimdMask operator|(const SimdMask& b) const { return SimdMask(low | b.low, high | b.high); }              \
+    SimdMask operator^(const SimdMask& b) const { return SimdMask(low ^ b.low, high ^ b.high); }              \
+    SimdMask operator~() const { return SimdMask(~low, ~high); }                                              \
+  };                                                                                                          \
+                                                                                                              \
+  template <>                                                                                                 \
+  struct SimdFloat<N>                                                                                         \
+  {                                                                                                           \
+    SimdFloat<H> low, high;                                                                                   \
+                                                                                                              \
+    SimdFloat() = default;                                                                                    \
+    SimdFloat(const SimdFloat<H>& in_low, const SimdFloat<H>& in_high) : low{ in_low }, high{ in_high } {}    \
+    SimdFloat(float value) : low(value), high(value) {}                                                       \
+                                                                                                              \
+    static SimdFloat Load(const float* data)                                                                  \
+    { return SimdFloat(SimdFloat<H>::Load(data), SimdFloat<H>::Load(data + H)); }                             \
+    void Store(float* data) const { low.Store(data); high.Store(data + H); }                                  \
+                                                                                                              \
+    float operator[](int i) const { return i < H ? low[i] : high[i - H]; }                                    \
+                                                                                                              \
+    SimdFloat operator+(const SimdFloat& b) const { return SimdFloat(low + b.low, high + b.high); }            \
+    SimdFloat operator-(const SimdFloat& b) const { return SimdFloat(low - b.low, high - b.high); }            \
+    SimdFloat operator*(const SimdFloat& b) const { return SimdFloat(low * b.low, high * b.high); }            \
+    SimdFloat operator/(const SimdFloat& b) const { return SimdFloat(low / b.low, high / b.high); }            \
+    SimdFloat operator-() const { return SimdFloat(-low, -high); }                                            \
+                                                                                                              \
+    SimdMask<N> operator<(const SimdFloat& b) const { return SimdMask<N>(low < b.low, high < b.high); }       \
+    SimdMask<N> operator<=(const SimdFloat& b) const { return SimdMask<N>(low <= b.low, high <= b.high); }    \
+    SimdMask<N> operator>(const SimdFloat& b) const { return SimdMask<N>(low > b.low, high > b.high); }       \
+    SimdMask<N> operator>=(const SimdFloat& b) const { return SimdMask<N>(low >= b.low, high >= b.high); }    \
+    SimdMask<N> operator==(const SimdFloat& b) const { return SimdMask<N>(low == b.low, high == b.high); }    \
+  };                                                                                                          \
+                                                                                                              \
+  template <>                                                                                                 \
+  inline SimdFloat<N> Min(const SimdFloat<N>& a, const SimdFloat<N>& b)                                       \
+  { return SimdFloat<N>(Min(a.low, b.low), Min(a.high, b.high)); }                                            \
+  template <>                                                                                                 \
+  inline SimdFloat<N> Max(const SimdFloat<N>& a, const SimdFloat<N>& b)                                       \
+  { return SimdFloat<N>(Max(a.low, b.low), Max(a.high, b.high)); }                                            \
+  template <>                                                                                                 \
+  inline SimdFloat<N> Abs(const SimdFloat<N>& a) { return SimdFloat<N>(Abs(a.low), Abs(a.high)); }           \
+  template <>                                                                                                 \
+  inline SimdFloat<N> Sqrt(const SimdFloat<N>& a) { return SimdFloat<N>(Sqrt(a.low), Sqrt(a.high)); }        \
+  template <>                                                                                                 \
+  inline SimdFloat<N> Exp(const SimdFloat<N>& a) { return SimdFloat<N>(Exp(a.low), Exp(a.high)); }           \
+  template <>                                                                                                 \
+  inline SimdFloat<N> Select(const SimdMask<N>& mask, const SimdFloat<N>& a, const SimdFloat<N>& b)           \
+  { return SimdFloat<N>(Select(mask.low, a.low, b.low), Select(mask.high, a.high, b.high)); }                 \
+  template <>                                                                                                 \
+  inline float ReduceMin(const SimdFloat<N>& a)                                                               \
+  { float low = ReduceMin(a.low), high = ReduceMin(a.high); return high < low ? high : low; }                 \
+  template <>                                                                                                 \
+  inline float ReduceMax(const SimdFloat<N>& a)                                                               \
+  { float low = ReduceMax(a.low), high = ReduceMax(a.high); return high > low ? high : low; }
+
+#if defined(VPT_SSE) && !defined(VPT_AVX)
+  VPT_SIMD_PAIR(8, 4)
+#endif
+#ifdef VPT_SSE
+  VPT_SIMD_PAIR(16, 8)
+#endif
+#undef VPT_SIMD_PAIR
+
+} // namespace PathTracer
+#endif // SIMD_HPP
@@ -30,50 +30,50 @@ namespace VulkanInit
     SwapChainSupportDetails support;
     support.capabilities = device.getSurfaceCapabilitiesKHR(surface);
 
-    Debug::Log("Swapchain can support the following capabilities:");
-    Debug::Log("Minimum image count %i", support.capabilities.minImageCount);
-    Debug::Log("Maximum image count %i", support.capabilities.maxImageCount);
+    DEBUG_LOG(Vulkan, "Swapchain can support the following capabilities:");
+    DEBUG_LOG(Vulkan, "Minimum image count %i", support.capabilities.minImageCount);
+    DEBUG_LOG(Vulkan, "Maximum image count %i", support.capabilities.maxImageCount);
 
-    Debug::Log("Current extent:");
-    Debug::Log("Width: %i", support.capabilities.currentExtent.width);
-    Debug::Log("Height: %i", support.capabilities.currentExtent.height);
+    DEBUG_LOG(Vulkan, "Current extent:");
+    DEBUG_LOG(Vulkan, "Width: %i", support.capabilities.currentExtent.width);
+    DEBUG_LOG(Vulkan, "Height: %i", support.capabilities.currentExtent.height);
 
-    Debug::Log("Minimum supported extent:");
-    Debug::Log("Width: %i", support.capabilities.minImageExtent.width);
-    Debug::Log("Height: %i", support.capabilities.minImageExtent.height);
+    DEBUG_LOG(Vulkan, "Minimum supported extent:");
+    DEBUG_LOG(Vulkan, "Width: %i", support.capabilities.minImageExtent.width);
+    DEBUG_LOG(Vulkan, "Height: %i", support.capabilities.minImageExtent.height);
 
-    Debug::Log("Maximum supported extent:");
-    Debug::Log("Width: %i", support.capabilities.maxImageExtent.width);
-    Debug::Log("Height: %i", support.capabilities.maxImageExtent.height);
+    DEBUG_LOG(Vulkan, "Maximum supported extent:");
+    DEBUG_LOG(Vulkan, "Width: %i", support.capabilities.maxImageExtent.width);
+    DEBUG_LOG(Vulkan, "Height: %i", support.capabilities.maxImageExtent.height);
 
-    Debug::Log("Maximum image array layers: %i", support.capabilities.maxImageArrayLayers);
+    DEBUG_LOG(Vulkan, "Maximum image array layers: %i", support.capabilities.maxImageArrayLayers);
 
-    Debug::Log("Supported transforms:");
+    DEBUG_LOG(Vulkan, "Supported transforms:");
     std::vector<std::string> string_list = LogTransformBits(support.capabilities.supportedTransforms);
-    for (const std::string& line : string_list) Debug::Log("%s", line.c_str());
+    for (const std::string& line : string_list) DEBUG_LOG(Vulkan, "%s", line.c_str());
 
-    Debug::Log("Current transform:");
+    DEBUG_LOG(Vulkan, "Current transform:");
     string_list = LogTransformBits(support.capabilities.currentTransform);
-    for (const std::string& line : string_list) Debug::Log("%s", line.c_str());
+    for (const std::string& line : string_list) DEBUG_LOG(Vulkan, "%s", line.c_str());
 
-    Debug::Log("Supported alpha operations:");
+    DEBUG_LOG(Vulkan, "Supported alpha operations:");
     string_list = LogAlphaCompositeBits(support.capabilities.supportedCompositeAlpha);
-    for (const std::string& line : string_list) Debug::Log("%s", line.c_str());
+    for (const std::string& line : string_list) DEBUG_LOG(Vulkan, "%s", line.c_str());
 
-    Debug::Log("Supported image usage:");
+    DEBUG_LOG(Vulkan, "Supported image usage:");
     string_list = LodImageUsageBits(support.capabilities.supportedUsageFlags);
-    for (const std::string& line : string_list) Debug::Log("%s", line.c_str());
+    for (const std::string& line : string_list) DEBUG_LOG(Vulkan, "%s", line.c_str());
 
     support.formats = device.getSurfaceFormatsKHR(surface);
     for (vk::SurfaceFormatKHR supported_format : support.formats)
     {
-      Debug::Log("Supported pixel format: %s", vk::to_string(supported_format.format).c_str());
-      Debug::Log("Supported color space: %s", vk::to_string(supported_format.colorSpace).c_str());
+      DEBUG_LOG(Vulkan, "Supported pixel format: %s", vk::to_string(supported_format.format).c_str());
+      DEBUG_LOG(Vulkan, "Supported color space: %s", vk::to_string(supported_format.colorSpace).c_str());
     }
 
     support.present_modes = device.getSurfacePresentModesKHR(surface);
     for (vk::PresentModeKHR present_mode : support.present_modes)
-      Debug::Log("%s", LogPresentMode(present_mode).c_str());
+      DEBUG_LOG(Vulkan, "%s", LogPresentMode(present_mode).c_str());
 
     return support;
   }
@@ -161,7 +161,7 @@ namespace VulkanInit
 
     SwapChainBundle bundle {};
     try { bundle.swapchain = logical_device.createSwapchainKHR(create_info); }
-    catch (vk::SystemError err) { Debug::Error("Failed to create a Swapchain!"); }
+    catch (vk::SystemError err) { DEBUG_ERROR(Vulkan, "Failed to create a Swapchain!"); }
 
     std::vector<vk::Image> images = logical_device.getSwapchainImagesKHR(bundle.swapchain);
     bundle.frames.resize(images.size());
@@ -0,0 +1,107 @@
+
+#ifndef TEXTURE_HPP
+#define TEXTURE_HPP
+
+#include <VulkanPT/image.hpp>
+#include <VulkanPT/ray.hpp>
+#include <algorithm>
+#include <cmath>
+
+namespace PathTracer
+{
+  // Layout of the levels of a texture. Block compressed levels hold rows of
+  // 4x4 blocks in Image::texels, blocks at odd edges repeat the edge texels.
+  // BC5 keeps the red and green channels, as for normal maps.
+  enum class TextureFormat : uint32_t
+  {
+    RGBA8 = 0,
+    BC1,
+    BC5,
+    BC7
+  };
+
+  inline bool BlockCompressed(TextureFormat format) { return format != TextureFormat::RGBA8; }
+  inline uint32_t BlockBytes(TextureFormat format) { return format == TextureFormat::BC1 ? 8 : 16; }
+
+  // Bytes of one level, for compressed formats rounded up to whole blocks.
+  inline size_t LevelSize(TextureFormat format, uint32_t width, uint32_t height)
+  {
+    if (!BlockCompressed(format)) return static_cast<size_t>(width) * height * 4;
+    return static_cast<size_t>((width + 3) / 4) * ((height + 3) / 4) * BlockBytes(format);
+  }
+
+  // Mip chain of one image. Every level halves both sides rounding down until
+  // 1x1, the same chain Vulkan expects for an image of the size of level 0.
+  struct Texture
+  {
+    std::vector<Image> levels;
+    TextureFormat format { TextureFormat::RGBA8 };
+    // Texels are sRGB encoded, filtering and sampling happen on linear values.
+    bool srgb { false };
+
+    bool Valid() const { return !levels.empty() && levels[0].Valid(); }
+    uint32_t LevelCount() const { return static_cast<uint32_t>(levels.size()); }
+    uint32_t getWidth() const { return levels.empty() ? 0 : levels[0].width; }
+    uint32_t getHeight() const { return levels.empty() ? 0 : levels[0].height; }
+
+    // Trilinear with repeat addressing, lod is clamped to the chain. Returns
+    // linear RGBA, compressed levels are decoded like the hardware does.
+    glm::vec4 Sample(const glm::vec2& uv, float lod) const;
+    size_t Size() const;
+  };
+
+  uint32_t MipLevelCount(uint32_t width, uint32_t height);
+  // One RGBA8 texel to linear values.
+  glm::vec4 DecodeTexel(const uint8_t* texel, bool srgb);
+
+  // Takes over image as level 0 and box filters the rest of the chain, each
+  // level from the unrounded linear values of the one above. Odd sizes weigh
+  // the source texels by how much of them a destination texel covers.
+  void GenerateMipmaps(Image&& image, bool srgb, Texture& texture);
+
+  // Pixel footprint carried along a path as a cone, after Akenine-Moller et
+  // al., "Improved Shader and Texture Level of Detail Using Ray Cones" (JCGT
+  // 2021). 8 bytes of payload instead of the 48 of ray differentials. width
+  // is signed, a cone focused by a concave mirror passes through zero.
+  struct RayCone
+  {
+    float width { 0.0f };
+    float spread { 0.0f };
+
+    // The cone at distance t along its ray.
+    RayCone Propagate(float t) const { return { width + spread * t, spread }; }
+    // Continues the cone after a bounce, see SurfaceSpreadAngle.
+    RayCone Bounce(float surface_spread) const { return { width, spread + surface_spread }; }
+  };
+
+  // Cone through one pixel of a pinhole camera, vertical_fov in radians.
+  inline RayCone PrimaryRayCone(float vertical_fov, uint32_t image_height)
+  {
+    return { 0.0f, std::atan(2.0f * std::tan(vertical_fov * 0.5f) / static_cast<float>(image_height)) };
+  }
+
+  // Spread a reflection adds: the normals under the footprint turn by
+  // curvature times its width on the surface and the reflection doubles that.
+  // Convex surfaces have a positive curvature and widen the cone.
+  inline float SurfaceSpreadAngle(float curvature, float width, float cos_theta)
+  {
+    return 2.0f * curvature * std::abs(width) / std::max(std::abs(cos_theta), 1e-4f);
+  }
+
+  // Mip level for a cone arriving at a hit. uv_density is the per-triangle
+  // 0.5 * log2(uv area / world area) of SurfacePoint, cos_theta is taken
+  // against the geometric normal.
+  inline float TextureLod(const RayCone& cone, float uv_density, float cos_theta, uint32_t width, uint32_t height)
+  {
+    float texels = static_cast<float>(width) * static_cast<float>(height);
+    return uv_density + 0.5f * std::log2(texels) + std::log2(std::abs(cone.width)) -
+           std::log2(std::max(std::abs(cos_theta), 1e-4f));
+  }
+
+  inline float TextureLod(const RayCone& cone, float uv_density, float cos_theta, const Texture& texture)
+  {
+    return TextureLod(cone, uv_density, cos_theta, texture.getWidth(), texture.getHeight());
+  }
+
+} // namespace PathTracer
+#endif // TEXTURE_HPP
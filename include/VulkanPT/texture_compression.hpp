@@ -0,0 +1,50 @@
+
+#ifndef TEXTURE_COMPRESSION_HPP
+#define TEXTURE_COMPRESSION_HPP
+
+#include <VulkanPT/texture.hpp>
+#include <string>
+
+namespace PathTracer
+{
+  // Encodes one 4x4 block of RGBA8 texels, rows top to bottom. BC1 is opaque,
+  // BC5 keeps red and green and BC7 always uses mode 6 (RGBA, one subset).
+  void EncodeBlock(TextureFormat format, const uint8_t texels[64], uint8_t* block);
+  // Decodes texel index (y * 4 + x) of a block, what the sampler sees. BC7
+  // is only decoded for mode 6, the one EncodeBlock writes.
+  void DecodeBlockTexel(TextureFormat format, const uint8_t* block, uint32_t index, uint8_t texel[4]);
+
+  // Every level of an RGBA8 texture, one task per band of block rows.
+  void CompressTexture(const Texture& texture, TextureFormat format, Texture& compressed, Scheduler& scheduler);
+  // Back to RGBA8 for devices without BC support.
+  void DecompressTexture(const Texture& texture, Texture& decompressed);
+
+  struct TextureCompressionSettings
+  {
+    // Encoded chains are cached here by the hash of the source texels, so
+    // scenes sharing an image share its entry. Empty disables the cache.
+    std::string cache_directory;
+    // Opaque color textures use BC1 (8:1) instead of BC7 (4:1).
+    bool bc1_for_opaque { true };
+  };
+
+  struct TextureCompressionStats
+  {
+    uint64_t source_bytes { 0 };
+    uint64_t compressed_bytes { 0 };
+    uint32_t cache_hits { 0 };
+    uint32_t encoded { 0 };
+  };
+
+  struct Scene;
+
+  inline std::string TextureCacheDirectoryFor(const std::string& source_path) { return source_path + ".vpttex"; }
+
+  // Replaces scene.images with compressed mip chains in scene.mip_chains.
+  // Normal maps become BC5, color textures BC1 or BC7 and the rest BC7.
+  // Cache hits skip both mipmap generation and encoding.
+  TextureCompressionStats CompressTextures(Scene& scene, Scheduler& scheduler,
+                                           const TextureCompressionSettings& settings);
+
+} // namespace PathTracer
+#endif // TEXTURE_COMPRESSION_HPP
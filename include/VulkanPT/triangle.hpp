@@ -0,0 +1,344 @@
+
+#ifndef TRIANGLE_HPP
+#define TRIANGLE_HPP
+
+#include <VulkanPT/ray.hpp>
+#include <VulkanPT/simd.hpp>
+
+namespace PathTracer
+{
+#ifdef VPT_AVX
+  constexpr int triangle_block_width = 8;
+#else
+  constexpr int triangle_block_width = 4;
+#endif // VPT_AVX
+
+  // N triangles in SoA form as stored in BVH leaves, what the three points
+  // hold is up to the kernel that packed them. Unused lanes are NaN, which
+  // fails every comparison in the kernels; zeros would not be safe since a
+  // collapsed triangle relative to the ray origin rounds to a tiny area.
+  template <int N>
+  struct TriangleBlock
+  {
+    alignas(32) float p0[3][N];
+    alignas(32) float p1[3][N];
+    alignas(32) float p2[3][N];
+    uint32_t primitive[N];
+
+    void Clear()
+    {
+      const float nan = std::numeric_limits<float>::quiet_NaN();
+      for (int axis = 0; axis < 3; ++axis)
+      {
+        for (int lane = 0; lane < N; ++lane) p0[axis][lane] = p1[axis][lane] = p2[axis][lane] = nan;
+      }
+      for (int lane = 0; lane < N; ++lane) primitive[lane] = invalid_index;
+    }
+  };
+
+  // Per-packet data for the N-rays-against-one-triangle path.
+  template <int N>
+  struct PacketRays
+  {
+    SimdFloat<N> origin[3];
+    SimdFloat<N> direction[3];
+    // watertight shear, only filled by kernels that need it
+    SimdFloat<N> shear[3];
+    SimdMask<N> kx[3];
+    SimdMask<N> ky[3];
+    SimdMask<N> kz[3];
+  };
+
+  template <int N>
+  inline SimdFloat<N> SelectAxis(const SimdMask<N>* axis, const SimdFloat<N>* value)
+  { return Select(axis[0], value[0], Select(axis[1], value[1], value[2])); }
+
+  // Moller-Trumbore on precomputed edges: p0 = v0, p1 = v1 - v0, p2 = v2 - v0.
+  // Cheapest test, but neighbouring triangles can both miss along a shared edge.
+  struct MollerTrumboreKernel
+  {
+    static constexpr const char* name = "moller-trumbore";
+
+    // Rays closer to parallel than about 1e-7 radians are misses. The
+    // determinant is |d| |e1 x e2| times that sine, so the test is relative
+    // and holds for tiny and huge triangles alike.
+    template <int N>
+    static SimdMask<N> NotParallel(const SimdFloat<N>& determinant, const SimdFloat<N>* e1, const SimdFloat<N>* e2,
+                                   const SimdFloat<N>* d)
+    {
+      using Float = SimdFloat<N>;
+      Float e1_squared = e1[0] * e1[0] + e1[1] * e1[1] + e1[2] * e1[2];
+      Float e2_squared = e2[0] * e2[0] + e2[1] * e2[1] + e2[2] * e2[2];
+      Float d_squared = d[0] * d[0] + d[1] * d[1] + d[2] * d[2];
+      return determinant * determinant > Float(1e-14f) * (e1_squared * e2_squared) * d_squared;
+    }
+
+    struct RayData
+    {
+      glm::vec3 origin;
+      glm::vec3 direction;
+    };
+
+    template <int N>
+    static void Pack(TriangleBlock<N>& block, int lane, const glm::vec3& v0, const glm::vec3& v1,
+                     const glm::vec3& v2)
+    {
+      glm::vec3 edge1 = v1 - v0;
+      glm::vec3 edge2 = v2 - v0;
+      for (int axis = 0; axis < 3; ++axis)
+      {
+        block.p0[axis][lane] = v0[axis];
+        block.p1[axis][lane] = edge1[axis];
+        block.p2[axis][lane] = edge2[axis];
+      }
+    }
+
+    static RayData Prepare(const Ray& ray) { return { ray.origin, ray.direction }; }
+
+    // One ray against the N triangles of a block.
+    template <int N>
+    static SimdMask<N> Intersect(const TriangleBlock<N>& block, const RayData& ray, float tmin, float tmax,
+                                 SimdFloat<N>& t, SimdFloat<N>& u, SimdFloat<N>& v)
+    {
+      using Float = SimdFloat<N>;
+
+      Float e1[3], e2[3], to_origin[3];
+      for (int axis = 0; axis < 3; ++axis)
+      {
+        e1[axis] = Float::Load(block.p1[axis]);
+        e2[axis] = Float::Load(block.p2[axis]);
+        to_origin[axis] = Float(ray.origin[axis]) - Float::Load(block.p0[axis]);
+      }
+
+      Float d[3] = { Float(ray.direction.x), Float(ray.direction.y), Float(ray.direction.z) };
+      const Float& dx = d[0];
+      const Float& dy = d[1];
+      const Float& dz = d[2];
+      Float px = dy * e2[2] - dz * e2[1];
+      Float py = dz * e2[0] - dx * e2[2];
+      Float pz = dx * e2[1] - dy * e2[0];
+      Float determinant = e1[0] * px + e1[1] * py + e1[2] * pz;
+      Float inverse_determinant = Float(1.0f) / determinant;
+
+      u = (to_origin[0] * px + to_origin[1] * py + to_origin[2] * pz) * inverse_determinant;
+
+      Float qx = to_origin[1] * e1[2] - to_origin[2] * e1[1];
+      Float qy = to_origin[2] * e1[0] - to_origin[0] * e1[2];
+      Float qz = to_origin[0] * e1[1] - to_origin[1] * e1[0];
+      v = (dx * qx + dy * qy + dz * qz) * inverse_determinant;
+      t = (e2[0] * qx + e2[1] * qy + e2[2] * qz) * inverse_determinant;
+
+      return NotParallel<N>(determinant, e1, e2, d) & (u >= Float(0.0f)) & (v >= Float(0.0f)) &
+             (u + v <= Float(1.0f)) & (t > Float(tmin)) & (t < Float(tmax));
+    }
+
+    template <int N>
+    static void PreparePacket(PacketRays<N>&) {}
+
+    // N rays against one triangle of a block.
+    template <int N, int W>
+    static SimdMask<N> IntersectPacket(const TriangleBlock<W>& block, int lane, const PacketRays<N>& rays,
+                                       const SimdFloat<N>& tmin, const SimdFloat<N>& tmax,
+                                       SimdFloat<N>& t, SimdFloat<N>& u, SimdFloat<N>& v)
+    {
+      using Float = SimdFloat<N>;
+
+      Float e1[3], e2[3], to_origin[3];
+      for (int axis = 0; axis < 3; ++axis)
+      {
+        e1[axis] = Float(block.p1[axis][lane]);
+        e2[axis] = Float(block.p2[axis][lane]);
+        to_origin[axis] = rays.origin[axis] - Float(block.p0[axis][lane]);
+      }
+
+      const Float* d = rays.direction;
+      Float px = d[1] * e2[2] - d[2] * e2[1];
+      Float py = d[2] * e2[0] - d[0] * e2[2];
+      Float pz = d[0] * e2[1] - d[1] * e2[0];
+      Float determinant = e1[0] * px + e1[1] * py + e1[2] * pz;
+      Float inverse_determinant = Float(1.0f) / determinant;
+
+      u = (to_origin[0] * px + to_origin[1] * py + to_origin[2] * pz) * inverse_determinant;
+
+      Float qx = to_origin[1] * e1[2] - to_origin[2] * e1[1];
+      Float qy = to_origin[2] * e1[0] - to_origin[0] * e1[2];
+      Float qz = to_origin[0] * e1[1] - to_origin[1] * e1[0];
+      v = (d[0] * qx + d[1] * qy + d[2] * qz) * inverse_determinant;
+      t = (e2[0] * qx + e2[1] * qy + e2[2] * qz) * inverse_determinant;
+
+      return NotParallel<N>(determinant, e1, e2, d) & (u >= Float(0.0f)) & (v >= Float(0.0f)) &
+             (u + v <= Float(1.0f)) & (t > tmin) & (t < tmax);
+    }
+  };
+
+  // Woop, Benthin and Wald, "Watertight Ray/Triangle Intersection" (JCGT 2013),
+  // on raw vertices: p0 = v0, p1 = v1, p2 = v2. Shared edges evaluate the same
+  // edge function in both triangles, so rays can't slip through a mesh. That
+  // only holds without FMA contraction, which premake5.lua turns off for GCC
+  // and Clang (-ffp-contract=off); MSVC's /fp:precise doesn't contract.
+  struct WatertightKernel
+  {
+    static constexpr const char* name = "watertight";
+
+    struct RayData
+    {
+      glm::vec3 origin;
+      int kx, ky, kz;
+      float sx, sy, sz;
+    };
+
+    template <int N>
+    static void Pack(TriangleBlock<N>& block, int lane, const glm::vec3& v0, const glm::vec3& v1,
+                     const glm::vec3& v2)
+    {
+      for (int axis = 0; axis < 3; ++axis)
+      {
+        block.p0[axis][lane] = v0[axis];
+        block.p1[axis][lane] = v1[axis];
+        block.p2[axis][lane] = v2[axis];
+      }
+    }
+
+    static void ShearAxes(const glm::vec3& direction, int& kx, int& ky, int& kz)
+    {
+      glm::vec3 magnitude = glm::abs(direction);
+      kz = magnitude.x > magnitude.y ? (magnitude.x > magnitude.z ? 0 : 2) :
+                                       (magnitude.y > magnitude.z ? 1 : 2);
+      kx = (kz + 1) % 3;
+      ky = (kx + 1) % 3;
+      // keep the winding independent of the direction sign
+      if (direction[kz] < 0.0f)
+      {
+        int swap = kx;
+        kx = ky;
+        ky = swap;
+      }
+    }
+
+    static RayData Prepare(const Ray& ray)
+    {
+      RayData data;
+      data.origin = ray.origin;
+      ShearAxes(ray.direction, data.kx, data.ky, data.kz);
+      data.sx = ray.direction[data.kx] / ray.direction[data.kz];
+      data.sy = ray.direction[data.ky] / ray.direction[data.kz];
+      data.sz = 1.0f / ray.direction[data.kz];
+      return data;
+    }
+
+    template <int N>
+    static SimdMask<N> Resolve(const SimdFloat<N>* a, const SimdFloat<N>* b, const SimdFloat<N>* c,
+                               const SimdFloat<N>& sx, const SimdFloat<N>& sy, const SimdFloat<N>& sz,
+                               const SimdFloat<N>& tmin, const SimdFloat<N>& tmax,
+                               SimdFloat<N>& t, SimdFloat<N>& u, SimdFloat<N>& v)
+    {
+      using Float = SimdFloat<N>;
+
+      // a, b, c hold the vertices relative to the origin in kx, ky, kz order
+      Float ax = a[0] - sx * a[2], ay = a[1] - sy * a[2];
+      Float bx = b[0] - sx * b[2], by = b[1] - sy * b[2];
+      Float cx = c[0] - sx * c[2], cy = c[1] - sy * c[2];
+
+      Float edge_u = cx * by - cy * bx;
+      Float edge_v = ax * cy - ay * cx;
+      Float edge_w = bx * ay - by * ax;
+
+      Float zero(0.0f);
+      SimdMask<N> inside = ((edge_u >= zero) & (edge_v >= zero) & (edge_w >= zero)) |
+                           ((edge_u <= zero) & (edge_v <= zero) & (edge_w <= zero));
+
+      Float determinant = edge_u + edge_v + edge_w;
+      Float scaled_t = (edge_u * a[2] + edge_v * b[2] + edge_w * c[2]) * sz;
+      Float inverse_determinant = Float(1.0f) / determinant;
+
+      t = scaled_t * inverse_determinant;
+      u = edge_v * inverse_determinant;
+      v = edge_w * inverse_determinant;
+
+      return inside & ~(determinant == zero) & (t > tmin) & (t < tmax);
+    }
+
+    template <int N>
+    static SimdMask<N> Intersect(const TriangleBlock<N>& block, const RayData& ray, float tmin, float tmax,
+                                 SimdFloat<N>& t, SimdFloat<N>& u, SimdFloat<N>& v)
+    {
+      using Float = SimdFloat<N>;
+
+      const int order[3] = { ray.kx, ray.ky, ray.kz };
+      Float a[3], b[3], c[3];
+      for (int i = 0; i < 3; ++i)
+      {
+        Float origin(ray.origin[order[i]]);
+        a[i] = Float::Load(block.p0[order[i]]) - origin;
+        b[i] = Float::Load(block.p1[order[i]]) - origin;
+        c[i] = Float::Load(block.p2[order[i]]) - origin;
+      }
+
+      return Resolve<N>(a, b, c, Float(ray.sx), Float(ray.sy), Float(ray.sz), Float(tmin), Float(tmax), t, u, v);
+    }
+
+    template <int N>
+    static void PreparePacket(PacketRays<N>& rays)
+    {
+      using Float = SimdFloat<N>;
+
+      alignas(32) float direction[3][N];
+      alignas(32) float shear[3][N];
+      uint32_t kx_bits[3] = {}, ky_bits[3] = {}, kz_bits[3] = {};
+      for (int axis = 0; axis < 3; ++axis) rays.direction[axis].Store(direction[axis]);
+
+      for (int lane = 0; lane < N; ++lane)
+      {
+        glm::vec3 lane_direction(direction[0][lane], direction[1][lane], direction[2][lane]);
+        int kx, ky, kz;
+        ShearAxes(lane_direction, kx, ky, kz);
+        shear[0][lane] = lane_direction[kx] / lane_direction[kz];
+        shear[1][lane] = lane_direction[ky] / lane_direction[kz];
+        shear[2][lane] = 1.0f / lane_direction[kz];
+        kx_bits[kx] |= 1u << lane;
+        ky_bits[ky] |= 1u << lane;
+        kz_bits[kz] |= 1u << lane;
+      }
+
+      for (int axis = 0; axis < 3; ++axis)
+      {
+        rays.shear[axis] = Float::Load(shear[axis]);
+        rays.kx[axis] = SimdMask<N>::FromBits(kx_bits[axis]);
+        rays.ky[axis] = SimdMask<N>::FromBits(ky_bits[axis]);
+        rays.kz[axis] = SimdMask<N>::FromBits(kz_bits[axis]);
+      }
+    }
+
+    template <int N, int W>
+    static SimdMask<N> IntersectPacket(const TriangleBlock<W>& block, int lane, const PacketRays<N>& rays,
+                                       const SimdFloat<N>& tmin, const SimdFloat<N>& tmax,
+                                       SimdFloat<N>& t, SimdFloat<N>& u, SimdFloat<N>& v)
+    {
+      using Float = SimdFloat<N>;
+
+      Float a[3], b[3], c[3];
+      for (int axis = 0; axis < 3; ++axis)
+      {
+        a[axis] = Float(block.p0[axis][lane]) - rays.origin[axis];
+        b[axis] = Float(block.p1[axis][lane]) - rays.origin[axis];
+        c[axis] = Float(block.p2[axis][lane]) - rays.origin[axis];
+      }
+
+      // every lane has its own axis order
+      Float a_sheared[3] = { SelectAxis(rays.kx, a), SelectAxis(rays.ky, a), SelectAxis(rays.kz, a) };
+      Float b_sheared[3] = { SelectAxis(rays.kx, b), SelectAxis(rays.ky, b), SelectAxis(rays.kz, b) };
+      Float c_sheared[3] = { SelectAxis(rays.kx, c), SelectAxis(rays.ky, c), SelectAxis(rays.kz, c) };
+
+      return Resolve<N>(a_sheared, b_sheared, c_sheared, rays.shear[0], rays.shear[1], rays.shear[2],
+                        tmin, tmax, t, u, v);
+    }
+  };
+
+#ifdef VPT_FAST_TRIANGLE_TEST
+  using DefaultTriangleKernel = MollerTrumboreKernel;
+#else
+  using DefaultTriangleKernel = WatertightKernel;
+#endif // VPT_FAST_TRIANGLE_TEST
+
+} // namespace PathTracer
+#endif // TRIANGLE_HPP
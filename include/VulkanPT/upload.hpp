@@ -0,0 +1,278 @@
+
+#ifndef UPLOAD_HPP
+#define UPLOAD_HPP
+
+#include <VulkanPT/config.hpp>
+#include <VulkanPT/curve.hpp>
+#include <VulkanPT/denoiser.hpp>
+#include <VulkanPT/environment.hpp>
+#include <VulkanPT/light_bvh.hpp>
+#include <VulkanPT/path_termination.hpp>
+#include <VulkanPT/radiance_cache.hpp>
+#include <VulkanPT/restir.hpp>
+#include <VulkanPT/sampler.hpp>
+#include <VulkanPT/scene.hpp>
+#include <VulkanPT/virtual_texture.hpp>
+#include <VulkanPT/volume.hpp>
+#include <mutex>
+
+namespace VulkanUtils
+{
+  struct DeviceBuffer
+  {
+    vk::Buffer buffer { nullptr };
+    vk::DeviceMemory memory { nullptr };
+    vk::DeviceSize size { 0 };
+  };
+
+  uint32_t FindMemoryType(vk::PhysicalDevice physical_device, uint32_t type_bits,
+                          vk::MemoryPropertyFlags properties);
+  DeviceBuffer CreateBuffer(vk::PhysicalDevice physical_device, vk::Device device, vk::DeviceSize size,
+                            vk::BufferUsageFlags usage, vk::MemoryPropertyFlags properties);
+  void DestroyBuffer(vk::Device device, DeviceBuffer& buffer);
+
+  struct DeviceImage
+  {
+    vk::Image image { nullptr };
+    vk::DeviceMemory memory { nullptr };
+    vk::ImageView view { nullptr };
+    uint32_t levels { 0 };
+  };
+
+  void DestroyImage(vk::Device device, DeviceImage& image);
+
+  // Persistently mapped staging buffer split into slots that are recorded and
+  // submitted in turn. Upload only blocks when it wraps around onto a slot
+  // whose copies are still in flight, so loaders keep parsing while earlier
+  // slices transfer.
+  //
+  // The slot fences only order the ring against itself, the ring signals no
+  // semaphores. Work that reads a destination must either be submitted after
+  // Wait() returns, or go to the same queue after Flush() and begin with a
+  // barrier from transfer writes to its own reads. Images get that barrier
+  // from UploadImage and UploadImageRegion, buffers don't. Destinations must
+  // stay alive until Wait() returns.
+  class UploadRing
+  {
+   public:
+    // Logs and leaves the ring invalid if the staging buffer, its mapping or
+    // the command buffers can't be created, every call is ignored then.
+    UploadRing(vk::PhysicalDevice physical_device, vk::Device in_device, uint32_t queue_family,
+               vk::Queue in_queue, vk::DeviceSize capacity = 64ull << 20, uint32_t slot_count = 4);
+    ~UploadRing();
+
+    bool Valid() const { return mapped != nullptr; }
+
+    // Thread safe, data can be released as soon as the call returns.
+    void Upload(vk::Buffer destination, vk::DeviceSize offset, const void* data, vk::DeviceSize size);
+    // Copies one level in slices of whole texel or block rows. The level goes
+    // from undefined to transfer dst before its first slice and to shader
+    // read only after its last, on the queue of the ring.
+    void UploadImage(vk::Image destination, uint32_t level, uint32_t width, uint32_t height, const void* data,
+                     PathTracer::TextureFormat format = PathTracer::TextureFormat::RGBA8);
+    // Moves every level of an image from undefined to layout.
+    void PrepareImage(vk::Image destination, uint32_t levels, vk::ImageLayout layout);
+    // Copies RGBA8 texels into a rectangle of level 0 of an image in the
+    // general layout, which shaders keep sampling elsewhere meanwhile.
+    void UploadImageRegion(vk::Image destination, vk::Offset2D offset, uint32_t width, uint32_t height,
+                           const void* data);
+    // Submits the slot being recorded.
+    void Flush();
+    // Flushes and blocks until every copy finished.
+    void Wait();
+
+    vk::DeviceSize getUploadedBytes() const { return uploaded_bytes; }
+
+   private:
+    struct Slot
+    {
+      vk::CommandBuffer command_buffer { nullptr };
+      vk::Fence fence { nullptr };
+      vk::DeviceSize used { 0 };
+      bool recording { false };
+    };
+
+    Slot& Acquire();
+    void Submit(Slot& slot);
+    // Destroys whatever the constructor created, without waiting.
+    void Release();
+
+    vk::Device device { nullptr };
+    vk::Queue queue { nullptr };
+    vk::CommandPool command_pool { nullptr };
+    DeviceBuffer staging;
+    uint8_t* mapped { nullptr };
+    vk::DeviceSize slot_size { 0 };
+    std::vector<Slot> slots;
+    uint32_t current { 0 };
+    vk::DeviceSize uploaded_bytes { 0 };
+    std::mutex mutex;
+  };
+
+  // Device local buffers for the sections of a loaded scene.
+  struct SceneBuffers
+  {
+    DeviceBuffer sections[static_cast<uint32_t>(PathTracer::SceneSection::Count)];
+  };
+
+  // Stream target for the scene loaders, allocates each buffer on its first
+  // slice and pushes every slice through the ring. Texture paths are skipped.
+  PathTracer::SceneStreamFunction StreamToDevice(vk::PhysicalDevice physical_device, vk::Device device,
+                                                 UploadRing& ring, SceneBuffers& buffers);
+  void DestroySceneBuffers(vk::Device device, SceneBuffers& buffers);
+
+  vk::Format TextureFormatFor(PathTracer::TextureFormat format, bool srgb);
+  // Requires the format to be sampleable with optimal tiling, BC formats
+  // are optional on some mobile and integrated devices.
+  bool SupportsTextureFormat(vk::PhysicalDevice physical_device, PathTracer::TextureFormat format, bool srgb);
+
+  // Sampled image with the whole mip chain of texture, which the loaders
+  // generate on the CPU so both backends filter the same levels and no format
+  // needs linear blit support. sRGB textures use an sRGB format. Block
+  // compressed chains the device can't sample are decoded to RGBA8 first.
+  DeviceImage CreateTexture(vk::PhysicalDevice physical_device, vk::Device device, UploadRing& ring,
+                            const PathTracer::Texture& texture);
+
+  // Device side of a VirtualTextureCache: the tile pool as one RGBA8 image
+  // in the general layout, the page table and the texture descriptors. The
+  // pool is unorm, shaders decode sRGB tiles by the descriptor flag.
+  struct VirtualTexturePool
+  {
+    DeviceImage tiles;
+    uint32_t columns { 0 };
+    DeviceBuffer page_table;
+    DeviceBuffer descriptors;
+  };
+
+  VirtualTexturePool CreateVirtualTexturePool(vk::PhysicalDevice physical_device, vk::Device device, UploadRing& ring,
+                                              const PathTracer::VirtualTextureSettings& settings);
+  // The TileUpload of the cache, tiles go to slot % columns, slot / columns.
+  PathTracer::VirtualTextureCache::TileUpload UploadTiles(UploadRing& ring, const VirtualTexturePool& pool);
+  // After VirtualTextureCache::Update, uploads the page table entries it
+  // changed. The buffers are created on the first call.
+  void UpdateVirtualTexturePool(vk::PhysicalDevice physical_device, vk::Device device, UploadRing& ring,
+                                VirtualTexturePool& pool, PathTracer::VirtualTextureCache& cache);
+  void DestroyVirtualTexturePool(vk::Device device, VirtualTexturePool& pool);
+
+  // Storage buffers of an environment light: radiance as vec4 per texel with
+  // the intensity applied, the marginal alias table and the conditional
+  // tables of all rows.
+  struct EnvironmentBuffers
+  {
+    DeviceBuffer radiance;
+    DeviceBuffer marginal;
+    DeviceBuffer conditional;
+  };
+
+  EnvironmentBuffers CreateEnvironmentBuffers(vk::PhysicalDevice physical_device, vk::Device device, UploadRing& ring,
+                                              const PathTracer::EnvironmentLight& light);
+  void DestroyEnvironmentBuffers(vk::Device device, EnvironmentBuffers& buffers);
+
+  // Storage buffers of the lights, the light BVH nodes and the leaf of every
+  // light, the last one for the pmf of lights hit by BSDF samples.
+  struct LightBVHBuffers
+  {
+    DeviceBuffer lights;
+    DeviceBuffer nodes;
+    DeviceBuffer light_leaves;
+  };
+
+  LightBVHBuffers CreateLightBVHBuffers(vk::PhysicalDevice physical_device, vk::Device device, UploadRing& ring,
+                                        const std::vector<PathTracer::Light>& lights,
+                                        const PathTracer::LightBVH& bvh);
+  // After LightBVH::Refit, which keeps every size, overwrites lights and nodes.
+  void UpdateLightBVHBuffers(UploadRing& ring, LightBVHBuffers& buffers, const std::vector<PathTracer::Light>& lights,
+                             const PathTracer::LightBVH& bvh);
+  void DestroyLightBVHBuffers(vk::Device device, LightBVHBuffers& buffers);
+
+  // Device-local storage for ReSTIR, written and read only by the device:
+  // three reservoir buffers per set, indexed by PathTracer::ReSTIRBufferIndex,
+  // and the primary surfaces of every set for the similarity tests of the
+  // temporal pass.
+  struct ReSTIRBuffers
+  {
+    std::vector<DeviceBuffer> reservoirs;
+    std::vector<DeviceBuffer> surfaces;
+  };
+
+  ReSTIRBuffers CreateReSTIRBuffers(vk::PhysicalDevice physical_device, vk::Device device, uint32_t width,
+                                    uint32_t height, uint32_t frames_in_flight);
+  void DestroyReSTIRBuffers(vk::Device device, ReSTIRBuffers& buffers);
+
+  // Sobol matrices and the blue-noise dither array of the device samplers.
+  struct SamplerBuffers
+  {
+    DeviceBuffer sobol;
+    DeviceBuffer blue_noise;
+  };
+
+  SamplerBuffers CreateSamplerBuffers(vk::PhysicalDevice physical_device, vk::Device device, UploadRing& ring,
+                                      const PathTracer::SamplerTables& tables);
+  void DestroySamplerBuffers(vk::Device device, SamplerBuffers& buffers);
+
+  // Device-local planes of the denoiser, two of each to ping-pong between
+  // frames or a-trous iterations: the guides of this and the previous frame,
+  // the color history as vec4 with the history length in w, the luminance
+  // moments as vec2 and the filter iterations as vec4 with the variance in w.
+  struct DenoiserBuffers
+  {
+    DeviceBuffer guides[2];
+    DeviceBuffer history[2];
+    DeviceBuffer moments[2];
+    DeviceBuffer filter[2];
+  };
+
+  DenoiserBuffers CreateDenoiserBuffers(vk::PhysicalDevice physical_device, vk::Device device, uint32_t width,
+                                        uint32_t height);
+  void DestroyDenoiserBuffers(vk::Device device, DenoiserBuffers& buffers);
+
+  // Radiance cache table: the entries as the cache holds them, whose
+  // checksums the device claims slots on with atomicCompSwap, and the fixed
+  // point sums of a frame, rgb and count per slot, starting at zero.
+  struct RadianceCacheBuffers
+  {
+    DeviceBuffer entries;
+    DeviceBuffer sums;
+  };
+
+  RadianceCacheBuffers CreateRadianceCacheBuffers(vk::PhysicalDevice physical_device, vk::Device device,
+                                                  UploadRing& ring, const PathTracer::RadianceCache& cache);
+  void DestroyRadianceCacheBuffers(vk::Device device, RadianceCacheBuffers& buffers);
+
+  // Device-local PathTracer::PathCounters the shaders add to over a frame,
+  // zeroed here and copied out as a transfer source for the statistics.
+  DeviceBuffer CreatePathCounterBuffer(vk::PhysicalDevice physical_device, vk::Device device, UploadRing& ring);
+
+  // A sparse volume on the device: the cell table, majorants and brick
+  // ranges copied from the mapping once, the page table from bricks to pool
+  // slots and the pool of resident 8 bit bricks.
+  struct VolumeBuffers
+  {
+    DeviceBuffer cells;
+    DeviceBuffer majorants;
+    DeviceBuffer bricks;
+    DeviceBuffer page_table;
+    DeviceBuffer pool;
+  };
+
+  VolumeBuffers CreateVolumeBuffers(vk::PhysicalDevice physical_device, vk::Device device, UploadRing& ring,
+                                    const PathTracer::SparseVolume& volume);
+  // After SparseVolume::Update, copies the page table and the slots it filled.
+  void UpdateVolumeBuffers(UploadRing& ring, VolumeBuffers& buffers, const PathTracer::SparseVolume& volume);
+  void DestroyVolumeBuffers(vk::Device device, VolumeBuffers& buffers);
+
+  // A curve BVH on the device: its nodes, and its pieces as
+  // PathTracer::GpuCurvePiece in leaf order with empty lanes kept, so that
+  // leaves index them like the CPU blocks.
+  struct CurveBuffers
+  {
+    DeviceBuffer nodes;
+    DeviceBuffer pieces;
+  };
+
+  CurveBuffers CreateCurveBuffers(vk::PhysicalDevice physical_device, vk::Device device, UploadRing& ring,
+                                  const PathTracer::CurveBVH& bvh);
+  void DestroyCurveBuffers(vk::Device device, CurveBuffers& buffers);
+
+} // namespace VulkanUtils
+#endif // UPLOAD_HPP
@@ -0,0 +1,208 @@
+
+#ifndef VIRTUAL_TEXTURE_HPP
+#define VIRTUAL_TEXTURE_HPP
+
+#include <VulkanPT/mapped_file.hpp>
+#include <VulkanPT/texture.hpp>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+namespace PathTracer
+{
+  // Pages cover 128x128 texels of one mip level. Stored tiles repeat 4 texels
+  // of their neighbours on every side, so bilinear and 4x4 block fetches near
+  // a page edge stay inside the tile in the physical pool.
+  constexpr uint32_t virtual_page_size = 128;
+  constexpr uint32_t virtual_page_border = 4;
+  constexpr uint32_t virtual_tile_size = virtual_page_size + 2 * virtual_page_border;
+  constexpr uint32_t virtual_tile_bytes = virtual_tile_size * virtual_tile_size * 4;
+  constexpr uint32_t non_resident_page = 0xFFFFFFFFu;
+  // 64K texels per side
+  constexpr uint32_t virtual_max_levels = 17;
+
+  // 16 bytes per texture, std430. Pages of a texture are numbered level by
+  // level, row by row from first_page, so a shader finds a page by summing
+  // the page counts of the finer levels.
+  struct VirtualTextureDescriptor
+  {
+    uint32_t width { 0 };
+    uint32_t height { 0 };
+    uint32_t first_page { 0 };
+    // level count in the low 16 bits, bit 16 for sRGB texels
+    uint32_t flags { 0 };
+  };
+
+  // Pages of one level, levels smaller than a page take one.
+  inline uint32_t PagesAcross(uint32_t size, uint32_t level)
+  {
+    return (std::max(size >> level, 1u) + virtual_page_size - 1) / virtual_page_size;
+  }
+
+  // Fills a stored tile, border included, from a level with repeat addressing.
+  void ExtractTile(const Image& level, uint32_t page_x, uint32_t page_y, uint8_t* tile);
+
+  // Tiles of one RGBA8 mip chain in a file, in page order, read through a
+  // mapping so only touched tiles are paged in.
+  class TileFile
+  {
+   public:
+    static bool Write(const std::string& path, const Texture& texture);
+
+    bool Open(const std::string& path);
+    bool ReadTile(uint32_t level, uint32_t page_x, uint32_t page_y, uint8_t* tile) const;
+
+    uint32_t getWidth() const { return width; }
+    uint32_t getHeight() const { return height; }
+    uint32_t getLevelCount() const { return level_count; }
+    bool isSrgb() const { return srgb; }
+
+   private:
+    MappedFile file;
+    uint32_t width { 0 };
+    uint32_t height { 0 };
+    uint32_t level_count { 0 };
+    bool srgb { false };
+    std::vector<uint64_t> level_offsets;
+  };
+
+  struct VirtualTextureSettings
+  {
+    // Physical pool capacity in tiles, the only memory that grows with use.
+    uint32_t pool_tiles { 1024 };
+    // Loads started per Update, bounds the upload traffic of one frame.
+    uint32_t max_loads_per_update { 256 };
+  };
+
+  struct VirtualTextureStats
+  {
+    uint64_t requests { 0 };
+    uint64_t loads { 0 };
+    uint64_t evictions { 0 };
+    uint32_t resident { 0 };
+    uint32_t pending { 0 };
+  };
+
+  // Page table, feedback and LRU pool for any number of virtual textures.
+  // Shading marks the pages it wants in the feedback bits (one per page,
+  // atomicOr on the device), Update turns them into loads for the background
+  // thread and publishes finished tiles. Missing pages fall back to the
+  // closest coarser resident level, the levels that fit into one page are
+  // loaded up front and never evicted, so every lookup resolves.
+  class VirtualTextureCache
+  {
+   public:
+    // Fills a stored tile of virtual_tile_bytes, called on the loader thread.
+    using TileSource = std::function<bool(uint32_t texture, uint32_t level, uint32_t page_x, uint32_t page_y,
+                                          uint8_t* tile)>;
+    // Copies a finished tile to its slot of the device pool, e.g. through
+    // the upload ring. Called on the loader thread before the page is
+    // published, so the page table upload of the next Update comes after it.
+    using TileUpload = std::function<void(uint32_t slot, const uint8_t* tile)>;
+
+    VirtualTextureCache(VirtualTextureSettings in_settings, TileSource in_source, TileUpload in_upload = TileUpload());
+    ~VirtualTextureCache();
+
+    // Textures are added before Start.
+    uint32_t AddTexture(uint32_t width, uint32_t height, uint32_t level_count, bool srgb);
+    // Loads the pinned levels and starts the loader thread.
+    bool Start();
+
+    uint32_t PageIndex(uint32_t texture, uint32_t level, uint32_t page_x, uint32_t page_y) const;
+    void Request(uint32_t page)
+    { feedback[page >> 5].fetch_or(1u << (page & 31), std::memory_order_relaxed); }
+    // Merges feedback read back from the device.
+    void AddFeedback(const uint32_t* words, size_t count);
+
+    // Trilinear like Texture::Sample, requests the pages it needs and reads
+    // the resident ones. Not concurrent with Update.
+    glm::vec4 Sample(uint32_t texture, const glm::vec2& uv, float lod);
+    // The finest level that Sample reads at uv right now.
+    uint32_t ResidentLevel(uint32_t texture, const glm::vec2& uv, uint32_t level) const;
+
+    // Frame boundary: publishes finished tiles, turns the feedback into
+    // loads and evicts the least recently used tiles for them.
+    void Update();
+    // Blocks until every started load is published, for tests and tools.
+    void Flush();
+
+    // Page table entries changed since the last call, as one range.
+    bool TakeDirtyRange(uint32_t& first, uint32_t& count);
+
+    const std::vector<uint32_t>& getPageTable() const { return page_table; }
+    const std::vector<VirtualTextureDescriptor>& getDescriptors() const { return descriptors; }
+    uint32_t getPageCount() const { return static_cast<uint32_t>(page_table.size()); }
+    uint32_t getPoolTiles() const { return settings.pool_tiles; }
+    const uint8_t* getTile(uint32_t slot) const { return &pool[static_cast<size_t>(slot) * virtual_tile_bytes]; }
+    const VirtualTextureStats& getStats() const { return stats; }
+
+   private:
+    struct PageAddress
+    {
+      uint32_t texture;
+      uint32_t level;
+      uint32_t x;
+      uint32_t y;
+    };
+
+    struct Load
+    {
+      uint32_t page;
+      uint32_t slot;
+      bool success;
+    };
+
+    PageAddress Address(uint32_t page) const;
+    bool Allocate(uint32_t& slot);
+    void Touch(uint32_t slot);
+    void Unlink(uint32_t slot);
+    void PushFront(uint32_t slot);
+    void MarkDirty(uint32_t page);
+    void PublishFinished();
+    glm::vec4 SampleLevel(uint32_t texture, const glm::vec2& uv, uint32_t level, bool request);
+    void LoaderLoop();
+
+    VirtualTextureSettings settings;
+    TileSource source;
+    TileUpload upload;
+
+    std::vector<VirtualTextureDescriptor> descriptors;
+    // first page of every level of every texture, texture * virtual_max_levels + level
+    std::vector<uint32_t> level_pages;
+    std::vector<uint32_t> page_table;
+    std::unique_ptr<std::atomic<uint32_t>[]> feedback;
+    size_t feedback_words { 0 };
+    std::vector<uint8_t> pending_pages;
+
+    std::vector<uint8_t> pool;
+    std::vector<uint32_t> slot_pages;
+    std::vector<uint64_t> slot_frames;
+    std::vector<uint8_t> slot_pinned;
+    // LRU list over slots, most recent at the head
+    std::vector<uint32_t> previous;
+    std::vector<uint32_t> next;
+    uint32_t head { non_resident_page };
+    uint32_t tail { non_resident_page };
+    std::vector<uint32_t> free_slots;
+    uint64_t frame { 1 };
+
+    uint32_t dirty_first { non_resident_page };
+    uint32_t dirty_last { 0 };
+    VirtualTextureStats stats;
+
+    std::thread loader;
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::condition_variable idle;
+    std::deque<Load> queue;
+    std::vector<Load> finished;
+    uint32_t in_flight { 0 };
+    bool stopping { false };
+  };
+
+} // namespace PathTracer
+#endif // VIRTUAL_TEXTURE_HPP
@@ -0,0 +1,156 @@
+
+#ifndef VOLUME_HPP
+#define VOLUME_HPP
+
+#include <VulkanPT/mapped_file.hpp>
+#include <VulkanPT/ray.hpp>
+#include <VulkanPT/sampler.hpp>
+#include <atomic>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace PathTracer
+{
+  // Bricks cover 8x8x8 voxels, one cell of the majorant grid each.
+  constexpr uint32_t volume_brick_size = 8;
+  constexpr uint32_t volume_brick_voxels = volume_brick_size * volume_brick_size * volume_brick_size;
+  // Cells without a brick, and bricks without a pool slot.
+  constexpr uint32_t empty_brick = 0xFFFFFFFFu;
+  constexpr uint32_t non_resident_brick = 0xFFFFFFFFu;
+
+  // 32 bytes, std430. Voxel grid placement, cells across every axis and the
+  // largest density of the whole volume.
+  struct VolumeDescriptor
+  {
+    glm::vec3 origin { 0.0f };
+    float voxel_size { 1.0f };
+    uint32_t cells[3] { 0, 0, 0 };
+    float maximum { 0.0f };
+  };
+  static_assert(sizeof(VolumeDescriptor) == 32, "VolumeDescriptor must match the std430 layout");
+
+  // 16 bytes, std430. Voxels of a brick are 8 bit steps of scale above
+  // minimum, average stands in while the brick is not resident.
+  struct VolumeBrick
+  {
+    float minimum { 0.0f };
+    float scale { 0.0f };
+    float average { 0.0f };
+    uint32_t padding { 0 };
+  };
+  static_assert(sizeof(VolumeBrick) == 16, "VolumeBrick must match the std430 layout");
+
+  // Dense densities to build a volume file from, x fastest.
+  struct DensityGrid
+  {
+    uint32_t width { 0 };
+    uint32_t height { 0 };
+    uint32_t depth { 0 };
+    glm::vec3 origin { 0.0f };
+    float voxel_size { 1.0f };
+    std::vector<float> density;
+  };
+
+  struct VolumeSettings
+  {
+    // Resident brick capacity, the only memory that grows with the volume.
+    uint32_t pool_bricks { 4096 };
+    // Bricks decoded per Update.
+    uint32_t max_loads_per_update { 1024 };
+    // False tracks against the largest density of the volume instead of
+    // the majorant grid, for comparisons.
+    bool majorant_grid { true };
+  };
+
+  struct VolumeStats
+  {
+    uint64_t requests { 0 };
+    uint64_t loads { 0 };
+    uint64_t evictions { 0 };
+    uint32_t resident { 0 };
+  };
+
+  // Work of one tracking call: density lookups and majorant cells visited.
+  struct TrackingStats
+  {
+    uint32_t lookups { 0 };
+    uint32_t cells { 0 };
+  };
+
+  // Sparse brick volume in the spirit of NanoVDB, mapped rather than read.
+  // Cells of 8^3 voxels hold a brick or nothing, and the majorant grid keeps
+  // the largest density per cell. Tracking walks the cells along the ray with
+  // a DDA and samples free flights against the majorant of each, so empty
+  // cells cost one step. Only the cell tables are touched at Open. Lookups
+  // request their bricks, Update decodes them into a pool of bounded size
+  // and evicts the least recently used ones, and bricks that are not
+  // resident read as their average until then.
+  class SparseVolume
+  {
+   public:
+    // Drops the bricks whose voxels are all zero.
+    static bool Write(const std::string& path, const DensityGrid& grid);
+
+    bool Open(const std::string& path, VolumeSettings in_settings = VolumeSettings());
+
+    // Density at position, nearest voxel. Any thread, not concurrent with
+    // Update.
+    float Density(const glm::vec3& position);
+    // Delta tracking of the medium with extinction sigma times the density,
+    // true with t at the first collision before ray.tmax.
+    bool SampleCollision(const Ray& ray, float sigma, Sampler& sampler, float& t, TrackingStats* stats = nullptr);
+    // Ratio tracking estimate of the transmittance from ray.tmin to ray.tmax.
+    float Transmittance(const Ray& ray, float sigma, Sampler& sampler, TrackingStats* stats = nullptr);
+
+    // Frame boundary: decodes requested bricks and evicts unused ones.
+    void Update();
+
+    const VolumeDescriptor& getDescriptor() const { return descriptor; }
+    const AABB& getBounds() const { return bounds; }
+    ArrayView<uint32_t> getCells() const { return cells; }
+    ArrayView<float> getMajorants() const { return majorants; }
+    ArrayView<VolumeBrick> getBricks() const { return bricks; }
+    uint32_t getBrickCount() const { return static_cast<uint32_t>(bricks.count); }
+    const std::vector<uint32_t>& getPageTable() const { return page_table; }
+    const std::vector<uint8_t>& getPool() const { return pool; }
+    // Pool slots the last Update filled.
+    const std::vector<uint32_t>& getLoadedSlots() const { return loaded_slots; }
+    const VolumeStats& getStats() const { return stats; }
+
+   private:
+    // Part of the ray inside the box of whole cells.
+    bool Clip(const Ray& ray, float& t_enter, float& t_exit) const;
+    // Calls visit(cell, t_enter, t_exit) for the cells along the ray in
+    // order until it returns false.
+    template <typename Visit>
+    void Traverse(const Ray& ray, Visit&& visit) const;
+    // Tentative collisions against the majorants, event(t, extinction,
+    // majorant) returns false to stop.
+    template <typename Event>
+    void Track(const Ray& ray, float sigma, Sampler& sampler, TrackingStats* stats, Event&& event);
+
+    VolumeSettings settings;
+    MappedFile file;
+    VolumeDescriptor descriptor;
+    uint32_t size[3] { 0, 0, 0 };
+    AABB bounds;
+    ArrayView<uint32_t> cells;
+    ArrayView<float> majorants;
+    ArrayView<VolumeBrick> bricks;
+    ArrayView<uint8_t> voxels;
+
+    std::vector<uint32_t> page_table;
+    std::unique_ptr<std::atomic<uint32_t>[]> requests;
+    size_t request_words { 0 };
+    std::vector<uint8_t> pool;
+    std::vector<uint32_t> slot_bricks;
+    std::vector<uint64_t> slot_frames;
+    std::vector<uint32_t> free_slots;
+    std::vector<uint32_t> loaded_slots;
+    uint64_t frame { 1 };
+    VolumeStats stats;
+  };
+
+} // namespace PathTracer
+#endif // VOLUME_HPP
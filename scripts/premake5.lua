@@ -1,6 +1,11 @@
 
 vulkan_sdk = os.getenv("VULKAN_SDK")
 
+newoption {
+  trigger = "avx2",
+  description = "Build with AVX2, widens CPU triangle blocks to 8 lanes"
+}
+
 workspace "Vulkan Path Tracer"
   filename "VulkanPT"
   language "C++"
@@ -36,6 +41,17 @@ workspace "Vulkan Path Tracer"
     optimize "On"
     targetdir "../bin"
 
+  -- the watertight triangle test relies on /fp:precise not contracting into FMAs
+  filter "options:avx2"
+    vectorextensions "AVX2"
+    floatingpoint "Default"
+
+  -- GCC and Clang contract by default, which breaks the watertight test
+  filter "toolset:gcc or clang"
+    buildoptions { "-ffp-contract=off" }
+
+  filter {}
+
 project "VulkanPT"
   uuid "34cb9741-9408-4c86-a84b-4386ebad1a99"
   kind "StaticLib"
@@ -71,3 +87,10 @@ project "SandBox"
   location "../build/SandBox"
   links { "VulkanPT", "opengl32" }
   files { "../sandbox/*.cpp" }
+
+project "Benchmark"
+  uuid "5b0f6a3e-2c1d-4e8a-9f47-3d6c8e1a2b90"
+  kind "ConsoleApp"
+  location "../build/Benchmark"
+  links { "VulkanPT" }
+  files { "../benchmark/*.cpp" }
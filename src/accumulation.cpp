@@ -0,0 +1,154 @@
+
+#include <VulkanPT/accumulation.hpp>
+#include <VulkanPT/scheduler.hpp>
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+namespace PathTracer
+{
+  Accumulator::Accumulator(uint32_t in_width, uint32_t in_height, uint32_t in_tile_size) :
+    width{ in_width }, height{ in_height }, tile_size{ in_tile_size }
+  {
+    pixels.resize(static_cast<size_t>(width) * height);
+
+    for (uint32_t y = 0; y < height; y += tile_size)
+    {
+      for (uint32_t x = 0; x < width; x += tile_size)
+      {
+        TileState tile;
+        tile.x = x;
+        tile.y = y;
+        tile.width = std::min(tile_size, width - x);
+        tile.height = std::min(tile_size, height - y);
+        tiles.push_back(tile);
+      }
+    }
+
+    // tiles are kept in Morton order so consecutive tiles stay spatially close
+    std::sort(tiles.begin(), tiles.end(), [this](const TileState& a, const TileState& b)
+    {
+      return MortonEncode(a.x / tile_size, a.y / tile_size) <
+             MortonEncode(b.x / tile_size, b.y / tile_size);
+    });
+  }
+
+  void Accumulator::Reset()
+  {
+    std::fill(pixels.begin(), pixels.end(), AccumulationPixel {});
+    for (TileState& tile : tiles)
+    {
+      tile.min_count = 0;
+      tile.error = 0.0f;
+      tile.converged = false;
+    }
+  }
+
+  float Accumulator::Variance(uint32_t x, uint32_t y) const
+  {
+    const AccumulationPixel& pixel = Pixel(x, y);
+    if (pixel.count < 2) return 0.0f;
+    return pixel.luminance_m2 / static_cast<float>(pixel.count - 1);
+  }
+
+  float Accumulator::RelativeError(uint32_t x, uint32_t y) const
+  {
+    const AccumulationPixel& pixel = Pixel(x, y);
+    if (pixel.count < 2) return std::numeric_limits<float>::infinity();
+
+    float standard_error = std::sqrt(Variance(x, y) / static_cast<float>(pixel.count));
+    // the offset keeps near black pixels from demanding endless samples
+    return standard_error / (pixel.luminance_mean + 1e-2f);
+  }
+
+  const TileState& Accumulator::UpdateTile(uint32_t tile_index, uint32_t min_samples,
+                                           float error_threshold)
+  {
+    TileState& tile = tiles[tile_index];
+
+    uint32_t min_count = UINT32_MAX;
+    float error_sum = 0.0f;
+    for (uint32_t y = tile.y; y < tile.y + tile.height; ++y)
+    {
+      for (uint32_t x = tile.x; x < tile.x + tile.width; ++x)
+      {
+        min_count = std::min(min_count, Pixel(x, y).count);
+        error_sum += std::min(RelativeError(x, y), 1e3f);
+      }
+    }
+
+    tile.min_count = min_count;
+    tile.error = error_sum / static_cast<float>(tile.width * tile.height);
+    tile.converged = min_count >= min_samples && tile.error < error_threshold;
+
+    return tile;
+  }
+
+  uint64_t Accumulator::TotalSamples() const
+  {
+    uint64_t total = 0;
+    for (const AccumulationPixel& pixel : pixels) total += pixel.count;
+    return total;
+  }
+
+  std::vector<TileBudget> AdaptiveSampler::PlanPass(Accumulator& accumulator) const
+  {
+    const std::vector<TileState>& tiles = accumulator.getTiles();
+
+    std::vector<TileBudget> plan;
+    uint64_t warmup_pixels = 0;
+    double error_weight = 0.0;
+
+    for (uint32_t i = 0; i < tiles.size(); ++i)
+    {
+      if (tiles[i].converged) continue;
+
+      const TileState& tile = accumulator.UpdateTile(i, settings.min_samples, settings.error_threshold);
+      if (tile.converged || tile.min_count >= settings.max_samples) continue;
+
+      uint64_t pixel_count = static_cast<uint64_t>(tile.width) * tile.height;
+
+      if (tile.min_count < settings.min_samples)
+        warmup_pixels += pixel_count;
+      else
+        error_weight += static_cast<double>(tile.error) * pixel_count;
+
+      plan.push_back({ i, 0 });
+    }
+
+    // every pass costs as much as a uniform pass over the whole image, the
+    // samples converged tiles no longer take go to the noisy ones
+    double budget = static_cast<double>(accumulator.getWidth()) * accumulator.getHeight() *
+                    settings.samples_per_pass;
+    double remaining = budget - static_cast<double>(warmup_pixels) * settings.samples_per_pass;
+    uint32_t pass_limit = settings.samples_per_pass * 16;
+
+    for (TileBudget& entry : plan)
+    {
+      const TileState& tile = tiles[entry.tile];
+      uint32_t headroom = settings.max_samples - tile.min_count;
+
+      if (tile.min_count < settings.min_samples || error_weight <= 0.0)
+      {
+        entry.samples = std::min(settings.samples_per_pass, headroom);
+        continue;
+      }
+
+      double samples = remaining * tile.error / error_weight;
+      entry.samples = std::clamp(static_cast<uint32_t>(std::lround(samples)), 1u,
+                                 std::min(headroom, pass_limit));
+    }
+
+    return plan;
+  }
+
+  bool AdaptiveSampler::Converged(const Accumulator& accumulator) const
+  {
+    for (const TileState& tile : accumulator.getTiles())
+    {
+      if (!tile.converged && tile.min_count < settings.max_samples) return false;
+    }
+    return true;
+  }
+
+} // namespace PathTracer
@@ -4,6 +4,7 @@
 #include <VulkanPT/logging.hpp>
 #include <VulkanPT/device.hpp>
 #include <VulkanPT/swapchain.hpp>
+#include <VulkanPT/profiler.hpp>
 
 Application::Application() {}
 
@@ -18,8 +19,11 @@ Application::~Application()
 
 #ifdef DEBUG
   instance.destroyDebugUtilsMessengerEXT(debug_messenger, nullptr, dispatch_loader);
+  validation_log->Summary();
 #endif // DEBUG
 
+  Profiler::Report();
+
   instance.destroy();
 }
 
@@ -44,14 +48,15 @@ void Application::CreateInstance()
   dispatch_loader = vk::DispatchLoaderDynamic(instance, vkGetInstanceProcAddr);
 
 #ifdef DEBUG
-  debug_messenger = VulkanInit::MakeDebugMessenger(instance, dispatch_loader);
+  validation_log = std::make_unique<VulkanInit::ValidationMessageLog>();
+  debug_messenger = VulkanInit::MakeDebugMessenger(instance, dispatch_loader, validation_log.get());
 #endif // DEBUG
 
   VkSurfaceKHR c_style_surface;
   if (glfwCreateWindowSurface(instance, window.getInstance(), nullptr, &c_style_surface) != VK_SUCCESS)
-    Debug::Error("Failed to abstract the glfw surface for Vulkan!");
+    DEBUG_ERROR(Vulkan, "Failed to abstract the glfw surface for Vulkan!");
   else
-    Debug::Log("Successfully abstracted the glfw surface for Vulkan!");
+    DEBUG_LOG(Vulkan, "Successfully abstracted the glfw surface for Vulkan!");
 
   surface = c_style_surface;
 }
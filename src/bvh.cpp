@@ -0,0 +1,786 @@
+
+#include <VulkanPT/bvh.hpp>
+#include <VulkanPT/simd.hpp>
+#include <VulkanPT/debug.hpp>
+#include <VulkanPT/profiler.hpp>
+#include <algorithm>
+#include <numeric>
+#include <utility>
+
+namespace PathTracer
+{
+  static constexpr uint32_t max_depth = 64;
+  static constexpr uint32_t stack_size = max_depth * 2;
+  // below this many rays sorting a stream costs more than it saves
+  static constexpr size_t stream_min_rays = 4096;
+
+  // Shared packet traversal, any_hit stops rays at their first intersection.
+  // Before testing rays individually each node is tested against the whole
+  // packet with interval arithmetic, which culls it for all rays at once.
+  template <typename Kernel, int N, bool any_hit>
+  static uint32_t TraversePacket(const std::vector<BVHNode>& nodes,
+                                 const std::vector<TriangleBlock<triangle_block_width>>& blocks,
+                                 const RayPacket<N>& packet, SimdFloat<N>& hit_t, SimdFloat<N>& hit_u,
+                                 SimdFloat<N>& hit_v, uint32_t* hit_triangle)
+  {
+    using Float = SimdFloat<N>;
+    using Mask = SimdMask<N>;
+    constexpr uint32_t W = triangle_block_width;
+
+    PacketRays<N> rays;
+    Float inverse_direction[3];
+    for (int axis = 0; axis < 3; ++axis)
+    {
+      alignas(32) float inverse[N];
+      for (int lane = 0; lane < N; ++lane) inverse[lane] = SafeInverse(packet.direction[axis][lane]);
+
+      rays.origin[axis] = Float::Load(packet.origin[axis]);
+      rays.direction[axis] = Float::Load(packet.direction[axis]);
+      inverse_direction[axis] = Float::Load(inverse);
+    }
+    Kernel::PreparePacket(rays);
+
+    Float tmin = Float::Load(packet.tmin);
+    hit_t = Float::Load(packet.tmax);
+    Mask active = Mask::FromBits(packet.valid);
+    uint32_t occluded = 0;
+
+    // interval bounds are only usable when every ray agrees on the direction signs
+    bool interval = true;
+    float origin_min[3], origin_max[3], inverse_min[3], inverse_max[3];
+    bool positive[3];
+    float packet_tmin = infinity;
+    int first_lane = 0;
+    while (!((packet.valid >> first_lane) & 1u)) first_lane++;
+
+    for (int axis = 0; axis < 3; ++axis)
+    {
+      origin_min[axis] = inverse_min[axis] = infinity;
+      origin_max[axis] = inverse_max[axis] = -infinity;
+      positive[axis] = packet.direction[axis][first_lane] >= 0.0f;
+
+      for (int lane = 0; lane < N; ++lane)
+      {
+        if (!((packet.valid >> lane) & 1u)) continue;
+
+        float inverse = SafeInverse(packet.direction[axis][lane]);
+        origin_min[axis] = std::min(origin_min[axis], packet.origin[axis][lane]);
+        origin_max[axis] = std::max(origin_max[axis], packet.origin[axis][lane]);
+        inverse_min[axis] = std::min(inverse_min[axis], inverse);
+        inverse_max[axis] = std::max(inverse_max[axis], inverse);
+        if ((packet.direction[axis][lane] >= 0.0f) != positive[axis]) interval = false;
+        if (axis == 0) packet_tmin = std::min(packet_tmin, packet.tmin[lane]);
+      }
+    }
+
+    uint32_t stack[stack_size];
+    uint32_t stack_pointer = 0;
+    stack[stack_pointer++] = 0;
+
+    while (stack_pointer > 0)
+    {
+      const BVHNode& node = nodes[stack[--stack_pointer]];
+
+      if (interval)
+      {
+        float entry = packet_tmin;
+        float exit = ReduceMax(Select(active, hit_t, Float(-infinity)));
+        for (int axis = 0; axis < 3; ++axis)
+        {
+          float near_plane = positive[axis] ? node.bounds_min[axis] : node.bounds_max[axis];
+          float far_plane = positive[axis] ? node.bounds_max[axis] : node.bounds_min[axis];
+
+          float a0 = (near_plane - origin_max[axis]), a1 = (near_plane - origin_min[axis]);
+          float b0 = (far_plane - origin_max[axis]), b1 = (far_plane - origin_min[axis]);
+          float near_low = std::min(std::min(a0 * inverse_min[axis], a0 * inverse_max[axis]),
+                                    std::min(a1 * inverse_min[axis], a1 * inverse_max[axis]));
+          float far_high = std::max(std::max(b0 * inverse_min[axis], b0 * inverse_max[axis]),
+                                    std::max(b1 * inverse_min[axis], b1 * inverse_max[axis]));
+
+          entry = std::max(entry, near_low);
+          exit = std::min(exit, far_high * robust_far_scale);
+        }
+        if (entry > exit) continue;
+      }
+
+      Float tnear = tmin;
+      Float tfar = hit_t;
+      for (int axis = 0; axis < 3; ++axis)
+      {
+        Float t0 = (Float(node.bounds_min[axis]) - rays.origin[axis]) * inverse_direction[axis];
+        Float t1 = (Float(node.bounds_max[axis]) - rays.origin[axis]) * inverse_direction[axis];
+        tnear = Max(tnear, Min(t0, t1));
+        tfar = Min(tfar, Max(t0, t1) * Float(robust_far_scale));
+      }
+
+      Mask node_mask = active & (tnear <= tfar);
+      if (node_mask.None()) continue;
+
+      if (node.IsLeaf())
+      {
+        for (uint32_t i = 0; i < node.count; ++i)
+        {
+          const TriangleBlock<W>& block = blocks[node.left_first + i / W];
+          Float t, u, v;
+          Mask hit = node_mask & Kernel::IntersectPacket(block, static_cast<int>(i % W), rays, tmin, hit_t, t, u, v);
+          uint32_t bits = hit.Bits();
+          if (bits == 0) continue;
+
+          hit_t = Select(hit, t, hit_t);
+          hit_u = Select(hit, u, hit_u);
+          hit_v = Select(hit, v, hit_v);
+          for (int lane = 0; lane < N; ++lane)
+            if ((bits >> lane) & 1u) hit_triangle[lane] = node.left_first * W + i;
+
+          if (any_hit)
+          {
+            occluded |= bits;
+            active = active & ~hit;
+            node_mask = node_mask & ~hit;
+            if (active.None()) return occluded;
+          }
+        }
+        continue;
+      }
+
+      // visit the child closer along the first active ray first
+      int lane = 0;
+      uint32_t bits = node_mask.Bits();
+      while (!((bits >> lane) & 1u)) lane++;
+      glm::vec3 lane_direction(packet.direction[0][lane], packet.direction[1][lane], packet.direction[2][lane]);
+
+      const BVHNode& left = nodes[node.left_first];
+      const BVHNode& right = nodes[node.left_first + 1];
+      glm::vec3 offset = (right.bounds_min + right.bounds_max) - (left.bounds_min + left.bounds_max);
+      bool left_first = glm::dot(offset, lane_direction) >= 0.0f;
+
+      stack[stack_pointer++] = left_first ? node.left_first + 1 : node.left_first;
+      stack[stack_pointer++] = left_first ? node.left_first : node.left_first + 1;
+    }
+
+    return occluded;
+  }
+
+  static uint32_t Part1By2(uint32_t value)
+  {
+    value &= 0x000003FF;
+    value = (value ^ (value << 16)) & 0xFF0000FF;
+    value = (value ^ (value << 8)) & 0x0300F00F;
+    value = (value ^ (value << 4)) & 0x030C30C3;
+    value = (value ^ (value << 2)) & 0x09249249;
+    return value;
+  }
+
+  static uint32_t MortonEncode3(const glm::uvec3& cell)
+  { return Part1By2(cell.x) | (Part1By2(cell.y) << 1) | (Part1By2(cell.z) << 2); }
+
+  template <typename Kernel>
+  void BVHT<Kernel>::Build(const std::vector<glm::vec3>& positions, const std::vector<uint32_t>& indices,
+                           BVHBuildSettings settings)
+  {
+    Profiler::Scope scope("bvh.build");
+    constexpr uint32_t W = triangle_block_width;
+
+    uint32_t triangle_count = static_cast<uint32_t>(indices.size() / 3);
+    nodes.clear();
+    blocks.clear();
+    if (triangle_count == 0) return;
+
+    std::vector<uint32_t> primitive_indices(triangle_count);
+    std::iota(primitive_indices.begin(), primitive_indices.end(), 0u);
+
+    std::vector<AABB> primitive_bounds(triangle_count);
+    std::vector<glm::vec3> centroids(triangle_count);
+    for (uint32_t i = 0; i < triangle_count; ++i)
+    {
+      for (uint32_t corner = 0; corner < 3; ++corner)
+        primitive_bounds[i].Grow(positions[indices[i * 3 + corner]]);
+      centroids[i] = primitive_bounds[i].Center();
+    }
+
+    BuildNodes(nodes, primitive_indices, primitive_bounds, centroids, settings);
+
+    // pack every leaf into its own run of blocks, leaves then point at blocks
+    for (BVHNode& node : nodes)
+    {
+      if (!node.IsLeaf()) continue;
+
+      uint32_t first_block = static_cast<uint32_t>(blocks.size());
+      uint32_t block_count = (node.count + W - 1) / W;
+      blocks.resize(blocks.size() + block_count);
+      for (uint32_t b = first_block; b < first_block + block_count; ++b) blocks[b].Clear();
+
+      for (uint32_t i = 0; i < node.count; ++i)
+      {
+        uint32_t primitive = primitive_indices[node.left_first + i];
+        TriangleBlock<W>& block = blocks[first_block + i / W];
+        Kernel::Pack(block, static_cast<int>(i % W), positions[indices[primitive * 3]],
+                     positions[indices[primitive * 3 + 1]], positions[indices[primitive * 3 + 2]]);
+        block.primitive[i % W] = primitive;
+      }
+      node.left_first = first_block;
+    }
+
+    DEBUG_LOG(BVH, "Built BVH with %zu nodes and %zu %s triangle blocks over %u triangles",
+              nodes.size(), blocks.size(), Kernel::name, triangle_count);
+  }
+
+  void BuildNodes(std::vector<BVHNode>& nodes, std::vector<uint32_t>& primitive_indices,
+                  const std::vector<AABB>& primitive_bounds, const std::vector<glm::vec3>& centroids,
+                  const BVHBuildSettings& settings)
+  {
+    nodes.clear();
+    if (primitive_indices.empty()) return;
+
+    // a binary tree over n leaves never needs more than 2n - 1 nodes, so
+    // references into nodes stay valid while subdividing
+    nodes.reserve(primitive_indices.size() * 2);
+    BVHNode root;
+    root.left_first = 0;
+    root.count = static_cast<uint32_t>(primitive_indices.size());
+    nodes.push_back(root);
+
+    struct BuildTask { uint32_t node; uint32_t depth; };
+    std::vector<BuildTask> todo = { { 0, 0 } };
+
+    struct Bin { AABB bounds; uint32_t count { 0 }; };
+    std::vector<Bin> bins(settings.bins);
+    std::vector<float> right_areas(settings.bins);
+    std::vector<uint32_t> right_counts(settings.bins);
+    const uint32_t block_width = std::max(settings.leaf_block_width, 1u);
+    auto cost = [&](uint32_t count) { return static_cast<float>((count + block_width - 1) / block_width); };
+
+    while (!todo.empty())
+    {
+      BuildTask task = todo.back();
+      todo.pop_back();
+      BVHNode& node = nodes[task.node];
+
+      AABB bounds;
+      AABB centroid_bounds;
+      for (uint32_t i = node.left_first; i < node.left_first + node.count; ++i)
+      {
+        bounds.Grow(primitive_bounds[primitive_indices[i]]);
+        centroid_bounds.Grow(centroids[primitive_indices[i]]);
+      }
+      node.bounds_min = bounds.min;
+      node.bounds_max = bounds.max;
+
+      if (node.count <= 1 || task.depth + 1 >= max_depth) continue;
+
+      // binned SAH, costs are relative to intersecting one block of primitives
+      float best_cost = infinity;
+      int best_axis = -1;
+      uint32_t best_split = 0;
+      for (int axis = 0; axis < 3; ++axis)
+      {
+        float extent = centroid_bounds.max[axis] - centroid_bounds.min[axis];
+        if (extent <= 0.0f) continue;
+
+        std::fill(bins.begin(), bins.end(), Bin {});
+        float scale = static_cast<float>(settings.bins) / extent;
+        for (uint32_t i = node.left_first; i < node.left_first + node.count; ++i)
+        {
+          uint32_t primitive = primitive_indices[i];
+          uint32_t bin = std::min(settings.bins - 1, static_cast<uint32_t>(
+                                  (centroids[primitive][axis] - centroid_bounds.min[axis]) * scale));
+          bins[bin].count++;
+          bins[bin].bounds.Grow(primitive_bounds[primitive]);
+        }
+
+        AABB right_bounds;
+        uint32_t right_count = 0;
+        for (uint32_t bin = settings.bins - 1; bin > 0; --bin)
+        {
+          right_bounds.Grow(bins[bin].bounds);
+          right_count += bins[bin].count;
+          right_areas[bin] = right_bounds.Area();
+          right_counts[bin] = right_count;
+        }
+
+        AABB left_bounds;
+        uint32_t left_count = 0;
+        for (uint32_t split = 1; split < settings.bins; ++split)
+        {
+          left_bounds.Grow(bins[split - 1].bounds);
+          left_count += bins[split - 1].count;
+          if (left_count == 0 || right_counts[split] == 0) continue;
+
+          float candidate = left_bounds.Area() * cost(left_count) + right_areas[split] * cost(right_counts[split]);
+          if (candidate < best_cost)
+          {
+            best_cost = candidate;
+            best_axis = axis;
+            best_split = split;
+          }
+        }
+      }
+
+      if (best_axis < 0) continue;
+
+      float area = bounds.Area();
+      float split_cost = settings.traversal_cost + (area > 0.0f ? best_cost / area : 0.0f);
+      if (node.count <= settings.max_leaf_size && split_cost >= cost(node.count)) continue;
+
+      float extent = centroid_bounds.max[best_axis] - centroid_bounds.min[best_axis];
+      float scale = static_cast<float>(settings.bins) / extent;
+      uint32_t* first = primitive_indices.data() + node.left_first;
+      uint32_t* middle = std::partition(first, first + node.count, [&](uint32_t primitive)
+      {
+        uint32_t bin = std::min(settings.bins - 1, static_cast<uint32_t>(
+                                (centroids[primitive][best_axis] - centroid_bounds.min[best_axis]) * scale));
+        return bin < best_split;
+      });
+
+      uint32_t left_count = static_cast<uint32_t>(middle - first);
+      if (left_count == 0 || left_count == node.count) continue;
+
+      uint32_t left_index = static_cast<uint32_t>(nodes.size());
+      BVHNode left;
+      left.left_first = node.left_first;
+      left.count = left_count;
+      BVHNode right;
+      right.left_first = node.left_first + left_count;
+      right.count = node.count - left_count;
+      nodes.push_back(left);
+      nodes.push_back(right);
+
+      node.left_first = left_index;
+      node.count = 0;
+
+      todo.push_back({ left_index + 1, task.depth + 1 });
+      todo.push_back({ left_index, task.depth + 1 });
+    }
+    nodes.shrink_to_fit();
+  }
+
+  template <typename Kernel>
+  bool BVHT<Kernel>::Intersect(const Ray& ray, Hit& hit, TraversalStats* stats) const
+  {
+    constexpr int W = triangle_block_width;
+    if (nodes.empty()) return false;
+    if (stats)
+    {
+      stats->rays++;
+      stats->node_bytes += sizeof(BVHNode);
+    }
+
+    typename Kernel::RayData ray_data = Kernel::Prepare(ray);
+    glm::vec3 inverse_direction = SafeInverse(ray.direction);
+    float tmax = std::min(ray.tmax, hit.t);
+    uint32_t hit_primitive = invalid_index;
+
+    uint32_t stack[stack_size];
+    uint32_t stack_pointer = 0;
+    stack[stack_pointer++] = 0;
+
+    while (stack_pointer > 0)
+    {
+      const BVHNode& node = nodes[stack[--stack_pointer]];
+      float tnear;
+      if (!IntersectNode(node, ray.origin, inverse_direction, ray.tmin, tmax, tnear)) continue;
+
+      if (node.IsLeaf())
+      {
+        uint32_t block_count = (node.count + W - 1) / W;
+        if (stats) stats->block_bytes += block_count * sizeof(TriangleBlock<W>);
+        for (uint32_t b = node.left_first; b < node.left_first + block_count; ++b)
+        {
+          SimdFloat<W> t, u, v;
+          SimdMask<W> mask = Kernel::Intersect(blocks[b], ray_data, ray.tmin, tmax, t, u, v);
+          if (mask.None()) continue;
+
+          int lane = NearestLane(mask, t);
+          tmax = t[lane];
+          hit.u = u[lane];
+          hit.v = v[lane];
+          hit_primitive = blocks[b].primitive[lane];
+        }
+        continue;
+      }
+
+      // both children are read to order them
+      if (stats) stats->node_bytes += 2 * sizeof(BVHNode);
+      uint32_t near_child = node.left_first;
+      uint32_t far_child = node.left_first + 1;
+      float near_t, far_t;
+      bool near_hit = IntersectNode(nodes[near_child], ray.origin, inverse_direction, ray.tmin, tmax, near_t);
+      bool far_hit = IntersectNode(nodes[far_child], ray.origin, inverse_direction, ray.tmin, tmax, far_t);
+      if (near_hit && far_hit && far_t < near_t)
+      {
+        std::swap(near_child, far_child);
+        std::swap(near_hit, far_hit);
+      }
+
+      if (far_hit) stack[stack_pointer++] = far_child;
+      if (near_hit) stack[stack_pointer++] = near_child;
+    }
+
+    if (hit_primitive == invalid_index) return false;
+
+    hit.t = tmax;
+    hit.primitive = hit_primitive;
+    return true;
+  }
+
+  bool ValidPrimitives(const std::vector<TriangleBlock<triangle_block_width>>& blocks, size_t primitive_count)
+  {
+    for (const TriangleBlock<triangle_block_width>& block : blocks)
+    {
+      for (int lane = 0; lane < triangle_block_width; ++lane)
+      {
+        if (block.primitive[lane] != invalid_index && block.primitive[lane] >= primitive_count) return false;
+      }
+    }
+    return true;
+  }
+
+  template <typename Kernel>
+  bool BVHT<Kernel>::Validate(size_t primitive_count) const
+  {
+    constexpr uint64_t W = triangle_block_width;
+    // children follow their parents, so one pass sees every parent of a node first
+    std::vector<uint32_t> depth(nodes.size(), 0);
+    for (size_t i = 0; i < nodes.size(); ++i)
+    {
+      const BVHNode& node = nodes[i];
+      if (node.IsLeaf())
+      {
+        if (node.left_first + (node.count + W - 1) / W > blocks.size()) return false;
+        continue;
+      }
+      if (node.left_first <= i || node.left_first + uint64_t(1) >= nodes.size() || depth[i] + 1 >= max_depth)
+        return false;
+      for (uint32_t child = node.left_first; child <= node.left_first + 1; ++child)
+        depth[child] = std::max(depth[child], depth[i] + 1);
+    }
+    return ValidPrimitives(blocks, primitive_count);
+  }
+
+  template <typename Kernel>
+  bool BVHT<Kernel>::Occluded(const Ray& ray) const
+  {
+    constexpr int W = triangle_block_width;
+    if (nodes.empty()) return false;
+
+    typename Kernel::RayData ray_data = Kernel::Prepare(ray);
+    glm::vec3 inverse_direction = SafeInverse(ray.direction);
+    uint32_t stack[stack_size];
+    uint32_t stack_pointer = 0;
+    stack[stack_pointer++] = 0;
+
+    while (stack_pointer > 0)
+    {
+      const BVHNode& node = nodes[stack[--stack_pointer]];
+      float tnear;
+      if (!IntersectNode(node, ray.origin, inverse_direction, ray.tmin, ray.tmax, tnear)) continue;
+
+      if (node.IsLeaf())
+      {
+        uint32_t block_count = (node.count + W - 1) / W;
+        for (uint32_t b = node.left_first; b < node.left_first + block_count; ++b)
+        {
+          SimdFloat<W> t, u, v;
+          if (Kernel::Intersect(blocks[b], ray_data, ray.tmin, ray.tmax, t, u, v).Any()) return true;
+        }
+        continue;
+      }
+
+      stack[stack_pointer++] = node.left_first + 1;
+      stack[stack_pointer++] = node.left_first;
+    }
+
+    return false;
+  }
+
+  template <typename Kernel>
+  template <int N>
+  void BVHT<Kernel>::IntersectPacket(const RayPacket<N>& packet, Hit* hits) const
+  {
+    for (int lane = 0; lane < N; ++lane) hits[lane] = Hit {};
+    if (nodes.empty() || packet.valid == 0) return;
+
+    SimdFloat<N> t, u, v;
+    uint32_t hit_triangle[N];
+    for (int lane = 0; lane < N; ++lane) hit_triangle[lane] = invalid_index;
+
+    TraversePacket<Kernel, N, false>(nodes, blocks, packet, t, u, v, hit_triangle);
+
+    alignas(32) float lanes_t[N], lanes_u[N], lanes_v[N];
+    t.Store(lanes_t);
+    u.Store(lanes_u);
+    v.Store(lanes_v);
+    for (int lane = 0; lane < N; ++lane)
+    {
+      if (hit_triangle[lane] == invalid_index || !((packet.valid >> lane) & 1u)) continue;
+      hits[lane].t = lanes_t[lane];
+      hits[lane].u = lanes_u[lane];
+      hits[lane].v = lanes_v[lane];
+      hits[lane].primitive = blocks[hit_triangle[lane] / triangle_block_width].primitive[hit_triangle[lane] % triangle_block_width];
+    }
+  }
+
+  template <typename Kernel>
+  template <int N>
+  uint32_t BVHT<Kernel>::OccludedPacket(const RayPacket<N>& packet) const
+  {
+    if (nodes.empty() || packet.valid == 0) return 0;
+
+    SimdFloat<N> t, u, v;
+    uint32_t hit_triangle[N];
+    return TraversePacket<Kernel, N, true>(nodes, blocks, packet, t, u, v, hit_triangle);
+  }
+
+  // A packet is coherent when its rays share a direction octant and start
+  // close together, otherwise its lanes part ways near the root.
+  static bool CoherentPacket(const Ray* rays, const uint32_t* order, size_t count, float max_spread)
+  {
+    const Ray& first = rays[order ? order[0] : 0];
+    const glm::bvec3 negative = glm::lessThan(first.direction, glm::vec3(0.0f));
+    for (size_t lane = 1; lane < count; ++lane)
+    {
+      const Ray& ray = rays[order ? order[lane] : lane];
+      if (glm::any(glm::notEqual(glm::lessThan(ray.direction, glm::vec3(0.0f)), negative)) ||
+          glm::length(ray.origin - first.origin) > max_spread)
+        return false;
+    }
+    return true;
+  }
+
+  template <typename Kernel>
+  TraceMode BVHT<Kernel>::ChooseMode(const Ray* rays, size_t count, bool any_hit) const
+  {
+    // any hit rays stop early on their own, in the trace benchmark shadow
+    // packets and streams of 8 SSE lanes ran at 0.84x and 0.9x of single rays
+    if (count < static_cast<size_t>(packet_width) || (any_hit && packet_width < 16))
+      return TraceMode::Single;
+
+    const float max_spread = glm::length(Bounds().Extent()) / 16.0f;
+    const size_t packets = count / packet_width;
+    const size_t samples = std::min<size_t>(packets, 64);
+    size_t coherent = 0;
+    for (size_t sample = 0; sample < samples; ++sample)
+      coherent += CoherentPacket(rays + sample * packets / samples * packet_width, nullptr, packet_width, max_spread);
+    if (coherent * 4 >= samples * 3) return TraceMode::Packet;
+    if (count < stream_min_rays) return TraceMode::Single;
+
+    // rays that mostly start next to the one before them already walk the
+    // tree in a cache friendly order, sorting them would only add its cost
+    size_t near = 0;
+    for (size_t sample = 0; sample < samples; ++sample)
+    {
+      const Ray* pair = rays + sample * (count - 1) / samples;
+      near += glm::length(pair[1].origin - pair[0].origin) <= max_spread / 16.0f;
+    }
+    return near * 2 < samples ? TraceMode::Stream : TraceMode::Single;
+  }
+
+  // Fills a packet from rays[order[first...]], unused lanes repeat the first
+  // ray so every lane holds finite data.
+  template <int N>
+  static void FillPacket(RayPacket<N>& packet, const Ray* rays, const uint32_t* order, size_t count)
+  {
+    packet.valid = 0;
+    for (int lane = 0; lane < N; ++lane)
+    {
+      size_t index = lane < static_cast<int>(count) ? lane : 0;
+      packet.Set(lane, rays[order ? order[index] : index]);
+    }
+    packet.valid = count >= static_cast<size_t>(N) ? (N == 32 ? 0xFFFFFFFFu : (1u << N) - 1u) :
+                                                     (1u << count) - 1u;
+  }
+
+  template <typename Kernel>
+  template <int N>
+  void BVHT<Kernel>::TracePackets(const Ray* rays, Hit* hits, size_t count) const
+  {
+    RayPacket<N> packet;
+    for (size_t first = 0; first < count; first += N)
+    {
+      size_t lanes = std::min(count - first, static_cast<size_t>(N));
+      FillPacket<N>(packet, rays + first, nullptr, lanes);
+
+      Hit packet_hits[N];
+      IntersectPacket<N>(packet, packet_hits);
+      for (size_t lane = 0; lane < lanes; ++lane) hits[first + lane] = packet_hits[lane];
+    }
+  }
+
+  template <typename Kernel>
+  template <int N>
+  void BVHT<Kernel>::TraceStream(const Ray* rays, Hit* hits, size_t count) const
+  {
+    std::vector<uint32_t> order = SortStream(rays, count);
+    const float max_spread = glm::length(Bounds().Extent()) / 16.0f;
+
+    // batches that sorting made coherent go as packets, the rest as single
+    // rays, which still gain from walking the tree in sorted order
+    RayPacket<N> packet;
+    for (size_t first = 0; first < count; first += N)
+    {
+      size_t lanes = std::min(count - first, static_cast<size_t>(N));
+      if (!CoherentPacket(rays, order.data() + first, lanes, max_spread))
+      {
+        for (size_t lane = 0; lane < lanes; ++lane)
+        {
+          Hit& hit = hits[order[first + lane]];
+          hit = Hit {};
+          Intersect(rays[order[first + lane]], hit);
+        }
+        continue;
+      }
+      FillPacket<N>(packet, rays, order.data() + first, lanes);
+
+      Hit packet_hits[N];
+      IntersectPacket<N>(packet, packet_hits);
+      for (size_t lane = 0; lane < lanes; ++lane) hits[order[first + lane]] = packet_hits[lane];
+    }
+  }
+
+  // LSD radix sort of the low key_bits of keys, carrying values along. A
+  // few passes over the bytes beat a comparison sort several times here.
+  static void RadixSort(std::vector<uint64_t>& keys, std::vector<uint32_t>& values, int key_bits)
+  {
+    constexpr int digit_bits = 9;
+    constexpr uint32_t digits = 1u << digit_bits;
+    std::vector<uint64_t> key_scratch(keys.size());
+    std::vector<uint32_t> value_scratch(values.size());
+    std::vector<uint32_t> offsets(digits);
+    for (int shift = 0; shift < key_bits; shift += digit_bits)
+    {
+      std::fill(offsets.begin(), offsets.end(), 0u);
+      for (uint64_t key : keys) offsets[(key >> shift) & (digits - 1)]++;
+      // a digit every key shares leaves the order as it is
+      if (std::find(offsets.begin(), offsets.end(), static_cast<uint32_t>(keys.size())) != offsets.end()) continue;
+
+      uint32_t sum = 0;
+      for (uint32_t& offset : offsets) sum += std::exchange(offset, sum);
+      for (size_t i = 0; i < keys.size(); ++i)
+      {
+        uint32_t& offset = offsets[(keys[i] >> shift) & (digits - 1)];
+        key_scratch[offset] = keys[i];
+        value_scratch[offset++] = values[i];
+      }
+      keys.swap(key_scratch);
+      values.swap(value_scratch);
+    }
+  }
+
+  template <typename Kernel>
+  std::vector<uint32_t> BVHT<Kernel>::SortStream(const Ray* rays, size_t count) const
+  {
+    // key = origin cell, then direction octant, then quantized direction
+    AABB bounds = Bounds();
+    glm::vec3 scale = 1023.0f / glm::max(bounds.Extent(), glm::vec3(1e-6f));
+
+    std::vector<uint64_t> keys(count);
+    std::vector<uint32_t> order(count);
+    for (size_t i = 0; i < count; ++i)
+    {
+      const Ray& ray = rays[i];
+      glm::vec3 direction = ray.direction / std::max(glm::length(ray.direction), 1e-20f);
+      uint64_t octant = (direction.x < 0.0f ? 1u : 0u) | (direction.y < 0.0f ? 2u : 0u) |
+                        (direction.z < 0.0f ? 4u : 0u);
+
+      glm::uvec3 direction_cell = glm::uvec3(glm::clamp(direction * 0.5f + 0.5f, 0.0f, 1.0f) * 15.0f);
+      glm::uvec3 origin_cell = glm::uvec3(glm::clamp((ray.origin - bounds.min) * scale, 0.0f, 1023.0f));
+
+      keys[i] = (static_cast<uint64_t>(MortonEncode3(origin_cell)) << 15) | (octant << 12) |
+                MortonEncode3(direction_cell);
+      order[i] = static_cast<uint32_t>(i);
+    }
+
+    RadixSort(keys, order, 45);
+    return order;
+  }
+
+  template <typename Kernel>
+  void BVHT<Kernel>::Trace(const Ray* rays, Hit* hits, size_t count, TraceMode mode) const
+  {
+    if (mode == TraceMode::Auto) mode = ChooseMode(rays, count, false);
+    switch (mode)
+    {
+    case TraceMode::Packet: TracePackets<packet_width>(rays, hits, count); break;
+    case TraceMode::Stream: TraceStream<packet_width>(rays, hits, count); break;
+    default:
+      for (size_t i = 0; i < count; ++i)
+      {
+        hits[i] = Hit {};
+        Intersect(rays[i], hits[i]);
+      }
+      break;
+    }
+  }
+
+  template <typename Kernel>
+  void BVHT<Kernel>::TraceOcclusion(const Ray* rays, bool* occluded, size_t count, TraceMode mode) const
+  {
+    if (mode == TraceMode::Auto) mode = ChooseMode(rays, count, true);
+    if (mode == TraceMode::Single)
+    {
+      for (size_t i = 0; i < count; ++i) occluded[i] = Occluded(rays[i]);
+      return;
+    }
+
+    std::vector<uint32_t> order;
+    if (mode == TraceMode::Stream) order = SortStream(rays, count);
+    const float max_spread = glm::length(Bounds().Extent()) / 16.0f;
+
+    RayPacket<packet_width> packet;
+    for (size_t first = 0; first < count; first += packet_width)
+    {
+      size_t lanes = std::min(count - first, static_cast<size_t>(packet_width));
+      const uint32_t* batch = order.empty() ? nullptr : order.data() + first;
+      if (batch && !CoherentPacket(rays, batch, lanes, max_spread))
+      {
+        for (size_t lane = 0; lane < lanes; ++lane) occluded[batch[lane]] = Occluded(rays[batch[lane]]);
+        continue;
+      }
+      FillPacket<packet_width>(packet, batch ? rays : rays + first, batch, lanes);
+
+      uint32_t bits = OccludedPacket<packet_width>(packet);
+      for (size_t lane = 0; lane < lanes; ++lane) occluded[batch ? batch[lane] : first + lane] = (bits >> lane) & 1u;
+    }
+  }
+
+  template <typename Kernel>
+  AABB BVHT<Kernel>::Bounds() const
+  {
+    AABB bounds;
+    if (!nodes.empty())
+    {
+      bounds.min = nodes[0].bounds_min;
+      bounds.max = nodes[0].bounds_max;
+    }
+    return bounds;
+  }
+
+  template class BVHT<MollerTrumboreKernel>;
+  template class BVHT<WatertightKernel>;
+
+  template void BVHT<MollerTrumboreKernel>::IntersectPacket<4>(const RayPacket<4>&, Hit*) const;
+  template uint32_t BVHT<MollerTrumboreKernel>::OccludedPacket<4>(const RayPacket<4>&) const;
+  template void BVHT<MollerTrumboreKernel>::TracePackets<4>(const Ray*, Hit*, size_t) const;
+  template void BVHT<MollerTrumboreKernel>::TraceStream<4>(const Ray*, Hit*, size_t) const;
+  template void BVHT<MollerTrumboreKernel>::IntersectPacket<8>(const RayPacket<8>&, Hit*) const;
+  template uint32_t BVHT<MollerTrumboreKernel>::OccludedPacket<8>(const RayPacket<8>&) const;
+  template void BVHT<MollerTrumboreKernel>::TracePackets<8>(const Ray*, Hit*, size_t) const;
+  template void BVHT<MollerTrumboreKernel>::TraceStream<8>(const Ray*, Hit*, size_t) const;
+  template void BVHT<MollerTrumboreKernel>::IntersectPacket<16>(const RayPacket<16>&, Hit*) const;
+  template uint32_t BVHT<MollerTrumboreKernel>::OccludedPacket<16>(const RayPacket<16>&) const;
+  template void BVHT<MollerTrumboreKernel>::TracePackets<16>(const Ray*, Hit*, size_t) const;
+  template void BVHT<MollerTrumboreKernel>::TraceStream<16>(const Ray*, Hit*, size_t) const;
+  template void BVHT<WatertightKernel>::IntersectPacket<4>(const RayPacket<4>&, Hit*) const;
+  template uint32_t BVHT<WatertightKernel>::OccludedPacket<4>(const RayPacket<4>&) const;
+  template void BVHT<WatertightKernel>::TracePackets<4>(const Ray*, Hit*, size_t) const;
+  template void BVHT<WatertightKernel>::TraceStream<4>(const Ray*, Hit*, size_t) const;
+  template void BVHT<WatertightKernel>::IntersectPacket<8>(const RayPacket<8>&, Hit*) const;
+  template uint32_t BVHT<WatertightKernel>::OccludedPacket<8>(const RayPacket<8>&) const;
+  template void BVHT<WatertightKernel>::TracePackets<8>(const Ray*, Hit*, size_t) const;
+  template void BVHT<WatertightKernel>::TraceStream<8>(const Ray*, Hit*, size_t) const;
+  template void BVHT<WatertightKernel>::IntersectPacket<16>(const RayPacket<16>&, Hit*) const;
+  template uint32_t BVHT<WatertightKernel>::OccludedPacket<16>(const RayPacket<16>&) const;
+  template void BVHT<WatertightKernel>::TracePackets<16>(const Ray*, Hit*, size_t) const;
+  template void BVHT<WatertightKernel>::TraceStream<16>(const Ray*, Hit*, size_t) const;
+
+} // namespace PathTracer
@@ -0,0 +1,379 @@
+
+#include <VulkanPT/compressed_bvh.hpp>
+#include <VulkanPT/debug.hpp>
+#include <VulkanPT/profiler.hpp>
+#include <algorithm>
+#include <cstring>
+
+namespace PathTracer
+{
+  static constexpr uint32_t max_leaf_blocks = 3;
+  static constexpr uint32_t inner_flag = 0x80;
+  // a wide node pushes at most seven more entries than it pops, for at most
+  // as many levels as the binary tree had
+  static constexpr uint32_t compressed_max_depth = 64;
+  static constexpr uint32_t compressed_stack_size = compressed_max_depth * compressed_bvh_width;
+
+  // 2^exponent straight from the float bits, exponents stay within the normal range
+  static float Exp2(int8_t exponent)
+  {
+    uint32_t bits = static_cast<uint32_t>(exponent + 127) << 23;
+    float value;
+    std::memcpy(&value, &bits, sizeof(value));
+    return value;
+  }
+
+  // A binary inner node, or a run of triangle blocks when node is invalid_index.
+  struct CollapseItem
+  {
+    uint32_t node { invalid_index };
+    uint32_t first_block { 0 };
+    uint32_t block_count { 0 };
+    AABB bounds;
+
+    // too big for a leaf slot, becomes a wide node of its own
+    bool Inner() const { return node != invalid_index || block_count > max_leaf_blocks; }
+  };
+
+  static CollapseItem MakeItem(const std::vector<BVHNode>& source, uint32_t index)
+  {
+    const BVHNode& node = source[index];
+    CollapseItem item;
+    item.bounds.min = node.bounds_min;
+    item.bounds.max = node.bounds_max;
+    if (node.IsLeaf())
+    {
+      item.first_block = node.left_first;
+      item.block_count = (node.count + triangle_block_width - 1) / triangle_block_width;
+    }
+    else item.node = index;
+    return item;
+  }
+
+  static void Expand(const std::vector<BVHNode>& source, const CollapseItem& item, CollapseItem& a, CollapseItem& b)
+  {
+    if (item.node != invalid_index)
+    {
+      a = MakeItem(source, source[item.node].left_first);
+      b = MakeItem(source, source[item.node].left_first + 1);
+      return;
+    }
+
+    // oversized leaves from the depth limit are halved, keeping the leaf bounds
+    a = b = item;
+    a.block_count = item.block_count / 2;
+    b.first_block = item.first_block + a.block_count;
+    b.block_count = item.block_count - a.block_count;
+  }
+
+  // Smallest power of two cell per axis that fits every child in 8 bits.
+  static void Quantize(CompressedBVHNode& node, const AABB& bounds, const std::vector<CollapseItem>& children)
+  {
+    node.origin = bounds.min;
+    for (int axis = 0; axis < 3; ++axis)
+    {
+      float extent = bounds.max[axis] - bounds.min[axis];
+      int exponent = extent > 0.0f ? static_cast<int>(std::ceil(std::log2(extent / 255.0f))) : -126;
+      exponent = std::max(exponent, -126);
+
+      for (bool fits = false; !fits; ++exponent)
+      {
+        float scale = Exp2(static_cast<int8_t>(exponent));
+        fits = true;
+        for (size_t i = 0; i < children.size() && fits; ++i)
+        {
+          // rounded estimates first, then nudged until the decoded planes enclose the child
+          float low = std::floor((children[i].bounds.min[axis] - node.origin[axis]) / scale);
+          float high = std::ceil((children[i].bounds.max[axis] - node.origin[axis]) / scale);
+          low = std::max(low, 0.0f);
+          while (low > 0.0f && node.origin[axis] + low * scale > children[i].bounds.min[axis]) low -= 1.0f;
+          while (node.origin[axis] + high * scale < children[i].bounds.max[axis]) high += 1.0f;
+
+          fits = high <= 255.0f;
+          node.bounds_min[axis][i] = static_cast<uint8_t>(low);
+          node.bounds_max[axis][i] = static_cast<uint8_t>(std::min(high, 255.0f));
+        }
+        if (fits) node.exponent[axis] = static_cast<int8_t>(exponent);
+      }
+    }
+  }
+
+  template <typename Kernel>
+  void CompressedBVHT<Kernel>::Build(const BVHT<Kernel>& bvh)
+  {
+    Profiler::Scope scope("bvh.compress");
+    nodes.clear();
+    blocks.clear();
+
+    const std::vector<BVHNode>& source = bvh.getNodes();
+    const std::vector<TriangleBlock<triangle_block_width>>& source_blocks = bvh.getBlocks();
+    if (source.empty()) return;
+
+    std::vector<std::pair<CollapseItem, uint32_t>> todo = { { MakeItem(source, 0), 0 } };
+    std::vector<CollapseItem> children;
+    nodes.emplace_back();
+    blocks.reserve(source_blocks.size());
+
+    while (!todo.empty())
+    {
+      CollapseItem item = todo.back().first;
+      uint32_t node_index = todo.back().second;
+      todo.pop_back();
+
+      children.clear();
+      if (item.Inner())
+      {
+        children.resize(2);
+        Expand(source, item, children[0], children[1]);
+      }
+      else children.push_back(item);
+
+      // open the largest inner child until all slots are used
+      while (children.size() < compressed_bvh_width)
+      {
+        int largest = -1;
+        for (size_t i = 0; i < children.size(); ++i)
+        {
+          if (children[i].Inner() && (largest < 0 || children[i].bounds.Area() > children[largest].bounds.Area()))
+            largest = static_cast<int>(i);
+        }
+        if (largest < 0) break;
+
+        CollapseItem opened = children[largest];
+        children.emplace_back();
+        Expand(source, opened, children[largest], children.back());
+      }
+
+      AABB bounds;
+      for (const CollapseItem& child : children) bounds.Grow(child.bounds);
+
+      CompressedBVHNode node;
+      Quantize(node, bounds, children);
+      node.child_base = static_cast<uint32_t>(nodes.size());
+      node.block_base = static_cast<uint32_t>(blocks.size());
+
+      uint32_t inner_count = 0;
+      uint32_t block_offset = 0;
+      for (size_t i = 0; i < children.size(); ++i)
+      {
+        const CollapseItem& child = children[i];
+        if (child.Inner())
+        {
+          node.meta[i] = static_cast<uint8_t>(inner_flag | inner_count);
+          node.inner_mask |= static_cast<uint8_t>(1u << i);
+          todo.push_back({ child, node.child_base + inner_count++ });
+          nodes.emplace_back();
+          continue;
+        }
+
+        node.meta[i] = static_cast<uint8_t>(child.block_count << 5 | block_offset);
+        blocks.insert(blocks.end(), source_blocks.begin() + child.first_block,
+                      source_blocks.begin() + child.first_block + child.block_count);
+        block_offset += child.block_count;
+      }
+      nodes[node_index] = node;
+    }
+
+    DEBUG_LOG(BVH, "Compressed %zu binary nodes into %zu wide nodes, %zu -> %zu bytes", source.size(), nodes.size(),
+              source.size() * sizeof(BVHNode), nodes.size() * sizeof(CompressedBVHNode));
+  }
+
+  struct CompressedStackEntry
+  {
+    uint32_t index;
+    // 0 for wide nodes, otherwise the number of triangle blocks at index
+    uint32_t block_count;
+    float t;
+  };
+
+  // Children of node the ray enters, in slot order, returns how many.
+  static uint32_t IntersectChildren(const CompressedBVHNode& node, const glm::vec3& origin,
+                                    const glm::vec3& inverse_direction, float tmin, float tmax,
+                                    CompressedStackEntry* entries)
+  {
+    using Float = SimdFloat<compressed_bvh_width>;
+
+    Float tnear(tmin), tfar(tmax);
+    for (int axis = 0; axis < 3; ++axis)
+    {
+      alignas(32) float low[compressed_bvh_width], high[compressed_bvh_width];
+      for (uint32_t i = 0; i < compressed_bvh_width; ++i)
+      {
+        low[i] = node.bounds_min[axis][i];
+        high[i] = node.bounds_max[axis][i];
+      }
+
+      // q * 2^exponent is exact, so base + q * scale rounds once whether or
+      // not it is contracted into an FMA, like the check in Quantize
+      Float base(node.origin[axis]), scale(Exp2(node.exponent[axis]));
+      Float ray_origin(origin[axis]), inverse(inverse_direction[axis]);
+      Float t0 = (base + Float::Load(low) * scale - ray_origin) * inverse;
+      Float t1 = (base + Float::Load(high) * scale - ray_origin) * inverse;
+      tnear = Max(tnear, Min(t0, t1));
+      tfar = Min(tfar, Max(t0, t1) * Float(robust_far_scale));
+    }
+
+    alignas(32) float near_t[compressed_bvh_width];
+    tnear.Store(near_t);
+    uint32_t bits = (tnear <= tfar).Bits();
+    uint32_t count = 0;
+    for (uint32_t i = 0; i < compressed_bvh_width; ++i)
+    {
+      uint8_t meta = node.meta[i];
+      if (meta == 0 || !((bits >> i) & 1u)) continue;
+
+      CompressedStackEntry& entry = entries[count++];
+      entry.t = near_t[i];
+      if (meta & inner_flag)
+      {
+        entry.index = node.child_base + (meta & ~inner_flag);
+        entry.block_count = 0;
+      }
+      else
+      {
+        entry.index = node.block_base + (meta & 0x1F);
+        entry.block_count = meta >> 5;
+      }
+    }
+    return count;
+  }
+
+  template <typename Kernel>
+  bool CompressedBVHT<Kernel>::Intersect(const Ray& ray, Hit& hit, TraversalStats* stats) const
+  {
+    constexpr int W = triangle_block_width;
+    if (nodes.empty()) return false;
+    if (stats) stats->rays++;
+
+    typename Kernel::RayData ray_data = Kernel::Prepare(ray);
+    glm::vec3 inverse_direction = SafeInverse(ray.direction);
+    float tmax = std::min(ray.tmax, hit.t);
+    uint32_t hit_primitive = invalid_index;
+
+    CompressedStackEntry stack[compressed_stack_size];
+    uint32_t stack_pointer = 0;
+    stack[stack_pointer++] = { 0, 0, ray.tmin };
+
+    while (stack_pointer > 0)
+    {
+      CompressedStackEntry entry = stack[--stack_pointer];
+      if (entry.t > tmax) continue;
+
+      if (entry.block_count > 0)
+      {
+        if (stats) stats->block_bytes += entry.block_count * sizeof(TriangleBlock<W>);
+        for (uint32_t b = entry.index; b < entry.index + entry.block_count; ++b)
+        {
+          SimdFloat<W> t, u, v;
+          SimdMask<W> mask = Kernel::Intersect(blocks[b], ray_data, ray.tmin, tmax, t, u, v);
+          if (mask.None()) continue;
+
+          SimdFloat<W> masked = Select(mask, t, SimdFloat<W>(infinity));
+          uint32_t nearest = (mask & (masked == SimdFloat<W>(ReduceMin(masked)))).Bits();
+          int lane = 0;
+          while (!((nearest >> lane) & 1u)) lane++;
+          tmax = t[lane];
+          hit.u = u[lane];
+          hit.v = v[lane];
+          hit_primitive = blocks[b].primitive[lane];
+        }
+        continue;
+      }
+
+      if (stats) stats->node_bytes += sizeof(CompressedBVHNode);
+      CompressedStackEntry children[compressed_bvh_width];
+      uint32_t count = IntersectChildren(nodes[entry.index], ray.origin, inverse_direction, ray.tmin, tmax, children);
+
+      // insertion sort, farthest first so the nearest child is popped next
+      for (uint32_t i = 0; i < count; ++i)
+      {
+        uint32_t j = stack_pointer + i;
+        for (; j > stack_pointer && stack[j - 1].t < children[i].t; --j) stack[j] = stack[j - 1];
+        stack[j] = children[i];
+      }
+      stack_pointer += count;
+    }
+
+    if (hit_primitive == invalid_index) return false;
+
+    hit.t = tmax;
+    hit.primitive = hit_primitive;
+    return true;
+  }
+
+  template <typename Kernel>
+  bool CompressedBVHT<Kernel>::Validate(size_t primitive_count) const
+  {
+    std::vector<uint32_t> depth(nodes.size(), 0);
+    for (size_t i = 0; i < nodes.size(); ++i)
+    {
+      const CompressedBVHNode& node = nodes[i];
+      for (uint32_t slot = 0; slot < compressed_bvh_width; ++slot)
+      {
+        uint8_t meta = node.meta[slot];
+        if (meta == 0) continue;
+        if (!(meta & inner_flag))
+        {
+          if (uint64_t(node.block_base) + (meta & 0x1F) + (meta >> 5) > blocks.size()) return false;
+          continue;
+        }
+        uint64_t child = uint64_t(node.child_base) + (meta & ~inner_flag);
+        if (child <= i || child >= nodes.size() || depth[i] + 1 >= compressed_max_depth) return false;
+        depth[child] = std::max(depth[child], depth[i] + 1);
+      }
+    }
+    return ValidPrimitives(blocks, primitive_count);
+  }
+
+  template <typename Kernel>
+  bool CompressedBVHT<Kernel>::Occluded(const Ray& ray) const
+  {
+    constexpr int W = triangle_block_width;
+    if (nodes.empty()) return false;
+
+    typename Kernel::RayData ray_data = Kernel::Prepare(ray);
+    glm::vec3 inverse_direction = SafeInverse(ray.direction);
+    CompressedStackEntry stack[compressed_stack_size];
+    uint32_t stack_pointer = 0;
+    stack[stack_pointer++] = { 0, 0, ray.tmin };
+
+    while (stack_pointer > 0)
+    {
+      CompressedStackEntry entry = stack[--stack_pointer];
+      if (entry.block_count > 0)
+      {
+        for (uint32_t b = entry.index; b < entry.index + entry.block_count; ++b)
+        {
+          SimdFloat<W> t, u, v;
+          if (Kernel::Intersect(blocks[b], ray_data, ray.tmin, ray.tmax, t, u, v).Any()) return true;
+        }
+        continue;
+      }
+
+      stack_pointer += IntersectChildren(nodes[entry.index], ray.origin, inverse_direction, ray.tmin, ray.tmax,
+                                         stack + stack_pointer);
+    }
+
+    return false;
+  }
+
+  template <typename Kernel>
+  void CompressedBVHT<Kernel>::Trace(const Ray* rays, Hit* hits, size_t count) const
+  {
+    for (size_t i = 0; i < count; ++i)
+    {
+      hits[i] = Hit {};
+      Intersect(rays[i], hits[i]);
+    }
+  }
+
+  template <typename Kernel>
+  void CompressedBVHT<Kernel>::TraceOcclusion(const Ray* rays, bool* occluded, size_t count) const
+  {
+    for (size_t i = 0; i < count; ++i) occluded[i] = Occluded(rays[i]);
+  }
+
+  template class CompressedBVHT<MollerTrumboreKernel>;
+  template class CompressedBVHT<WatertightKernel>;
+
+} // namespace PathTracer
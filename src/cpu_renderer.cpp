@@ -0,0 +1,57 @@
+
+#include <VulkanPT/cpu_renderer.hpp>
+#include <VulkanPT/profiler.hpp>
+
+namespace PathTracer
+{
+  CpuRenderer::CpuRenderer(uint32_t in_width, uint32_t in_height, AdaptiveSettings settings,
+                           uint32_t thread_count) :
+    scheduler{ thread_count }, accumulator{ in_width, in_height }, sampler{ settings },
+    path_statistics{ scheduler.getThreadCount() }
+  {}
+
+  bool CpuRenderer::RenderPass(const SampleFunction& sample)
+  {
+    Profiler::Scope scope("cpu.render_pass");
+
+    std::vector<TileBudget> plan = sampler.PlanPass(accumulator);
+    if (plan.empty())
+    {
+      if (!statistics_reported) path_statistics.Report();
+      statistics_reported = true;
+      return false;
+    }
+
+    const std::vector<TileState>& tiles = accumulator.getTiles();
+    scheduler.ParallelFor(static_cast<uint32_t>(plan.size()), [&](uint32_t task, uint32_t thread)
+    {
+      const TileBudget& budget = plan[task];
+      const TileState& tile = tiles[budget.tile];
+
+      for (uint32_t y = tile.y; y < tile.y + tile.height; ++y)
+      {
+        for (uint32_t x = tile.x; x < tile.x + tile.width; ++x)
+        {
+          uint32_t first_sample = accumulator.Pixel(x, y).count;
+          for (uint32_t i = 0; i < budget.samples; ++i)
+            accumulator.AddSample(x, y, sample(x, y, first_sample + i, thread));
+        }
+      }
+
+      scheduler.AddWork(thread, static_cast<uint64_t>(tile.width) * tile.height * budget.samples);
+    });
+
+    return true;
+  }
+
+  void CpuRenderer::Reset()
+  {
+    // an image dropped before it converged still reports what it traced
+    if (!statistics_reported && path_statistics.Total().samples) path_statistics.Report();
+    statistics_reported = false;
+    accumulator.Reset();
+    scheduler.ResetStats();
+    path_statistics.Reset();
+  }
+
+} // namespace PathTracer
@@ -0,0 +1,343 @@
+
+#include <VulkanPT/curve.hpp>
+#include <VulkanPT/debug.hpp>
+#include <VulkanPT/profiler.hpp>
+#include <algorithm>
+#include <numeric>
+#include <utility>
+
+namespace PathTracer
+{
+  static constexpr uint32_t curve_stack_size = 64 * 2;
+
+  // Ray aligned frame: positions relative to the origin project onto two
+  // unit axes across the ray, and onto the direction scaled so that the
+  // third coordinate is the ray parameter.
+  struct CurveRay
+  {
+    glm::vec3 origin;
+    glm::vec3 axis_x;
+    glm::vec3 axis_y;
+    glm::vec3 axis_t;
+    float inverse_length;
+  };
+
+  static CurveRay PrepareCurveRay(const Ray& ray)
+  {
+    CurveRay frame;
+    const float length = glm::length(ray.direction);
+    const glm::vec3 z = ray.direction / length;
+    // Duff et al., "Building an Orthonormal Basis, Revisited" (2017)
+    const float sign = std::copysign(1.0f, z.z);
+    const float a = -1.0f / (sign + z.z);
+    const float b = z.x * z.y * a;
+    frame.origin = ray.origin;
+    frame.axis_x = glm::vec3(1.0f + sign * z.x * z.x * a, sign * b, -sign * z.x);
+    frame.axis_y = glm::vec3(b, sign + z.y * z.y * a, -z.y);
+    frame.axis_t = ray.direction / (length * length);
+    frame.inverse_length = 1.0f / length;
+    return frame;
+  }
+
+  // Blossom of a cubic Bezier curve, de Casteljau with one parameter per
+  // level. (u, u, u) is the point at u and the piece [a, b] has the control
+  // points (a, a, a), (a, a, b), (a, b, b) and (b, b, b).
+  static glm::vec4 Blossom(const glm::vec4* p, float t0, float t1, float t2)
+  {
+    const glm::vec4 a[3] = { glm::mix(p[0], p[1], t0), glm::mix(p[1], p[2], t0), glm::mix(p[2], p[3], t0) };
+    const glm::vec4 b[2] = { glm::mix(a[0], a[1], t1), glm::mix(a[1], a[2], t1) };
+    return glm::mix(b[0], b[1], t2);
+  }
+
+  // Closest hit of every lane of a block, u in [0, 1] along its segment. The
+  // lanes walk their piece in linear steps and test the point of each step
+  // closest to the ray, in the ray frame a 2D distance to the origin. Round
+  // curves move the hit towards the ray origin by the half chord there.
+  template <int W>
+  static SimdMask<W> IntersectBlock(const CurveBlock<W>& block, const CurveRay& ray, CurveType type, float tmin,
+                                    float tmax, SimdFloat<W>& hit_t, SimdFloat<W>& hit_u, SimdFloat<W>& hit_v)
+  {
+    using Float = SimdFloat<W>;
+    using Mask = SimdMask<W>;
+
+    Float x[4], y[4], z[4], r[4];
+    for (int point = 0; point < 4; ++point)
+    {
+      const Float px = Float::Load(block.points[point][0]) - Float(ray.origin.x);
+      const Float py = Float::Load(block.points[point][1]) - Float(ray.origin.y);
+      const Float pz = Float::Load(block.points[point][2]) - Float(ray.origin.z);
+      x[point] = px * Float(ray.axis_x.x) + py * Float(ray.axis_x.y) + pz * Float(ray.axis_x.z);
+      y[point] = px * Float(ray.axis_y.x) + py * Float(ray.axis_y.y) + pz * Float(ray.axis_y.z);
+      z[point] = px * Float(ray.axis_t.x) + py * Float(ray.axis_t.y) + pz * Float(ray.axis_t.z);
+      r[point] = Float::Load(block.points[point][3]);
+    }
+
+    Mask found = Mask::FromBits(0);
+    hit_t = Float(tmax);
+    hit_u = hit_v = Float(0.0f);
+    Float ax = x[0], ay = y[0], az = z[0], ar = r[0];
+    for (int step = 1; step <= curve_linear_steps; ++step)
+    {
+      const float s = static_cast<float>(step) / curve_linear_steps;
+      const float weights[4] = { (1.0f - s) * (1.0f - s) * (1.0f - s), 3.0f * s * (1.0f - s) * (1.0f - s),
+                                 3.0f * s * s * (1.0f - s), s * s * s };
+      Float bx = x[0] * Float(weights[0]), by = y[0] * Float(weights[0]);
+      Float bz = z[0] * Float(weights[0]), br = r[0] * Float(weights[0]);
+      for (int point = 1; point < 4; ++point)
+      {
+        bx = bx + x[point] * Float(weights[point]);
+        by = by + y[point] * Float(weights[point]);
+        bz = bz + z[point] * Float(weights[point]);
+        br = br + r[point] * Float(weights[point]);
+      }
+
+      const Float dx = bx - ax, dy = by - ay;
+      const Float length2 = Max(dx * dx + dy * dy, Float(1e-30f));
+      const Float f = Min(Max(-(ax * dx + ay * dy) / length2, Float(0.0f)), Float(1.0f));
+      const Float cx = ax + dx * f, cy = ay + dy * f;
+      const Float distance2 = cx * cx + cy * cy;
+      const Float radius = ar + (br - ar) * f;
+      const Float radius2 = radius * radius;
+      Float t = az + (bz - az) * f;
+      if (type == CurveType::Round) t = t - Sqrt(Max(radius2 - distance2, Float(0.0f))) * Float(ray.inverse_length);
+
+      const Mask hit = (distance2 <= radius2) & (t > Float(tmin)) & (t < hit_t);
+      hit_t = Select(hit, t, hit_t);
+      hit_u = Select(hit, Float(static_cast<float>(step - 1)) + f, hit_u);
+      hit_v = Select(hit, (dx * cy - dy * cx) / Max(Sqrt(length2) * radius, Float(1e-30f)), hit_v);
+      found = found | hit;
+
+      ax = bx;
+      ay = by;
+      az = bz;
+      ar = br;
+    }
+
+    hit_u = Float::Load(block.u0) + Float::Load(block.du) * hit_u * Float(1.0f / curve_linear_steps);
+    return found;
+  }
+
+  void CurveBVH::Build(const CurveSet& in_curves, CurveBuildSettings settings)
+  {
+    Profiler::Scope scope("curve_bvh.build");
+    constexpr uint32_t W = triangle_block_width;
+
+    curves = in_curves;
+    nodes.clear();
+    blocks.clear();
+    const uint32_t splits = std::max(settings.splits, 1u);
+    const uint32_t segment_count = static_cast<uint32_t>(curves.segments.size());
+    const uint32_t piece_count = segment_count * splits;
+    if (piece_count == 0) return;
+
+    std::vector<glm::vec4> pieces(static_cast<size_t>(piece_count) * 4);
+    std::vector<AABB> primitive_bounds(piece_count);
+    std::vector<glm::vec3> centroids(piece_count);
+    for (uint32_t piece = 0; piece < piece_count; ++piece)
+    {
+      const glm::vec4* p = &curves.points[curves.segments[piece / splits]];
+      const float u0 = static_cast<float>(piece % splits) / splits;
+      const float u1 = static_cast<float>(piece % splits + 1) / splits;
+      glm::vec4* q = &pieces[static_cast<size_t>(piece) * 4];
+      q[0] = Blossom(p, u0, u0, u0);
+      q[1] = Blossom(p, u0, u0, u1);
+      q[2] = Blossom(p, u0, u1, u1);
+      q[3] = Blossom(p, u1, u1, u1);
+
+      // the control points bound the piece, the largest radius widens that
+      const float radius = std::max(std::max(q[0].w, q[1].w), std::max(q[2].w, q[3].w));
+      for (int point = 0; point < 4; ++point)
+      {
+        primitive_bounds[piece].Grow(glm::vec3(q[point]) - radius);
+        primitive_bounds[piece].Grow(glm::vec3(q[point]) + radius);
+      }
+      centroids[piece] = primitive_bounds[piece].Center();
+    }
+
+    std::vector<uint32_t> primitive_indices(piece_count);
+    std::iota(primitive_indices.begin(), primitive_indices.end(), 0u);
+    BuildNodes(nodes, primitive_indices, primitive_bounds, centroids, settings.bvh);
+
+    for (BVHNode& node : nodes)
+    {
+      if (!node.IsLeaf()) continue;
+
+      uint32_t first_block = static_cast<uint32_t>(blocks.size());
+      uint32_t block_count = (node.count + W - 1) / W;
+      blocks.resize(blocks.size() + block_count);
+      for (uint32_t b = first_block; b < first_block + block_count; ++b) blocks[b].Clear();
+
+      for (uint32_t i = 0; i < node.count; ++i)
+      {
+        const uint32_t piece = primitive_indices[node.left_first + i];
+        CurveBlock<W>& block = blocks[first_block + i / W];
+        const uint32_t lane = i % W;
+        for (int point = 0; point < 4; ++point)
+        {
+          for (int axis = 0; axis < 4; ++axis)
+            block.points[point][axis][lane] = pieces[static_cast<size_t>(piece) * 4 + point][axis];
+        }
+        block.u0[lane] = static_cast<float>(piece % splits) / splits;
+        block.du[lane] = 1.0f / splits;
+        block.primitive[lane] = piece / splits;
+      }
+      node.left_first = first_block;
+    }
+
+    DEBUG_LOG(BVH, "Built curve BVH with %zu nodes and %zu blocks over %u segments in %u pieces",
+              nodes.size(), blocks.size(), segment_count, piece_count);
+  }
+
+  bool CurveBVH::Intersect(const Ray& ray, Hit& hit, TraversalStats* stats) const
+  {
+    constexpr int W = triangle_block_width;
+    if (nodes.empty()) return false;
+    if (stats)
+    {
+      stats->rays++;
+      stats->node_bytes += sizeof(BVHNode);
+    }
+
+    const CurveRay frame = PrepareCurveRay(ray);
+    glm::vec3 inverse_direction = SafeInverse(ray.direction);
+    float tmax = std::min(ray.tmax, hit.t);
+    uint32_t hit_primitive = invalid_index;
+
+    uint32_t stack[curve_stack_size];
+    uint32_t stack_pointer = 0;
+    stack[stack_pointer++] = 0;
+
+    while (stack_pointer > 0)
+    {
+      const BVHNode& node = nodes[stack[--stack_pointer]];
+      float tnear;
+      if (!IntersectNode(node, ray.origin, inverse_direction, ray.tmin, tmax, tnear)) continue;
+
+      if (node.IsLeaf())
+      {
+        uint32_t block_count = (node.count + W - 1) / W;
+        if (stats) stats->block_bytes += block_count * sizeof(CurveBlock<W>);
+        for (uint32_t b = node.left_first; b < node.left_first + block_count; ++b)
+        {
+          SimdFloat<W> t, u, v;
+          SimdMask<W> mask = IntersectBlock(blocks[b], frame, curves.type, ray.tmin, tmax, t, u, v);
+          if (mask.None()) continue;
+
+          int lane = NearestLane(mask, t);
+          tmax = t[lane];
+          hit.u = u[lane];
+          hit.v = v[lane];
+          hit_primitive = blocks[b].primitive[lane];
+        }
+        continue;
+      }
+
+      if (stats) stats->node_bytes += 2 * sizeof(BVHNode);
+      uint32_t near_child = node.left_first;
+      uint32_t far_child = node.left_first + 1;
+      float near_t, far_t;
+      bool near_hit = IntersectNode(nodes[near_child], ray.origin, inverse_direction, ray.tmin, tmax, near_t);
+      bool far_hit = IntersectNode(nodes[far_child], ray.origin, inverse_direction, ray.tmin, tmax, far_t);
+      if (near_hit && far_hit && far_t < near_t)
+      {
+        std::swap(near_child, far_child);
+        std::swap(near_hit, far_hit);
+      }
+
+      if (far_hit) stack[stack_pointer++] = far_child;
+      if (near_hit) stack[stack_pointer++] = near_child;
+    }
+
+    if (hit_primitive == invalid_index) return false;
+
+    hit.t = tmax;
+    hit.primitive = hit_primitive;
+    return true;
+  }
+
+  bool CurveBVH::Occluded(const Ray& ray) const
+  {
+    constexpr int W = triangle_block_width;
+    if (nodes.empty()) return false;
+
+    const CurveRay frame = PrepareCurveRay(ray);
+    glm::vec3 inverse_direction = SafeInverse(ray.direction);
+    uint32_t stack[curve_stack_size];
+    uint32_t stack_pointer = 0;
+    stack[stack_pointer++] = 0;
+
+    while (stack_pointer > 0)
+    {
+      const BVHNode& node = nodes[stack[--stack_pointer]];
+      float tnear;
+      if (!IntersectNode(node, ray.origin, inverse_direction, ray.tmin, ray.tmax, tnear)) continue;
+
+      if (node.IsLeaf())
+      {
+        uint32_t block_count = (node.count + W - 1) / W;
+        for (uint32_t b = node.left_first; b < node.left_first + block_count; ++b)
+        {
+          SimdFloat<W> t, u, v;
+          if (IntersectBlock(blocks[b], frame, curves.type, ray.tmin, ray.tmax, t, u, v).Any()) return true;
+        }
+        continue;
+      }
+
+      stack[stack_pointer++] = node.left_first + 1;
+      stack[stack_pointer++] = node.left_first;
+    }
+
+    return false;
+  }
+
+  glm::vec3 CurveBVH::Position(uint32_t segment, float u) const
+  { return glm::vec3(Blossom(&curves.points[curves.segments[segment]], u, u, u)); }
+
+  glm::vec3 CurveBVH::Normal(const Ray& ray, const Hit& hit) const
+  {
+    const glm::vec4* p = &curves.points[curves.segments[hit.primitive]];
+    const glm::vec3 axis = glm::vec3(Blossom(p, hit.u, hit.u, hit.u));
+    const glm::vec3 derivative = glm::vec3(Blossom(p, hit.u, hit.u, 1.0f)) - glm::vec3(Blossom(p, hit.u, hit.u, 0.0f));
+
+    glm::vec3 normal = curves.type == CurveType::Round ? ray.origin + ray.direction * hit.t - axis : -ray.direction;
+    const float derivative2 = glm::dot(derivative, derivative);
+    if (derivative2 > 0.0f) normal -= derivative * (glm::dot(normal, derivative) / derivative2);
+
+    const float length = glm::length(normal);
+    return length > 0.0f ? normal / length : -glm::normalize(ray.direction);
+  }
+
+  std::vector<GpuCurvePiece> CurveBVH::GpuPieces() const
+  {
+    constexpr int W = triangle_block_width;
+    std::vector<GpuCurvePiece> pieces(blocks.size() * W);
+    for (size_t b = 0; b < blocks.size(); ++b)
+    {
+      for (int lane = 0; lane < W; ++lane)
+      {
+        GpuCurvePiece& piece = pieces[b * W + lane];
+        for (int point = 0; point < 4; ++point)
+        {
+          for (int axis = 0; axis < 4; ++axis) piece.points[point][axis] = blocks[b].points[point][axis][lane];
+        }
+        piece.segment = blocks[b].primitive[lane];
+        piece.u0 = blocks[b].u0[lane];
+        piece.du = blocks[b].du[lane];
+        piece.type = curves.type;
+      }
+    }
+    return pieces;
+  }
+
+  AABB CurveBVH::Bounds() const
+  {
+    AABB bounds;
+    if (!nodes.empty())
+    {
+      bounds.min = nodes[0].bounds_min;
+      bounds.max = nodes[0].bounds_max;
+    }
+    return bounds;
+  }
+
+} // namespace PathTracer
@@ -1,37 +1,106 @@
 
 #include <VulkanPT/debug.hpp>
 #include <cstdarg>
+#include <cstdio>
+#include <cstring>
+#include <mutex>
 #include <string>
 
-static void WriteLog(const char* prepend, const char* message, va_list args)
-{ vprintf((std::string(prepend) + message + "\n").c_str(), args); }
+std::atomic<uint8_t> Debug::levels[static_cast<size_t>(Debug::Category::Count)] = {};
 
-void Debug::Log(const char* message, ...)
+static std::mutex write_mutex;
+
+static const char* level_prefixes[] = { "\033[0;32m[LOG]", "\033[0;33m[WARNING]", "\033[0;31m[ERROR]" };
+static const char* category_names[] = { "general", "vulkan", "bvh", "io", "scheduler" };
+
+static_assert(sizeof(category_names) / sizeof(category_names[0]) ==
+              static_cast<size_t>(Debug::Category::Count), "missing category name");
+
+// every category starts at the compile-time floor
+static const bool levels_initialized = []()
 {
-#ifdef DEBUG
-  va_list args;
-  va_start(args, message);
-  WriteLog("\033[0;32m[LOG]: \033[0m", message, args);
-  va_end(args);
-#endif // DEBUG
+  Debug::SetLevel(static_cast<Debug::Level>(VPT_LOG_LEVEL));
+  return true;
+}();
+
+static void WriteLog(Debug::Level level, Debug::Category category, const char* message, va_list args)
+{
+  char buffer[1024];
+  vsnprintf(buffer, sizeof(buffer), message, args);
+
+  std::lock_guard<std::mutex> lock(write_mutex);
+  printf("%s[%s]: \033[0m%s\n", level_prefixes[static_cast<size_t>(level)],
+         Debug::CategoryName(category), buffer);
 }
 
-void Debug::Warning(const char* message, ...)
+void Debug::SetLevel(Category category, Level level)
+{ levels[static_cast<size_t>(category)].store(static_cast<uint8_t>(level), std::memory_order_relaxed); }
+
+void Debug::SetLevel(Level level)
 {
-#ifdef DEBUG
-  va_list args;
-  va_start(args, message);
-  WriteLog("\033[0;33m[WARNING]: \033[0m", message, args);
-  va_end(args);
-#endif // DEBUG
+  for (size_t i = 0; i < static_cast<size_t>(Category::Count); ++i)
+    SetLevel(static_cast<Category>(i), level);
+}
+
+Debug::Level Debug::GetLevel(Category category)
+{ return static_cast<Level>(levels[static_cast<size_t>(category)].load(std::memory_order_relaxed)); }
+
+const char* Debug::CategoryName(Category category)
+{ return category_names[static_cast<size_t>(category)]; }
+
+void Debug::Configure(const char* spec)
+{
+  if (!spec) return;
+
+  // spec is a comma separated list of "level" or "category=level" entries
+  std::string entries(spec);
+  size_t start = 0;
+  while (start <= entries.size())
+  {
+    size_t end = entries.find(',', start);
+    if (end == std::string::npos) end = entries.size();
+    std::string entry = entries.substr(start, end - start);
+    start = end + 1;
+    if (entry.empty()) continue;
+
+    size_t separator = entry.find('=');
+    std::string level_name = separator == std::string::npos ? entry : entry.substr(separator + 1);
+
+    Level level;
+    if (level_name == "log") level = Level::Log;
+    else if (level_name == "warning") level = Level::Warning;
+    else if (level_name == "error") level = Level::Error;
+    else if (level_name == "none") level = Level::None;
+    else
+    {
+      DEBUG_WARNING(General, "Unknown log level %s", level_name.c_str());
+      continue;
+    }
+
+    if (separator == std::string::npos)
+    {
+      SetLevel(level);
+      continue;
+    }
+
+    std::string category_name = entry.substr(0, separator);
+    bool found = false;
+    for (size_t i = 0; i < static_cast<size_t>(Category::Count); ++i)
+    {
+      if (category_name == category_names[i])
+      {
+        SetLevel(static_cast<Category>(i), level);
+        found = true;
+      }
+    }
+    if (!found) DEBUG_WARNING(General, "Unknown log category %s", category_name.c_str());
+  }
 }
 
-void Debug::Error(const char* message, ...)
+void Debug::Write(Level level, Category category, const char* message, ...)
 {
-#ifdef DEBUG
   va_list args;
   va_start(args, message);
-  WriteLog("\033[0;31m[ERROR]: \033[0m", message, args);
+  WriteLog(level, category, message, args);
   va_end(args);
-#endif // DEBUG
 }
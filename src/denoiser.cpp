@@ -0,0 +1,333 @@
+
+#include <VulkanPT/denoiser.hpp>
+#include <VulkanPT/accumulation.hpp>
+#include <VulkanPT/profiler.hpp>
+#include <VulkanPT/simd.hpp>
+#include <algorithm>
+
+namespace PathTracer
+{
+#if defined(VPT_AVX)
+  static constexpr int denoise_lanes = 8;
+#else
+  static constexpr int denoise_lanes = 4;
+#endif
+
+  // B3 spline, the a-trous kernel of the paper
+  static const float atrous_kernel[5] = { 1.0f / 16.0f, 1.0f / 4.0f, 3.0f / 8.0f, 1.0f / 4.0f, 1.0f / 16.0f };
+
+  static glm::vec3 Demodulation(const DenoiseGuide& guide, bool demodulate)
+  { return demodulate ? glm::max(guide.albedo, glm::vec3(1e-3f)) : glm::vec3(1.0f); }
+
+  static float NormalWeight(const glm::vec3& a, const glm::vec3& b, uint32_t power)
+  {
+    float base = std::max(glm::dot(a, b), 0.0f), weight = 1.0f;
+    for (; power; power >>= 1)
+    {
+      if (power & 1) weight *= base;
+      base *= base;
+    }
+    return weight;
+  }
+
+  Denoiser::Denoiser(uint32_t in_width, uint32_t in_height, DenoiserSettings in_settings)
+    : width{ in_width }, height{ in_height }, settings{ in_settings }
+  {
+    border = settings.atrous_iterations ? 2u << (settings.atrous_iterations - 1) : 0;
+    stride = 2 * border + (width + denoise_lanes - 1) / denoise_lanes * denoise_lanes;
+    const size_t padded = static_cast<size_t>(stride) * height;
+    const size_t pixels = static_cast<size_t>(width) * height;
+
+    for (int axis = 0; axis < 3; ++axis) normal[axis].assign(padded, 0.0f);
+    for (std::vector<float>* plane : { &depth, &depth_scale, &valid, &luminance_scale }) plane->assign(padded, 0.0f);
+    for (int i = 0; i < 2; ++i)
+    {
+      for (int channel = 0; channel < 3; ++channel) illumination[i][channel].assign(padded, 0.0f);
+      variance[i].assign(padded, 0.0f);
+      luminance[i].assign(padded, 0.0f);
+      history_color[i].assign(pixels, glm::vec3(0.0f));
+      history_moments[i].assign(pixels, glm::vec2(0.0f));
+      history_length[i].assign(pixels, 0.0f);
+    }
+  }
+
+  void Denoiser::Reset()
+  {
+    previous_guides.clear();
+    for (std::vector<float>& lengths : history_length) std::fill(lengths.begin(), lengths.end(), 0.0f);
+  }
+
+  void Denoiser::Denoise(const std::vector<glm::vec3>& color, const std::vector<DenoiseGuide>& guides,
+                         Scheduler& scheduler, std::vector<glm::vec3>& output)
+  {
+    Profiler::Scope scope("denoiser.denoise");
+    current ^= 1;
+    Accumulate(color, guides, scheduler);
+    EstimateVariance(scheduler);
+
+    uint32_t source = 0;
+    for (uint32_t iteration = 0; iteration < settings.atrous_iterations; ++iteration)
+    {
+      FilterPass(1u << iteration, source, scheduler);
+      source ^= 1;
+      if (iteration != settings.feedback_iteration) continue;
+
+      // the filtered color is what the next frame blends into
+      scheduler.ParallelFor(height, [&](uint32_t y, uint32_t)
+      {
+        for (uint32_t x = 0; x < width; ++x)
+        {
+          const size_t index = Index(x, y);
+          if (valid[index] == 0.0f) continue;
+          history_color[current][static_cast<size_t>(y) * width + x] =
+            glm::vec3(illumination[source][0][index], illumination[source][1][index], illumination[source][2][index]);
+        }
+      });
+    }
+
+    output.resize(color.size());
+    scheduler.ParallelFor(height, [&](uint32_t y, uint32_t)
+    {
+      for (uint32_t x = 0; x < width; ++x)
+      {
+        const size_t pixel = static_cast<size_t>(y) * width + x;
+        const size_t index = Index(x, y);
+        if (valid[index] == 0.0f)
+        {
+          output[pixel] = color[pixel];
+          continue;
+        }
+        output[pixel] = glm::vec3(illumination[source][0][index], illumination[source][1][index],
+                                  illumination[source][2][index]) *
+                        Demodulation(guides[pixel], settings.demodulate_albedo);
+      }
+    });
+    previous_guides = guides;
+  }
+
+  // Blends this frame into the reprojected history. The four texels around
+  // the previous position count when their surface matches, renormalized
+  // over the ones that do.
+  void Denoiser::Accumulate(const std::vector<glm::vec3>& color, const std::vector<DenoiseGuide>& guides,
+                            Scheduler& scheduler)
+  {
+    const uint32_t previous = current ^ 1;
+    const bool history = previous_guides.size() == guides.size();
+    scheduler.ParallelFor(height, [&](uint32_t y, uint32_t)
+    {
+      for (uint32_t x = 0; x < width; ++x)
+      {
+        const size_t pixel = static_cast<size_t>(y) * width + x;
+        const size_t index = Index(x, y);
+        const DenoiseGuide& guide = guides[pixel];
+        if (!guide.valid)
+        {
+          valid[index] = 0.0f;
+          history_length[current][pixel] = 0.0f;
+          continue;
+        }
+
+        valid[index] = 1.0f;
+        for (int axis = 0; axis < 3; ++axis) normal[axis][index] = guide.normal[axis];
+        depth[index] = guide.depth;
+        depth_scale[index] = 1.0f / (settings.sigma_depth * std::max(guide.depth_gradient, 1e-4f * guide.depth) +
+                                     1e-8f);
+
+        glm::vec3 sample = color[pixel] / Demodulation(guide, settings.demodulate_albedo);
+        float sample_luminance = Accumulator::Luminance(sample);
+        glm::vec2 moments(sample_luminance, sample_luminance * sample_luminance);
+
+        float weight_sum = 0.0f, length = 0.0f;
+        glm::vec3 previous_color(0.0f);
+        glm::vec2 previous_moments(0.0f);
+        const float px = x + guide.motion.x, py = y + guide.motion.y;
+        const float fx = px - std::floor(px), fy = py - std::floor(py);
+        const int32_t x0 = static_cast<int32_t>(std::floor(px)), y0 = static_cast<int32_t>(std::floor(py));
+        for (int32_t tap = 0; history && tap < 4; ++tap)
+        {
+          const int32_t tx = x0 + (tap & 1), ty = y0 + (tap >> 1);
+          const float weight = ((tap & 1) ? fx : 1.0f - fx) * ((tap >> 1) ? fy : 1.0f - fy);
+          if (weight <= 0.0f || tx < 0 || ty < 0 || tx >= static_cast<int32_t>(width) ||
+              ty >= static_cast<int32_t>(height))
+            continue;
+          const size_t texel = static_cast<size_t>(ty) * width + tx;
+          const DenoiseGuide& old = previous_guides[texel];
+          if (!old.valid || glm::dot(old.normal, guide.normal) < 0.9f ||
+              std::abs(old.depth - guide.depth) > 2.0f * guide.depth_gradient + 0.01f * guide.depth)
+            continue;
+          weight_sum += weight;
+          previous_color += history_color[previous][texel] * weight;
+          previous_moments += history_moments[previous][texel] * weight;
+          length += history_length[previous][texel] * weight;
+        }
+
+        if (weight_sum > 1e-3f)
+        {
+          length = std::min(length / weight_sum + 1.0f, static_cast<float>(settings.history_limit));
+          const float color_alpha = std::max(settings.color_alpha, 1.0f / length);
+          const float moments_alpha = std::max(settings.moments_alpha, 1.0f / length);
+          sample = glm::mix(previous_color / weight_sum, sample, color_alpha);
+          moments = glm::mix(previous_moments / weight_sum, moments, moments_alpha);
+        }
+        else length = 1.0f;
+
+        history_color[current][pixel] = sample;
+        history_moments[current][pixel] = moments;
+        history_length[current][pixel] = length;
+        for (int channel = 0; channel < 3; ++channel) illumination[0][channel][index] = sample[channel];
+        luminance[0][index] = Accumulator::Luminance(sample);
+        variance[0][index] = std::max(moments.y - moments.x * moments.x, 0.0f);
+      }
+    });
+  }
+
+  // Young pixels have too few samples for temporal moments and take them
+  // from a 7x7 neighbourhood on the same surface instead, boosted while the
+  // history is short.
+  void Denoiser::EstimateVariance(Scheduler& scheduler)
+  {
+    const float young = static_cast<float>(settings.spatial_variance_history);
+    scheduler.ParallelFor(height, [&](uint32_t y, uint32_t)
+    {
+      DenormalsAreZero flush;
+      for (uint32_t x = 0; x < width; ++x)
+      {
+        const size_t pixel = static_cast<size_t>(y) * width + x;
+        const size_t index = Index(x, y);
+        const float length = history_length[current][pixel];
+        if (valid[index] == 0.0f || length >= young) continue;
+
+        const glm::vec3 center_normal(normal[0][index], normal[1][index], normal[2][index]);
+        float weight_sum = 0.0f;
+        glm::vec2 moments(0.0f);
+        for (int32_t dy = -3; dy <= 3; ++dy)
+        {
+          const int32_t sy = static_cast<int32_t>(y) + dy;
+          if (sy < 0 || sy >= static_cast<int32_t>(height)) continue;
+          for (int32_t dx = -3; dx <= 3; ++dx)
+          {
+            const int32_t sx = static_cast<int32_t>(x) + dx;
+            if (sx < 0 || sx >= static_cast<int32_t>(width)) continue;
+            const size_t neighbor = Index(sx, sy);
+            if (valid[neighbor] == 0.0f) continue;
+
+            const float distance = static_cast<float>(std::max(std::abs(dx), std::abs(dy)));
+            const glm::vec3 neighbor_normal(normal[0][neighbor], normal[1][neighbor], normal[2][neighbor]);
+            float weight = NormalWeight(center_normal, neighbor_normal, settings.normal_power);
+            if (distance > 0.0f)
+              weight *= std::exp(-std::abs(depth[index] - depth[neighbor]) * depth_scale[index] / distance);
+            weight_sum += weight;
+            moments += history_moments[current][static_cast<size_t>(sy) * width + sx] * weight;
+          }
+        }
+        moments /= weight_sum;
+        variance[0][index] = std::max(moments.y - moments.x * moments.x, 0.0f) * young / length;
+      }
+    });
+  }
+
+  // One a-trous iteration: a 5x5 B3 spline with holes of step pixels,
+  // weighed by luminance, normal and depth similarity. Variance goes through
+  // the squared weights. Lanes cover neighbouring pixels of a row.
+  void Denoiser::FilterPass(uint32_t step, uint32_t source, Scheduler& scheduler)
+  {
+    using Float = SimdFloat<denoise_lanes>;
+    const uint32_t target = source ^ 1;
+
+    // luminance edges are relative to the 3x3 blurred standard deviation
+    scheduler.ParallelFor(height, [&](uint32_t y, uint32_t)
+    {
+      for (uint32_t x = 0; x < width; ++x)
+      {
+        const size_t index = Index(x, y);
+        float sum = 0.0f, weight_sum = 0.0f;
+        for (int32_t dy = -1; dy <= 1; ++dy)
+        {
+          const int32_t sy = static_cast<int32_t>(y) + dy;
+          if (sy < 0 || sy >= static_cast<int32_t>(height)) continue;
+          for (int32_t dx = -1; dx <= 1; ++dx)
+          {
+            const size_t neighbor = static_cast<size_t>(static_cast<int64_t>(index) +
+                                                        static_cast<int64_t>(dy) * stride + dx);
+            const float weight = valid[neighbor] * (dx ? 0.5f : 1.0f) * (dy ? 0.5f : 1.0f);
+            sum += variance[source][neighbor] * weight;
+            weight_sum += weight;
+          }
+        }
+        const float deviation = weight_sum > 0.0f ? std::sqrt(std::max(sum / weight_sum, 0.0f)) : 0.0f;
+        luminance_scale[index] = 1.0f / (settings.sigma_luminance * deviation + 1e-10f);
+      }
+    });
+
+    const std::vector<float>* colors = illumination[source];
+    std::vector<float>* targets = illumination[target];
+    scheduler.ParallelFor(height, [&](uint32_t y, uint32_t)
+    {
+      DenormalsAreZero flush;
+      for (uint32_t x = 0; x < width; x += denoise_lanes)
+      {
+        const size_t center = Index(x, y);
+        const Float center_valid = Float::Load(&valid[center]);
+        const Float center_luminance = Float::Load(&luminance[source][center]);
+        const Float center_depth = Float::Load(&depth[center]);
+        const Float center_normal[3] = { Float::Load(&normal[0][center]), Float::Load(&normal[1][center]),
+                                         Float::Load(&normal[2][center]) };
+        const Float lum_scale = Float::Load(&luminance_scale[center]);
+        const Float z_scale = Float::Load(&depth_scale[center]);
+
+        Float weight_sum(0.0f), variance_sum(0.0f);
+        Float sums[3] = { Float(0.0f), Float(0.0f), Float(0.0f) };
+        for (int32_t dy = -2; dy <= 2; ++dy)
+        {
+          const int32_t sy = static_cast<int32_t>(y) + dy * static_cast<int32_t>(step);
+          if (sy < 0 || sy >= static_cast<int32_t>(height)) continue;
+          for (int32_t dx = -2; dx <= 2; ++dx)
+          {
+            const size_t tap = static_cast<size_t>(static_cast<int64_t>(center) +
+                                                   static_cast<int64_t>(dy) * step * stride +
+                                                   static_cast<int64_t>(dx) * step);
+            const float kernel = atrous_kernel[dx + 2] * atrous_kernel[dy + 2];
+            Float weight = center_valid * Float(kernel);
+            if (dx != 0 || dy != 0)
+            {
+              const float distance = static_cast<float>(step * std::max(std::abs(dx), std::abs(dy)));
+              Float exponent = Abs(center_luminance - Float::Load(&luminance[source][tap])) * lum_scale +
+                               Abs(center_depth - Float::Load(&depth[tap])) * z_scale * Float(1.0f / distance);
+              Float cosine = center_normal[0] * Float::Load(&normal[0][tap]) +
+                             center_normal[1] * Float::Load(&normal[1][tap]) +
+                             center_normal[2] * Float::Load(&normal[2][tap]);
+              Float base = Max(cosine, Float(0.0f)), normal_weight(1.0f);
+              for (uint32_t power = settings.normal_power; power; power >>= 1)
+              {
+                if (power & 1) normal_weight = normal_weight * base;
+                base = base * base;
+              }
+              weight = Exp(-exponent) * normal_weight * Float::Load(&valid[tap]) * Float(kernel);
+            }
+
+            weight_sum = weight_sum + weight;
+            for (int channel = 0; channel < 3; ++channel)
+              sums[channel] = sums[channel] + weight * Float::Load(&colors[channel][tap]);
+            variance_sum = variance_sum + weight * weight * Float::Load(&variance[source][tap]);
+          }
+        }
+
+        // invalid pixels keep their value, their weight sum may be zero
+        const SimdMask<denoise_lanes> filtered = center_valid > Float(0.0f);
+        const Float inverse = Float(1.0f) / Max(weight_sum, Float(1e-20f));
+        Float filtered_luminance(0.0f);
+        const float luminance_weights[3] = { 0.2126f, 0.7152f, 0.0722f };
+        for (int channel = 0; channel < 3; ++channel)
+        {
+          Float value = Select(filtered, sums[channel] * inverse, Float::Load(&colors[channel][center]));
+          value.Store(&targets[channel][center]);
+          filtered_luminance = filtered_luminance + value * Float(luminance_weights[channel]);
+        }
+        filtered_luminance.Store(&luminance[target][center]);
+        Select(filtered, variance_sum * inverse * inverse, Float::Load(&variance[source][center]))
+          .Store(&variance[target][center]);
+      }
+    });
+  }
+
+} // namespace PathTracer
@@ -0,0 +1,406 @@
+
+#include <VulkanPT/displacement.hpp>
+#include <VulkanPT/debug.hpp>
+#include <VulkanPT/profiler.hpp>
+#include <algorithm>
+#include <cmath>
+#include <numeric>
+#include <utility>
+
+namespace PathTracer
+{
+  static constexpr uint32_t displacement_stack_size = 64 * 2;
+
+  std::vector<SubdivisionPatch> GridPatches(const std::vector<glm::vec3>& points, uint32_t width, uint32_t height)
+  {
+    std::vector<SubdivisionPatch> patches;
+    if (width < 2 || height < 2 || points.size() < static_cast<size_t>(width) * height) return patches;
+
+    // one ring of phantom points, p[-1] = 2 p[0] - p[1], puts the end of a
+    // uniform cubic B-spline on its last point
+    const int32_t w = static_cast<int32_t>(width), h = static_cast<int32_t>(height);
+    auto point = [&](int32_t x, int32_t y)
+    {
+      const int32_t cx = std::min(std::max(x, 0), w - 1), cy = std::min(std::max(y, 0), h - 1);
+      const int32_t mx = x < 0 ? 1 : (x >= w ? w - 2 : cx), my = y < 0 ? 1 : (y >= h ? h - 2 : cy);
+      const glm::vec3 base = points[static_cast<size_t>(cy) * width + cx];
+      const glm::vec3 along_x = x == cx ? glm::vec3(0.0f) : base - points[static_cast<size_t>(cy) * width + mx];
+      const glm::vec3 along_y = y == cy ? glm::vec3(0.0f) : base - points[static_cast<size_t>(my) * width + cx];
+      return base + along_x + along_y;
+    };
+
+    patches.resize(static_cast<size_t>(width - 1) * (height - 1));
+    for (int32_t y = 0; y + 1 < h; ++y)
+    {
+      for (int32_t x = 0; x + 1 < w; ++x)
+      {
+        SubdivisionPatch& patch = patches[static_cast<size_t>(y) * (width - 1) + x];
+        for (int32_t j = 0; j < 4; ++j)
+        {
+          for (int32_t i = 0; i < 4; ++i) patch.points[j * 4 + i] = point(x + i - 1, y + j - 1);
+        }
+        patch.uv_size = glm::vec2(1.0f / (width - 1), 1.0f / (height - 1));
+        patch.uv_min = glm::vec2(x, y) * patch.uv_size;
+      }
+    }
+    return patches;
+  }
+
+  float DisplacementMap::Sample(const glm::vec2& uv) const
+  {
+    if (heights.empty()) return 0.0f;
+    const float x = uv.x * width - 0.5f, y = uv.y * height - 0.5f;
+    const float fx = std::floor(x), fy = std::floor(y);
+    const int32_t x0 = std::min(std::max(static_cast<int32_t>(fx), 0), static_cast<int32_t>(width) - 1);
+    const int32_t y0 = std::min(std::max(static_cast<int32_t>(fy), 0), static_cast<int32_t>(height) - 1);
+    const int32_t x1 = std::min(std::max(static_cast<int32_t>(fx) + 1, 0), static_cast<int32_t>(width) - 1);
+    const int32_t y1 = std::min(std::max(static_cast<int32_t>(fy) + 1, 0), static_cast<int32_t>(height) - 1);
+    const float tx = x - fx, ty = y - fy;
+    const float top = heights[static_cast<size_t>(y0) * width + x0] * (1.0f - tx) +
+                      heights[static_cast<size_t>(y0) * width + x1] * tx;
+    const float bottom = heights[static_cast<size_t>(y1) * width + x0] * (1.0f - tx) +
+                         heights[static_cast<size_t>(y1) * width + x1] * tx;
+    return top * (1.0f - ty) + bottom * ty;
+  }
+
+  // Uniform cubic B-spline basis and its derivative.
+  static void BSplineBasis(float t, float* basis, float* derivative)
+  {
+    const float s = 1.0f - t;
+    basis[0] = s * s * s / 6.0f;
+    basis[1] = (3.0f * t * t * t - 6.0f * t * t + 4.0f) / 6.0f;
+    basis[2] = (-3.0f * t * t * t + 3.0f * t * t + 3.0f * t + 1.0f) / 6.0f;
+    basis[3] = t * t * t / 6.0f;
+    derivative[0] = -0.5f * s * s;
+    derivative[1] = 0.5f * (3.0f * t * t - 4.0f * t);
+    derivative[2] = 0.5f * (-3.0f * t * t + 2.0f * t + 1.0f);
+    derivative[3] = 0.5f * t * t;
+  }
+
+  void DisplacedSurface::Build(std::vector<SubdivisionPatch> in_patches, DisplacementMap in_map,
+                               TessellationSettings in_settings)
+  {
+    Profiler::Scope scope("displacement.build");
+    settings = in_settings;
+    settings.max_rate = std::max(settings.max_rate, 1u);
+    patches = std::move(in_patches);
+    map = std::move(in_map);
+    nodes.clear();
+    ClearCache();
+    stats = TessellationStats {};
+
+    const uint32_t patch_count = static_cast<uint32_t>(patches.size());
+    slots.reset(new Slot[patch_count]);
+    if (patch_count == 0) return;
+
+    // the control points bound the limit surface, grown by the largest
+    // displacement over the texels the patch samples
+    std::vector<AABB> bounds(patch_count);
+    std::vector<glm::vec3> centroids(patch_count);
+    for (uint32_t patch = 0; patch < patch_count; ++patch)
+    {
+      const SubdivisionPatch& source = patches[patch];
+      for (const glm::vec3& point : source.points) bounds[patch].Grow(point);
+
+      float displacement = 0.0f;
+      if (!map.heights.empty())
+      {
+        const glm::vec2 size(map.width, map.height);
+        const glm::ivec2 first = glm::floor(source.uv_min * size - 0.5f);
+        const glm::ivec2 last = glm::ivec2(glm::floor((source.uv_min + source.uv_size) * size - 0.5f)) + 1;
+        for (int32_t y = std::max(first.y, 0); y <= std::min(last.y, static_cast<int32_t>(map.height) - 1); ++y)
+        {
+          for (int32_t x = std::max(first.x, 0); x <= std::min(last.x, static_cast<int32_t>(map.width) - 1); ++x)
+            displacement = std::max(displacement, std::fabs(map.heights[static_cast<size_t>(y) * map.width + x]));
+        }
+      }
+      displacement *= std::fabs(settings.displacement_scale);
+      bounds[patch].min -= displacement;
+      bounds[patch].max += displacement;
+      centroids[patch] = bounds[patch].Center();
+    }
+
+    // one patch per leaf, so that rays only dice the patches they reach
+    BVHBuildSettings build;
+    build.max_leaf_size = 1;
+    patch_order.resize(patch_count);
+    std::iota(patch_order.begin(), patch_order.end(), 0u);
+    BuildNodes(nodes, patch_order, bounds, centroids, build);
+
+    DEBUG_LOG(BVH, "Built displaced surface over %u patches, cache of %.1f MB", patch_count,
+              settings.cache_bytes / 1048576.0);
+  }
+
+  void DisplacedSurface::Evaluate(uint32_t patch, const glm::vec2& uv, glm::vec3& position, glm::vec3& normal) const
+  {
+    const SubdivisionPatch& source = patches[patch];
+    float bu[4], du[4], bv[4], dv[4];
+    BSplineBasis(uv.x, bu, du);
+    BSplineBasis(uv.y, bv, dv);
+
+    glm::vec3 tangent_u(0.0f), tangent_v(0.0f);
+    position = glm::vec3(0.0f);
+    for (int j = 0; j < 4; ++j)
+    {
+      for (int i = 0; i < 4; ++i)
+      {
+        const glm::vec3& point = source.points[j * 4 + i];
+        position += point * (bu[i] * bv[j]);
+        tangent_u += point * (du[i] * bv[j]);
+        tangent_v += point * (bu[i] * dv[j]);
+      }
+    }
+    const glm::vec3 cross = glm::cross(tangent_v, tangent_u);
+    const float length = glm::length(cross);
+    normal = length > 0.0f ? cross / length : glm::vec3(0.0f, 1.0f, 0.0f);
+  }
+
+  glm::vec3 DisplacedSurface::Position(uint32_t patch, const glm::vec2& uv) const
+  {
+    glm::vec3 position, normal;
+    Evaluate(patch, uv, position, normal);
+    const SubdivisionPatch& source = patches[patch];
+    return position + normal * (settings.displacement_scale * map.Sample(source.uv_min + uv * source.uv_size));
+  }
+
+  glm::vec3 DisplacedSurface::Normal(const Hit& hit) const
+  {
+    const float step = 0.25f / Rate(hit.primitive);
+    const glm::vec2 uv(hit.u, hit.v);
+    const float u0 = std::max(uv.x - step, 0.0f), u1 = std::min(uv.x + step, 1.0f);
+    const float v0 = std::max(uv.y - step, 0.0f), v1 = std::min(uv.y + step, 1.0f);
+    const uint32_t patch = hit.primitive;
+    const glm::vec3 tangent_u = Position(patch, glm::vec2(u1, uv.y)) - Position(patch, glm::vec2(u0, uv.y));
+    const glm::vec3 tangent_v = Position(patch, glm::vec2(uv.x, v1)) - Position(patch, glm::vec2(uv.x, v0));
+    const glm::vec3 cross = glm::cross(tangent_v, tangent_u);
+    const float length = glm::length(cross);
+    return length > 0.0f ? cross / length : glm::vec3(0.0f, 1.0f, 0.0f);
+  }
+
+  uint32_t DisplacedSurface::Rate(uint32_t patch) const
+  {
+    const glm::vec2 texels = patches[patch].uv_size * glm::vec2(map.width, map.height);
+    const float rate = std::ceil(std::max(texels.x, texels.y));
+    return std::min(std::max(static_cast<uint32_t>(std::max(rate, 1.0f)), 1u), settings.max_rate);
+  }
+
+  // A grid of rate by rate quads, two triangles each, with a BVH over them.
+  std::unique_ptr<const DisplacedSurface::Tessellation> DisplacedSurface::Tessellate(uint32_t patch) const
+  {
+    std::unique_ptr<Tessellation> tessellation = std::make_unique<Tessellation>();
+    const uint32_t rate = Rate(patch);
+    std::vector<glm::vec3> positions(static_cast<size_t>(rate + 1) * (rate + 1));
+    // divided rather than stepped, so that shared edges land on the same
+    // parameters in both patches
+    for (uint32_t y = 0; y <= rate; ++y)
+    {
+      for (uint32_t x = 0; x <= rate; ++x)
+      {
+        const glm::vec2 uv = glm::vec2(x, y) / static_cast<float>(rate);
+        positions[static_cast<size_t>(y) * (rate + 1) + x] = Position(patch, uv);
+      }
+    }
+
+    std::vector<uint32_t> indices;
+    indices.reserve(static_cast<size_t>(rate) * rate * 6);
+    for (uint32_t y = 0; y < rate; ++y)
+    {
+      for (uint32_t x = 0; x < rate; ++x)
+      {
+        const uint32_t a = y * (rate + 1) + x, b = a + 1, c = a + rate + 1, d = c + 1;
+        indices.insert(indices.end(), { a, b, d, a, d, c });
+      }
+    }
+
+    tessellation->bvh.Build(positions, indices);
+    tessellation->rate = rate;
+    tessellation->bytes = sizeof(Tessellation) + tessellation->bvh.getNodes().size() * sizeof(BVHNode) +
+                          tessellation->bvh.getBlocks().size() * sizeof(TriangleBlock<triangle_block_width>);
+    return tessellation;
+  }
+
+  const DisplacedSurface::Tessellation& DisplacedSurface::Acquire(uint32_t patch)
+  {
+    Slot& slot = slots[patch];
+    const Tessellation* tessellation = slot.tessellation.load(std::memory_order_acquire);
+    if (tessellation)
+    {
+      // only written when it changes, so hot patches keep their cache line shared
+      const uint64_t now = clock.load(std::memory_order_relaxed);
+      if (slot.last_use.load(std::memory_order_relaxed) != now) slot.last_use.store(now, std::memory_order_relaxed);
+      return *tessellation;
+    }
+
+    // diced without the lock, a thread that got there first wins
+    std::unique_ptr<const Tessellation> created = Tessellate(patch);
+    std::lock_guard<std::mutex> lock(mutex);
+    tessellation = slot.tessellation.load(std::memory_order_relaxed);
+    if (tessellation) return *tessellation;
+
+    tessellation = created.release();
+    slot.tessellation.store(tessellation, std::memory_order_release);
+    slot.last_use.store(clock.fetch_add(1, std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    resident.push_back(patch);
+    stats.tessellations++;
+    stats.resident_bytes += tessellation->bytes;
+    stats.peak_bytes = std::max(stats.peak_bytes, stats.resident_bytes + stats.retired_bytes);
+
+    if (stats.resident_bytes > settings.cache_bytes)
+    {
+      // least recently used first, the patch just diced stays
+      std::sort(resident.begin(), resident.end(), [&](uint32_t a, uint32_t b)
+      {
+        return slots[a].last_use.load(std::memory_order_relaxed) < slots[b].last_use.load(std::memory_order_relaxed);
+      });
+      const size_t target = settings.cache_bytes / 8 * 7;
+      size_t kept = 0;
+      for (size_t i = 0; i < resident.size(); ++i)
+      {
+        const uint32_t victim = resident[i];
+        if (stats.resident_bytes <= target || victim == patch)
+        {
+          resident[kept++] = victim;
+          continue;
+        }
+        // rays may still be in it, freed at the end of the frame
+        const Tessellation* evicted = slots[victim].tessellation.exchange(nullptr, std::memory_order_relaxed);
+        stats.resident_bytes -= evicted->bytes;
+        stats.retired_bytes += evicted->bytes;
+        retired.emplace_back(evicted);
+        stats.evictions++;
+      }
+      resident.resize(kept);
+    }
+    return *tessellation;
+  }
+
+  bool DisplacedSurface::IntersectPatch(uint32_t patch, const Ray& ray, Hit& hit)
+  {
+    const Tessellation& tessellation = Acquire(patch);
+    Hit local;
+    local.t = hit.t;
+    if (!tessellation.bvh.Intersect(ray, local)) return false;
+
+    // back from the barycentrics of the grid triangle to the patch
+    const uint32_t rate = tessellation.rate;
+    const uint32_t quad = local.primitive / 2;
+    const glm::vec2 a(quad % rate, quad / rate);
+    const glm::vec2 second = local.primitive % 2 ? glm::vec2(1.0f, 1.0f) : glm::vec2(1.0f, 0.0f);
+    const glm::vec2 third = local.primitive % 2 ? glm::vec2(0.0f, 1.0f) : glm::vec2(1.0f, 1.0f);
+    const glm::vec2 uv = (a + second * local.u + third * local.v) / static_cast<float>(rate);
+
+    hit.t = local.t;
+    hit.u = uv.x;
+    hit.v = uv.y;
+    hit.primitive = patch;
+    return true;
+  }
+
+  bool DisplacedSurface::Intersect(const Ray& ray, Hit& hit)
+  {
+    if (nodes.empty()) return false;
+
+    glm::vec3 inverse_direction = SafeInverse(ray.direction);
+    Hit closest;
+    closest.t = std::min(ray.tmax, hit.t);
+
+    uint32_t stack[displacement_stack_size];
+    uint32_t stack_pointer = 0;
+    stack[stack_pointer++] = 0;
+
+    while (stack_pointer > 0)
+    {
+      const BVHNode& node = nodes[stack[--stack_pointer]];
+      float tnear;
+      if (!IntersectNode(node, ray.origin, inverse_direction, ray.tmin, closest.t, tnear)) continue;
+
+      if (node.IsLeaf())
+      {
+        for (uint32_t i = node.left_first; i < node.left_first + node.count; ++i)
+          IntersectPatch(patch_order[i], ray, closest);
+        continue;
+      }
+
+      // near child first, so that far patches are rarely diced at all
+      uint32_t near_child = node.left_first;
+      uint32_t far_child = node.left_first + 1;
+      float near_t, far_t;
+      bool near_hit = IntersectNode(nodes[near_child], ray.origin, inverse_direction, ray.tmin, closest.t, near_t);
+      bool far_hit = IntersectNode(nodes[far_child], ray.origin, inverse_direction, ray.tmin, closest.t, far_t);
+      if (near_hit && far_hit && far_t < near_t)
+      {
+        std::swap(near_child, far_child);
+        std::swap(near_hit, far_hit);
+      }
+
+      if (far_hit) stack[stack_pointer++] = far_child;
+      if (near_hit) stack[stack_pointer++] = near_child;
+    }
+
+    if (!closest.Valid()) return false;
+    hit = closest;
+    return true;
+  }
+
+  bool DisplacedSurface::Occluded(const Ray& ray)
+  {
+    if (nodes.empty()) return false;
+
+    glm::vec3 inverse_direction = SafeInverse(ray.direction);
+    uint32_t stack[displacement_stack_size];
+    uint32_t stack_pointer = 0;
+    stack[stack_pointer++] = 0;
+
+    while (stack_pointer > 0)
+    {
+      const BVHNode& node = nodes[stack[--stack_pointer]];
+      float tnear;
+      if (!IntersectNode(node, ray.origin, inverse_direction, ray.tmin, ray.tmax, tnear)) continue;
+
+      if (node.IsLeaf())
+      {
+        for (uint32_t i = node.left_first; i < node.left_first + node.count; ++i)
+        {
+          if (Acquire(patch_order[i]).bvh.Occluded(ray)) return true;
+        }
+        continue;
+      }
+
+      stack[stack_pointer++] = node.left_first + 1;
+      stack[stack_pointer++] = node.left_first;
+    }
+
+    return false;
+  }
+
+  DisplacedSurface::~DisplacedSurface()
+  {
+    ClearCache();
+  }
+
+  void DisplacedSurface::EndFrame()
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    retired.clear();
+    stats.retired_bytes = 0;
+  }
+
+  void DisplacedSurface::ClearCache()
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    for (uint32_t patch : resident) delete slots[patch].tessellation.exchange(nullptr, std::memory_order_relaxed);
+    resident.clear();
+    retired.clear();
+    stats.resident_bytes = 0;
+    stats.retired_bytes = 0;
+  }
+
+  TessellationStats DisplacedSurface::getStats() const
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    TessellationStats result = stats;
+    result.resident = static_cast<uint32_t>(resident.size());
+    return result;
+  }
+
+} // namespace PathTracer
@@ -0,0 +1,272 @@
+
+#include <VulkanPT/environment.hpp>
+#include <VulkanPT/accumulation.hpp>
+#include <VulkanPT/debug.hpp>
+#include <VulkanPT/mapped_file.hpp>
+#include <VulkanPT/profiler.hpp>
+#include <cstdio>
+#include <cstring>
+
+namespace PathTracer
+{
+  void BuildAliasTable(const float* weights, uint32_t count, AliasEntry* table)
+  {
+    double total = 0.0;
+    for (uint32_t i = 0; i < count; ++i) total += weights[i] > 0.0f ? weights[i] : 0.0f;
+    if (!(total > 0.0) || !std::isfinite(total))
+    {
+      for (uint32_t i = 0; i < count; ++i) table[i] = { 1.0f, i, 1.0f, 0 };
+      return;
+    }
+
+    std::vector<double> scaled(count);
+    std::vector<uint32_t> small, large;
+    for (uint32_t i = 0; i < count; ++i)
+    {
+      scaled[i] = (weights[i] > 0.0f ? weights[i] : 0.0f) * count / total;
+      table[i].pdf = static_cast<float>(scaled[i]);
+      (scaled[i] < 1.0 ? small : large).push_back(i);
+    }
+
+    while (!small.empty() && !large.empty())
+    {
+      uint32_t less = small.back();
+      small.pop_back();
+      uint32_t more = large.back();
+      table[less].threshold = static_cast<float>(scaled[less]);
+      table[less].alias = more;
+
+      scaled[more] = (scaled[more] + scaled[less]) - 1.0;
+      if (scaled[more] < 1.0)
+      {
+        large.pop_back();
+        small.push_back(more);
+      }
+    }
+    // whatever is left is 1 up to rounding
+    small.insert(small.end(), large.begin(), large.end());
+    for (uint32_t i : small)
+    {
+      table[i].threshold = 1.0f;
+      table[i].alias = i;
+    }
+  }
+
+  static bool ReadLine(const uint8_t*& data, const uint8_t* end, std::string& line)
+  {
+    const uint8_t* start = data;
+    while (data < end && *data != '\n') ++data;
+    if (data == end) return false;
+    line.assign(reinterpret_cast<const char*>(start), data - start);
+    ++data;
+    return true;
+  }
+
+  static glm::vec3 DecodeRGBE(const uint8_t* rgbe)
+  {
+    if (rgbe[3] == 0) return glm::vec3(0.0f);
+    float scale = std::ldexp(1.0f, static_cast<int>(rgbe[3]) - (128 + 8));
+    return glm::vec3(rgbe[0], rgbe[1], rgbe[2]) * scale;
+  }
+
+  // New style run length encoding stores each of the four components of a
+  // scanline separately, runs are marked by counts above 128.
+  static bool ReadScanline(const uint8_t*& data, const uint8_t* end, uint32_t width, uint8_t* scanline)
+  {
+    if (width < 8 || width > 0x7FFF || end - data < 4 || data[0] != 2 || data[1] != 2 || (data[2] & 0x80))
+    {
+      if (static_cast<size_t>(end - data) < static_cast<size_t>(width) * 4) return false;
+      std::memcpy(scanline, data, static_cast<size_t>(width) * 4);
+      data += static_cast<size_t>(width) * 4;
+      return true;
+    }
+
+    if (((static_cast<uint32_t>(data[2]) << 8) | data[3]) != width) return false;
+    data += 4;
+    for (uint32_t component = 0; component < 4; ++component)
+    {
+      uint32_t x = 0;
+      while (x < width)
+      {
+        if (data == end) return false;
+        uint32_t count = *data++;
+        if (count > 128)
+        {
+          count -= 128;
+          if (count > width - x || data == end) return false;
+          for (uint32_t i = 0; i < count; ++i) scanline[(x + i) * 4 + component] = *data;
+          ++data;
+        }
+        else
+        {
+          if (count == 0 || count > width - x || static_cast<uint32_t>(end - data) < count) return false;
+          for (uint32_t i = 0; i < count; ++i) scanline[(x + i) * 4 + component] = data[i];
+          data += count;
+        }
+        x += count;
+      }
+    }
+    return true;
+  }
+
+  bool DecodeRadianceHDR(const uint8_t* data, size_t size, EnvironmentMap& map)
+  {
+    const uint8_t* end = data + size;
+    std::string line;
+    if (!ReadLine(data, end, line) || line.compare(0, 2, "#?") != 0) return false;
+
+    bool rgbe = true;
+    while (ReadLine(data, end, line) && !line.empty())
+    {
+      if (line.compare(0, 7, "FORMAT=") == 0) rgbe = line == "FORMAT=32-bit_rle_rgbe";
+    }
+    if (!rgbe)
+    {
+      DEBUG_WARNING(IO, "Only RGBE HDR images are supported");
+      return false;
+    }
+
+    unsigned int width = 0, height = 0;
+    if (!ReadLine(data, end, line) || std::sscanf(line.c_str(), "-Y %u +X %u", &height, &width) != 2 ||
+        width == 0 || height == 0 || width > 0x10000 || height > 0x10000)
+    {
+      DEBUG_WARNING(IO, "Unsupported HDR resolution line \"%s\"", line.c_str());
+      return false;
+    }
+
+    map.width = width;
+    map.height = height;
+    map.texels.resize(static_cast<size_t>(width) * height);
+    std::vector<uint8_t> scanline(static_cast<size_t>(width) * 4);
+    for (uint32_t y = 0; y < height; ++y)
+    {
+      if (!ReadScanline(data, end, width, scanline.data())) return false;
+      glm::vec3* row = &map.texels[static_cast<size_t>(y) * width];
+      for (uint32_t x = 0; x < width; ++x) row[x] = DecodeRGBE(&scanline[x * 4]);
+    }
+    return true;
+  }
+
+  bool LoadEnvironmentMap(const std::string& path, EnvironmentMap& map)
+  {
+    Profiler::Scope scope("environment.load");
+    MappedFile file;
+    if (!file.Open(path))
+    {
+      DEBUG_WARNING(IO, "Failed to open environment map %s", path.c_str());
+      return false;
+    }
+
+    if (!DecodeRadianceHDR(file.getData(), file.getSize(), map))
+    {
+      DEBUG_WARNING(IO, "Failed to decode environment map %s", path.c_str());
+      map = EnvironmentMap {};
+      return false;
+    }
+    return true;
+  }
+
+  void EnvironmentLight::Build(EnvironmentMap&& in_map, Scheduler& scheduler, float in_intensity)
+  {
+    Profiler::Scope scope("environment.build");
+    map = std::move(in_map);
+    intensity = in_intensity;
+    marginal.clear();
+    conditional.clear();
+    power = 0.0f;
+    if (!map.Valid()) return;
+
+    const uint32_t width = map.width;
+    const uint32_t height = map.height;
+    conditional.resize(static_cast<size_t>(width) * height);
+    std::vector<float> row_weights(height);
+    std::vector<double> row_power(height);
+
+    // weights are luminance times the solid angle of the texel, the sin
+    // theta factor of equal area rows
+    scheduler.ParallelFor(height, [&](uint32_t y, uint32_t)
+    {
+      const float sin_theta = std::sin((y + 0.5f) * environment_pi / height);
+      const float solid_angle = 2.0f * environment_pi / width *
+                                (std::cos(y * environment_pi / height) - std::cos((y + 1) * environment_pi / height));
+      std::vector<float> weights(width);
+      double sum = 0.0;
+      double luminance_sum = 0.0;
+      for (uint32_t x = 0; x < width; ++x)
+      {
+        float luminance = Accumulator::Luminance(map.texels[static_cast<size_t>(y) * width + x]);
+        if (!std::isfinite(luminance) || luminance < 0.0f) luminance = 0.0f;
+        weights[x] = luminance * sin_theta;
+        sum += weights[x];
+        luminance_sum += luminance;
+      }
+      BuildAliasTable(weights.data(), width, &conditional[static_cast<size_t>(y) * width]);
+      row_weights[y] = static_cast<float>(sum);
+      row_power[y] = luminance_sum * solid_angle;
+    });
+
+    marginal.resize(height);
+    BuildAliasTable(row_weights.data(), height, marginal.data());
+
+    double total = 0.0;
+    for (double value : row_power) total += value;
+    power = static_cast<float>(total) * intensity;
+    DEBUG_LOG(IO, "Environment %ux%u, power %.3f", width, height, power);
+  }
+
+  EnvironmentSample EnvironmentLight::Sample(const glm::vec2& u) const
+  {
+    EnvironmentSample sample;
+    float v_offset, u_offset;
+    uint32_t y = SampleAliasTable(marginal.data(), map.height, u.y, v_offset);
+    const AliasEntry* row = &conditional[static_cast<size_t>(y) * map.width];
+    uint32_t x = SampleAliasTable(row, map.width, u.x, u_offset);
+
+    glm::vec2 uv((x + u_offset) / map.width, (y + v_offset) / map.height);
+    sample.direction = EnvironmentDirection(uv);
+
+    // Rounding on the way to the direction and back can carry a sample on
+    // the edge of its texel into a neighbour, mostly at the seam and near the
+    // poles. Those few move to the texel centre, so that Pdf and Radiance,
+    // which only see the direction, find the texel chosen here.
+    const uint32_t texel = y * map.width + x;
+    glm::vec2 found = EnvironmentUV(sample.direction);
+    if (Texel(found) != texel)
+    {
+      sample.direction = EnvironmentDirection(glm::vec2((x + 0.5f) / map.width, (y + 0.5f) / map.height));
+      found = EnvironmentUV(sample.direction);
+    }
+    sample.radiance = map.texels[texel] * intensity;
+    sample.pdf = TexelPdf(texel, found.y);
+    return sample;
+  }
+
+  uint32_t EnvironmentLight::Texel(const glm::vec2& uv) const
+  {
+    uint32_t x = std::min(static_cast<uint32_t>(uv.x * map.width), map.width - 1);
+    uint32_t y = std::min(static_cast<uint32_t>(uv.y * map.height), map.height - 1);
+    return y * map.width + x;
+  }
+
+  float EnvironmentLight::TexelPdf(uint32_t texel, float v) const
+  {
+    float sin_theta = std::sin(v * environment_pi);
+    if (!(sin_theta > 0.0f)) return 0.0f;
+    return marginal[texel / map.width].pdf * conditional[texel].pdf /
+           (2.0f * environment_pi * environment_pi * sin_theta);
+  }
+
+  float EnvironmentLight::Pdf(const glm::vec3& direction) const
+  {
+    if (!Valid()) return 0.0f;
+    glm::vec2 uv = EnvironmentUV(direction);
+    return TexelPdf(Texel(uv), uv.y);
+  }
+
+  glm::vec3 EnvironmentLight::Radiance(const glm::vec3& direction) const
+  {
+    if (!Valid()) return glm::vec3(0.0f);
+    return map.texels[Texel(EnvironmentUV(direction))] * intensity;
+  }
+
+} // namespace PathTracer
@@ -0,0 +1,838 @@
+
+#include <VulkanPT/gltf_loader.hpp>
+#include <VulkanPT/debug.hpp>
+#include <VulkanPT/hash.hpp>
+#include <VulkanPT/json.hpp>
+#include <VulkanPT/mapped_file.hpp>
+#include <VulkanPT/profiler.hpp>
+#include <VulkanPT/scene_cache.hpp>
+#include <VulkanPT/texture_compression.hpp>
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <cmath>
+#include <cstring>
+
+namespace PathTracer
+{
+  static constexpr uint32_t glb_magic = 0x46546C67;
+  static constexpr uint32_t glb_json_chunk = 0x4E4F534A;
+  static constexpr uint32_t glb_bin_chunk = 0x004E4942;
+
+  // accessor component types and primitive modes
+  static constexpr uint32_t component_byte = 5120;
+  static constexpr uint32_t component_unsigned_byte = 5121;
+  static constexpr uint32_t component_short = 5122;
+  static constexpr uint32_t component_unsigned_short = 5123;
+  static constexpr uint32_t component_unsigned_int = 5125;
+  static constexpr uint32_t component_float = 5126;
+  static constexpr uint32_t mode_triangles = 4;
+  static constexpr uint32_t mode_triangle_strip = 5;
+  static constexpr uint32_t mode_triangle_fan = 6;
+
+  // Either a mapped external file, decoded data URI bytes or the GLB BIN chunk.
+  struct GltfBuffer
+  {
+    MappedFile file;
+    std::vector<uint8_t> bytes;
+    const uint8_t* data { nullptr };
+    size_t size { 0 };
+    // external files take part in the cache key
+    bool external { false };
+  };
+
+  // Strided, bounds checked view of an accessor inside its buffer.
+  struct GltfAccessor
+  {
+    const uint8_t* data { nullptr };
+    size_t count { 0 };
+    size_t stride { 0 };
+    uint32_t component_type { 0 };
+    uint32_t components { 0 };
+    bool normalized { false };
+
+    bool Valid() const { return data != nullptr; }
+
+    float Read(size_t element, uint32_t component) const
+    {
+      const uint8_t* p = data + element * stride;
+      switch (component_type)
+      {
+      case component_float:
+      {
+        float value;
+        std::memcpy(&value, p + component * 4, 4);
+        return value;
+      }
+      case component_byte:
+      {
+        float value = static_cast<float>(reinterpret_cast<const int8_t*>(p)[component]);
+        return normalized ? std::max(value / 127.0f, -1.0f) : value;
+      }
+      case component_unsigned_byte:
+      {
+        float value = static_cast<float>(p[component]);
+        return normalized ? value / 255.0f : value;
+      }
+      case component_short:
+      {
+        int16_t raw;
+        std::memcpy(&raw, p + component * 2, 2);
+        return normalized ? std::max(raw / 32767.0f, -1.0f) : static_cast<float>(raw);
+      }
+      case component_unsigned_short:
+      {
+        uint16_t raw;
+        std::memcpy(&raw, p + component * 2, 2);
+        return normalized ? raw / 65535.0f : static_cast<float>(raw);
+      }
+      default:
+        return 0.0f;
+      }
+    }
+
+    uint32_t ReadIndex(size_t element) const
+    {
+      const uint8_t* p = data + element * stride;
+      switch (component_type)
+      {
+      case component_unsigned_byte: return *p;
+      case component_unsigned_short:
+      {
+        uint16_t index;
+        std::memcpy(&index, p, 2);
+        return index;
+      }
+      case component_unsigned_int:
+      {
+        uint32_t index;
+        std::memcpy(&index, p, 4);
+        return index;
+      }
+      default:
+        return invalid_index;
+      }
+    }
+  };
+
+  // One primitive of one mesh node, the unit of work of the geometry pass.
+  struct GltfDraw
+  {
+    glm::mat4 transform { 1.0f };
+    glm::mat3 normal_transform { 1.0f };
+    bool identity { true };
+    // negative scale mirrors the triangles, their winding is swapped back
+    bool mirrored { false };
+    uint32_t mode { mode_triangles };
+    uint32_t material { 0 };
+    uint32_t vertex_base { 0 };
+    uint32_t first_triangle { 0 };
+    uint32_t triangle_count { 0 };
+    GltfAccessor positions;
+    GltfAccessor normals;
+    GltfAccessor uvs;
+    GltfAccessor indices;
+  };
+
+  static std::string Directory(const std::string& path)
+  {
+    size_t slash = path.find_last_of("/\\");
+    return slash == std::string::npos ? std::string() : path.substr(0, slash + 1);
+  }
+
+  static bool IsDataUri(const std::string& uri) { return uri.compare(0, 5, "data:") == 0; }
+
+  static std::string DecodeUri(const std::string& uri)
+  {
+    std::string decoded;
+    decoded.reserve(uri.size());
+    for (size_t i = 0; i < uri.size(); ++i)
+    {
+      if (uri[i] == '%' && i + 2 < uri.size() && std::isxdigit(static_cast<unsigned char>(uri[i + 1])) &&
+          std::isxdigit(static_cast<unsigned char>(uri[i + 2])))
+      {
+        decoded += static_cast<char>(std::stoi(uri.substr(i + 1, 2), nullptr, 16));
+        i += 2;
+      }
+      else decoded += uri[i];
+    }
+    return decoded;
+  }
+
+  static bool DecodeDataUri(const std::string& uri, std::vector<uint8_t>& bytes)
+  {
+    size_t comma = uri.find(',');
+    if (comma == std::string::npos || uri.rfind(";base64", comma) == std::string::npos) return false;
+
+    static const auto value = [](char c) -> int
+    {
+      if (c >= 'A' && c <= 'Z') return c - 'A';
+      if (c >= 'a' && c <= 'z') return c - 'a' + 26;
+      if (c >= '0' && c <= '9') return c - '0' + 52;
+      if (c == '+' || c == '-') return 62;
+      if (c == '/' || c == '_') return 63;
+      return -1;
+    };
+
+    bytes.clear();
+    bytes.reserve((uri.size() - comma) / 4 * 3);
+    uint32_t bits = 0;
+    int bit_count = 0;
+    for (size_t i = comma + 1; i < uri.size() && uri[i] != '='; ++i)
+    {
+      int digit = value(uri[i]);
+      if (digit < 0) return false;
+      bits = bits << 6 | static_cast<uint32_t>(digit);
+      bit_count += 6;
+      if (bit_count >= 8)
+      {
+        bit_count -= 8;
+        bytes.push_back(static_cast<uint8_t>(bits >> bit_count));
+      }
+    }
+    return true;
+  }
+
+  // Splits a GLB container into its JSON text and BIN chunk.
+  static bool ReadGlb(const MappedFile& file, const char*& json, size_t& json_size, GltfBuffer& bin)
+  {
+    const uint8_t* data = file.getData();
+    size_t size = file.getSize();
+    uint32_t header[3];
+    std::memcpy(header, data, sizeof(header));
+    if (header[1] != 2) return false;
+    size = std::min<size_t>(size, header[2]);
+
+    json = nullptr;
+    for (size_t offset = sizeof(header); offset + 8 <= size;)
+    {
+      uint32_t chunk[2];
+      std::memcpy(chunk, data + offset, sizeof(chunk));
+      offset += sizeof(chunk);
+      if (chunk[0] > size - offset) return false;
+
+      if (chunk[1] == glb_json_chunk && !json)
+      {
+        json = reinterpret_cast<const char*>(data + offset);
+        json_size = chunk[0];
+      }
+      else if (chunk[1] == glb_bin_chunk && !bin.data)
+      {
+        bin.data = data + offset;
+        bin.size = chunk[0];
+      }
+      offset += (chunk[0] + 3) & ~3u;
+    }
+    return json != nullptr;
+  }
+
+  static bool LoadBuffers(const JsonValue& json, const std::string& directory, GltfBuffer& bin,
+                          std::vector<GltfBuffer>& buffers)
+  {
+    const JsonValue& list = json["buffers"];
+    buffers.resize(list.Size());
+    for (size_t i = 0; i < list.Size(); ++i)
+    {
+      const JsonValue& buffer = list[i];
+      GltfBuffer& target = buffers[i];
+      size_t length = static_cast<size_t>(buffer["byteLength"].Int());
+
+      if (!buffer.Has("uri"))
+      {
+        // only the first buffer of a GLB may refer to the BIN chunk
+        if (i != 0 || !bin.data)
+        {
+          DEBUG_ERROR(IO, "glTF buffer %zu has no data", i);
+          return false;
+        }
+        target.data = bin.data;
+        target.size = bin.size;
+      }
+      else if (IsDataUri(buffer["uri"].String()))
+      {
+        if (!DecodeDataUri(buffer["uri"].String(), target.bytes))
+        {
+          DEBUG_ERROR(IO, "glTF buffer %zu has a malformed data URI", i);
+          return false;
+        }
+        target.data = target.bytes.data();
+        target.size = target.bytes.size();
+      }
+      else
+      {
+        std::string path = directory + DecodeUri(buffer["uri"].String());
+        if (!target.file.Open(path))
+        {
+          DEBUG_ERROR(IO, "Failed to open glTF buffer %s", path.c_str());
+          return false;
+        }
+        target.data = target.file.getData();
+        target.size = target.file.getSize();
+        target.external = true;
+      }
+
+      if (target.size < length)
+      {
+        DEBUG_ERROR(IO, "glTF buffer %zu is shorter than its byteLength", i);
+        return false;
+      }
+      target.size = length;
+    }
+    return true;
+  }
+
+  // Bytes of a buffer view, nullptr if it is out of range.
+  static const uint8_t* ViewData(const JsonValue& json, const std::vector<GltfBuffer>& buffers, int64_t index,
+                                 size_t& size, size_t& stride)
+  {
+    const JsonValue& view = json["bufferViews"][static_cast<size_t>(index)];
+    int64_t buffer = view["buffer"].Int(-1);
+    int64_t offset = view["byteOffset"].Int(0);
+    int64_t length = view["byteLength"].Int(-1);
+    if (buffer < 0 || static_cast<size_t>(buffer) >= buffers.size() || offset < 0 || length < 0 ||
+        static_cast<uint64_t>(offset) + static_cast<uint64_t>(length) > buffers[static_cast<size_t>(buffer)].size)
+      return nullptr;
+
+    size = static_cast<size_t>(length);
+    stride = static_cast<size_t>(view["byteStride"].Int(0));
+    return buffers[static_cast<size_t>(buffer)].data + offset;
+  }
+
+  static GltfAccessor ReadAccessor(const JsonValue& json, const std::vector<GltfBuffer>& buffers, int64_t index)
+  {
+    GltfAccessor accessor;
+    const JsonValue& source = json["accessors"][static_cast<size_t>(std::max<int64_t>(index, 0))];
+    if (index < 0 || !source.IsObject()) return accessor;
+    if (source.Has("sparse")) DEBUG_WARNING(IO, "Sparse glTF accessor %lld, only its dense part is used",
+                                            static_cast<long long>(index));
+    if (!source.Has("bufferView")) return accessor;
+
+    static const char* types[] = { "SCALAR", "VEC2", "VEC3", "VEC4" };
+    uint32_t components = 0;
+    for (uint32_t i = 0; i < 4; ++i)
+      if (source["type"].String() == types[i]) components = i + 1;
+
+    uint32_t component_type = static_cast<uint32_t>(source["componentType"].Int());
+    size_t component_size = component_type == component_float || component_type == component_unsigned_int ? 4 :
+                            (component_type == component_short || component_type == component_unsigned_short ? 2 : 1);
+    size_t element_size = component_size * components;
+    size_t count = static_cast<size_t>(std::max<int64_t>(source["count"].Int(), 0));
+
+    size_t view_size, stride;
+    const uint8_t* view = ViewData(json, buffers, source["bufferView"].Int(-1), view_size, stride);
+    size_t offset = static_cast<size_t>(std::max<int64_t>(source["byteOffset"].Int(0), 0));
+    if (stride == 0) stride = element_size;
+    // the last element ends at offset + stride * (count - 1) + element_size, kept from overflowing
+    if (!view || components == 0 || count == 0 || stride < element_size || offset > view_size ||
+        element_size > view_size - offset || count - 1 > (view_size - offset - element_size) / stride)
+    {
+      DEBUG_WARNING(IO, "glTF accessor %lld is invalid", static_cast<long long>(index));
+      return accessor;
+    }
+
+    accessor.data = view + offset;
+    accessor.count = count;
+    accessor.stride = stride;
+    accessor.component_type = component_type;
+    accessor.components = components;
+    accessor.normalized = source["normalized"].Bool();
+    return accessor;
+  }
+
+  static glm::mat4 LocalTransform(const JsonValue& node)
+  {
+    glm::mat4 transform(1.0f);
+    if (node.Has("matrix"))
+    {
+      // column major, like glm
+      for (int i = 0; i < 16; ++i) transform[i / 4][i % 4] = static_cast<float>(node["matrix"][i].Number(i % 5 == 0));
+      return transform;
+    }
+
+    float q[4];
+    for (size_t i = 0; i < 4; ++i) q[i] = static_cast<float>(node["rotation"][i].Number(i == 3));
+    float x = q[0], y = q[1], z = q[2], w = q[3];
+    glm::mat3 rotation(1.0f - 2.0f * (y * y + z * z), 2.0f * (x * y + z * w), 2.0f * (x * z - y * w),
+                       2.0f * (x * y - z * w), 1.0f - 2.0f * (x * x + z * z), 2.0f * (y * z + x * w),
+                       2.0f * (x * z + y * w), 2.0f * (y * z - x * w), 1.0f - 2.0f * (x * x + y * y));
+
+    for (int axis = 0; axis < 3; ++axis)
+    {
+      float scale = static_cast<float>(node["scale"][axis].Number(1.0));
+      transform[axis] = glm::vec4(rotation[axis] * scale, 0.0f);
+      transform[3][axis] = static_cast<float>(node["translation"][axis].Number());
+    }
+    return transform;
+  }
+
+  static void ReadTexture(const JsonValue& json, const JsonValue& info, int32_t& texture)
+  {
+    if (!info.IsObject()) return;
+    const JsonValue& source = json["textures"][static_cast<size_t>(std::max<int64_t>(info["index"].Int(-1), 0))];
+    if (info["index"].Int(-1) < 0 || !source.IsObject()) return;
+    if (info["texCoord"].Int(0) != 0) DEBUG_WARNING(IO, "Only TEXCOORD_0 is supported");
+    texture = static_cast<int32_t>(source["source"].Int(-1));
+  }
+
+  static void ReadMaterials(const JsonValue& json, Scene& scene)
+  {
+    const JsonValue& list = json["materials"];
+    for (size_t i = 0; i < list.Size(); ++i)
+    {
+      const JsonValue& source = list[i];
+      const JsonValue& pbr = source["pbrMetallicRoughness"];
+      const JsonValue& extensions = source["extensions"];
+      Material material;
+
+      for (int channel = 0; channel < 4; ++channel)
+        material.base_color[channel] = static_cast<float>(pbr["baseColorFactor"][channel].Number(1.0));
+      material.metallic = static_cast<float>(pbr["metallicFactor"].Number(1.0));
+      material.roughness = static_cast<float>(pbr["roughnessFactor"].Number(1.0));
+      ReadTexture(json, pbr["baseColorTexture"], material.base_color_texture);
+      ReadTexture(json, pbr["metallicRoughnessTexture"], material.metallic_roughness_texture);
+      ReadTexture(json, source["normalTexture"], material.normal_texture);
+      ReadTexture(json, source["emissiveTexture"], material.emission_texture);
+
+      float strength = static_cast<float>(extensions["KHR_materials_emissive_strength"]["emissiveStrength"].Number(1.0));
+      for (int channel = 0; channel < 3; ++channel)
+        material.emission[channel] = static_cast<float>(source["emissiveFactor"][channel].Number()) * strength;
+      material.ior = static_cast<float>(extensions["KHR_materials_ior"]["ior"].Number(1.5));
+      material.transmission = static_cast<float>(extensions["KHR_materials_transmission"]["transmissionFactor"].Number());
+
+      const std::string& alpha_mode = source["alphaMode"].String();
+      if (alpha_mode == "MASK") material.alpha_cutoff = static_cast<float>(source["alphaCutoff"].Number(0.5));
+      else if (alpha_mode != "BLEND") material.base_color.a = 1.0f;
+
+      scene.materials.push_back(material);
+    }
+  }
+
+  // Images are not part of the scene cache, so this also runs after a cache hit.
+  static void DecodeImages(const JsonValue& json, const std::vector<GltfBuffer>& buffers, const std::string& path,
+                           Scene& scene, Scheduler& scheduler, const GltfLoadSettings& settings)
+  {
+    Profiler::Scope scope("gltf.images");
+    const std::string directory = Directory(path);
+    const JsonValue& list = json["images"];
+    scene.images.assign(list.Size(), Image {});
+    scheduler.ParallelFor(static_cast<uint32_t>(list.Size()), [&](uint32_t task, uint32_t)
+    {
+      const JsonValue& source = list[task];
+      const std::string& uri = source["uri"].String();
+      bool success = false;
+      if (source.Has("bufferView"))
+      {
+        size_t size, stride;
+        const uint8_t* data = ViewData(json, buffers, source["bufferView"].Int(-1), size, stride);
+        success = data && DecodeImage(data, size, scene.images[task]);
+      }
+      else if (IsDataUri(uri))
+      {
+        std::vector<uint8_t> bytes;
+        success = DecodeDataUri(uri, bytes) && DecodeImage(bytes.data(), bytes.size(), scene.images[task]);
+      }
+      else success = LoadImageFile(directory + DecodeUri(uri), scene.images[task]);
+
+      if (!success) DEBUG_WARNING(IO, "Failed to decode glTF image %u", task);
+    });
+
+    if (settings.compress_textures)
+    {
+      TextureCompressionSettings compression;
+      if (settings.use_cache)
+      {
+        compression.cache_directory = settings.texture_cache_directory.empty() ? TextureCacheDirectoryFor(path)
+                                                                                : settings.texture_cache_directory;
+      }
+      CompressTextures(scene, scheduler, compression);
+    }
+    else if (settings.mipmaps) scene.GenerateMipmaps(scheduler);
+  }
+
+  static bool CheckExtensions(const JsonValue& json)
+  {
+    static const char* supported[] = { "KHR_materials_emissive_strength", "KHR_materials_ior",
+                                       "KHR_materials_transmission" };
+    for (const JsonValue& extension : json["extensionsRequired"].getArray())
+    {
+      if (std::none_of(std::begin(supported), std::end(supported),
+                       [&](const char* name) { return extension.String() == name; }))
+      {
+        DEBUG_ERROR(IO, "Required glTF extension %s is not supported", extension.String().c_str());
+        return false;
+      }
+    }
+    return true;
+  }
+
+  // Walks the node trees of the chosen scene and turns every mesh primitive
+  // into a draw, sized so the geometry pass knows where everything lands.
+  static bool CollectDraws(const JsonValue& json, const std::vector<GltfBuffer>& buffers, uint32_t scene_index,
+                           Scene& scene, std::vector<GltfDraw>& draws, uint64_t& vertex_count, uint64_t& triangle_count)
+  {
+    const JsonValue& nodes = json["nodes"];
+    std::vector<uint8_t> visited(nodes.Size(), 0);
+    std::vector<std::pair<size_t, glm::mat4>> stack;
+
+    if (scene_index == invalid_index) scene_index = static_cast<uint32_t>(json["scene"].Int(0));
+    const JsonValue& roots = json["scenes"][scene_index]["nodes"];
+    if (json["scenes"].Size() > 0 && !json["scenes"][scene_index].IsObject())
+    {
+      DEBUG_ERROR(IO, "glTF scene %u does not exist", scene_index);
+      return false;
+    }
+    if (json["scenes"].Size() == 0)
+    {
+      // no scenes, every root node is instantiated
+      std::vector<uint8_t> child(nodes.Size(), 0);
+      for (const JsonValue& node : nodes.getArray())
+        for (const JsonValue& index : node["children"].getArray())
+          if (index.Int(-1) >= 0 && static_cast<size_t>(index.Int()) < child.size()) child[static_cast<size_t>(index.Int())] = 1;
+      for (size_t i = nodes.Size(); i-- > 0;)
+        if (!child[i]) stack.emplace_back(i, glm::mat4(1.0f));
+    }
+    else
+    {
+      for (size_t i = roots.Size(); i-- > 0;)
+        stack.emplace_back(static_cast<size_t>(roots[i].Int(-1)), glm::mat4(1.0f));
+    }
+
+    uint32_t default_material = invalid_index;
+    while (!stack.empty())
+    {
+      size_t index = stack.back().first;
+      glm::mat4 parent = stack.back().second;
+      stack.pop_back();
+      if (index >= nodes.Size() || visited[index])
+      {
+        DEBUG_WARNING(IO, "glTF node %zu is invalid or part of a cycle", index);
+        continue;
+      }
+      visited[index] = 1;
+
+      const JsonValue& node = nodes[index];
+      glm::mat4 transform = parent * LocalTransform(node);
+      const JsonValue& children = node["children"];
+      for (size_t i = children.Size(); i-- > 0;) stack.emplace_back(static_cast<size_t>(children[i].Int(-1)), transform);
+
+      int64_t mesh = node["mesh"].Int(-1);
+      if (mesh < 0) continue;
+
+      Instance instance;
+      instance.transform = transform;
+      instance.mesh = static_cast<uint32_t>(mesh);
+      instance.first_triangle = static_cast<uint32_t>(triangle_count);
+      instance.node = static_cast<uint32_t>(index);
+
+      bool identity = transform == glm::mat4(1.0f);
+      glm::mat3 normal_transform = glm::transpose(glm::inverse(glm::mat3(transform)));
+      bool mirrored = glm::determinant(glm::mat3(transform)) < 0.0f;
+
+      for (const JsonValue& primitive : json["meshes"][static_cast<size_t>(mesh)]["primitives"].getArray())
+      {
+        GltfDraw draw;
+        draw.transform = transform;
+        draw.normal_transform = normal_transform;
+        draw.identity = identity;
+        draw.mirrored = mirrored;
+        draw.mode = static_cast<uint32_t>(primitive["mode"].Int(mode_triangles));
+        if (draw.mode != mode_triangles && draw.mode != mode_triangle_strip && draw.mode != mode_triangle_fan) continue;
+
+        const JsonValue& attributes = primitive["attributes"];
+        draw.positions = ReadAccessor(json, buffers, attributes["POSITION"].Int(-1));
+        draw.normals = ReadAccessor(json, buffers, attributes["NORMAL"].Int(-1));
+        draw.uvs = ReadAccessor(json, buffers, attributes["TEXCOORD_0"].Int(-1));
+        draw.indices = ReadAccessor(json, buffers, primitive["indices"].Int(-1));
+        if (!draw.positions.Valid() || draw.positions.components != 3 ||
+            (primitive.Has("indices") && (!draw.indices.Valid() || draw.indices.ReadIndex(0) == invalid_index)))
+        {
+          DEBUG_WARNING(IO, "Skipped a primitive of glTF mesh %lld", static_cast<long long>(mesh));
+          continue;
+        }
+        if (draw.normals.Valid() && (draw.normals.count != draw.positions.count || draw.normals.components != 3))
+          draw.normals = GltfAccessor {};
+        if (draw.uvs.Valid() && (draw.uvs.count != draw.positions.count || draw.uvs.components != 2))
+          draw.uvs = GltfAccessor {};
+
+        size_t corners = draw.indices.Valid() ? draw.indices.count : draw.positions.count;
+        size_t triangles = draw.mode == mode_triangles ? corners / 3 : (corners >= 3 ? corners - 2 : 0);
+        if (triangles == 0) continue;
+
+        int64_t material = primitive["material"].Int(-1);
+        if (material < 0 || static_cast<size_t>(material) >= json["materials"].Size())
+        {
+          if (default_material == invalid_index)
+          {
+            default_material = static_cast<uint32_t>(scene.materials.size());
+            scene.materials.emplace_back();
+          }
+          draw.material = default_material;
+        }
+        else draw.material = static_cast<uint32_t>(material);
+
+        draw.vertex_base = static_cast<uint32_t>(vertex_count);
+        draw.first_triangle = static_cast<uint32_t>(triangle_count);
+        draw.triangle_count = static_cast<uint32_t>(triangles);
+        vertex_count += draw.positions.count;
+        triangle_count += triangles;
+        if (vertex_count >= invalid_index || triangle_count * 3 >= invalid_index)
+        {
+          DEBUG_ERROR(IO, "glTF scene is too large");
+          return false;
+        }
+        draws.push_back(draw);
+      }
+
+      instance.triangle_count = static_cast<uint32_t>(triangle_count) - instance.first_triangle;
+      scene.instances.push_back(instance);
+    }
+    return true;
+  }
+
+  // Vertices and triangles of the draws, written in parallel over fixed size
+  // ranges so one huge primitive doesn't serialize the pass.
+  static void WriteGeometry(const std::vector<GltfDraw>& draws, Scene& scene, Scheduler& scheduler)
+  {
+    Profiler::Scope scope("gltf.geometry");
+    const uint32_t range = 1u << 16;
+
+    struct Task
+    {
+      uint32_t draw;
+      uint32_t begin;
+      bool triangles;
+    };
+    std::vector<Task> tasks;
+    for (uint32_t i = 0; i < draws.size(); ++i)
+    {
+      for (uint32_t begin = 0; begin < draws[i].positions.count; begin += range) tasks.push_back({ i, begin, false });
+      for (uint32_t begin = 0; begin < draws[i].triangle_count; begin += range) tasks.push_back({ i, begin, true });
+    }
+
+    std::atomic<uint32_t> bad_indices { 0 };
+    scheduler.ParallelFor(static_cast<uint32_t>(tasks.size()), [&](uint32_t task_index, uint32_t)
+    {
+      const Task& task = tasks[task_index];
+      const GltfDraw& draw = draws[task.draw];
+
+      if (!task.triangles)
+      {
+        uint32_t end = static_cast<uint32_t>(std::min<size_t>(draw.positions.count, task.begin + range));
+        glm::vec3* positions = scene.positions.data() + draw.vertex_base;
+        if (draw.identity && draw.positions.component_type == component_float && draw.positions.stride == sizeof(glm::vec3))
+          std::memcpy(positions + task.begin, draw.positions.data + task.begin * sizeof(glm::vec3),
+                      (end - task.begin) * sizeof(glm::vec3));
+        else
+        {
+          for (uint32_t i = task.begin; i < end; ++i)
+          {
+            glm::vec3 position(draw.positions.Read(i, 0), draw.positions.Read(i, 1), draw.positions.Read(i, 2));
+            positions[i] = glm::vec3(draw.transform * glm::vec4(position, 1.0f));
+          }
+        }
+
+        if (!scene.normals.empty() && draw.normals.Valid())
+        {
+          for (uint32_t i = task.begin; i < end; ++i)
+          {
+            glm::vec3 normal(draw.normals.Read(i, 0), draw.normals.Read(i, 1), draw.normals.Read(i, 2));
+            normal = draw.normal_transform * normal;
+            float length = glm::length(normal);
+            scene.normals[draw.vertex_base + i] = length > 0.0f ? normal / length : normal;
+          }
+        }
+        if (!scene.uvs.empty() && draw.uvs.Valid())
+        {
+          for (uint32_t i = task.begin; i < end; ++i)
+            scene.uvs[draw.vertex_base + i] = glm::vec2(draw.uvs.Read(i, 0), draw.uvs.Read(i, 1));
+        }
+        return;
+      }
+
+      uint32_t end = std::min(draw.triangle_count, task.begin + range);
+      uint32_t* indices = scene.indices.data() + static_cast<size_t>(draw.first_triangle) * 3;
+      std::fill(scene.material_indices.begin() + draw.first_triangle + task.begin,
+                scene.material_indices.begin() + draw.first_triangle + end, draw.material);
+
+      if (draw.mode == mode_triangles && draw.indices.Valid() && draw.vertex_base == 0 && !draw.mirrored &&
+          draw.indices.component_type == component_unsigned_int && draw.indices.stride == sizeof(uint32_t))
+      {
+        // tightly packed 32-bit indices only need a range check
+        std::memcpy(indices + task.begin * 3, draw.indices.data + task.begin * 3 * sizeof(uint32_t),
+                    (end - task.begin) * 3 * sizeof(uint32_t));
+        uint32_t bad = 0;
+        for (uint32_t i = task.begin * 3; i < end * 3; ++i)
+        {
+          if (indices[i] < draw.positions.count) continue;
+          indices[i] = 0;
+          bad++;
+        }
+        if (bad) bad_indices.fetch_add(bad, std::memory_order_relaxed);
+        return;
+      }
+
+      uint32_t bad = 0;
+      auto corner = [&](size_t i)
+      {
+        uint32_t index = draw.indices.Valid() ? draw.indices.ReadIndex(i) : static_cast<uint32_t>(i);
+        if (index >= draw.positions.count)
+        {
+          bad++;
+          index = 0;
+        }
+        return draw.vertex_base + index;
+      };
+
+      for (uint32_t triangle = task.begin; triangle < end; ++triangle)
+      {
+        uint32_t a, b, c;
+        if (draw.mode == mode_triangles)
+        {
+          a = corner(triangle * 3ull);
+          b = corner(triangle * 3ull + 1);
+          c = corner(triangle * 3ull + 2);
+        }
+        else if (draw.mode == mode_triangle_strip)
+        {
+          // every other strip triangle flips to keep a consistent winding
+          a = corner(triangle + (triangle & 1));
+          b = corner(triangle + 1 - (triangle & 1));
+          c = corner(triangle + 2ull);
+        }
+        else
+        {
+          a = corner(0);
+          b = corner(triangle + 1ull);
+          c = corner(triangle + 2ull);
+        }
+        if (draw.mirrored) std::swap(b, c);
+        indices[triangle * 3] = a;
+        indices[triangle * 3 + 1] = b;
+        indices[triangle * 3 + 2] = c;
+      }
+      if (bad) bad_indices.fetch_add(bad, std::memory_order_relaxed);
+    });
+
+    if (bad_indices.load() > 0) DEBUG_WARNING(IO, "Replaced %u out of range glTF indices", bad_indices.load());
+  }
+
+  bool LoadGltf(const std::string& path, Scene& scene, Scheduler& scheduler, const GltfLoadSettings& settings)
+  {
+    Profiler::Scope scope("gltf.load");
+
+    MappedFile file;
+    if (!file.Open(path))
+    {
+      DEBUG_ERROR(IO, "Failed to open %s", path.c_str());
+      return false;
+    }
+
+    const char* text = reinterpret_cast<const char*>(file.getData());
+    size_t text_size = file.getSize();
+    GltfBuffer bin;
+    uint32_t magic = 0;
+    if (file.getSize() >= 12) std::memcpy(&magic, file.getData(), sizeof(magic));
+    if (magic == glb_magic && !ReadGlb(file, text, text_size, bin))
+    {
+      DEBUG_ERROR(IO, "%s is not a valid GLB file", path.c_str());
+      return false;
+    }
+
+    JsonValue json;
+    std::string error;
+    if (!JsonValue::Parse(text, text_size, json, &error))
+    {
+      DEBUG_ERROR(IO, "Failed to parse %s: %s", path.c_str(), error.c_str());
+      return false;
+    }
+    if (json["asset"]["version"].String().compare(0, 2, "2.") != 0)
+    {
+      DEBUG_ERROR(IO, "%s is not a glTF 2.0 file", path.c_str());
+      return false;
+    }
+    if (!CheckExtensions(json)) return false;
+
+    std::string directory = Directory(path);
+    std::vector<GltfBuffer> buffers;
+    if (!LoadBuffers(json, directory, bin, buffers)) return false;
+
+    uint64_t source_hash = 0;
+    if (settings.use_cache)
+    {
+      // the cache key covers the file, its external buffers and the load options
+      source_hash = HashCombine(HashBytes(file.getData(), file.getSize()), settings.build_bvh);
+      source_hash = HashCombine(source_hash, settings.scene);
+      source_hash = HashCombine(source_hash, settings.quantize);
+      source_hash = HashCombine(source_hash, settings.compress_bvh);
+      for (const GltfBuffer& buffer : buffers)
+        if (buffer.external) source_hash = HashBytes(buffer.data, buffer.size, source_hash);
+
+      scene = Scene {};
+      SceneCache cache;
+      if (cache.Open(SceneCache::PathFor(path), source_hash) && cache.Load(scene))
+      {
+        cache.Stream(settings.stream);
+        if (settings.decode_images) DecodeImages(json, buffers, path, scene, scheduler, settings);
+        DEBUG_LOG(IO, "Loaded %s from its scene cache", path.c_str());
+        return true;
+      }
+    }
+
+    scene = Scene {};
+    ReadMaterials(json, scene);
+
+    std::vector<GltfDraw> draws;
+    uint64_t vertex_count = 0;
+    uint64_t triangle_count = 0;
+    if (!CollectDraws(json, buffers, settings.scene, scene, draws, vertex_count, triangle_count)) return false;
+
+    // attributes present on any primitive are stored for all, zero where missing
+    bool has_normals = std::any_of(draws.begin(), draws.end(), [](const GltfDraw& draw) { return draw.normals.Valid(); });
+    bool has_uvs = std::any_of(draws.begin(), draws.end(), [](const GltfDraw& draw) { return draw.uvs.Valid(); });
+    scene.positions.resize(vertex_count);
+    scene.normals.assign(has_normals ? vertex_count : 0, glm::vec3(0.0f));
+    scene.uvs.assign(has_uvs ? vertex_count : 0, glm::vec2(0.0f));
+    scene.indices.resize(triangle_count * 3);
+    scene.material_indices.resize(triangle_count);
+    WriteGeometry(draws, scene, scheduler);
+
+    if (settings.quantize)
+    {
+      QuantizationStats stats = QuantizeScene(scene, scheduler);
+      DEBUG_LOG(IO, "Quantized %s: %llu -> %llu attribute bytes, max error %g position, %g rad normal, %g uv",
+                path.c_str(), static_cast<unsigned long long>(stats.float_bytes),
+                static_cast<unsigned long long>(stats.quantized_bytes), stats.max_position_error,
+                stats.max_normal_error, stats.max_uv_error);
+    }
+    SceneCache::StreamSections(settings.stream, scene, SceneCache::vertex_sections);
+    SceneCache::StreamSections(settings.stream, scene, { SceneSection::MaterialIndices, SceneSection::Materials,
+                                                         SceneSection::Instances });
+
+    // embedded images have no file of their own, they are named after the
+    // glTF and their index
+    const JsonValue& images = json["images"];
+    for (size_t i = 0; i < images.Size(); ++i)
+    {
+      const std::string& uri = images[i]["uri"].String();
+      if (images[i].Has("bufferView") || uri.empty() || IsDataUri(uri))
+        scene.textures.push_back(path + "#image" + std::to_string(i));
+      else scene.textures.push_back(directory + DecodeUri(uri));
+    }
+
+    if (settings.build_bvh)
+    {
+      scene.BuildBVH();
+      if (settings.compress_bvh) scene.BuildCompressedBVH();
+      SceneCache::StreamSections(settings.stream, scene, SceneCache::bvh_sections);
+    }
+
+    if (settings.use_cache) SceneCache::Write(SceneCache::PathFor(path), scene, source_hash);
+    if (settings.decode_images) DecodeImages(json, buffers, path, scene, scheduler, settings);
+
+    DEBUG_LOG(IO, "Loaded %s: %zu vertices, %u triangles, %zu instances, %zu materials, %zu textures", path.c_str(),
+              scene.positions.size(), scene.TriangleCount(), scene.instances.size(), scene.materials.size(),
+              scene.textures.size());
+    return true;
+  }
+
+} // namespace PathTracer
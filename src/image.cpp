@@ -0,0 +1,503 @@
+
+#include <VulkanPT/image.hpp>
+#include <VulkanPT/debug.hpp>
+#include <VulkanPT/mapped_file.hpp>
+#include <VulkanPT/profiler.hpp>
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+
+namespace PathTracer
+{
+  static std::mutex decoder_mutex;
+  static ImageDecoder external_decoder;
+
+  void SetImageDecoder(ImageDecoder decoder)
+  {
+    std::lock_guard<std::mutex> lock(decoder_mutex);
+    external_decoder = std::move(decoder);
+  }
+
+  // Canonical Huffman code, codes up to fast_bits long resolve with one lookup.
+  struct Huffman
+  {
+    static constexpr int fast_bits = 9;
+
+    uint16_t counts[16] {};
+    uint16_t symbols[288] {};
+    // symbol << 4 | length, 0 when the code is longer than fast_bits
+    uint16_t fast[1 << fast_bits] {};
+
+    // False for over-subscribed lengths, which give no prefix code. Incomplete
+    // ones are fine, their unused codes fail to decode.
+    bool Build(const uint8_t* lengths, int count)
+    {
+      std::memset(counts, 0, sizeof(counts));
+      std::memset(fast, 0, sizeof(fast));
+      for (int i = 0; i < count; ++i) counts[lengths[i]]++;
+      counts[0] = 0;
+
+      int left = 1;
+      for (int length = 1; length < 16; ++length)
+      {
+        left = (left << 1) - counts[length];
+        if (left < 0) return false;
+      }
+
+      uint16_t offsets[16];
+      offsets[1] = 0;
+      for (int length = 1; length < 15; ++length) offsets[length + 1] = offsets[length] + counts[length];
+      for (int i = 0; i < count; ++i)
+        if (lengths[i]) symbols[offsets[lengths[i]]++] = static_cast<uint16_t>(i);
+
+      // walk the canonical codes to fill the table with bit reversed codes
+      int code = 0;
+      int index = 0;
+      for (int length = 1; length <= fast_bits; ++length)
+      {
+        for (int i = 0; i < counts[length]; ++i, ++code, ++index)
+        {
+          int reversed = 0;
+          for (int bit = 0; bit < length; ++bit) reversed |= ((code >> bit) & 1) << (length - 1 - bit);
+          for (int fill = reversed; fill < (1 << fast_bits); fill += 1 << length)
+            fast[fill] = static_cast<uint16_t>(symbols[index] << 4 | length);
+        }
+        code <<= 1;
+      }
+      return true;
+    }
+  };
+
+  class BitReader
+  {
+   public:
+    BitReader(const uint8_t* in_data, size_t in_size) : data{ in_data }, size{ in_size } {}
+
+    uint32_t Peek(int count)
+    {
+      while (available < count)
+      {
+        // past the end reads zeros, only consuming them counts as an overrun
+        uint32_t byte = 0;
+        if (position < size) byte = data[position];
+        else padding++;
+        position++;
+        buffer |= static_cast<uint64_t>(byte) << available;
+        available += 8;
+      }
+      return static_cast<uint32_t>(buffer & ((1ull << count) - 1));
+    }
+
+    void Skip(int count)
+    {
+      buffer >>= count;
+      available -= count;
+    }
+
+    uint32_t Read(int count)
+    {
+      if (count == 0) return 0;
+      uint32_t value = Peek(count);
+      Skip(count);
+      return value;
+    }
+
+    void AlignToByte() { Skip(available % 8); }
+
+    // only valid after AlignToByte, hands out whole bytes
+    const uint8_t* Bytes(size_t count)
+    {
+      position -= available / 8;
+      buffer = 0;
+      available = 0;
+      padding = 0;
+      if (position + count > size)
+      {
+        padding = 1;
+        return nullptr;
+      }
+      const uint8_t* bytes = data + position;
+      position += count;
+      return bytes;
+    }
+
+    bool Overrun() const { return static_cast<int>(padding) * 8 > available; }
+
+   private:
+    const uint8_t* data;
+    size_t size;
+    size_t position { 0 };
+    uint64_t buffer { 0 };
+    int available { 0 };
+    uint32_t padding { 0 };
+  };
+
+  static int DecodeSymbol(BitReader& reader, const Huffman& huffman)
+  {
+    uint16_t entry = huffman.fast[reader.Peek(Huffman::fast_bits)];
+    if (entry)
+    {
+      reader.Skip(entry & 15);
+      return entry >> 4;
+    }
+
+    // slow path for long codes, one bit at a time as in zlib's puff
+    int code = 0, first = 0, index = 0;
+    for (int length = 1; length < 16; ++length)
+    {
+      code |= static_cast<int>(reader.Read(1));
+      int count = huffman.counts[length];
+      if (code - count < first) return huffman.symbols[index + (code - first)];
+      index += count;
+      first = (first + count) << 1;
+      code <<= 1;
+    }
+    return -1;
+  }
+
+  bool Inflate(const uint8_t* data, size_t size, std::vector<uint8_t>& output, size_t max_size, bool zlib_header)
+  {
+    static const uint16_t length_base[] = { 3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+                                            35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258 };
+    static const uint8_t length_extra[] = { 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+                                            3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+    static const uint16_t distance_base[] = { 1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129,
+                                              193, 257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097,
+                                              6145, 8193, 12289, 16385, 24577 };
+    static const uint8_t distance_extra[] = { 0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7,
+                                              8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13 };
+    static const uint8_t code_length_order[] = { 16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15 };
+
+    if (zlib_header)
+    {
+      if (size < 2 || (data[0] & 15) != 8 || ((data[0] << 8) | data[1]) % 31 != 0 || (data[1] & 32)) return false;
+      data += 2;
+      size -= 2;
+    }
+
+    BitReader reader(data, size);
+    Huffman literals, distances;
+    bool last = false;
+    while (!last)
+    {
+      last = reader.Read(1) != 0;
+      uint32_t type = reader.Read(2);
+
+      if (type == 0)
+      {
+        reader.AlignToByte();
+        const uint8_t* header = reader.Bytes(4);
+        if (!header) return false;
+        uint16_t length = static_cast<uint16_t>(header[0] | header[1] << 8);
+        uint16_t complement = static_cast<uint16_t>(header[2] | header[3] << 8);
+        if (length != static_cast<uint16_t>(~complement)) return false;
+        const uint8_t* bytes = reader.Bytes(length);
+        if (!bytes || length > max_size - output.size()) return false;
+        output.insert(output.end(), bytes, bytes + length);
+        continue;
+      }
+
+      if (type == 1)
+      {
+        uint8_t lengths[288 + 32];
+        std::fill(lengths, lengths + 144, 8);
+        std::fill(lengths + 144, lengths + 256, 9);
+        std::fill(lengths + 256, lengths + 280, 7);
+        std::fill(lengths + 280, lengths + 288, 8);
+        std::fill(lengths + 288, lengths + 320, 5);
+        if (!literals.Build(lengths, 288) || !distances.Build(lengths + 288, 30)) return false;
+      }
+      else if (type == 2)
+      {
+        uint32_t literal_count = reader.Read(5) + 257;
+        uint32_t distance_count = reader.Read(5) + 1;
+        uint32_t code_count = reader.Read(4) + 4;
+        if (literal_count > 286 || distance_count > 30) return false;
+
+        uint8_t code_lengths[19] = {};
+        for (uint32_t i = 0; i < code_count; ++i) code_lengths[code_length_order[i]] = static_cast<uint8_t>(reader.Read(3));
+        Huffman code_huffman;
+        if (!code_huffman.Build(code_lengths, 19)) return false;
+
+        uint8_t lengths[288 + 32] = {};
+        uint32_t total = literal_count + distance_count;
+        for (uint32_t i = 0; i < total;)
+        {
+          int symbol = DecodeSymbol(reader, code_huffman);
+          if (symbol < 0) return false;
+          if (symbol < 16)
+          {
+            lengths[i++] = static_cast<uint8_t>(symbol);
+            continue;
+          }
+
+          uint8_t value = 0;
+          uint32_t repeat;
+          if (symbol == 16)
+          {
+            if (i == 0) return false;
+            value = lengths[i - 1];
+            repeat = 3 + reader.Read(2);
+          }
+          else if (symbol == 17) repeat = 3 + reader.Read(3);
+          else repeat = 11 + reader.Read(7);
+          if (i + repeat > total) return false;
+          std::fill(lengths + i, lengths + i + repeat, value);
+          i += repeat;
+        }
+
+        if (!literals.Build(lengths, static_cast<int>(literal_count)) ||
+            !distances.Build(lengths + literal_count, static_cast<int>(distance_count)))
+          return false;
+      }
+      else return false;
+
+      while (true)
+      {
+        int symbol = DecodeSymbol(reader, literals);
+        if (symbol < 0 || reader.Overrun()) return false;
+        if (symbol < 256)
+        {
+          if (output.size() == max_size) return false;
+          output.push_back(static_cast<uint8_t>(symbol));
+          continue;
+        }
+        if (symbol == 256) break;
+
+        symbol -= 257;
+        if (symbol >= 29) return false;
+        size_t length = length_base[symbol] + reader.Read(length_extra[symbol]);
+        int distance_symbol = DecodeSymbol(reader, distances);
+        if (distance_symbol < 0 || distance_symbol >= 30) return false;
+        size_t distance = distance_base[distance_symbol] + reader.Read(distance_extra[distance_symbol]);
+        if (distance > output.size() || length > max_size - output.size()) return false;
+
+        size_t from = output.size() - distance;
+        output.resize(output.size() + length);
+        uint8_t* target = output.data() + output.size() - length;
+        const uint8_t* source = output.data() + from;
+        // overlapping copies repeat the last distance bytes
+        for (size_t i = 0; i < length; ++i) target[i] = source[i];
+      }
+    }
+
+    return !reader.Overrun();
+  }
+
+  static uint32_t ReadBigEndian(const uint8_t* bytes)
+  { return static_cast<uint32_t>(bytes[0]) << 24 | bytes[1] << 16 | bytes[2] << 8 | bytes[3]; }
+
+  static uint8_t Paeth(int a, int b, int c)
+  {
+    int p = a + b - c;
+    int pa = std::abs(p - a), pb = std::abs(p - b), pc = std::abs(p - c);
+    return static_cast<uint8_t>(pa <= pb && pa <= pc ? a : (pb <= pc ? b : c));
+  }
+
+  static bool Unfilter(uint8_t* rows, uint32_t row_bytes, uint32_t height, uint32_t pixel_bytes)
+  {
+    uint8_t* previous = nullptr;
+    for (uint32_t y = 0; y < height; ++y)
+    {
+      uint8_t filter = rows[0];
+      uint8_t* row = rows + 1;
+      for (uint32_t x = 0; x < row_bytes; ++x)
+      {
+        int left = x >= pixel_bytes ? row[x - pixel_bytes] : 0;
+        int up = previous ? previous[x] : 0;
+        int up_left = previous && x >= pixel_bytes ? previous[x - pixel_bytes] : 0;
+        switch (filter)
+        {
+        case 0: break;
+        case 1: row[x] = static_cast<uint8_t>(row[x] + left); break;
+        case 2: row[x] = static_cast<uint8_t>(row[x] + up); break;
+        case 3: row[x] = static_cast<uint8_t>(row[x] + ((left + up) >> 1)); break;
+        case 4: row[x] = static_cast<uint8_t>(row[x] + Paeth(left, up, up_left)); break;
+        default: return false;
+        }
+      }
+      previous = row;
+      rows += row_bytes + 1;
+    }
+    return true;
+  }
+
+  static bool DecodePng(const uint8_t* data, size_t size, Image& image)
+  {
+    uint32_t width = 0, height = 0;
+    uint8_t depth = 0, color = 0, interlace = 0;
+    uint8_t palette[256][4];
+    for (int i = 0; i < 256; ++i) palette[i][0] = palette[i][1] = palette[i][2] = 0, palette[i][3] = 255;
+    int transparent[3] = { -1, -1, -1 };
+    std::vector<uint8_t> compressed;
+
+    for (size_t offset = 8; offset + 12 <= size;)
+    {
+      uint32_t length = ReadBigEndian(data + offset);
+      const uint8_t* type = data + offset + 4;
+      const uint8_t* chunk = data + offset + 8;
+      if (offset + 12 + static_cast<size_t>(length) > size) return false;
+      offset += 12 + static_cast<size_t>(length);
+
+      if (std::memcmp(type, "IHDR", 4) == 0 && length >= 13)
+      {
+        width = ReadBigEndian(chunk);
+        height = ReadBigEndian(chunk + 4);
+        depth = chunk[8];
+        color = chunk[9];
+        interlace = chunk[12];
+      }
+      else if (std::memcmp(type, "PLTE", 4) == 0)
+      {
+        for (uint32_t i = 0; i < std::min(length / 3, 256u); ++i)
+          for (int channel = 0; channel < 3; ++channel) palette[i][channel] = chunk[i * 3 + channel];
+      }
+      else if (std::memcmp(type, "tRNS", 4) == 0)
+      {
+        if (color == 3)
+          for (uint32_t i = 0; i < std::min(length, 256u); ++i) palette[i][3] = chunk[i];
+        else
+          for (uint32_t i = 0; i < std::min(length / 2, 3u); ++i) transparent[i] = chunk[i * 2] << 8 | chunk[i * 2 + 1];
+      }
+      else if (std::memcmp(type, "IDAT", 4) == 0) compressed.insert(compressed.end(), chunk, chunk + length);
+      else if (std::memcmp(type, "IEND", 4) == 0) break;
+    }
+
+    static const int channel_counts[] = { 1, 0, 3, 1, 2, 0, 4 };
+    int channels = color <= 6 ? channel_counts[color] : 0;
+    if (width == 0 || height == 0 || channels == 0 || (depth != 1 && depth != 2 && depth != 4 && depth != 8 && depth != 16) ||
+        width > (1u << 16) || height > (1u << 16))
+      return false;
+
+    uint32_t bits_per_pixel = static_cast<uint32_t>(channels) * depth;
+    uint32_t pixel_bytes = std::max(1u, bits_per_pixel / 8);
+
+    // Adam7 passes, a single full resolution pass when not interlaced
+    static const uint32_t pass_x[] = { 0, 4, 0, 2, 0, 1, 0 }, pass_y[] = { 0, 0, 4, 0, 2, 0, 1 };
+    static const uint32_t step_x[] = { 8, 8, 4, 4, 2, 2, 1 }, step_y[] = { 8, 8, 8, 4, 4, 2, 2 };
+    int passes = interlace ? 7 : 1;
+    uint32_t pass_widths[7] = {}, pass_heights[7] = {};
+    size_t raw_size = 0;
+    for (int pass = 0; pass < passes; ++pass)
+    {
+      uint32_t x0 = interlace ? pass_x[pass] : 0, y0 = interlace ? pass_y[pass] : 0;
+      uint32_t dx = interlace ? step_x[pass] : 1, dy = interlace ? step_y[pass] : 1;
+      pass_widths[pass] = width > x0 ? (width - x0 + dx - 1) / dx : 0;
+      pass_heights[pass] = height > y0 ? (height - y0 + dy - 1) / dy : 0;
+      if (pass_widths[pass] == 0 || pass_heights[pass] == 0) continue;
+      uint32_t row_bytes = (pass_widths[pass] * bits_per_pixel + 7) / 8;
+      raw_size += static_cast<size_t>(row_bytes + 1) * pass_heights[pass];
+    }
+
+    // a stream that inflates past the filtered rows is damaged, stop it there
+    std::vector<uint8_t> raw;
+    raw.reserve(raw_size);
+    if (!Inflate(compressed.data(), compressed.size(), raw, raw_size)) return false;
+
+    image.width = width;
+    image.height = height;
+    image.texels.assign(static_cast<size_t>(width) * height * 4, 255);
+
+    size_t offset = 0;
+    for (int pass = 0; pass < passes; ++pass)
+    {
+      uint32_t x0 = interlace ? pass_x[pass] : 0, y0 = interlace ? pass_y[pass] : 0;
+      uint32_t dx = interlace ? step_x[pass] : 1, dy = interlace ? step_y[pass] : 1;
+      uint32_t pass_width = pass_widths[pass];
+      uint32_t pass_height = pass_heights[pass];
+      if (pass_width == 0 || pass_height == 0) continue;
+
+      uint32_t row_bytes = (pass_width * bits_per_pixel + 7) / 8;
+      if (offset + static_cast<size_t>(row_bytes + 1) * pass_height > raw.size()) return false;
+      uint8_t* rows = raw.data() + offset;
+      if (!Unfilter(rows, row_bytes, pass_height, pixel_bytes)) return false;
+      offset += static_cast<size_t>(row_bytes + 1) * pass_height;
+
+      for (uint32_t y = 0; y < pass_height; ++y)
+      {
+        const uint8_t* row = rows + static_cast<size_t>(y) * (row_bytes + 1) + 1;
+        for (uint32_t x = 0; x < pass_width; ++x)
+        {
+          // samples as 16 bit values, sub-byte depths are unpacked from the left
+          int samples[4];
+          for (int channel = 0; channel < channels; ++channel)
+          {
+            uint32_t index = x * channels + channel;
+            if (depth == 16) samples[channel] = row[index * 2] << 8 | row[index * 2 + 1];
+            else if (depth == 8) samples[channel] = row[index];
+            else
+            {
+              uint32_t bit = index * depth;
+              samples[channel] = (row[bit / 8] >> (8 - depth - bit % 8)) & ((1 << depth) - 1);
+            }
+          }
+
+          uint8_t* texel = image.texels.data() + (static_cast<size_t>(y0 + y * dy) * width + x0 + x * dx) * 4;
+          auto to8 = [&](int sample)
+          {
+            if (depth == 16) return static_cast<uint8_t>(sample >> 8);
+            return static_cast<uint8_t>(sample * 255 / ((1 << depth) - 1));
+          };
+
+          if (color == 3)
+          {
+            std::memcpy(texel, palette[samples[0] & 255], 4);
+            continue;
+          }
+
+          bool gray = color == 0 || color == 4;
+          for (int channel = 0; channel < 3; ++channel) texel[channel] = to8(samples[gray ? 0 : channel]);
+          if (color == 4 || color == 6) texel[3] = to8(samples[channels - 1]);
+          else if (gray ? samples[0] == transparent[0] :
+                   samples[0] == transparent[0] && samples[1] == transparent[1] && samples[2] == transparent[2])
+            texel[3] = 0;
+        }
+      }
+    }
+
+    return true;
+  }
+
+  bool DecodeImage(const uint8_t* data, size_t size, Image& image)
+  {
+    static const uint8_t png_signature[] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+    if (size >= 8 && std::memcmp(data, png_signature, 8) == 0) return DecodePng(data, size, image);
+
+    ImageDecoder decoder;
+    {
+      std::lock_guard<std::mutex> lock(decoder_mutex);
+      decoder = external_decoder;
+    }
+    return decoder && decoder(data, size, image);
+  }
+
+  bool LoadImageFile(const std::string& path, Image& image)
+  {
+    MappedFile file;
+    if (!file.Open(path))
+    {
+      DEBUG_WARNING(IO, "Failed to open image %s", path.c_str());
+      return false;
+    }
+
+    if (!DecodeImage(file.getData(), file.getSize(), image))
+    {
+      DEBUG_WARNING(IO, "Failed to decode image %s", path.c_str());
+      image = Image {};
+      return false;
+    }
+    return true;
+  }
+
+  void LoadImageFiles(const std::vector<std::string>& paths, std::vector<Image>& images, Scheduler& scheduler)
+  {
+    Profiler::Scope scope("image.load");
+    images.assign(paths.size(), Image {});
+    scheduler.ParallelFor(static_cast<uint32_t>(paths.size()), [&](uint32_t task, uint32_t)
+    {
+      LoadImageFile(paths[task], images[task]);
+    });
+  }
+
+} // namespace PathTracer
@@ -0,0 +1,268 @@
+
+#include <VulkanPT/json.hpp>
+#include <cstdlib>
+#include <cstring>
+
+namespace PathTracer
+{
+  static const JsonValue null_value;
+
+  const JsonValue& JsonValue::operator[](const char* key) const
+  {
+    if (type != Type::Object) return null_value;
+    for (const std::pair<std::string, JsonValue>& member : object)
+      if (member.first == key) return member.second;
+    return null_value;
+  }
+
+  const JsonValue& JsonValue::operator[](size_t index) const
+  {
+    if (type != Type::Array || index >= array.size()) return null_value;
+    return array[index];
+  }
+
+  class JsonParser
+  {
+   public:
+    JsonParser(const char* in_text, size_t in_size) : p{ in_text }, begin{ in_text }, end{ in_text + in_size } {}
+
+    bool ParseDocument(JsonValue& value, std::string* error)
+    {
+      bool success = ParseValue(value, 0);
+      SkipSpaces();
+      if (success && p != end) Fail("trailing characters");
+
+      if (!failure) return true;
+      if (error) *error = std::string(failure) + " at offset " + std::to_string(p - begin);
+      return false;
+    }
+
+   private:
+    static constexpr int max_depth = 256;
+
+    bool Fail(const char* message)
+    {
+      if (!failure) failure = message;
+      return false;
+    }
+
+    void SkipSpaces()
+    {
+      while (p < end && (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r')) p++;
+    }
+
+    bool Literal(const char* word)
+    {
+      size_t length = std::strlen(word);
+      if (static_cast<size_t>(end - p) < length || std::memcmp(p, word, length) != 0) return Fail("bad literal");
+      p += length;
+      return true;
+    }
+
+    static void AppendUtf8(std::string& text, uint32_t code)
+    {
+      if (code < 0x80) text += static_cast<char>(code);
+      else if (code < 0x800)
+      {
+        text += static_cast<char>(0xC0 | code >> 6);
+        text += static_cast<char>(0x80 | (code & 0x3F));
+      }
+      else if (code < 0x10000)
+      {
+        text += static_cast<char>(0xE0 | code >> 12);
+        text += static_cast<char>(0x80 | (code >> 6 & 0x3F));
+        text += static_cast<char>(0x80 | (code & 0x3F));
+      }
+      else
+      {
+        text += static_cast<char>(0xF0 | code >> 18);
+        text += static_cast<char>(0x80 | (code >> 12 & 0x3F));
+        text += static_cast<char>(0x80 | (code >> 6 & 0x3F));
+        text += static_cast<char>(0x80 | (code & 0x3F));
+      }
+    }
+
+    bool ParseHex(uint32_t& code)
+    {
+      if (end - p < 4) return Fail("bad escape");
+      code = 0;
+      for (int i = 0; i < 4; ++i, ++p)
+      {
+        char c = *p;
+        uint32_t digit = c >= '0' && c <= '9' ? c - '0' : (c >= 'a' && c <= 'f' ? c - 'a' + 10 :
+                         (c >= 'A' && c <= 'F' ? c - 'A' + 10 : 16u));
+        if (digit > 15) return Fail("bad escape");
+        code = code << 4 | digit;
+      }
+      return true;
+    }
+
+    bool ParseString(std::string& text)
+    {
+      ++p;
+      while (true)
+      {
+        const char* run = p;
+        while (p < end && *p != '"' && *p != '\\') p++;
+        text.append(run, p);
+        if (p >= end) return Fail("unterminated string");
+        if (*p++ == '"') return true;
+
+        if (p >= end) return Fail("unterminated string");
+        switch (*p++)
+        {
+        case '"': text += '"'; break;
+        case '\\': text += '\\'; break;
+        case '/': text += '/'; break;
+        case 'b': text += '\b'; break;
+        case 'f': text += '\f'; break;
+        case 'n': text += '\n'; break;
+        case 'r': text += '\r'; break;
+        case 't': text += '\t'; break;
+        case 'u':
+        {
+          uint32_t code;
+          if (!ParseHex(code)) return false;
+          // surrogate pairs
+          if (code >= 0xD800 && code < 0xDC00 && end - p >= 6 && p[0] == '\\' && p[1] == 'u')
+          {
+            p += 2;
+            uint32_t low;
+            if (!ParseHex(low)) return false;
+            code = 0x10000 + ((code - 0xD800) << 10) + (low - 0xDC00);
+          }
+          AppendUtf8(text, code);
+          break;
+        }
+        default: return Fail("bad escape");
+        }
+      }
+    }
+
+    bool ParseNumber(double& number)
+    {
+      // strtod needs a terminated buffer, numbers are short
+      char buffer[64];
+      size_t length = 0;
+      while (p + length < end && length < sizeof(buffer) - 1 &&
+             std::strchr("+-0123456789.eE", p[length]) != nullptr)
+        length++;
+      if (length == 0) return Fail("unexpected character");
+
+      std::memcpy(buffer, p, length);
+      buffer[length] = '\0';
+      char* parsed_end;
+      number = std::strtod(buffer, &parsed_end);
+      if (parsed_end == buffer) return Fail("bad number");
+      p += parsed_end - buffer;
+      return true;
+    }
+
+    bool ParseValue(JsonValue& value, int depth)
+    {
+      if (depth > max_depth) return Fail("nesting too deep");
+      SkipSpaces();
+      if (p >= end) return Fail("unexpected end");
+
+      switch (*p)
+      {
+      case '{':
+      {
+        value.type = JsonValue::Type::Object;
+        ++p;
+        SkipSpaces();
+        if (p < end && *p == '}')
+        {
+          ++p;
+          return true;
+        }
+        while (true)
+        {
+          SkipSpaces();
+          if (p >= end || *p != '"') return Fail("expected key");
+          value.object.emplace_back();
+          if (!ParseString(value.object.back().first)) return false;
+          SkipSpaces();
+          if (p >= end || *p++ != ':') return Fail("expected ':'");
+          if (!ParseValue(value.object.back().second, depth + 1)) return false;
+          SkipSpaces();
+          if (p < end && *p == ',')
+          {
+            ++p;
+            continue;
+          }
+          if (p < end && *p == '}')
+          {
+            ++p;
+            return true;
+          }
+          return Fail("expected ',' or '}'");
+        }
+      }
+      case '[':
+      {
+        value.type = JsonValue::Type::Array;
+        ++p;
+        SkipSpaces();
+        if (p < end && *p == ']')
+        {
+          ++p;
+          return true;
+        }
+        while (true)
+        {
+          value.array.emplace_back();
+          if (!ParseValue(value.array.back(), depth + 1)) return false;
+          SkipSpaces();
+          if (p < end && *p == ',')
+          {
+            ++p;
+            continue;
+          }
+          if (p < end && *p == ']')
+          {
+            ++p;
+            return true;
+          }
+          return Fail("expected ',' or ']'");
+        }
+      }
+      case '"':
+        value.type = JsonValue::Type::String;
+        return ParseString(value.string);
+      case 't':
+        value.type = JsonValue::Type::Bool;
+        value.boolean = true;
+        return Literal("true");
+      case 'f':
+        value.type = JsonValue::Type::Bool;
+        return Literal("false");
+      case 'n':
+        return Literal("null");
+      default:
+        value.type = JsonValue::Type::Number;
+        return ParseNumber(value.number);
+      }
+    }
+
+    const char* p;
+    const char* begin;
+    const char* end;
+    const char* failure { nullptr };
+  };
+
+  bool JsonValue::Parse(const char* text, size_t size, JsonValue& value, std::string* error)
+  {
+    value = JsonValue {};
+    // a UTF-8 byte order mark is tolerated
+    if (size >= 3 && std::memcmp(text, "\xEF\xBB\xBF", 3) == 0)
+    {
+      text += 3;
+      size -= 3;
+    }
+
+    JsonParser parser(text, size);
+    return parser.ParseDocument(value, error);
+  }
+
+} // namespace PathTracer
@@ -0,0 +1,497 @@
+
+#include <VulkanPT/light_bvh.hpp>
+#include <VulkanPT/accumulation.hpp>
+#include <VulkanPT/debug.hpp>
+#include <VulkanPT/profiler.hpp>
+#include <VulkanPT/scene.hpp>
+#include <algorithm>
+
+namespace PathTracer
+{
+  static constexpr float light_pi = 3.14159265358979f;
+
+  static float SafeSqrt(float value) { return std::sqrt(std::max(value, 0.0f)); }
+  static float SafeAcos(float value) { return std::acos(std::min(std::max(value, -1.0f), 1.0f)); }
+
+  // cos(max(0, a - b)) and sin(max(0, a - b)) from the cosines and sines of a and b
+  static float CosSubClamped(float sin_a, float cos_a, float sin_b, float cos_b)
+  { return cos_a > cos_b ? 1.0f : cos_a * cos_b + sin_a * sin_b; }
+
+  static float SinSubClamped(float sin_a, float cos_a, float sin_b, float cos_b)
+  { return cos_a > cos_b ? 0.0f : sin_a * cos_b - cos_a * sin_b; }
+
+  // Bounds of one light or of a subtree while building, the node without
+  // its links.
+  struct LightBounds
+  {
+    AABB bounds;
+    glm::vec3 axis { 0.0f, 0.0f, 1.0f };
+    float cos_theta_o { 1.0f };
+    float cos_theta_e { 1.0f };
+    float power { 0.0f };
+    bool two_sided { false };
+  };
+
+  static LightBounds BoundLight(const Light& light)
+  {
+    LightBounds result;
+    float luminance = Accumulator::Luminance(light.emission);
+    if (!(luminance > 0.0f)) return result;
+
+    if (light.type == LightType::Point)
+    {
+      result.bounds.Grow(light.position);
+      result.cos_theta_o = -1.0f;
+      result.cos_theta_e = 0.0f;
+      result.power = 4.0f * light_pi * luminance;
+      return result;
+    }
+
+    glm::vec3 normal = glm::cross(light.edge1, light.edge2);
+    float length = glm::length(normal);
+    if (!(length > 0.0f)) return result;
+    result.bounds.Grow(light.position);
+    result.bounds.Grow(light.position + light.edge1);
+    result.bounds.Grow(light.position + light.edge2);
+    result.axis = normal / length;
+    result.cos_theta_o = 1.0f;
+    result.cos_theta_e = 0.0f;
+    result.two_sided = (light.flags & 1) != 0;
+    result.power = luminance * 0.5f * length * light_pi * (result.two_sided ? 2.0f : 1.0f);
+    return result;
+  }
+
+  // Smallest cone around both, the whole sphere when they don't fit into
+  // less than a half angle of pi.
+  static void UnionCone(const glm::vec3& axis_a, float cos_a, const glm::vec3& axis_b, float cos_b,
+                        glm::vec3& axis, float& cos_theta)
+  {
+    float theta_a = SafeAcos(cos_a);
+    float theta_b = SafeAcos(cos_b);
+    float theta_d = SafeAcos(glm::dot(axis_a, axis_b));
+    if (std::min(theta_d + theta_b, light_pi) <= theta_a)
+    {
+      axis = axis_a;
+      cos_theta = cos_a;
+      return;
+    }
+    if (std::min(theta_d + theta_a, light_pi) <= theta_b)
+    {
+      axis = axis_b;
+      cos_theta = cos_b;
+      return;
+    }
+
+    float theta_o = 0.5f * (theta_a + theta_d + theta_b);
+    glm::vec3 rotation_axis = glm::cross(axis_a, axis_b);
+    float rotation_length = glm::length(rotation_axis);
+    if (theta_o >= light_pi || !(rotation_length > 0.0f))
+    {
+      axis = axis_a;
+      cos_theta = -1.0f;
+      return;
+    }
+
+    // rotate axis_a by theta_o - theta_a towards axis_b
+    float theta_r = theta_o - theta_a;
+    rotation_axis /= rotation_length;
+    axis = axis_a * std::cos(theta_r) + glm::cross(rotation_axis, axis_a) * std::sin(theta_r) +
+           rotation_axis * glm::dot(rotation_axis, axis_a) * (1.0f - std::cos(theta_r));
+    axis = glm::normalize(axis);
+    cos_theta = std::cos(theta_o);
+  }
+
+  static LightBounds Union(const LightBounds& a, const LightBounds& b)
+  {
+    if (!(a.power > 0.0f)) return b;
+    if (!(b.power > 0.0f)) return a;
+
+    LightBounds result;
+    result.bounds = a.bounds;
+    result.bounds.Grow(b.bounds);
+    UnionCone(a.axis, a.cos_theta_o, b.axis, b.cos_theta_o, result.axis, result.cos_theta_o);
+    result.cos_theta_e = std::min(a.cos_theta_e, b.cos_theta_e);
+    result.power = a.power + b.power;
+    result.two_sided = a.two_sided || b.two_sided;
+    return result;
+  }
+
+  static void StoreBounds(const LightBounds& bounds, LightBVHNode& node)
+  {
+    node.bounds_min = bounds.bounds.min;
+    node.bounds_max = bounds.bounds.max;
+    node.axis = bounds.axis;
+    node.cos_theta_o = bounds.cos_theta_o;
+    node.cos_theta_e = bounds.cos_theta_e;
+    node.power = bounds.power;
+    node.flags = bounds.two_sided ? 1u : 0u;
+  }
+
+  static LightBounds LoadBounds(const LightBVHNode& node)
+  {
+    LightBounds bounds;
+    bounds.bounds.min = node.bounds_min;
+    bounds.bounds.max = node.bounds_max;
+    bounds.axis = node.axis;
+    bounds.cos_theta_o = node.cos_theta_o;
+    bounds.cos_theta_e = node.cos_theta_e;
+    bounds.power = node.power;
+    bounds.two_sided = (node.flags & 1) != 0;
+    return bounds;
+  }
+
+  // Surface area orientation heuristic: power times the solid angle measure
+  // of the cone times the box area, stretched along thin axes.
+  static float SplitCost(const LightBounds& bounds, float stretch)
+  {
+    if (!(bounds.power > 0.0f)) return 0.0f;
+    float theta_o = SafeAcos(bounds.cos_theta_o);
+    float theta_e = SafeAcos(bounds.cos_theta_e);
+    float theta_w = std::min(theta_o + theta_e, light_pi);
+    float sin_theta_o = SafeSqrt(1.0f - bounds.cos_theta_o * bounds.cos_theta_o);
+    float measure = 2.0f * light_pi * (1.0f - bounds.cos_theta_o) +
+                    0.5f * light_pi * (2.0f * theta_w * sin_theta_o - std::cos(theta_o - 2.0f * theta_w) -
+                                       2.0f * theta_o * sin_theta_o + bounds.cos_theta_o);
+    // points have no area, their count still has to matter
+    float area = std::max(bounds.bounds.Area(), 1e-6f);
+    return bounds.power * measure * stretch * area;
+  }
+
+  float LightImportance(const LightBVHNode& node, const glm::vec3& p, const glm::vec3& n)
+  {
+    if (!(node.power > 0.0f)) return 0.0f;
+
+    glm::vec3 center = (node.bounds_min + node.bounds_max) * 0.5f;
+    glm::vec3 to_point = p - center;
+    float radius_squared = 0.25f * glm::dot(node.bounds_max - node.bounds_min, node.bounds_max - node.bounds_min);
+    float distance_squared = glm::dot(to_point, to_point);
+    // the box as seen from p through its bounding sphere
+    float cos_theta_b = -1.0f;
+    if (distance_squared > radius_squared) cos_theta_b = SafeSqrt(1.0f - radius_squared / distance_squared);
+    float sin_theta_b = SafeSqrt(1.0f - cos_theta_b * cos_theta_b);
+
+    glm::vec3 direction = distance_squared > 0.0f ? to_point / std::sqrt(distance_squared) : glm::vec3(0.0f);
+    float cos_theta_w = glm::dot(node.axis, direction);
+    if (node.flags & 1) cos_theta_w = std::abs(cos_theta_w);
+    float sin_theta_w = SafeSqrt(1.0f - cos_theta_w * cos_theta_w);
+    float sin_theta_o = SafeSqrt(1.0f - node.cos_theta_o * node.cos_theta_o);
+
+    // angle between p and the closest direction of the cone, minus what the box spans
+    float cos_theta_x = CosSubClamped(sin_theta_w, cos_theta_w, sin_theta_o, node.cos_theta_o);
+    float sin_theta_x = SinSubClamped(sin_theta_w, cos_theta_w, sin_theta_o, node.cos_theta_o);
+    float cos_theta = CosSubClamped(sin_theta_x, cos_theta_x, sin_theta_b, cos_theta_b);
+    if (cos_theta <= node.cos_theta_e) return 0.0f;
+
+    // pbrt-v4 clamps by half the diagonal length rather than its square,
+    // which keeps big nodes around p from all looking equally far away
+    float clamped = std::max(distance_squared, std::max(std::sqrt(radius_squared), 1e-8f));
+    float importance = node.power * cos_theta / clamped;
+    if (n != glm::vec3(0.0f))
+    {
+      float cos_theta_i = std::abs(glm::dot(direction, n));
+      float sin_theta_i = SafeSqrt(1.0f - cos_theta_i * cos_theta_i);
+      importance *= CosSubClamped(sin_theta_i, cos_theta_i, sin_theta_b, cos_theta_b);
+    }
+    return std::max(importance, 0.0f);
+  }
+
+  void CollectEmissiveTriangles(const Scene& scene, std::vector<Light>& lights,
+                                std::vector<uint32_t>& triangle_lights)
+  {
+    triangle_lights.assign(scene.TriangleCount(), invalid_index);
+    if (scene.material_indices.size() < scene.TriangleCount()) return;
+
+    for (uint32_t triangle = 0; triangle < scene.TriangleCount(); ++triangle)
+    {
+      uint32_t material = scene.material_indices[triangle];
+      if (material >= scene.materials.size()) continue;
+      // emission textures scale the factor, so it bounds their power
+      const glm::vec3& emission = scene.materials[material].emission;
+      if (!(Accumulator::Luminance(emission) > 0.0f)) continue;
+
+      const glm::vec3& p0 = scene.positions[scene.indices[triangle * 3]];
+      Light light;
+      light.type = LightType::Triangle;
+      light.position = p0;
+      light.edge1 = scene.positions[scene.indices[triangle * 3 + 1]] - p0;
+      light.edge2 = scene.positions[scene.indices[triangle * 3 + 2]] - p0;
+      light.primitive = triangle;
+      light.emission = emission;
+      triangle_lights[triangle] = static_cast<uint32_t>(lights.size());
+      lights.push_back(light);
+    }
+  }
+
+  struct LightPrimitive
+  {
+    LightBounds bounds;
+    glm::vec3 centroid;
+    uint32_t light;
+  };
+
+  struct LightSubtree
+  {
+    uint32_t node;
+    uint32_t begin;
+    uint32_t end;
+  };
+
+  // Splits primitives[begin, end) below node down to single lights. With
+  // deferred set, ranges of at most task_size lights are handed back instead.
+  static void Subdivide(std::vector<LightBVHNode>& nodes, uint32_t node_index, std::vector<LightPrimitive>& primitives,
+                        uint32_t begin, uint32_t end, const LightBVHSettings& settings, uint32_t task_size,
+                        std::vector<LightSubtree>* deferred)
+  {
+    std::vector<LightSubtree> todo = { { node_index, begin, end } };
+    std::vector<LightBounds> bins(settings.bins);
+    std::vector<uint32_t> bin_counts(settings.bins);
+    std::vector<float> right_costs(settings.bins);
+
+    while (!todo.empty())
+    {
+      LightSubtree task = todo.back();
+      todo.pop_back();
+      const uint32_t count = task.end - task.begin;
+
+      LightBounds bounds;
+      AABB centroid_bounds;
+      for (uint32_t i = task.begin; i < task.end; ++i)
+      {
+        bounds = Union(bounds, primitives[i].bounds);
+        centroid_bounds.Grow(primitives[i].centroid);
+      }
+      StoreBounds(bounds, nodes[task.node]);
+
+      if (count == 1)
+      {
+        nodes[task.node].left_first = primitives[task.begin].light;
+        nodes[task.node].count = 1;
+        continue;
+      }
+      if (deferred && count <= task_size)
+      {
+        deferred->push_back(task);
+        continue;
+      }
+
+      float best_cost = infinity;
+      int best_axis = -1;
+      uint32_t best_split = 0;
+      glm::vec3 extent = bounds.bounds.Extent();
+      float max_extent = std::max(extent.x, std::max(extent.y, extent.z));
+      for (int axis = 0; axis < 3; ++axis)
+      {
+        float centroid_extent = centroid_bounds.max[axis] - centroid_bounds.min[axis];
+        if (centroid_extent <= 0.0f) continue;
+
+        std::fill(bins.begin(), bins.end(), LightBounds {});
+        std::fill(bin_counts.begin(), bin_counts.end(), 0u);
+        float scale = static_cast<float>(settings.bins) / centroid_extent;
+        for (uint32_t i = task.begin; i < task.end; ++i)
+        {
+          uint32_t bin = std::min(settings.bins - 1, static_cast<uint32_t>(
+                                  (primitives[i].centroid[axis] - centroid_bounds.min[axis]) * scale));
+          bins[bin] = Union(bins[bin], primitives[i].bounds);
+          bin_counts[bin]++;
+        }
+
+        float stretch = max_extent / std::max(extent[axis], 1e-6f * max_extent);
+        LightBounds right;
+        for (uint32_t bin = settings.bins - 1; bin > 0; --bin)
+        {
+          right = Union(right, bins[bin]);
+          right_costs[bin] = SplitCost(right, stretch);
+        }
+
+        LightBounds left;
+        uint32_t left_count = 0;
+        for (uint32_t split = 1; split < settings.bins; ++split)
+        {
+          left = Union(left, bins[split - 1]);
+          left_count += bin_counts[split - 1];
+          if (left_count == 0 || left_count == count) continue;
+
+          float cost = SplitCost(left, stretch) + right_costs[split];
+          if (cost < best_cost)
+          {
+            best_cost = cost;
+            best_axis = axis;
+            best_split = split;
+          }
+        }
+      }
+
+      uint32_t middle = task.begin + count / 2;
+      if (best_axis >= 0)
+      {
+        float scale = static_cast<float>(settings.bins) /
+                      (centroid_bounds.max[best_axis] - centroid_bounds.min[best_axis]);
+        LightPrimitive* first = primitives.data() + task.begin;
+        middle = static_cast<uint32_t>(std::partition(first, first + count, [&](const LightPrimitive& primitive)
+        {
+          uint32_t bin = std::min(settings.bins - 1, static_cast<uint32_t>(
+                                  (primitive.centroid[best_axis] - centroid_bounds.min[best_axis]) * scale));
+          return bin < best_split;
+        }) - primitives.data());
+      }
+      // lights on one spot, any halving is as good
+      if (middle == task.begin || middle == task.end) middle = task.begin + count / 2;
+
+      uint32_t left_child = static_cast<uint32_t>(nodes.size());
+      nodes.resize(nodes.size() + 2);
+      nodes[task.node].left_first = left_child;
+      nodes[task.node].count = 0;
+      nodes[left_child].parent = task.node;
+      nodes[left_child + 1].parent = task.node;
+      todo.push_back({ left_child + 1, middle, task.end });
+      todo.push_back({ left_child, task.begin, middle });
+    }
+  }
+
+  void LightBVH::Build(const std::vector<Light>& lights, Scheduler& scheduler, LightBVHSettings settings)
+  {
+    Profiler::Scope scope("light_bvh.build");
+    nodes.clear();
+    light_leaves.assign(lights.size(), invalid_index);
+    settings.bins = std::max(settings.bins, 2u);
+
+    std::vector<LightBounds> light_bounds(lights.size());
+    scheduler.ParallelFor(static_cast<uint32_t>(lights.size()), [&](uint32_t light, uint32_t)
+    {
+      light_bounds[light] = BoundLight(lights[light]);
+    });
+
+    std::vector<LightPrimitive> primitives;
+    primitives.reserve(lights.size());
+    for (uint32_t light = 0; light < lights.size(); ++light)
+    {
+      if (light_bounds[light].power > 0.0f)
+        primitives.push_back({ light_bounds[light], light_bounds[light].bounds.Center(), light });
+    }
+    if (primitives.empty()) return;
+
+    const uint32_t count = static_cast<uint32_t>(primitives.size());
+    uint32_t task_size = settings.task_size;
+    if (task_size == 0) task_size = std::max(count / (scheduler.getThreadCount() * 8), 256u);
+
+    // the top of the tree on this thread, the subtrees below task_size in parallel
+    nodes.reserve(static_cast<size_t>(count) * 2);
+    nodes.emplace_back();
+    std::vector<LightSubtree> subtrees;
+    Subdivide(nodes, 0, primitives, 0, count, settings, task_size, &subtrees);
+
+    std::vector<std::vector<LightBVHNode>> subtree_nodes(subtrees.size());
+    scheduler.ParallelFor(static_cast<uint32_t>(subtrees.size()), [&](uint32_t task, uint32_t)
+    {
+      std::vector<LightBVHNode>& local = subtree_nodes[task];
+      local.reserve(static_cast<size_t>(subtrees[task].end - subtrees[task].begin) * 2);
+      local.emplace_back();
+      Subdivide(local, 0, primitives, subtrees[task].begin, subtrees[task].end, settings, 0, nullptr);
+    });
+
+    // local node k > 0 goes to offset + k, the local root replaces its placeholder
+    for (size_t task = 0; task < subtrees.size(); ++task)
+    {
+      std::vector<LightBVHNode>& local = subtree_nodes[task];
+      const uint32_t root = subtrees[task].node;
+      const uint32_t offset = static_cast<uint32_t>(nodes.size()) - 1;
+      auto relocate = [&](uint32_t index) { return index == 0 ? root : index + offset; };
+      for (size_t k = 0; k < local.size(); ++k)
+      {
+        LightBVHNode node = local[k];
+        if (!node.IsLeaf()) node.left_first = relocate(node.left_first);
+        if (k == 0)
+        {
+          node.parent = nodes[root].parent;
+          nodes[root] = node;
+        }
+        else
+        {
+          node.parent = relocate(node.parent);
+          nodes.push_back(node);
+        }
+      }
+      std::vector<LightBVHNode>().swap(local);
+    }
+
+    for (uint32_t node = 0; node < nodes.size(); ++node)
+      if (nodes[node].IsLeaf()) light_leaves[nodes[node].left_first] = node;
+
+    DEBUG_LOG(BVH, "Built light BVH with %zu nodes over %u of %zu lights, %zu parallel subtrees", nodes.size(), count,
+              lights.size(), subtrees.size());
+  }
+
+  void LightBVH::Refit(const std::vector<Light>& lights, Scheduler& scheduler)
+  {
+    Profiler::Scope scope("light_bvh.refit");
+    if (nodes.empty()) return;
+
+    scheduler.ParallelFor(static_cast<uint32_t>(std::min(lights.size(), light_leaves.size())),
+                          [&](uint32_t light, uint32_t)
+    {
+      if (light_leaves[light] != invalid_index) StoreBounds(BoundLight(lights[light]), nodes[light_leaves[light]]);
+    });
+
+    // children always come after their parent
+    for (uint32_t node = static_cast<uint32_t>(nodes.size()); node > 0; --node)
+    {
+      LightBVHNode& parent = nodes[node - 1];
+      if (parent.IsLeaf()) continue;
+      StoreBounds(Union(LoadBounds(nodes[parent.left_first]), LoadBounds(nodes[parent.left_first + 1])), parent);
+    }
+  }
+
+  bool LightBVH::Sample(const glm::vec3& p, const glm::vec3& n, float u, uint32_t& light, float& pmf) const
+  {
+    if (nodes.empty()) return false;
+
+    uint32_t index = 0;
+    pmf = 1.0f;
+    if (nodes[0].IsLeaf() && !(LightImportance(nodes[0], p, n) > 0.0f)) return false;
+    while (!nodes[index].IsLeaf())
+    {
+      const LightBVHNode& node = nodes[index];
+      float left = LightImportance(nodes[node.left_first], p, n);
+      float right = LightImportance(nodes[node.left_first + 1], p, n);
+      if (!(left + right > 0.0f)) return false;
+
+      // the leftover of u picks the next level
+      float p_left = left / (left + right);
+      if (u < p_left)
+      {
+        index = node.left_first;
+        pmf *= p_left;
+        u = std::min(u / p_left, 0.99999994f);
+      }
+      else
+      {
+        index = node.left_first + 1;
+        pmf *= 1.0f - p_left;
+        u = std::min((u - p_left) / (1.0f - p_left), 0.99999994f);
+      }
+    }
+    light = nodes[index].left_first;
+    return true;
+  }
+
+  float LightBVH::Pmf(const glm::vec3& p, const glm::vec3& n, uint32_t light) const
+  {
+    if (light >= light_leaves.size() || light_leaves[light] == invalid_index) return 0.0f;
+
+    uint32_t index = light_leaves[light];
+    if (index == 0) return LightImportance(nodes[0], p, n) > 0.0f ? 1.0f : 0.0f;
+
+    float pmf = 1.0f;
+    while (index != 0)
+    {
+      const LightBVHNode& parent = nodes[nodes[index].parent];
+      float left = LightImportance(nodes[parent.left_first], p, n);
+      float right = LightImportance(nodes[parent.left_first + 1], p, n);
+      if (!(left + right > 0.0f)) return 0.0f;
+      pmf *= (index == parent.left_first ? left : right) / (left + right);
+      index = nodes[index].parent;
+    }
+    return pmf;
+  }
+
+} // namespace PathTracer
@@ -5,6 +5,7 @@
 
 void ApplicationMain()
 {
+  Debug::Configure(getenv("VPT_LOG"));
 
   Application application {};
   application.Init();
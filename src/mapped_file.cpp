@@ -0,0 +1,121 @@
+
+#include <VulkanPT/mapped_file.hpp>
+#include <VulkanPT/debug.hpp>
+#include <VulkanPT/hash.hpp>
+#include <utility>
+
+#if defined(_WIN32)
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace PathTracer
+{
+  MappedFile::~MappedFile()
+  {
+    Close();
+  }
+
+  MappedFile::MappedFile(MappedFile&& other) noexcept
+  {
+    *this = std::move(other);
+  }
+
+  MappedFile& MappedFile::operator=(MappedFile&& other) noexcept
+  {
+    if (this == &other) return *this;
+
+    Close();
+    std::swap(data, other.data);
+    std::swap(size, other.size);
+    std::swap(file, other.file);
+#if defined(_WIN32)
+    std::swap(mapping, other.mapping);
+#endif
+    return *this;
+  }
+
+  bool MappedFile::Open(const std::string& path)
+  {
+    Close();
+
+#if defined(_WIN32)
+    file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+                       FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (file == INVALID_HANDLE_VALUE)
+    {
+      file = nullptr;
+      return false;
+    }
+
+    LARGE_INTEGER file_size;
+    if (!GetFileSizeEx(file, &file_size) || file_size.QuadPart == 0)
+    {
+      Close();
+      return false;
+    }
+
+    mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (mapping) data = static_cast<const uint8_t*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+    if (!data)
+    {
+      DEBUG_ERROR(IO, "Failed to map %s", path.c_str());
+      Close();
+      return false;
+    }
+    size = static_cast<size_t>(file_size.QuadPart);
+#else
+    file = open(path.c_str(), O_RDONLY);
+    if (file < 0) return false;
+
+    struct stat status;
+    if (fstat(file, &status) != 0 || status.st_size == 0)
+    {
+      Close();
+      return false;
+    }
+
+    void* address = mmap(nullptr, static_cast<size_t>(status.st_size), PROT_READ, MAP_PRIVATE, file, 0);
+    if (address == MAP_FAILED)
+    {
+      DEBUG_ERROR(IO, "Failed to map %s", path.c_str());
+      Close();
+      return false;
+    }
+    data = static_cast<const uint8_t*>(address);
+    size = static_cast<size_t>(status.st_size);
+#endif
+
+    return true;
+  }
+
+  void MappedFile::Close()
+  {
+#if defined(_WIN32)
+    if (data) UnmapViewOfFile(data);
+    if (mapping) CloseHandle(mapping);
+    if (file) CloseHandle(file);
+    mapping = nullptr;
+    file = nullptr;
+#else
+    if (data) munmap(const_cast<uint8_t*>(data), size);
+    if (file >= 0) close(file);
+    file = -1;
+#endif
+    data = nullptr;
+    size = 0;
+  }
+
+  uint64_t HashFile(const std::string& path, uint64_t seed)
+  {
+    MappedFile file;
+    if (!file.Open(path)) return 0;
+    return HashBytes(file.getData(), file.getSize(), seed);
+  }
+
+} // namespace PathTracer
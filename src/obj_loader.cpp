@@ -0,0 +1,750 @@
+
+#include <VulkanPT/obj_loader.hpp>
+#include <VulkanPT/debug.hpp>
+#include <VulkanPT/hash.hpp>
+#include <VulkanPT/mapped_file.hpp>
+#include <VulkanPT/profiler.hpp>
+#include <VulkanPT/scene_cache.hpp>
+#include <VulkanPT/texture_compression.hpp>
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstring>
+#include <memory>
+#include <string_view>
+#include <unordered_map>
+
+namespace PathTracer
+{
+  struct ObjCorner
+  {
+    uint32_t position;
+    uint32_t uv;
+    uint32_t normal;
+  };
+
+  // Lines [begin, end) of the file. The counts come from a first pass so
+  // every chunk knows where its attributes land before parsing them.
+  struct ObjChunk
+  {
+    const char* begin { nullptr };
+    const char* end { nullptr };
+    uint32_t position_count { 0 };
+    uint32_t uv_count { 0 };
+    uint32_t normal_count { 0 };
+    uint32_t position_base { 0 };
+    uint32_t uv_base { 0 };
+    uint32_t normal_base { 0 };
+    uint32_t corner_base { 0 };
+    uint32_t skipped_faces { 0 };
+
+    std::vector<ObjCorner> corners;
+    // index into material_names, invalid_index until the chunk's first usemtl
+    std::vector<uint32_t> triangle_materials;
+    std::vector<std::string> material_names;
+    std::vector<std::string> libraries;
+  };
+
+  static bool IsSpace(char c) { return c == ' ' || c == '\t' || c == '\r'; }
+  static bool IsDigit(char c) { return c >= '0' && c <= '9'; }
+
+  static void SkipSpaces(const char*& p, const char* end)
+  {
+    while (p < end && IsSpace(*p)) p++;
+  }
+
+  static const char* LineEnd(const char* p, const char* end)
+  {
+    const void* newline = std::memchr(p, '\n', static_cast<size_t>(end - p));
+    return newline ? static_cast<const char*>(newline) : end;
+  }
+
+  static bool MatchKeyword(const char*& p, const char* end, const char* keyword)
+  {
+    size_t length = std::strlen(keyword);
+    if (static_cast<size_t>(end - p) < length || std::memcmp(p, keyword, length) != 0) return false;
+    if (p + length < end && !IsSpace(p[length])) return false;
+    p += length;
+    return true;
+  }
+
+  // Locale independent and a lot faster than strtof, exact for the usual
+  // handful of significant digits.
+  static float ParseFloat(const char*& p, const char* end)
+  {
+    static const double powers[] = { 1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+                                      1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22 };
+
+    SkipSpaces(p, end);
+    bool negative = false;
+    if (p < end && (*p == '-' || *p == '+')) negative = *p++ == '-';
+
+    uint64_t mantissa = 0;
+    int digits = 0;
+    int exponent = 0;
+    for (; p < end && IsDigit(*p); ++p)
+    {
+      if (digits < 19)
+      {
+        mantissa = mantissa * 10 + static_cast<uint64_t>(*p - '0');
+        digits += mantissa != 0;
+      }
+      else exponent++;
+    }
+
+    if (p < end && *p == '.')
+    {
+      for (++p; p < end && IsDigit(*p); ++p)
+      {
+        if (digits >= 19) continue;
+        mantissa = mantissa * 10 + static_cast<uint64_t>(*p - '0');
+        digits += mantissa != 0;
+        exponent--;
+      }
+    }
+
+    if (p < end && (*p == 'e' || *p == 'E'))
+    {
+      ++p;
+      bool negative_exponent = false;
+      if (p < end && (*p == '-' || *p == '+')) negative_exponent = *p++ == '-';
+      int value = 0;
+      for (; p < end && IsDigit(*p); ++p) value = std::min(value * 10 + (*p - '0'), 1000);
+      exponent += negative_exponent ? -value : value;
+    }
+
+    double result = static_cast<double>(mantissa);
+    if (exponent < 0 && exponent >= -22) result /= powers[-exponent];
+    else if (exponent > 0 && exponent <= 22) result *= powers[exponent];
+    else if (exponent != 0) result *= std::pow(10.0, exponent);
+    return static_cast<float>(negative ? -result : result);
+  }
+
+  static bool ParseInt(const char*& p, const char* end, int64_t& value)
+  {
+    bool negative = false;
+    if (p < end && (*p == '-' || *p == '+')) negative = *p++ == '-';
+    if (p >= end || !IsDigit(*p)) return false;
+
+    value = 0;
+    for (; p < end && IsDigit(*p); ++p) value = std::min<int64_t>(value * 10 + (*p - '0'), 0xFFFFFFFFll);
+    if (negative) value = -value;
+    return true;
+  }
+
+  // Resolves a 1-based or negative (relative) OBJ index against count
+  // attributes seen so far, invalid_index if out of range.
+  static uint32_t ResolveIndex(int64_t index, uint32_t seen, uint32_t total)
+  {
+    int64_t resolved = index > 0 ? index - 1 : static_cast<int64_t>(seen) + index;
+    return resolved >= 0 && resolved < total ? static_cast<uint32_t>(resolved) : invalid_index;
+  }
+
+  static std::string ParseName(const char* p, const char* end)
+  {
+    SkipSpaces(p, end);
+    while (end > p && IsSpace(end[-1])) end--;
+    return std::string(p, end);
+  }
+
+  static std::string Directory(const std::string& path)
+  {
+    size_t slash = path.find_last_of("/\\");
+    return slash == std::string::npos ? std::string() : path.substr(0, slash + 1);
+  }
+
+  static void CountAttributes(ObjChunk& chunk)
+  {
+    for (const char* line = chunk.begin; line < chunk.end;)
+    {
+      const char* end = LineEnd(line, chunk.end);
+      const char* p = line;
+      SkipSpaces(p, end);
+      if (end - p > 1 && p[0] == 'v')
+      {
+        if (IsSpace(p[1])) chunk.position_count++;
+        else if (p[1] == 't' && end - p > 2 && IsSpace(p[2])) chunk.uv_count++;
+        else if (p[1] == 'n' && end - p > 2 && IsSpace(p[2])) chunk.normal_count++;
+      }
+      line = end + 1;
+    }
+  }
+
+  struct ObjAttributes
+  {
+    std::vector<glm::vec3> positions;
+    std::vector<glm::vec2> uvs;
+    std::vector<glm::vec3> normals;
+  };
+
+  static void ParseChunk(ObjChunk& chunk, ObjAttributes& attributes)
+  {
+    uint32_t positions = chunk.position_base;
+    uint32_t uvs = chunk.uv_base;
+    uint32_t normals = chunk.normal_base;
+    uint32_t total_positions = static_cast<uint32_t>(attributes.positions.size());
+    uint32_t total_uvs = static_cast<uint32_t>(attributes.uvs.size());
+    uint32_t total_normals = static_cast<uint32_t>(attributes.normals.size());
+    uint32_t material = invalid_index;
+    std::vector<ObjCorner> polygon;
+
+    for (const char* line = chunk.begin; line < chunk.end;)
+    {
+      const char* end = LineEnd(line, chunk.end);
+      const char* p = line;
+      line = end + 1;
+      SkipSpaces(p, end);
+      if (p >= end || *p == '#') continue;
+
+      if (MatchKeyword(p, end, "v"))
+      {
+        glm::vec3& position = attributes.positions[positions++];
+        for (int axis = 0; axis < 3; ++axis) position[axis] = ParseFloat(p, end);
+      }
+      else if (MatchKeyword(p, end, "vt"))
+      {
+        glm::vec2& uv = attributes.uvs[uvs++];
+        uv.x = ParseFloat(p, end);
+        uv.y = ParseFloat(p, end);
+      }
+      else if (MatchKeyword(p, end, "vn"))
+      {
+        glm::vec3& normal = attributes.normals[normals++];
+        for (int axis = 0; axis < 3; ++axis) normal[axis] = ParseFloat(p, end);
+      }
+      else if (MatchKeyword(p, end, "f"))
+      {
+        polygon.clear();
+        bool valid = true;
+        while (true)
+        {
+          SkipSpaces(p, end);
+          if (p >= end || *p == '#') break;
+
+          ObjCorner corner { invalid_index, invalid_index, invalid_index };
+          int64_t index;
+          if (!ParseInt(p, end, index))
+          {
+            valid = false;
+            break;
+          }
+          corner.position = ResolveIndex(index, positions, total_positions);
+          valid = valid && corner.position != invalid_index;
+
+          if (p < end && *p == '/')
+          {
+            ++p;
+            if (ParseInt(p, end, index))
+            {
+              corner.uv = ResolveIndex(index, uvs, total_uvs);
+              valid = valid && corner.uv != invalid_index;
+            }
+            if (p < end && *p == '/')
+            {
+              ++p;
+              if (ParseInt(p, end, index))
+              {
+                corner.normal = ResolveIndex(index, normals, total_normals);
+                valid = valid && corner.normal != invalid_index;
+              }
+            }
+          }
+          polygon.push_back(corner);
+        }
+
+        if (!valid || polygon.size() < 3)
+        {
+          chunk.skipped_faces++;
+          continue;
+        }
+
+        for (size_t i = 2; i < polygon.size(); ++i)
+        {
+          chunk.corners.insert(chunk.corners.end(), { polygon[0], polygon[i - 1], polygon[i] });
+          chunk.triangle_materials.push_back(material);
+        }
+      }
+      else if (MatchKeyword(p, end, "usemtl"))
+      {
+        material = static_cast<uint32_t>(chunk.material_names.size());
+        chunk.material_names.push_back(ParseName(p, end));
+      }
+      else if (MatchKeyword(p, end, "mtllib"))
+      {
+        // several libraries may share a line, names with spaces are not supported
+        while (true)
+        {
+          SkipSpaces(p, end);
+          const char* name = p;
+          while (p < end && !IsSpace(*p)) p++;
+          if (p == name) break;
+          chunk.libraries.emplace_back(name, p);
+        }
+      }
+    }
+  }
+
+  static int32_t AddTexture(Scene& scene, std::unordered_map<std::string, int32_t>& textures,
+                            const std::string& directory, const char* p, const char* end)
+  {
+    // options like "-bm 1.0" come first, the file name is the last token
+    while (end > p && IsSpace(end[-1])) end--;
+    const char* name = end;
+    while (name > p && !IsSpace(name[-1])) name--;
+    if (name == end) return -1;
+
+    std::string path = directory + std::string(name, end);
+    auto found = textures.find(path);
+    if (found != textures.end()) return found->second;
+
+    int32_t index = static_cast<int32_t>(scene.textures.size());
+    scene.textures.push_back(path);
+    textures.emplace(path, index);
+    return index;
+  }
+
+  static void LoadMtl(const std::string& path, Scene& scene, std::unordered_map<std::string, uint32_t>& names,
+                      std::unordered_map<std::string, int32_t>& textures)
+  {
+    MappedFile file;
+    if (!file.Open(path))
+    {
+      DEBUG_WARNING(IO, "Failed to open material library %s", path.c_str());
+      return;
+    }
+
+    std::string directory = Directory(path);
+    const char* data = reinterpret_cast<const char*>(file.getData());
+    const char* data_end = data + file.getSize();
+    Material* material = nullptr;
+
+    for (const char* line = data; line < data_end;)
+    {
+      const char* end = LineEnd(line, data_end);
+      const char* p = line;
+      line = end + 1;
+      SkipSpaces(p, end);
+      if (p >= end || *p == '#') continue;
+
+      if (MatchKeyword(p, end, "newmtl"))
+      {
+        std::string name = ParseName(p, end);
+        auto found = names.find(name);
+        if (found == names.end())
+        {
+          found = names.emplace(name, static_cast<uint32_t>(scene.materials.size())).first;
+          scene.materials.emplace_back();
+        }
+        material = &scene.materials[found->second];
+        continue;
+      }
+      if (!material) continue;
+
+      if (MatchKeyword(p, end, "Kd"))
+      {
+        for (int channel = 0; channel < 3; ++channel) material->base_color[channel] = ParseFloat(p, end);
+      }
+      else if (MatchKeyword(p, end, "Ke"))
+      {
+        for (int channel = 0; channel < 3; ++channel) material->emission[channel] = ParseFloat(p, end);
+      }
+      else if (MatchKeyword(p, end, "Ns"))
+      {
+        // Blinn-Phong exponent to GGX alpha, roughness is its square root
+        material->roughness = std::pow(2.0f / (std::max(ParseFloat(p, end), 0.0f) + 2.0f), 0.25f);
+      }
+      else if (MatchKeyword(p, end, "Pr")) material->roughness = ParseFloat(p, end);
+      else if (MatchKeyword(p, end, "Pm")) material->metallic = ParseFloat(p, end);
+      else if (MatchKeyword(p, end, "Ni")) material->ior = ParseFloat(p, end);
+      else if (MatchKeyword(p, end, "d")) material->base_color.a = ParseFloat(p, end);
+      else if (MatchKeyword(p, end, "Tr")) material->base_color.a = 1.0f - ParseFloat(p, end);
+      else if (MatchKeyword(p, end, "map_Kd"))
+        material->base_color_texture = AddTexture(scene, textures, directory, p, end);
+      else if (MatchKeyword(p, end, "map_Ke"))
+        material->emission_texture = AddTexture(scene, textures, directory, p, end);
+      else if (MatchKeyword(p, end, "map_Bump") || MatchKeyword(p, end, "map_bump") ||
+               MatchKeyword(p, end, "bump") || MatchKeyword(p, end, "norm"))
+        material->normal_texture = AddTexture(scene, textures, directory, p, end);
+    }
+  }
+
+  // Every position/uv/normal triple in the scene once, shared by all threads
+  // without locks. A slot is claimed with a CAS on its state and keeps the
+  // lowest corner that referenced it, which makes the final vertex order
+  // independent of the thread timing.
+  class VertexTable
+  {
+   public:
+    static constexpr uint32_t empty = 0;
+    static constexpr uint32_t writing = 1;
+    static constexpr uint32_t ready = 2;
+
+    struct Slot
+    {
+      std::atomic<uint32_t> state;
+      uint32_t position;
+      uint32_t uv;
+      uint32_t normal;
+      std::atomic<uint32_t> owner;
+    };
+
+    VertexTable(size_t capacity, Scheduler& scheduler)
+      : slots{ new Slot[capacity] }, mask{ capacity - 1 }, limit{ capacity / 4 * 3 }
+    {
+      const uint32_t block = 1u << 16;
+      scheduler.ParallelFor(static_cast<uint32_t>((capacity + block - 1) / block), [&](uint32_t task, uint32_t)
+      {
+        size_t last = std::min(capacity, static_cast<size_t>(task + 1) * block);
+        for (size_t i = static_cast<size_t>(task) * block; i < last; ++i)
+        {
+          slots[i].state.store(empty, std::memory_order_relaxed);
+          slots[i].owner.store(invalid_index, std::memory_order_relaxed);
+        }
+      });
+    }
+
+    // Returns the slot of corner's key, invalid_index once the table is too full.
+    uint32_t Insert(const ObjCorner& key, uint32_t corner, uint32_t& inserted)
+    {
+      uint64_t hash = HashBytes(&key, sizeof(key));
+      for (size_t probe = 0, i = hash & mask; probe <= mask; ++probe, i = (i + 1) & mask)
+      {
+        Slot& slot = slots[i];
+        uint32_t state = slot.state.load(std::memory_order_acquire);
+        if (state == empty)
+        {
+          if (slot.state.compare_exchange_strong(state, writing, std::memory_order_acq_rel))
+          {
+            slot.position = key.position;
+            slot.uv = key.uv;
+            slot.normal = key.normal;
+            slot.state.store(ready, std::memory_order_release);
+            ClaimOwner(slot, corner);
+
+            // publish the fill level in batches to keep the counter off the hot path
+            if (++inserted == 1024)
+            {
+              if (size.fetch_add(inserted, std::memory_order_relaxed) + inserted > limit)
+                full.store(true, std::memory_order_relaxed);
+              inserted = 0;
+            }
+            return static_cast<uint32_t>(i);
+          }
+        }
+
+        while (state == writing) state = slot.state.load(std::memory_order_acquire);
+        if (slot.position == key.position && slot.uv == key.uv && slot.normal == key.normal)
+        {
+          ClaimOwner(slot, corner);
+          return static_cast<uint32_t>(i);
+        }
+        if (full.load(std::memory_order_relaxed)) break;
+      }
+
+      full.store(true, std::memory_order_relaxed);
+      return invalid_index;
+    }
+
+    bool Full() const { return full.load(std::memory_order_relaxed); }
+    Slot& operator[](uint32_t index) { return slots[index]; }
+
+   private:
+    static void ClaimOwner(Slot& slot, uint32_t corner)
+    {
+      uint32_t owner = slot.owner.load(std::memory_order_relaxed);
+      while (corner < owner && !slot.owner.compare_exchange_weak(owner, corner, std::memory_order_relaxed)) {}
+    }
+
+    std::unique_ptr<Slot[]> slots;
+    size_t mask;
+    size_t limit;
+    std::atomic<size_t> size { 0 };
+    std::atomic<bool> full { false };
+  };
+
+  static size_t NextPowerOfTwo(size_t value)
+  {
+    size_t power = 1024;
+    while (power < value) power *= 2;
+    return power;
+  }
+
+  // Turns the corners into an indexed vertex buffer, parallel over runs of corners.
+  static void BuildVertices(const std::vector<ObjChunk>& chunks, uint32_t corner_count,
+                            const ObjAttributes& attributes, Scene& scene, Scheduler& scheduler)
+  {
+    Profiler::Scope scope("obj.vertices");
+    const uint32_t run = 1u << 16;
+    const uint32_t run_count = (corner_count + run - 1) / run;
+
+    // corners are addressed globally, chunk boundaries don't line up with runs
+    std::vector<const ObjCorner*> corners(corner_count);
+    scheduler.ParallelFor(static_cast<uint32_t>(chunks.size()), [&](uint32_t task, uint32_t)
+    {
+      const ObjChunk& chunk = chunks[task];
+      for (size_t i = 0; i < chunk.corners.size(); ++i) corners[chunk.corner_base + i] = &chunk.corners[i];
+    });
+
+    size_t largest = std::max(attributes.positions.size(), std::max(attributes.uvs.size(), attributes.normals.size()));
+    size_t capacity = NextPowerOfTwo(std::max(largest * 2, static_cast<size_t>(corner_count) / 3));
+    std::unique_ptr<VertexTable> table;
+    std::vector<uint32_t> corner_slots(corner_count);
+    while (true)
+    {
+      table = std::make_unique<VertexTable>(capacity, scheduler);
+      scheduler.ParallelFor(run_count, [&](uint32_t task, uint32_t)
+      {
+        uint32_t inserted = 0;
+        uint32_t last = std::min(corner_count, (task + 1) * run);
+        for (uint32_t corner = task * run; corner < last && !table->Full(); ++corner)
+          corner_slots[corner] = table->Insert(*corners[corner], corner, inserted);
+      });
+
+      if (!table->Full()) break;
+      capacity *= 2;
+      DEBUG_LOG(IO, "Vertex table full, retrying with %zu slots", capacity);
+    }
+
+    // owners are the first corner of each distinct vertex, numbering them in
+    // corner order gives the vertex indices
+    std::vector<uint32_t> run_vertices(run_count + 1, 0);
+    scheduler.ParallelFor(run_count, [&](uint32_t task, uint32_t)
+    {
+      uint32_t last = std::min(corner_count, (task + 1) * run);
+      uint32_t owners = 0;
+      for (uint32_t corner = task * run; corner < last; ++corner)
+        owners += (*table)[corner_slots[corner]].owner.load(std::memory_order_relaxed) == corner;
+      run_vertices[task + 1] = owners;
+    });
+    for (uint32_t i = 0; i < run_count; ++i) run_vertices[i + 1] += run_vertices[i];
+
+    uint32_t vertex_count = run_vertices[run_count];
+    scene.positions.resize(vertex_count);
+    scene.uvs.assign(attributes.uvs.empty() ? 0 : vertex_count, glm::vec2(0.0f));
+    scene.normals.assign(attributes.normals.empty() ? 0 : vertex_count, glm::vec3(0.0f));
+
+    // the owner slot field is reused for the vertex index, only owners write it
+    scheduler.ParallelFor(run_count, [&](uint32_t task, uint32_t)
+    {
+      uint32_t vertex = run_vertices[task];
+      uint32_t last = std::min(corner_count, (task + 1) * run);
+      for (uint32_t corner = task * run; corner < last; ++corner)
+      {
+        VertexTable::Slot& slot = (*table)[corner_slots[corner]];
+        if (slot.owner.load(std::memory_order_relaxed) != corner) continue;
+
+        scene.positions[vertex] = attributes.positions[slot.position];
+        if (slot.uv != invalid_index && !scene.uvs.empty()) scene.uvs[vertex] = attributes.uvs[slot.uv];
+        if (slot.normal != invalid_index && !scene.normals.empty()) scene.normals[vertex] = attributes.normals[slot.normal];
+        slot.owner.store(vertex++, std::memory_order_relaxed);
+      }
+    });
+
+    scene.indices.resize(corner_count);
+    scheduler.ParallelFor(run_count, [&](uint32_t task, uint32_t)
+    {
+      uint32_t last = std::min(corner_count, (task + 1) * run);
+      for (uint32_t corner = task * run; corner < last; ++corner)
+        scene.indices[corner] = (*table)[corner_slots[corner]].owner.load(std::memory_order_relaxed);
+    });
+  }
+
+  // The cache key covers the OBJ, its material libraries and the load options.
+  static uint64_t SourceHash(const MappedFile& file, const std::string& directory, const ObjLoadSettings& settings)
+  {
+    std::string_view text(reinterpret_cast<const char*>(file.getData()), file.getSize());
+    uint64_t hash = HashCombine(HashBytes(text.data(), text.size()), settings.build_bvh);
+    hash = HashCombine(hash, settings.quantize);
+    hash = HashCombine(hash, settings.compress_bvh);
+
+    for (size_t found = text.find("mtllib"); found != std::string_view::npos; found = text.find("mtllib", found + 6))
+    {
+      if (found > 0 && text[found - 1] != '\n') continue;
+      const char* end = LineEnd(text.data() + found, text.data() + text.size());
+      const char* p = text.data() + found + 6;
+      while (true)
+      {
+        SkipSpaces(p, end);
+        const char* name = p;
+        while (p < end && !IsSpace(*p)) p++;
+        if (p == name) break;
+        hash = HashFile(directory + std::string(name, p), hash);
+      }
+    }
+    return hash;
+  }
+
+  // Images are not part of the scene cache, so this also runs after a cache hit.
+  static void LoadImages(const std::string& path, Scene& scene, Scheduler& scheduler, const ObjLoadSettings& settings)
+  {
+    LoadImageFiles(scene.textures, scene.images, scheduler);
+    if (settings.compress_textures)
+    {
+      TextureCompressionSettings compression;
+      if (settings.use_cache)
+      {
+        compression.cache_directory = settings.texture_cache_directory.empty() ? TextureCacheDirectoryFor(path)
+                                                                                : settings.texture_cache_directory;
+      }
+      CompressTextures(scene, scheduler, compression);
+    }
+    else if (settings.mipmaps) scene.GenerateMipmaps(scheduler);
+  }
+
+  bool LoadObj(const std::string& path, Scene& scene, Scheduler& scheduler, const ObjLoadSettings& settings)
+  {
+    Profiler::Scope scope("obj.load");
+
+    MappedFile file;
+    if (!file.Open(path))
+    {
+      DEBUG_ERROR(IO, "Failed to open %s", path.c_str());
+      return false;
+    }
+
+    std::string directory = Directory(path);
+    uint64_t source_hash = 0;
+    if (settings.use_cache)
+    {
+      source_hash = SourceHash(file, directory, settings);
+      // the cache doesn't hold every field, none may survive from an earlier scene
+      scene = Scene {};
+      SceneCache cache;
+      if (cache.Open(SceneCache::PathFor(path), source_hash) && cache.Load(scene))
+      {
+        cache.Stream(settings.stream);
+        if (settings.decode_images) LoadImages(path, scene, scheduler, settings);
+        DEBUG_LOG(IO, "Loaded %s from its scene cache", path.c_str());
+        return true;
+      }
+    }
+
+    const char* data = reinterpret_cast<const char*>(file.getData());
+    const char* data_end = data + file.getSize();
+
+    std::vector<ObjChunk> chunks;
+    size_t chunk_size = std::max<size_t>(settings.chunk_size, 4096);
+    for (const char* begin = data; begin < data_end;)
+    {
+      const char* end = begin + std::min(chunk_size, static_cast<size_t>(data_end - begin));
+      end = end < data_end ? LineEnd(end, data_end) + 1 : data_end;
+      chunks.emplace_back();
+      chunks.back().begin = begin;
+      chunks.back().end = std::min(end, data_end);
+      begin = chunks.back().end;
+    }
+    const uint32_t chunk_count = static_cast<uint32_t>(chunks.size());
+
+    {
+      Profiler::Scope parse_scope("obj.parse");
+      scheduler.ParallelFor(chunk_count, [&](uint32_t task, uint32_t) { CountAttributes(chunks[task]); });
+
+      uint64_t positions = 0, uvs = 0, normals = 0;
+      for (ObjChunk& chunk : chunks)
+      {
+        chunk.position_base = static_cast<uint32_t>(positions);
+        chunk.uv_base = static_cast<uint32_t>(uvs);
+        chunk.normal_base = static_cast<uint32_t>(normals);
+        positions += chunk.position_count;
+        uvs += chunk.uv_count;
+        normals += chunk.normal_count;
+      }
+      if (positions >= invalid_index || uvs >= invalid_index || normals >= invalid_index)
+      {
+        DEBUG_ERROR(IO, "%s has too many vertices", path.c_str());
+        return false;
+      }
+
+      ObjAttributes attributes;
+      attributes.positions.resize(positions);
+      attributes.uvs.resize(uvs);
+      attributes.normals.resize(normals);
+      scheduler.ParallelFor(chunk_count, [&](uint32_t task, uint32_t) { ParseChunk(chunks[task], attributes); });
+
+      uint64_t corners = 0;
+      uint32_t skipped_faces = 0;
+      for (ObjChunk& chunk : chunks)
+      {
+        chunk.corner_base = static_cast<uint32_t>(corners);
+        corners += chunk.corners.size();
+        skipped_faces += chunk.skipped_faces;
+      }
+      if (corners >= invalid_index)
+      {
+        DEBUG_ERROR(IO, "%s has too many faces", path.c_str());
+        return false;
+      }
+      if (skipped_faces > 0) DEBUG_WARNING(IO, "Skipped %u malformed faces in %s", skipped_faces, path.c_str());
+
+      scene = Scene {};
+      BuildVertices(chunks, static_cast<uint32_t>(corners), attributes, scene, scheduler);
+    }
+
+    if (settings.quantize)
+    {
+      QuantizationStats stats = QuantizeScene(scene, scheduler);
+      DEBUG_LOG(IO, "Quantized %s: %llu -> %llu attribute bytes, max error %g position, %g rad normal, %g uv",
+                path.c_str(), static_cast<unsigned long long>(stats.float_bytes),
+                static_cast<unsigned long long>(stats.quantized_bytes), stats.max_position_error,
+                stats.max_normal_error, stats.max_uv_error);
+    }
+    SceneCache::StreamSections(settings.stream, scene, SceneCache::vertex_sections);
+
+    // materials, names that no library defines fall back to a default material
+    std::unordered_map<std::string, uint32_t> material_names;
+    std::unordered_map<std::string, int32_t> textures;
+    for (const ObjChunk& chunk : chunks)
+    {
+      for (const std::string& library : chunk.libraries) LoadMtl(directory + library, scene, material_names, textures);
+    }
+
+    uint32_t default_material = invalid_index;
+    auto resolve = [&](const std::string& name)
+    {
+      auto found = material_names.find(name);
+      if (found != material_names.end()) return found->second;
+      if (default_material == invalid_index)
+      {
+        default_material = static_cast<uint32_t>(scene.materials.size());
+        scene.materials.emplace_back();
+      }
+      if (!name.empty()) DEBUG_WARNING(IO, "Material %s is not defined", name.c_str());
+      material_names.emplace(name, default_material);
+      return default_material;
+    };
+
+    uint32_t current_material = invalid_index;
+    scene.material_indices.resize(scene.indices.size() / 3);
+    for (const ObjChunk& chunk : chunks)
+    {
+      std::vector<uint32_t> chunk_materials(chunk.material_names.size());
+      for (size_t i = 0; i < chunk.material_names.size(); ++i) chunk_materials[i] = resolve(chunk.material_names[i]);
+
+      uint32_t first_triangle = chunk.corner_base / 3;
+      for (size_t i = 0; i < chunk.triangle_materials.size(); ++i)
+      {
+        uint32_t local = chunk.triangle_materials[i];
+        if (local == invalid_index && current_material == invalid_index) current_material = resolve("");
+        scene.material_indices[first_triangle + i] = local == invalid_index ? current_material : chunk_materials[local];
+      }
+      if (!chunk_materials.empty()) current_material = chunk_materials.back();
+    }
+
+    SceneCache::StreamSections(settings.stream, scene, { SceneSection::MaterialIndices, SceneSection::Materials });
+
+    if (settings.build_bvh)
+    {
+      scene.BuildBVH();
+      if (settings.compress_bvh) scene.BuildCompressedBVH();
+      SceneCache::StreamSections(settings.stream, scene, SceneCache::bvh_sections);
+    }
+
+    if (settings.use_cache) SceneCache::Write(SceneCache::PathFor(path), scene, source_hash);
+    if (settings.decode_images) LoadImages(path, scene, scheduler, settings);
+
+    DEBUG_LOG(IO, "Loaded %s: %zu vertices, %u triangles, %zu materials, %zu textures", path.c_str(),
+              scene.positions.size(), scene.TriangleCount(), scene.materials.size(), scene.textures.size());
+    return true;
+  }
+
+} // namespace PathTracer
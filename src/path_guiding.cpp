@@ -0,0 +1,228 @@
+
+#include <VulkanPT/path_guiding.hpp>
+#include <VulkanPT/profiler.hpp>
+
+namespace PathTracer
+{
+  static constexpr float guiding_four_pi = 4.0f * 3.14159265f;
+
+  void DirectionalTree::Record(glm::vec2 point, float value)
+  {
+    if (!(value > 0.0f) || !std::isfinite(value)) return;
+    uint32_t node = 0;
+    for (;;)
+    {
+      const uint32_t bx = point.x >= 0.5f ? 1 : 0, by = point.y >= 0.5f ? 1 : 0;
+      const uint32_t quadrant = bx | (by << 1);
+      point = point * 2.0f - glm::vec2(static_cast<float>(bx), static_cast<float>(by));
+      const uint32_t child = nodes[node].children[quadrant];
+      if (!child)
+      {
+        nodes[node].sums[quadrant].Add(value);
+        return;
+      }
+      node = child;
+    }
+  }
+
+  void DirectionalTree::Build() { Build(0); }
+
+  float DirectionalTree::Build(uint32_t node)
+  {
+    float total = 0.0f;
+    for (int quadrant = 0; quadrant < 4; ++quadrant)
+    {
+      if (nodes[node].children[quadrant]) nodes[node].sums[quadrant].Store(Build(nodes[node].children[quadrant]));
+      total += nodes[node].sums[quadrant].Load();
+    }
+    return total;
+  }
+
+  DirectionalTree DirectionalTree::Refine(float threshold, uint32_t max_depth) const
+  {
+    DirectionalTree result;
+    Refine(0, 0.0f, getTotal(), 1, threshold, max_depth, 0, result.nodes);
+    return result;
+  }
+
+  // source is invalid_index below leaves of the old tree, whose energy is
+  // then taken as spread evenly over the quadrants.
+  void DirectionalTree::Refine(uint32_t source, float energy, float total, uint32_t depth, float threshold,
+                               uint32_t max_depth, uint32_t target, std::vector<DirectionalNode>& refined) const
+  {
+    if (!(total > 0.0f) || depth >= max_depth) return;
+    for (int quadrant = 0; quadrant < 4; ++quadrant)
+    {
+      const float share = source != invalid_index ? nodes[source].sums[quadrant].Load() : energy * 0.25f;
+      if (share <= threshold * total) continue;
+
+      const uint32_t child = static_cast<uint32_t>(refined.size());
+      refined.emplace_back();
+      refined[target].children[quadrant] = child;
+      const uint32_t source_child = source != invalid_index && nodes[source].children[quadrant] ?
+                                    nodes[source].children[quadrant] : invalid_index;
+      Refine(source_child, share, total, depth + 1, threshold, max_depth, child, refined);
+    }
+  }
+
+  glm::vec2 DirectionalTree::Sample(glm::vec2 u, float& pdf) const
+  {
+    pdf = 1.0f;
+    if (!(getTotal() > 0.0f)) return u;
+
+    glm::vec2 origin(0.0f);
+    float size = 1.0f;
+    uint32_t node = 0;
+    for (;;)
+    {
+      float sums[4];
+      for (int quadrant = 0; quadrant < 4; ++quadrant) sums[quadrant] = nodes[node].sums[quadrant].Load();
+      const float node_total = sums[0] + sums[1] + sums[2] + sums[3];
+
+      // pick the half along x, then the quadrant within it, reusing u
+      uint32_t bx = 0, by = 0;
+      const float left = (sums[0] + sums[2]) / node_total;
+      if (u.x < left) u.x /= left;
+      else
+      {
+        u.x = (u.x - left) / (1.0f - left);
+        bx = 1;
+      }
+      const float bottom = sums[bx] / (sums[bx] + sums[bx + 2]);
+      if (u.y < bottom) u.y /= bottom;
+      else
+      {
+        u.y = (u.y - bottom) / (1.0f - bottom);
+        by = 1;
+      }
+      u = glm::min(u, glm::vec2(0.99999994f));
+
+      const uint32_t quadrant = bx | (by << 1);
+      pdf *= 4.0f * sums[quadrant] / node_total;
+      size *= 0.5f;
+      origin += glm::vec2(static_cast<float>(bx), static_cast<float>(by)) * size;
+      if (!nodes[node].children[quadrant]) return origin + u * size;
+      node = nodes[node].children[quadrant];
+    }
+  }
+
+  float DirectionalTree::Pdf(glm::vec2 point) const
+  {
+    if (!(getTotal() > 0.0f)) return 1.0f;
+
+    float pdf = 1.0f;
+    uint32_t node = 0;
+    for (;;)
+    {
+      const uint32_t bx = point.x >= 0.5f ? 1 : 0, by = point.y >= 0.5f ? 1 : 0;
+      const uint32_t quadrant = bx | (by << 1);
+      point = point * 2.0f - glm::vec2(static_cast<float>(bx), static_cast<float>(by));
+      float node_total = 0.0f;
+      for (int i = 0; i < 4; ++i) node_total += nodes[node].sums[i].Load();
+      if (!(node_total > 0.0f)) return 0.0f;
+      pdf *= 4.0f * nodes[node].sums[quadrant].Load() / node_total;
+      if (!nodes[node].children[quadrant]) return pdf;
+      node = nodes[node].children[quadrant];
+    }
+  }
+
+  float DirectionalTree::getTotal() const
+  {
+    float total = 0.0f;
+    for (int quadrant = 0; quadrant < 4; ++quadrant) total += nodes[0].sums[quadrant].Load();
+    return total;
+  }
+
+  PathGuiding::PathGuiding(const AABB& in_bounds, GuidingSettings in_settings)
+    : settings{ in_settings }, nodes(1), leaves(1)
+  {
+    // a cube keeps the cells of alternating splits close to cubes
+    glm::vec3 center = (in_bounds.min + in_bounds.max) * 0.5f;
+    glm::vec3 extent = in_bounds.max - in_bounds.min;
+    float half = std::max(std::max(extent.x, extent.y), std::max(extent.z, 1e-6f)) * 0.5f * 1.001f;
+    bounds.min = center - glm::vec3(half);
+    bounds.max = center + glm::vec3(half);
+  }
+
+  uint32_t PathGuiding::FindLeaf(const glm::vec3& position) const
+  {
+    glm::vec3 p = glm::clamp((position - bounds.min) / (bounds.max - bounds.min), glm::vec3(0.0f), glm::vec3(1.0f));
+    uint32_t node = 0;
+    while (nodes[node].children)
+    {
+      const uint32_t axis = nodes[node].axis;
+      if (p[axis] < 0.5f)
+      {
+        p[axis] *= 2.0f;
+        node = nodes[node].children;
+      }
+      else
+      {
+        p[axis] = p[axis] * 2.0f - 1.0f;
+        node = nodes[node].children + 1;
+      }
+    }
+    return nodes[node].leaf;
+  }
+
+  glm::vec3 PathGuiding::Sample(const glm::vec3& position, const glm::vec2& u, float& pdf) const
+  {
+    glm::vec2 point = leaves[FindLeaf(position)].sampling.Sample(u, pdf);
+    pdf /= guiding_four_pi;
+    return SquareToDirection(point);
+  }
+
+  float PathGuiding::Pdf(const glm::vec3& position, const glm::vec3& direction) const
+  { return leaves[FindLeaf(position)].sampling.Pdf(DirectionToSquare(direction)) / guiding_four_pi; }
+
+  void PathGuiding::Record(const glm::vec3& position, const glm::vec3& direction, float radiance_over_pdf)
+  {
+    Leaf& leaf = leaves[FindLeaf(position)];
+    leaf.samples.fetch_add(1, std::memory_order_relaxed);
+    leaf.building.Record(DirectionToSquare(direction), radiance_over_pdf);
+  }
+
+  void PathGuiding::EndIteration(Scheduler& scheduler)
+  {
+    Profiler::Scope scope("guiding.end_iteration");
+
+    // leaves that saw nothing keep guiding with what they learned before
+    scheduler.ParallelFor(static_cast<uint32_t>(leaves.size()), [&](uint32_t index, uint32_t)
+    {
+      Leaf& leaf = leaves[index];
+      leaf.building.Build();
+      if (leaf.building.getTotal() > 0.0f) leaf.sampling = leaf.building;
+      leaf.building = leaf.sampling.Refine(settings.directional_threshold, settings.max_directional_depth);
+    });
+
+    // both halves inherit the trees and half the samples, and split on while
+    // that is still above the threshold
+    const float threshold = settings.spatial_threshold * std::sqrt(std::pow(2.0f, static_cast<float>(iteration)));
+    for (uint32_t node = 0; node < nodes.size(); ++node)
+    {
+      if (nodes[node].children) continue;
+      const uint32_t samples = leaves[nodes[node].leaf].samples.load();
+      if (samples <= threshold) continue;
+
+      leaves[nodes[node].leaf].samples = samples / 2;
+      Leaf copy = leaves[nodes[node].leaf];
+      leaves.push_back(copy);
+      const uint32_t axis = (nodes[node].axis + 1) % 3;
+      const uint32_t children = static_cast<uint32_t>(nodes.size());
+      nodes.push_back(SpatialNode { 0, axis, nodes[node].leaf });
+      nodes.push_back(SpatialNode { 0, axis, static_cast<uint32_t>(leaves.size() - 1) });
+      nodes[node].children = children;
+    }
+
+    for (Leaf& leaf : leaves) leaf.samples = 0;
+    iteration++;
+  }
+
+  uint32_t PathGuiding::getDirectionalNodeCount() const
+  {
+    uint32_t count = 0;
+    for (const Leaf& leaf : leaves) count += leaf.sampling.getNodeCount();
+    return count;
+  }
+
+} // namespace PathTracer
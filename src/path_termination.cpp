@@ -0,0 +1,129 @@
+
+#include <VulkanPT/path_termination.hpp>
+#include <VulkanPT/debug.hpp>
+#include <VulkanPT/profiler.hpp>
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <string>
+
+namespace PathTracer
+{
+  TerminationDecision DecideTermination(const TerminationSettings& settings, uint32_t depth, float throughput,
+                                        float expected, float pixel, float u)
+  {
+    TerminationDecision decision;
+    const bool past_max = depth >= settings.max_depth;
+    if (depth >= path_depth_limit || (past_max && settings.depth_policy == DepthPolicy::Truncate))
+    {
+      decision.paths = 0;
+      decision.end = PathEnd::Depth;
+      return decision;
+    }
+
+    float survival = 1.0f;
+    if (depth >= settings.min_depth && settings.roulette == RouletteMode::Throughput) survival = throughput;
+    else if (depth >= settings.min_depth && settings.roulette == RouletteMode::Efficiency)
+    {
+      if (expected > 0.0f && pixel > 0.0f)
+      {
+        // the window is centered on contributions equal to the pixel value
+        const float contribution = throughput * expected / pixel;
+        const float lower = 2.0f / (1.0f + settings.window), upper = lower * settings.window;
+        if (contribution < lower) survival = contribution;
+        else if (contribution > upper && !past_max)
+        {
+          decision.paths = std::min(static_cast<uint32_t>(std::ceil(contribution)), std::max(settings.max_split, 1u));
+          decision.weight = 1.0f / static_cast<float>(decision.paths);
+          return decision;
+        }
+      }
+      else survival = throughput;
+    }
+    survival = std::min(std::max(survival, settings.min_survival), 1.0f);
+    if (past_max) survival = std::min(survival, settings.tail_survival);
+    if (!(survival < 1.0f)) return decision;
+
+    if (u >= survival)
+    {
+      decision.paths = 0;
+      decision.end = past_max ? PathEnd::Depth : PathEnd::Roulette;
+    }
+    else decision.weight = 1.0f / survival;
+    return decision;
+  }
+
+  uint64_t PathTotals::Paths() const
+  {
+    uint64_t paths = 0;
+    for (uint64_t count : ends) paths += count;
+    return paths;
+  }
+
+  void PathStatistics::AddPath(uint32_t thread, uint32_t length, PathEnd end)
+  {
+    PathTotals& totals = threads[thread].totals;
+    totals.segments += length;
+    totals.ends[static_cast<uint32_t>(end)]++;
+    totals.lengths[std::min(length, path_length_bins - 1)]++;
+  }
+
+  void PathStatistics::Add(const PathCounters& counters)
+  {
+    PathTotals& totals = threads[0].totals;
+    totals.samples += counters.samples;
+    totals.rays += counters.rays;
+    totals.splits += counters.splits;
+    totals.segments += counters.segments;
+    for (uint32_t i = 0; i < static_cast<uint32_t>(PathEnd::Count); ++i) totals.ends[i] += counters.ends[i];
+    for (uint32_t i = 0; i < path_length_bins; ++i) totals.lengths[i] += counters.lengths[i];
+  }
+
+  PathTotals PathStatistics::Total() const
+  {
+    PathTotals total;
+    for (const Thread& thread : threads)
+    {
+      const PathTotals& totals = thread.totals;
+      total.samples += totals.samples;
+      total.rays += totals.rays;
+      total.splits += totals.splits;
+      total.segments += totals.segments;
+      for (uint32_t i = 0; i < static_cast<uint32_t>(PathEnd::Count); ++i) total.ends[i] += totals.ends[i];
+      for (uint32_t i = 0; i < path_length_bins; ++i) total.lengths[i] += totals.lengths[i];
+    }
+    return total;
+  }
+
+  void PathStatistics::Reset()
+  {
+    for (Thread& thread : threads) thread.totals = PathTotals();
+  }
+
+  void PathStatistics::Report() const
+  {
+    const PathTotals total = Total();
+    const double paths = static_cast<double>(std::max<uint64_t>(total.Paths(), 1));
+    auto share = [&](PathEnd end) { return total.ends[static_cast<uint32_t>(end)] * 100.0 / paths; };
+    DEBUG_LOG(General, "Paths: %llu samples, %.2f rays/sample, mean length %.2f, %llu splits, "
+              "%.1f%% escaped, %.1f%% absorbed, %.1f%% roulette, %.1f%% depth",
+              static_cast<unsigned long long>(total.samples), total.RaysPerSample(), total.MeanLength(),
+              static_cast<unsigned long long>(total.splits), share(PathEnd::Escaped), share(PathEnd::Absorbed),
+              share(PathEnd::Roulette), share(PathEnd::Depth));
+
+    std::string histogram;
+    for (uint32_t i = 0; i < path_length_bins; ++i)
+    {
+      if (!total.lengths[i]) continue;
+      char bin[32];
+      snprintf(bin, sizeof(bin), " %u%s:%.1f%%", i, i + 1 == path_length_bins ? "+" : "",
+               total.lengths[i] * 100.0 / paths);
+      histogram += bin;
+    }
+    DEBUG_LOG(General, "Path lengths:%s", histogram.c_str());
+
+    Profiler::Count("paths.samples", total.samples);
+    Profiler::Count("paths.rays", total.rays);
+  }
+
+} // namespace PathTracer
@@ -0,0 +1,66 @@
+
+#include <VulkanPT/profiler.hpp>
+#include <VulkanPT/debug.hpp>
+#include <map>
+#include <mutex>
+
+struct ProfilerEntry
+{
+  uint64_t count { 0 };
+  uint64_t samples { 0 };
+  double milliseconds { 0.0 };
+};
+
+static std::mutex profiler_mutex;
+static std::map<std::string, ProfilerEntry> profiler_entries;
+
+void Profiler::Count(const std::string& name, uint64_t amount)
+{
+  std::lock_guard<std::mutex> lock(profiler_mutex);
+  profiler_entries[name].count += amount;
+}
+
+void Profiler::AddTime(const std::string& name, double milliseconds)
+{
+  std::lock_guard<std::mutex> lock(profiler_mutex);
+  ProfilerEntry& entry = profiler_entries[name];
+  entry.samples++;
+  entry.milliseconds += milliseconds;
+}
+
+uint64_t Profiler::GetCount(const std::string& name)
+{
+  std::lock_guard<std::mutex> lock(profiler_mutex);
+  auto it = profiler_entries.find(name);
+  return it == profiler_entries.end() ? 0 : it->second.count;
+}
+
+double Profiler::GetTime(const std::string& name)
+{
+  std::lock_guard<std::mutex> lock(profiler_mutex);
+  auto it = profiler_entries.find(name);
+  return it == profiler_entries.end() ? 0.0 : it->second.milliseconds;
+}
+
+void Profiler::Report()
+{
+  std::lock_guard<std::mutex> lock(profiler_mutex);
+  if (profiler_entries.empty()) return;
+
+  DEBUG_LOG(General, "Profiler report:");
+  for (const auto& [name, entry] : profiler_entries)
+  {
+    if (entry.samples > 0)
+      DEBUG_LOG(General, "%s: %.3f ms total, %llu samples, %.3f ms average", name.c_str(),
+                entry.milliseconds, static_cast<unsigned long long>(entry.samples),
+                entry.milliseconds / static_cast<double>(entry.samples));
+    if (entry.count > 0)
+      DEBUG_LOG(General, "%s: %llu", name.c_str(), static_cast<unsigned long long>(entry.count));
+  }
+}
+
+void Profiler::Reset()
+{
+  std::lock_guard<std::mutex> lock(profiler_mutex);
+  profiler_entries.clear();
+}
@@ -0,0 +1,189 @@
+
+#include <VulkanPT/quantize.hpp>
+#include <VulkanPT/profiler.hpp>
+#include <VulkanPT/scene.hpp>
+
+namespace PathTracer
+{
+  static float SignNotZero(float value) { return value >= 0.0f ? 1.0f : -1.0f; }
+
+  static uint32_t PackSnorm(int32_t x, int32_t y)
+  {
+    return static_cast<uint32_t>(static_cast<uint16_t>(static_cast<int16_t>(x))) |
+           static_cast<uint32_t>(static_cast<uint16_t>(static_cast<int16_t>(y))) << 16;
+  }
+
+  uint32_t EncodeOctahedral(const glm::vec3& normal)
+  {
+    float l1 = std::abs(normal.x) + std::abs(normal.y) + std::abs(normal.z);
+    if (!(l1 > 0.0f)) return octahedral_zero;
+
+    glm::vec2 p = glm::vec2(normal.x, normal.y) / l1;
+    if (normal.z < 0.0f)
+      p = glm::vec2((1.0f - std::abs(p.y)) * SignNotZero(p.x), (1.0f - std::abs(p.x)) * SignNotZero(p.y));
+
+    glm::vec3 unit = glm::normalize(normal);
+    int32_t base_x = static_cast<int32_t>(std::floor(p.x * 32767.0f));
+    int32_t base_y = static_cast<int32_t>(std::floor(p.y * 32767.0f));
+    uint32_t best = 0;
+    float best_dot = -2.0f;
+    for (int32_t dy = 0; dy < 2; ++dy)
+    {
+      for (int32_t dx = 0; dx < 2; ++dx)
+      {
+        uint32_t packed = PackSnorm(std::min(std::max(base_x + dx, -32767), 32767),
+                                    std::min(std::max(base_y + dy, -32767), 32767));
+        float dot = glm::dot(DecodeOctahedral(packed), unit);
+        if (dot > best_dot)
+        {
+          best_dot = dot;
+          best = packed;
+        }
+      }
+    }
+    return best;
+  }
+
+  static uint16_t QuantizeUnorm(float value, float offset, float scale)
+  {
+    if (!(scale > 0.0f)) return 0;
+    float q = std::round((value - offset) / scale);
+    return static_cast<uint16_t>(std::min(std::max(q, 0.0f), 65535.0f));
+  }
+
+  QuantizationStats QuantizeScene(Scene& scene, Scheduler& scheduler)
+  {
+    Profiler::Scope scope("quantize");
+
+    QuantizationStats stats;
+    const uint32_t vertex_count = static_cast<uint32_t>(scene.positions.size());
+    const bool has_normals = !scene.normals.empty();
+    const bool has_uvs = !scene.uvs.empty();
+    stats.float_bytes = scene.positions.size() * sizeof(glm::vec3) + scene.normals.size() * sizeof(glm::vec3) +
+                        scene.uvs.size() * sizeof(glm::vec2);
+
+    // one info per block, each block is quantized to its own bounds
+    const uint32_t range = quantization_block_vertices;
+    const uint32_t range_count = (vertex_count + range - 1) / range;
+
+    struct RangeData
+    {
+      AABB bounds;
+      glm::vec2 uv_min { infinity };
+      glm::vec2 uv_max { -infinity };
+      float position_error { 0.0f };
+      float normal_error { 0.0f };
+      float uv_error { 0.0f };
+    };
+    std::vector<RangeData> ranges(range_count);
+    scheduler.ParallelFor(range_count, [&](uint32_t task, uint32_t)
+    {
+      RangeData& data = ranges[task];
+      uint32_t last = std::min(vertex_count, (task + 1) * range);
+      for (uint32_t i = task * range; i < last; ++i)
+      {
+        data.bounds.Grow(scene.positions[i]);
+        if (!has_uvs) continue;
+        data.uv_min = glm::min(data.uv_min, scene.uvs[i]);
+        data.uv_max = glm::max(data.uv_max, scene.uvs[i]);
+      }
+    });
+
+    scene.quantization.assign(range_count, QuantizationInfo {});
+    for (uint32_t block = 0; block < range_count; ++block)
+    {
+      const RangeData& data = ranges[block];
+      QuantizationInfo& info = scene.quantization[block];
+      info.first_vertex = block * range;
+      info.vertex_count = std::min(vertex_count - info.first_vertex, range);
+      if (!data.bounds.Empty())
+      {
+        info.position_offset = data.bounds.min;
+        info.position_scale = data.bounds.Extent() / 65535.0f;
+      }
+      if (has_uvs)
+      {
+        info.uv_offset = data.uv_min;
+        info.uv_scale = (data.uv_max - data.uv_min) / 65535.0f;
+      }
+    }
+
+    scene.quantized_positions.resize(vertex_count);
+    scene.quantized_normals.resize(has_normals ? vertex_count : 0);
+    scene.quantized_uvs.resize(has_uvs ? vertex_count : 0);
+
+    scheduler.ParallelFor(range_count, [&](uint32_t task, uint32_t)
+    {
+      RangeData& data = ranges[task];
+      const QuantizationInfo& info = scene.quantization[task];
+      uint32_t last = std::min(vertex_count, (task + 1) * range);
+      for (uint32_t i = task * range; i < last; ++i)
+      {
+        glm::vec3& position = scene.positions[i];
+        QuantizedPosition& quantized = scene.quantized_positions[i];
+        quantized.x = QuantizeUnorm(position.x, info.position_offset.x, info.position_scale.x);
+        quantized.y = QuantizeUnorm(position.y, info.position_offset.y, info.position_scale.y);
+        quantized.z = QuantizeUnorm(position.z, info.position_offset.z, info.position_scale.z);
+        quantized.w = 0;
+        glm::vec3 decoded = DecodePosition(info, quantized);
+        data.position_error = std::max(data.position_error, glm::length(decoded - position));
+        position = decoded;
+
+        if (has_normals)
+        {
+          glm::vec3& normal = scene.normals[i];
+          uint32_t packed = EncodeOctahedral(normal);
+          glm::vec3 decoded_normal = DecodeOctahedral(packed);
+          if (packed != octahedral_zero)
+          {
+            float cosine = glm::dot(decoded_normal, glm::normalize(normal));
+            data.normal_error = std::max(data.normal_error, std::acos(std::min(std::max(cosine, -1.0f), 1.0f)));
+          }
+          scene.quantized_normals[i] = packed;
+          normal = decoded_normal;
+        }
+
+        if (has_uvs)
+        {
+          glm::vec2& uv = scene.uvs[i];
+          uint32_t packed = QuantizeUnorm(uv.x, info.uv_offset.x, info.uv_scale.x) |
+                            static_cast<uint32_t>(QuantizeUnorm(uv.y, info.uv_offset.y, info.uv_scale.y)) << 16;
+          glm::vec2 decoded_uv = DecodeUV(info, packed);
+          data.uv_error = std::max(data.uv_error, glm::length(decoded_uv - uv));
+          scene.quantized_uvs[i] = packed;
+          uv = decoded_uv;
+        }
+      }
+    });
+
+    for (const RangeData& data : ranges)
+    {
+      stats.max_position_error = std::max(stats.max_position_error, data.position_error);
+      stats.max_normal_error = std::max(stats.max_normal_error, data.normal_error);
+      stats.max_uv_error = std::max(stats.max_uv_error, data.uv_error);
+    }
+    stats.quantized_bytes = scene.quantization.size() * sizeof(QuantizationInfo) +
+                            scene.quantized_positions.size() * sizeof(QuantizedPosition) +
+                            scene.quantized_normals.size() * sizeof(uint32_t) + scene.quantized_uvs.size() * sizeof(uint32_t);
+    return stats;
+  }
+
+  void DequantizeScene(Scene& scene)
+  {
+    Profiler::Scope scope("dequantize");
+
+    const std::vector<QuantizationInfo>& info = scene.quantization;
+    scene.positions.resize(scene.quantized_positions.size());
+    for (size_t i = 0; i < scene.quantized_positions.size(); ++i)
+      scene.positions[i] = DecodePosition(info[i / quantization_block_vertices], scene.quantized_positions[i]);
+
+    scene.normals.resize(scene.quantized_normals.size());
+    for (size_t i = 0; i < scene.quantized_normals.size(); ++i)
+      scene.normals[i] = DecodeOctahedral(scene.quantized_normals[i]);
+
+    scene.uvs.resize(scene.quantized_uvs.size());
+    for (size_t i = 0; i < scene.quantized_uvs.size(); ++i)
+      scene.uvs[i] = DecodeUV(info[i / quantization_block_vertices], scene.quantized_uvs[i]);
+  }
+
+} // namespace PathTracer
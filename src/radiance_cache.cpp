@@ -0,0 +1,146 @@
+
+#include <VulkanPT/radiance_cache.hpp>
+#include <VulkanPT/profiler.hpp>
+#include <VulkanPT/sampler.hpp>
+#include <algorithm>
+#include <cmath>
+
+namespace PathTracer
+{
+  RadianceCache::RadianceCache(RadianceCacheSettings in_settings) : settings{ in_settings }
+  {
+    uint32_t size = 1;
+    while (size < settings.table_size && size < (1u << 30)) size <<= 1;
+    settings.table_size = size;
+    settings.max_probes = std::max(std::min(settings.max_probes, size), 1u);
+    mask = size - 1;
+
+    entries.resize(size);
+    checksums.reset(new std::atomic<uint32_t>[size]);
+    sums.reset(new std::atomic<uint32_t>[static_cast<size_t>(size) * 4]);
+    Clear();
+  }
+
+  void RadianceCache::Clear()
+  {
+    std::fill(entries.begin(), entries.end(), RadianceCacheEntry {});
+    for (uint32_t i = 0; i < settings.table_size; ++i) checksums[i].store(0, std::memory_order_relaxed);
+    for (size_t i = 0; i < static_cast<size_t>(settings.table_size) * 4; ++i)
+      sums[i].store(0, std::memory_order_relaxed);
+    frame = 0;
+  }
+
+  // Two independent PCG chains over the cell, its level and normal bin, the
+  // first picks the slot and the second is stored to recognize the cell.
+  void RadianceCache::Hash(const glm::vec3& position, const glm::vec3& normal, uint32_t& slot,
+                           uint32_t& checksum) const
+  {
+    const float distance = glm::length(position - camera);
+    const uint32_t level = distance > settings.lod_distance ?
+                           std::min(static_cast<uint32_t>(std::ceil(std::log2(distance / settings.lod_distance))),
+                                    15u) : 0;
+    const float size = settings.cell_size * static_cast<float>(1u << level);
+    const glm::vec3 magnitude = glm::abs(normal);
+    const uint32_t axis = magnitude.x > magnitude.y ? (magnitude.x > magnitude.z ? 0 : 2) :
+                                                      (magnitude.y > magnitude.z ? 1 : 2);
+    const uint32_t bin = axis * 2 + (normal[axis] < 0.0f ? 1 : 0);
+
+    uint32_t cell[3];
+    for (int i = 0; i < 3; ++i) cell[i] = static_cast<uint32_t>(static_cast<int32_t>(std::floor(position[i] / size)));
+    slot = PcgHash(cell[0] + PcgHash(cell[1] + PcgHash(cell[2] + PcgHash(level * 8 + bin)))) & mask;
+    checksum = PcgHash(cell[2] ^ PcgHash(cell[1] ^ PcgHash(cell[0] ^ PcgHash(level * 8 + bin + 0x2545F491u))));
+    checksum = std::max(checksum, 1u);
+  }
+
+  bool RadianceCache::Lookup(const glm::vec3& position, const glm::vec3& normal, glm::vec3& radiance) const
+  {
+    uint32_t slot, checksum;
+    Hash(position, normal, slot, checksum);
+    for (uint32_t probe = 0; probe < settings.max_probes; ++probe)
+    {
+      const uint32_t index = (slot + probe) & mask;
+      if (checksums[index].load(std::memory_order_relaxed) != checksum) continue;
+      const RadianceCacheEntry& entry = entries[index];
+      if (entry.sample_count < settings.min_samples) return false;
+      radiance = entry.radiance;
+      return true;
+    }
+    return false;
+  }
+
+  bool RadianceCache::Update(const glm::vec3& position, const glm::vec3& normal, const glm::vec3& radiance)
+  {
+    uint32_t slot, checksum;
+    Hash(position, normal, slot, checksum);
+
+    // the cell's own slot anywhere in the probe window, else the first free
+    // one, which may race with another thread claiming it
+    uint32_t found = invalid_index;
+    for (uint32_t probe = 0; probe < settings.max_probes && found == invalid_index; ++probe)
+    {
+      const uint32_t index = (slot + probe) & mask;
+      if (checksums[index].load(std::memory_order_relaxed) == checksum) found = index;
+    }
+    for (uint32_t probe = 0; probe < settings.max_probes && found == invalid_index; ++probe)
+    {
+      const uint32_t index = (slot + probe) & mask;
+      uint32_t expected = 0;
+      if (checksums[index].compare_exchange_strong(expected, checksum, std::memory_order_relaxed) ||
+          expected == checksum)
+        found = index;
+    }
+    if (found == invalid_index) return false;
+
+    std::atomic<uint32_t>* target = &sums[static_cast<size_t>(found) * 4];
+    for (int channel = 0; channel < 3; ++channel)
+    {
+      const float value = std::min(std::max(radiance[channel], 0.0f), settings.max_radiance);
+      target[channel].fetch_add(static_cast<uint32_t>(value * radiance_cache_scale + 0.5f), std::memory_order_relaxed);
+    }
+    target[3].fetch_add(1, std::memory_order_relaxed);
+    return true;
+  }
+
+  void RadianceCache::EndFrame(Scheduler& scheduler)
+  {
+    Profiler::Scope scope("radiance_cache.end_frame");
+    const uint32_t block = 4096;
+    scheduler.ParallelFor((settings.table_size + block - 1) / block, [&](uint32_t task, uint32_t)
+    {
+      const uint32_t end = std::min((task + 1) * block, settings.table_size);
+      for (uint32_t index = task * block; index < end; ++index)
+      {
+        const uint32_t checksum = checksums[index].load(std::memory_order_relaxed);
+        if (!checksum) continue;
+        RadianceCacheEntry& entry = entries[index];
+        std::atomic<uint32_t>* source = &sums[static_cast<size_t>(index) * 4];
+        const uint32_t count = source[3].exchange(0, std::memory_order_relaxed);
+        if (count)
+        {
+          glm::vec3 mean;
+          for (int channel = 0; channel < 3; ++channel)
+            mean[channel] = source[channel].exchange(0, std::memory_order_relaxed) / (radiance_cache_scale * count);
+          const float samples = static_cast<float>(count);
+          entry.radiance += (mean - entry.radiance) * (samples / (entry.sample_count + samples));
+          entry.sample_count = std::min(entry.sample_count + samples, settings.max_samples);
+          entry.checksum = checksum;
+          entry.last_frame = frame;
+        }
+        else if (frame - entry.last_frame > settings.max_age)
+        {
+          entry = RadianceCacheEntry {};
+          checksums[index].store(0, std::memory_order_relaxed);
+        }
+      }
+    });
+    frame++;
+  }
+
+  uint32_t RadianceCache::getOccupiedSlots() const
+  {
+    uint32_t count = 0;
+    for (uint32_t i = 0; i < settings.table_size; ++i) count += checksums[i].load(std::memory_order_relaxed) ? 1 : 0;
+    return count;
+  }
+
+} // namespace PathTracer
@@ -0,0 +1,283 @@
+
+#include <VulkanPT/restir.hpp>
+#include <VulkanPT/accumulation.hpp>
+#include <VulkanPT/profiler.hpp>
+#include <VulkanPT/sampler.hpp>
+
+namespace PathTracer
+{
+  // PCG stream per pixel, frame and pass, the same on both backends
+  struct PixelRandom
+  {
+    uint32_t state;
+
+    PixelRandom(uint32_t x, uint32_t y, uint32_t frame, uint32_t pass)
+      : state{ PcgHash(x + PcgHash(y + PcgHash(frame * 8 + pass))) } {}
+
+    float Next()
+    {
+      state = PcgHash(state);
+      return UnitFloat(state);
+    }
+  };
+
+  // Uniform point on a triangle from two numbers, points lights ignore them.
+  static glm::vec3 LightPosition(const Light& light, const glm::vec2& uv)
+  {
+    if (light.type == LightType::Point) return light.position;
+    float root = std::sqrt(uv.x);
+    return light.position + light.edge1 * (root * (1.0f - uv.y)) + light.edge2 * (root * uv.y);
+  }
+
+  // Unshadowed light from a point on a light reaching a diffuse surface, in
+  // the area measure of triangle lights.
+  static glm::vec3 Contribution(const ReSTIRSurface& surface, const Light& light, const glm::vec2& uv)
+  {
+    glm::vec3 to_light = LightPosition(light, uv) - surface.position;
+    float distance_squared = glm::dot(to_light, to_light);
+    if (!(distance_squared > 0.0f)) return glm::vec3(0.0f);
+    glm::vec3 direction = to_light / std::sqrt(distance_squared);
+    float cos_surface = glm::dot(surface.normal, direction);
+    if (cos_surface <= 0.0f) return glm::vec3(0.0f);
+    if (light.type == LightType::Point) return light.emission * (cos_surface / distance_squared);
+
+    glm::vec3 normal = glm::normalize(glm::cross(light.edge1, light.edge2));
+    float cos_light = -glm::dot(normal, direction);
+    if (light.flags & 1) cos_light = std::abs(cos_light);
+    if (cos_light <= 0.0f) return glm::vec3(0.0f);
+    return light.emission * (cos_surface * cos_light / distance_squared);
+  }
+
+  static float Target(const ReSTIRSurface& surface, const std::vector<Light>& lights, uint32_t light,
+                      const glm::vec2& uv)
+  {
+    if (!surface.valid || light == invalid_index) return 0.0f;
+    return Accumulator::Luminance(Contribution(surface, lights[light], uv));
+  }
+
+  static bool Visible(const ReSTIRSurface& surface, const Light& light, const glm::vec2& uv, const BVH& bvh)
+  {
+    glm::vec3 to_light = LightPosition(light, uv) - surface.position;
+    float distance = glm::length(to_light);
+    float offset = 1e-4f * std::max(1.0f, glm::length(surface.position));
+    Ray ray;
+    ray.origin = surface.position + surface.normal * offset;
+    ray.direction = to_light / distance;
+    ray.tmin = 0.0f;
+    // stops short of emissive triangles, which are part of the scene
+    ray.tmax = distance * (1.0f - 1e-3f);
+    return !bvh.Occluded(ray);
+  }
+
+  static bool Similar(const ReSTIRSurface& a, const ReSTIRSurface& b, const ReSTIRSettings& settings)
+  {
+    return a.valid && b.valid && glm::dot(a.normal, b.normal) >= settings.normal_threshold &&
+           std::abs(a.depth - b.depth) <= settings.depth_threshold * a.depth;
+  }
+
+  // Weighted reservoir sampling of one more candidate.
+  static void Stream(Reservoir& reservoir, uint32_t light, const glm::vec2& uv, float target, float weight,
+                     PixelRandom& random)
+  {
+    if (!(weight > 0.0f)) return;
+    reservoir.weight_sum += weight;
+    if (random.Next() * reservoir.weight_sum < weight)
+    {
+      reservoir.light = light;
+      reservoir.uv = uv;
+      reservoir.target = target;
+    }
+  }
+
+  // Merges reservoirs of surfaces into one for the first surface. Every
+  // input is weighed by the balance heuristic over the surfaces, its count
+  // times the target at its own surface over the same sum for all of them,
+  // which keeps samples that only one surface could produce from turning
+  // into fireflies. With a bvh the other surfaces only count where they see
+  // the sample, since their reservoirs drop what they can't see, and rays
+  // receives the shadow rays that took.
+  static Reservoir Combine(const Reservoir* const* inputs, const ReSTIRSurface* const* surfaces, uint32_t count,
+                           const std::vector<Light>& lights, const BVH* bvh, uint64_t& rays, PixelRandom& random)
+  {
+    Reservoir result;
+    for (uint32_t i = 0; i < count; ++i)
+    {
+      const Reservoir& input = *inputs[i];
+      result.count += input.count;
+      if (!(input.contribution_weight > 0.0f)) continue;
+      float target = Target(*surfaces[0], lights, input.light, input.uv);
+      if (!(target > 0.0f)) continue;
+
+      float own = 0.0f, sum = 0.0f;
+      for (uint32_t j = 0; j < count; ++j)
+      {
+        float weighted = inputs[j]->count * (j == 0 ? target : Target(*surfaces[j], lights, input.light, input.uv));
+        if (bvh && j != 0 && j != i && weighted > 0.0f)
+        {
+          rays++;
+          if (!Visible(*surfaces[j], lights[input.light], input.uv, *bvh)) weighted = 0.0f;
+        }
+        sum += weighted;
+        if (j == i) own = weighted;
+      }
+      Stream(result, input.light, input.uv, target, own / sum * target * input.contribution_weight, random);
+    }
+    if (result.target > 0.0f) result.contribution_weight = result.weight_sum / result.target;
+    return result;
+  }
+
+  ReSTIRDI::ReSTIRDI(uint32_t in_width, uint32_t in_height, ReSTIRSettings in_settings)
+    : width{ in_width }, height{ in_height }, settings{ in_settings }
+  {
+    const size_t pixels = static_cast<size_t>(width) * height;
+    for (std::vector<Reservoir>& buffer : reservoirs) buffer.resize(pixels);
+    for (std::vector<Reservoir>& buffer : spatial) buffer.resize(pixels);
+  }
+
+  void ReSTIRDI::Reset()
+  {
+    previous_surfaces.clear();
+    frame = 0;
+  }
+
+  void ReSTIRDI::Render(const std::vector<ReSTIRSurface>& surfaces, const std::vector<Light>& lights,
+                        const LightBVH& light_bvh, const BVH& bvh, const ReprojectFunction& reproject,
+                        Scheduler& scheduler, std::vector<glm::vec3>& radiance)
+  {
+    Profiler::Scope scope("restir.render");
+    const uint32_t previous = current;
+    current ^= 1;
+    const bool temporal = settings.temporal_reuse && previous_surfaces.size() == surfaces.size() && reproject;
+    const float candidates = static_cast<float>(settings.initial_candidates);
+    std::vector<uint64_t> row_rays(height, 0);
+
+    // candidates, visibility of the survivor and temporal reuse
+    scheduler.ParallelFor(height, [&](uint32_t y, uint32_t)
+    {
+      for (uint32_t x = 0; x < width; ++x)
+      {
+        const size_t pixel = static_cast<size_t>(y) * width + x;
+        const ReSTIRSurface& surface = surfaces[pixel];
+        Reservoir& output = reservoirs[current][pixel];
+        output = Reservoir {};
+        if (!surface.valid) continue;
+
+        PixelRandom random(x, y, frame, 0);
+        Reservoir initial;
+        for (uint32_t i = 0; i < settings.initial_candidates; ++i)
+        {
+          uint32_t light;
+          float pmf;
+          float u = random.Next();
+          glm::vec2 uv(random.Next(), random.Next());
+          if (!light_bvh.Sample(surface.position, surface.normal, u, light, pmf)) continue;
+
+          float pdf = pmf;
+          if (lights[light].type == LightType::Triangle)
+            pdf /= 0.5f * glm::length(glm::cross(lights[light].edge1, lights[light].edge2));
+          float target = Target(surface, lights, light, uv);
+          Stream(initial, light, uv, target, target / pdf, random);
+        }
+        initial.count = candidates;
+        if (initial.target > 0.0f)
+        {
+          initial.contribution_weight = initial.weight_sum / (candidates * initial.target);
+          row_rays[y]++;
+          if (!Visible(surface, lights[initial.light], initial.uv, bvh)) initial.contribution_weight = 0.0f;
+        }
+
+        uint32_t previous_x, previous_y;
+        if (!temporal || !reproject(x, y, surface, previous_x, previous_y) || previous_x >= width ||
+            previous_y >= height)
+        {
+          output = initial;
+          continue;
+        }
+        const size_t previous_pixel = static_cast<size_t>(previous_y) * width + previous_x;
+        if (!Similar(surface, previous_surfaces[previous_pixel], settings))
+        {
+          output = initial;
+          continue;
+        }
+
+        Reservoir history = reservoirs[previous][previous_pixel];
+        history.count = std::min(history.count, settings.temporal_history * candidates);
+        const Reservoir* inputs[] = { &initial, &history };
+        const ReSTIRSurface* input_surfaces[] = { &surface, &previous_surfaces[previous_pixel] };
+        output = Combine(inputs, input_surfaces, 2, lights, nullptr, row_rays[y], random);
+      }
+    });
+
+    // spatial passes ping-pong between their own buffers, the history only
+    // keeps temporal results so that any bias of reuse between surfaces
+    // doesn't pile up over frames
+    const uint32_t neighbor_limit = std::min(settings.spatial_neighbors, 15u);
+    for (uint32_t pass = 0; pass < settings.spatial_passes; ++pass)
+    {
+      const std::vector<Reservoir>& source = pass == 0 ? reservoirs[current] : spatial[(pass - 1) & 1];
+      std::vector<Reservoir>& target = spatial[pass & 1];
+      scheduler.ParallelFor(height, [&](uint32_t y, uint32_t)
+      {
+        const Reservoir* inputs[16];
+        const ReSTIRSurface* input_surfaces[16];
+        for (uint32_t x = 0; x < width; ++x)
+        {
+          const size_t pixel = static_cast<size_t>(y) * width + x;
+          const ReSTIRSurface& surface = surfaces[pixel];
+          if (!surface.valid)
+          {
+            target[pixel] = Reservoir {};
+            continue;
+          }
+
+          PixelRandom random(x, y, frame, pass + 1);
+          uint32_t count = 0;
+          inputs[count] = &source[pixel];
+          input_surfaces[count++] = &surface;
+          for (uint32_t i = 0; i < neighbor_limit; ++i)
+          {
+            float angle = random.Next() * 6.28318531f;
+            float radius = std::sqrt(random.Next()) * settings.spatial_radius;
+            int64_t nx = static_cast<int64_t>(x) + static_cast<int64_t>(std::lround(std::cos(angle) * radius));
+            int64_t ny = static_cast<int64_t>(y) + static_cast<int64_t>(std::lround(std::sin(angle) * radius));
+            if (nx < 0 || ny < 0 || nx >= width || ny >= height || (nx == x && ny == y)) continue;
+            const size_t neighbor = static_cast<size_t>(ny) * width + static_cast<size_t>(nx);
+            if (!Similar(surface, surfaces[neighbor], settings)) continue;
+            inputs[count] = &source[neighbor];
+            input_surfaces[count++] = &surfaces[neighbor];
+          }
+          target[pixel] = Combine(inputs, input_surfaces, count, lights, settings.spatial_visibility ? &bvh : nullptr,
+                                  row_rays[y], random);
+        }
+      });
+    }
+
+    // shading with one more shadow ray for the final sample, which also
+    // drops samples that became occluded since they were reused
+    std::vector<Reservoir>& shaded = settings.spatial_passes ? spatial[(settings.spatial_passes - 1) & 1] :
+                                                               reservoirs[current];
+    radiance.assign(surfaces.size(), glm::vec3(0.0f));
+    scheduler.ParallelFor(height, [&](uint32_t y, uint32_t)
+    {
+      for (uint32_t x = 0; x < width; ++x)
+      {
+        const size_t pixel = static_cast<size_t>(y) * width + x;
+        Reservoir& reservoir = shaded[pixel];
+        if (!surfaces[pixel].valid || !(reservoir.contribution_weight > 0.0f)) continue;
+        row_rays[y]++;
+        if (!Visible(surfaces[pixel], lights[reservoir.light], reservoir.uv, bvh))
+        {
+          reservoir.contribution_weight = 0.0f;
+          continue;
+        }
+        radiance[pixel] = Contribution(surfaces[pixel], lights[reservoir.light], reservoir.uv) *
+                          reservoir.contribution_weight;
+      }
+    });
+
+    for (uint64_t rays : row_rays) shadow_rays += rays;
+    previous_surfaces = surfaces;
+    frame++;
+  }
+
+} // namespace PathTracer
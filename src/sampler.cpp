@@ -0,0 +1,170 @@
+
+#include <VulkanPT/sampler.hpp>
+#include <VulkanPT/profiler.hpp>
+#include <algorithm>
+#include <cmath>
+
+namespace PathTracer
+{
+  // Degree s of the primitive polynomial, its inner coefficients a and the
+  // initial direction numbers m, from new-joe-kuo-6.21201. The first
+  // dimension is the van der Corput sequence and has no entry.
+  struct SobolPolynomial
+  {
+    uint32_t degree;
+    uint32_t coefficients;
+    uint32_t initial[6];
+  };
+
+  static const SobolPolynomial sobol_polynomials[sobol_dimensions - 1] =
+  {
+    { 1, 0, { 1 } },
+    { 2, 1, { 1, 3 } },
+    { 3, 1, { 1, 3, 1 } },
+  };
+
+  void BuildSobolMatrices(std::vector<uint32_t>& matrices)
+  {
+    matrices.assign(sobol_dimensions * 32, 0);
+    for (uint32_t bit = 0; bit < 32; ++bit) matrices[bit] = 1u << (31 - bit);
+
+    for (uint32_t dimension = 1; dimension < sobol_dimensions; ++dimension)
+    {
+      const SobolPolynomial& polynomial = sobol_polynomials[dimension - 1];
+      const uint32_t s = polynomial.degree;
+      uint32_t* columns = &matrices[dimension * 32];
+      for (uint32_t bit = 0; bit < 32; ++bit)
+      {
+        if (bit < s)
+        {
+          columns[bit] = polynomial.initial[bit] << (31 - bit);
+          continue;
+        }
+        // the recurrence of the polynomial on the direction numbers
+        uint32_t column = columns[bit - s] ^ (columns[bit - s] >> s);
+        for (uint32_t k = 1; k < s; ++k)
+        {
+          if ((polynomial.coefficients >> (s - 1 - k)) & 1) column ^= columns[bit - k];
+        }
+        columns[bit] = column;
+      }
+    }
+  }
+
+  void BuildBlueNoise(uint32_t size, uint32_t seed, std::vector<uint32_t>& ranks)
+  {
+    Profiler::Scope scope("sampler.blue_noise");
+    const uint32_t count = size * size;
+    ranks.assign(count, 0);
+    if (count == 0) return;
+
+    // toroidal Gaussian, sigma 1.5 as in the paper
+    std::vector<float> kernel(count);
+    for (uint32_t y = 0; y < size; ++y)
+    {
+      for (uint32_t x = 0; x < size; ++x)
+      {
+        float dx = static_cast<float>(std::min(x, size - x));
+        float dy = static_cast<float>(std::min(y, size - y));
+        kernel[y * size + x] = std::exp(-(dx * dx + dy * dy) / (2.0f * 1.5f * 1.5f));
+      }
+    }
+
+    std::vector<uint8_t> pattern(count, 0);
+    std::vector<float> energy(count, 0.0f);
+    auto toggle = [&](uint32_t texel, float sign)
+    {
+      pattern[texel] = sign > 0.0f ? 1 : 0;
+      const uint32_t tx = texel % size, ty = texel / size;
+      for (uint32_t y = 0; y < size; ++y)
+      {
+        const float* row = &kernel[((y + size - ty) % size) * size];
+        float* target = &energy[y * size];
+        for (uint32_t x = 0; x < size; ++x) target[x] += sign * row[(x + size - tx) % size];
+      }
+    };
+    // densest minority texel, or emptiest majority texel
+    auto tightest_cluster = [&]()
+    {
+      uint32_t best = 0;
+      float best_energy = -1.0f;
+      for (uint32_t i = 0; i < count; ++i)
+      {
+        if (pattern[i] && energy[i] > best_energy)
+        {
+          best = i;
+          best_energy = energy[i];
+        }
+      }
+      return best;
+    };
+    auto largest_void = [&]()
+    {
+      uint32_t best = 0;
+      float best_energy = INFINITY;
+      for (uint32_t i = 0; i < count; ++i)
+      {
+        if (!pattern[i] && energy[i] < best_energy)
+        {
+          best = i;
+          best_energy = energy[i];
+        }
+      }
+      return best;
+    };
+
+    // random initial pattern of a tenth of the texels, then swap clusters
+    // into voids until it is even
+    const uint32_t initial_count = std::max(count / 10, 1u);
+    uint32_t state = PcgHash(seed);
+    for (uint32_t placed = 0; placed < initial_count;)
+    {
+      state = PcgHash(state);
+      uint32_t texel = state % count;
+      if (pattern[texel]) continue;
+      toggle(texel, 1.0f);
+      placed++;
+    }
+    for (uint32_t i = 0; i < count; ++i)
+    {
+      uint32_t cluster = tightest_cluster();
+      toggle(cluster, -1.0f);
+      uint32_t hole = largest_void();
+      toggle(hole, 1.0f);
+      if (hole == cluster) break;
+    }
+
+    // ranks below the initial pattern come from taking clusters away, ranks
+    // above from filling voids. Past half the texels the zeros are the
+    // minority and their tightest cluster is the largest void of the ones.
+    std::vector<uint8_t> initial_pattern = pattern;
+    std::vector<float> initial_energy = energy;
+    std::vector<uint32_t> order(count);
+    for (uint32_t rank = initial_count; rank-- > 0;)
+    {
+      uint32_t cluster = tightest_cluster();
+      toggle(cluster, -1.0f);
+      order[cluster] = rank;
+    }
+    pattern = std::move(initial_pattern);
+    energy = std::move(initial_energy);
+    for (uint32_t rank = initial_count; rank < count; ++rank)
+    {
+      uint32_t hole = largest_void();
+      toggle(hole, 1.0f);
+      order[hole] = rank;
+    }
+
+    for (uint32_t i = 0; i < count; ++i)
+      ranks[i] = static_cast<uint32_t>(((static_cast<uint64_t>(order[i]) << 32) + (1ull << 31)) / count);
+  }
+
+  void SamplerTables::Build(uint32_t in_blue_noise_size, uint32_t seed)
+  {
+    Profiler::Scope scope("sampler.build");
+    BuildSobolMatrices(sobol);
+    blue_noise_size = in_blue_noise_size;
+    BuildBlueNoise(blue_noise_size, seed, blue_noise);
+  }
+
+} // namespace PathTracer
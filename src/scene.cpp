@@ -0,0 +1,88 @@
+
+#include <VulkanPT/scene.hpp>
+#include <VulkanPT/profiler.hpp>
+
+namespace PathTracer
+{
+  SurfacePoint Scene::Interpolate(const Hit& hit, bool decode_quantized) const
+  {
+    SurfacePoint point;
+    if (!hit.Valid()) return point;
+
+    const uint32_t* corners = &indices[static_cast<size_t>(hit.primitive) * 3];
+    const float weights[3] = { 1.0f - hit.u - hit.v, hit.u, hit.v };
+    const bool decode = decode_quantized && Quantized();
+
+    glm::vec3 corner_positions[3];
+    glm::vec3 corner_normals[3];
+    glm::vec2 corner_uvs[3];
+    for (int i = 0; i < 3; ++i)
+    {
+      uint32_t vertex = corners[i];
+      const QuantizationInfo* info = decode ? &quantization[vertex / quantization_block_vertices] : nullptr;
+      corner_positions[i] = decode ? DecodePosition(*info, quantized_positions[vertex]) : positions[vertex];
+      point.position += weights[i] * corner_positions[i];
+      if (!normals.empty())
+      {
+        corner_normals[i] = decode ? DecodeOctahedral(quantized_normals[vertex]) : normals[vertex];
+        point.normal += weights[i] * corner_normals[i];
+      }
+      if (!uvs.empty())
+      {
+        corner_uvs[i] = decode ? DecodeUV(*info, quantized_uvs[vertex]) : uvs[vertex];
+        point.uv += weights[i] * corner_uvs[i];
+      }
+    }
+
+    float length = glm::length(point.normal);
+    if (length > 0.0f) point.normal /= length;
+
+    glm::vec3 cross = glm::cross(corner_positions[1] - corner_positions[0], corner_positions[2] - corner_positions[0]);
+    float world_area = glm::length(cross);
+    if (world_area > 0.0f) point.geometric_normal = cross / world_area;
+
+    if (!uvs.empty())
+    {
+      glm::vec2 du = corner_uvs[1] - corner_uvs[0];
+      glm::vec2 dv = corner_uvs[2] - corner_uvs[0];
+      float uv_area = std::abs(du.x * dv.y - du.y * dv.x);
+      if (uv_area > 0.0f && world_area > 0.0f) point.uv_density = 0.5f * std::log2(uv_area / world_area);
+    }
+
+    // how fast the shading normal turns along the edges, averaged
+    if (!normals.empty())
+    {
+      for (int i = 0; i < 3; ++i)
+      {
+        int j = i < 2 ? i + 1 : 0;
+        glm::vec3 edge = corner_positions[j] - corner_positions[i];
+        float edge_length = glm::dot(edge, edge);
+        if (edge_length > 0.0f) point.curvature += glm::dot(corner_normals[j] - corner_normals[i], edge) / edge_length;
+      }
+      point.curvature /= 3.0f;
+    }
+
+    if (hit.primitive < material_indices.size()) point.material = material_indices[hit.primitive];
+    return point;
+  }
+
+  void Scene::GenerateMipmaps(Scheduler& scheduler)
+  {
+    Profiler::Scope scope("scene.mipmaps");
+
+    std::vector<uint8_t> srgb(images.size(), 0);
+    for (const Material& material : materials)
+    {
+      for (int32_t texture : { material.base_color_texture, material.emission_texture })
+        if (texture >= 0 && static_cast<size_t>(texture) < srgb.size()) srgb[texture] = 1;
+    }
+
+    mip_chains.assign(images.size(), Texture {});
+    scheduler.ParallelFor(static_cast<uint32_t>(images.size()), [&](uint32_t task, uint32_t)
+    {
+      PathTracer::GenerateMipmaps(std::move(images[task]), srgb[task] != 0, mip_chains[task]);
+      images[task] = Image {};
+    });
+  }
+
+} // namespace PathTracer
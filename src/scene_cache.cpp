@@ -0,0 +1,277 @@
+
+#include <VulkanPT/scene_cache.hpp>
+#include <VulkanPT/debug.hpp>
+#include <VulkanPT/hash.hpp>
+#include <VulkanPT/profiler.hpp>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+
+namespace PathTracer
+{
+  static const char scene_magic[8] = { 'V', 'P', 'T', 'S', 'C', 'E', 'N', 'E' };
+
+  static uint64_t KernelHash()
+  { return HashBytes(DefaultTriangleKernel::name, std::strlen(DefaultTriangleKernel::name)); }
+
+  static uint64_t AlignUp(uint64_t value)
+  { return (value + SceneCache::alignment - 1) & ~(SceneCache::alignment - 1); }
+
+  constexpr uint32_t section_count = static_cast<uint32_t>(SceneSection::Count);
+
+  struct SectionSource
+  {
+    const void* data;
+    uint32_t stride;
+    uint64_t count;
+  };
+
+  // What a scene stores in every section, textures receives the path blob.
+  // Quantized scenes store only the 16-bit attributes, Load decodes them again.
+  static void GetSources(const Scene& scene, std::vector<char>& textures, SectionSource* sources)
+  {
+    textures.clear();
+    for (const std::string& texture : scene.textures)
+      textures.insert(textures.end(), texture.c_str(), texture.c_str() + texture.size() + 1);
+
+    const std::vector<BVHNode>& nodes = scene.bvh.getNodes();
+    const auto& blocks = scene.bvh.getBlocks();
+    const std::vector<CompressedBVHNode>& compressed_nodes = scene.compressed_bvh.getNodes();
+    const auto& compressed_blocks = scene.compressed_bvh.getBlocks();
+    const bool quantized = scene.Quantized();
+    const SectionSource table[] = {
+      { scene.positions.data(), sizeof(glm::vec3), quantized ? 0 : scene.positions.size() },
+      { scene.normals.data(), sizeof(glm::vec3), quantized ? 0 : scene.normals.size() },
+      { scene.uvs.data(), sizeof(glm::vec2), quantized ? 0 : scene.uvs.size() },
+      { scene.indices.data(), sizeof(uint32_t), scene.indices.size() },
+      { scene.material_indices.data(), sizeof(uint32_t), scene.material_indices.size() },
+      { scene.materials.data(), sizeof(Material), scene.materials.size() },
+      { nodes.data(), sizeof(BVHNode), nodes.size() },
+      { blocks.data(), sizeof(blocks[0]), blocks.size() },
+      { compressed_nodes.data(), sizeof(CompressedBVHNode), compressed_nodes.size() },
+      { compressed_blocks.data(), sizeof(compressed_blocks[0]), compressed_blocks.size() },
+      { scene.instances.data(), sizeof(Instance), scene.instances.size() },
+      { scene.quantization.data(), sizeof(QuantizationInfo), quantized ? scene.quantization.size() : 0 },
+      { scene.quantized_positions.data(), sizeof(QuantizedPosition), scene.quantized_positions.size() },
+      { scene.quantized_normals.data(), sizeof(uint32_t), scene.quantized_normals.size() },
+      { scene.quantized_uvs.data(), sizeof(uint32_t), scene.quantized_uvs.size() },
+      { textures.data(), 1, textures.size() }
+    };
+    static_assert(sizeof(table) / sizeof(table[0]) == section_count, "Missing scene cache section");
+    std::copy(std::begin(table), std::end(table), sources);
+  }
+
+  bool SceneCache::Write(const std::string& path, const Scene& scene, uint64_t source_hash)
+  {
+    Profiler::Scope scope("scene_cache.write");
+
+    std::vector<char> textures;
+    SectionSource sources[section_count];
+    GetSources(scene, textures, sources);
+
+    SceneCacheSection sections[section_count];
+    uint64_t offset = AlignUp(sizeof(SceneCacheHeader) + sizeof(sections));
+    for (uint32_t i = 0; i < section_count; ++i)
+    {
+      sections[i] = { i, sources[i].stride, offset, sources[i].count };
+      offset = AlignUp(offset + sources[i].stride * sources[i].count);
+    }
+
+    SceneCacheHeader header {};
+    std::memcpy(header.magic, scene_magic, sizeof(scene_magic));
+    header.version = version;
+    header.section_count = section_count;
+    header.source_hash = source_hash;
+    header.file_size = offset;
+    header.kernel_hash = KernelHash();
+    header.block_width = triangle_block_width;
+
+    std::string temporary_path = path + ".tmp";
+    FILE* output = std::fopen(temporary_path.c_str(), "wb");
+    if (!output)
+    {
+      DEBUG_ERROR(IO, "Failed to create scene cache %s", temporary_path.c_str());
+      return false;
+    }
+
+    static const char padding[alignment] = {};
+    uint64_t written = 0;
+    auto write = [&](const void* data, uint64_t size)
+    {
+      if (size > 0 && std::fwrite(data, 1, size, output) != size) return false;
+      written += size;
+      return true;
+    };
+
+    bool success = write(&header, sizeof(header)) && write(sections, sizeof(sections));
+    for (uint32_t i = 0; success && i < section_count; ++i)
+    {
+      success = write(padding, sections[i].offset - written) &&
+                write(sources[i].data, sources[i].stride * sources[i].count);
+    }
+    success = success && write(padding, header.file_size - written);
+    success = std::fclose(output) == 0 && success;
+
+    std::error_code error;
+    if (success) std::filesystem::rename(temporary_path, path, error);
+    if (!success || error)
+    {
+      DEBUG_ERROR(IO, "Failed to write scene cache %s", path.c_str());
+      std::filesystem::remove(temporary_path, error);
+      return false;
+    }
+
+    DEBUG_LOG(IO, "Wrote scene cache %s (%llu bytes)", path.c_str(), static_cast<unsigned long long>(header.file_size));
+    return true;
+  }
+
+  bool SceneCache::Open(const std::string& path, uint64_t source_hash)
+  {
+    Close();
+    if (!file.Open(path)) return false;
+
+    constexpr uint32_t section_count = static_cast<uint32_t>(SceneSection::Count);
+    const char* reason = nullptr;
+    SceneCacheHeader header;
+    if (file.getSize() < sizeof(header) + sizeof(sections)) reason = "truncated header";
+    else
+    {
+      std::memcpy(&header, file.getData(), sizeof(header));
+      if (std::memcmp(header.magic, scene_magic, sizeof(scene_magic)) != 0) reason = "not a scene cache";
+      else if (header.version != version) reason = "old version";
+      else if (header.source_hash != source_hash) reason = "source changed";
+      else if (header.kernel_hash != KernelHash() || header.block_width != triangle_block_width)
+        reason = "different triangle kernel";
+      else if (header.section_count != section_count || header.file_size != file.getSize())
+        reason = "truncated";
+    }
+
+    if (!reason)
+    {
+      std::memcpy(sections, file.getData() + sizeof(header), sizeof(sections));
+      for (uint32_t i = 0; i < section_count && !reason; ++i)
+      {
+        const SceneCacheSection& section = sections[i];
+        // divided rather than multiplied, stride * count can wrap
+        if (section.type != i || section.offset % alignment != 0 || section.offset > file.getSize() ||
+            (section.count > 0 && (section.stride == 0 ||
+                                   section.count > (file.getSize() - section.offset) / section.stride)))
+          reason = "bad section table";
+      }
+    }
+
+    if (reason)
+    {
+      DEBUG_LOG(IO, "Ignoring scene cache %s: %s", path.c_str(), reason);
+      Close();
+      return false;
+    }
+
+    return true;
+  }
+
+  template <typename T>
+  static void CopySection(const SceneCache& cache, SceneSection type, std::vector<T>& target)
+  {
+    ArrayView<T> view = cache.getSection<T>(type);
+    target.assign(view.begin(), view.end());
+  }
+
+  bool SceneCache::Load(Scene& scene) const
+  {
+    if (!file.IsOpen()) return false;
+    Profiler::Scope scope("scene_cache.load");
+
+    CopySection(*this, SceneSection::Positions, scene.positions);
+    CopySection(*this, SceneSection::Normals, scene.normals);
+    CopySection(*this, SceneSection::UVs, scene.uvs);
+    CopySection(*this, SceneSection::Indices, scene.indices);
+    CopySection(*this, SceneSection::MaterialIndices, scene.material_indices);
+    CopySection(*this, SceneSection::Materials, scene.materials);
+    CopySection(*this, SceneSection::Instances, scene.instances);
+    CopySection(*this, SceneSection::QuantizedPositions, scene.quantized_positions);
+    CopySection(*this, SceneSection::QuantizedNormals, scene.quantized_normals);
+    CopySection(*this, SceneSection::QuantizedUVs, scene.quantized_uvs);
+    CopySection(*this, SceneSection::Quantization, scene.quantization);
+    // without an info for every block the positions stay empty and the
+    // index check below rejects the file
+    const size_t quantization_blocks =
+      (scene.quantized_positions.size() + quantization_block_vertices - 1) / quantization_block_vertices;
+    if (scene.Quantized() && scene.quantization.size() == quantization_blocks) DequantizeScene(scene);
+
+    ArrayView<BVHNode> nodes = getSection<BVHNode>(SceneSection::BVHNodes);
+    ArrayView<TriangleBlock<triangle_block_width>> blocks =
+      getSection<TriangleBlock<triangle_block_width>>(SceneSection::TriangleBlocks);
+    scene.bvh.Assign(nodes.data, nodes.count, blocks.data, blocks.count);
+    ArrayView<CompressedBVHNode> compressed_nodes = getSection<CompressedBVHNode>(SceneSection::CompressedBVHNodes);
+    ArrayView<TriangleBlock<triangle_block_width>> compressed_blocks =
+      getSection<TriangleBlock<triangle_block_width>>(SceneSection::CompressedTriangleBlocks);
+    scene.compressed_bvh.Assign(compressed_nodes.data, compressed_nodes.count, compressed_blocks.data,
+                                compressed_blocks.count);
+
+    // the traversals trust every index, a damaged file must not reach them
+    const size_t triangle_count = scene.indices.size() / 3;
+    bool valid = scene.indices.size() % 3 == 0 && scene.bvh.Validate(triangle_count) &&
+                 scene.compressed_bvh.Validate(triangle_count);
+    for (size_t i = 0; valid && i < scene.indices.size(); ++i) valid = scene.indices[i] < scene.positions.size();
+    if (!valid)
+    {
+      DEBUG_ERROR(IO, "Scene cache references nodes, blocks or vertices it doesn't contain");
+      scene = Scene {};
+      return false;
+    }
+
+    scene.textures.clear();
+    ArrayView<char> textures = getSection<char>(SceneSection::Textures);
+    for (size_t start = 0; start < textures.count;)
+    {
+      size_t end = start;
+      while (end < textures.count && textures[end] != '\0') end++;
+      scene.textures.emplace_back(textures.data + start, end - start);
+      start = end + 1;
+    }
+    return true;
+  }
+
+  static void StreamSource(const SceneStreamFunction& stream, SceneSection section, const SectionSource& source)
+  {
+    const uint64_t size = source.stride * source.count;
+    const uint64_t slice = 16ull << 20;
+    for (uint64_t offset = 0; offset < size; offset += slice)
+    {
+      stream(section, static_cast<const uint8_t*>(source.data) + offset, offset, std::min(slice, size - offset),
+             size);
+    }
+  }
+
+  void SceneCache::StreamScene(const SceneStreamFunction& stream, const Scene& scene)
+  {
+    if (!stream) return;
+    std::vector<char> textures;
+    SectionSource sources[section_count];
+    GetSources(scene, textures, sources);
+    for (uint32_t i = 0; i < section_count; ++i) StreamSource(stream, static_cast<SceneSection>(i), sources[i]);
+  }
+
+  void SceneCache::StreamSections(const SceneStreamFunction& stream, const Scene& scene, const SceneSection* sections,
+                                  size_t count)
+  {
+    if (!stream) return;
+    std::vector<char> textures;
+    SectionSource sources[section_count];
+    GetSources(scene, textures, sources);
+    for (size_t i = 0; i < count; ++i) StreamSource(stream, sections[i], sources[static_cast<uint32_t>(sections[i])]);
+  }
+
+  void SceneCache::Stream(const SceneStreamFunction& stream) const
+  {
+    if (!file.IsOpen() || !stream) return;
+
+    for (const SceneCacheSection& section : sections)
+    {
+      uint64_t size = section.stride * section.count;
+      if (size > 0) stream(static_cast<SceneSection>(section.type), file.getData() + section.offset, 0, size, size);
+    }
+  }
+
+} // namespace PathTracer
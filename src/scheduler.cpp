@@ -0,0 +1,267 @@
+
+#include <VulkanPT/scheduler.hpp>
+#include <VulkanPT/debug.hpp>
+#include <VulkanPT/profiler.hpp>
+#include <algorithm>
+#include <chrono>
+#include <string>
+
+#if defined(_WIN32)
+#define NOMINMAX
+#include <windows.h>
+#elif defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#include <fstream>
+#endif
+
+namespace PathTracer
+{
+  struct NumaNode
+  {
+#if defined(_WIN32)
+    GROUP_AFFINITY affinity {};
+#else
+    std::vector<uint32_t> cpus;
+#endif
+  };
+
+  static std::vector<NumaNode> QueryNumaNodes()
+  {
+    std::vector<NumaNode> nodes;
+
+#if defined(_WIN32)
+    ULONG highest_node = 0;
+    if (!GetNumaHighestNodeNumber(&highest_node)) return nodes;
+
+    for (USHORT node = 0; node <= highest_node; ++node)
+    {
+      NumaNode numa_node;
+      if (GetNumaNodeProcessorMaskEx(node, &numa_node.affinity) && numa_node.affinity.Mask != 0)
+        nodes.push_back(numa_node);
+    }
+#elif defined(__linux__)
+    for (uint32_t node = 0; ; ++node)
+    {
+      std::ifstream file("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist");
+      if (!file) break;
+
+      // cpulist looks like "0-15,32-47"
+      NumaNode numa_node;
+      std::string range;
+      while (std::getline(file, range, ','))
+      {
+        size_t dash = range.find('-');
+        uint32_t first = static_cast<uint32_t>(std::stoul(range.substr(0, dash)));
+        uint32_t last = dash == std::string::npos ? first :
+                        static_cast<uint32_t>(std::stoul(range.substr(dash + 1)));
+        for (uint32_t cpu = first; cpu <= last; ++cpu) numa_node.cpus.push_back(cpu);
+      }
+      if (!numa_node.cpus.empty()) nodes.push_back(numa_node);
+    }
+#endif
+
+    return nodes;
+  }
+
+  static bool PinThread(std::thread& thread, const NumaNode& node)
+  {
+#if defined(_WIN32)
+    return SetThreadGroupAffinity(thread.native_handle(), &node.affinity, nullptr) != 0;
+#elif defined(__linux__)
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (uint32_t cpu : node.cpus) CPU_SET(cpu, &set);
+    return pthread_setaffinity_np(thread.native_handle(), sizeof(set), &set) == 0;
+#else
+    return false;
+#endif
+  }
+
+  Scheduler::Scheduler(uint32_t thread_count, bool pin_threads)
+  {
+    if (thread_count == 0) thread_count = std::max(1u, std::thread::hardware_concurrency());
+
+    for (uint32_t i = 0; i < thread_count; ++i)
+      workers.push_back(std::make_unique<Worker>());
+    for (uint32_t i = 0; i < thread_count; ++i)
+      workers[i]->thread = std::thread(&Scheduler::WorkerLoop, this, i);
+
+    // only worth restricting threads when there is more than one node, workers
+    // fill the nodes in blocks so neighbouring deques share a node
+    std::vector<NumaNode> nodes = pin_threads ? QueryNumaNodes() : std::vector<NumaNode>();
+    if (nodes.size() > 1)
+    {
+      uint32_t per_node = (thread_count + static_cast<uint32_t>(nodes.size()) - 1) /
+                          static_cast<uint32_t>(nodes.size());
+      for (uint32_t i = 0; i < thread_count; ++i)
+      {
+        uint32_t node = std::min(i / per_node, static_cast<uint32_t>(nodes.size()) - 1);
+        workers[i]->stats.numa_node = node;
+        if (!PinThread(workers[i]->thread, nodes[node]))
+          DEBUG_WARNING(Scheduler, "Failed to pin worker %u to NUMA node %u", i, node);
+      }
+    }
+
+    DEBUG_LOG(Scheduler, "Started %u worker threads on %zu NUMA nodes", thread_count,
+              std::max<size_t>(nodes.size(), 1));
+  }
+
+  Scheduler::~Scheduler()
+  {
+    {
+      std::lock_guard<std::mutex> lock(job_mutex);
+      stopping = true;
+    }
+    job_start.notify_all();
+
+    for (std::unique_ptr<Worker>& worker : workers) worker->thread.join();
+  }
+
+  void Scheduler::Run(const std::vector<uint32_t>& tasks, const Task& function)
+  {
+    if (tasks.empty()) return;
+
+    std::unique_lock<std::mutex> lock(job_mutex);
+
+    // contiguous runs keep the locality of the incoming order per thread
+    size_t thread_count = workers.size();
+    for (size_t i = 0; i < thread_count; ++i)
+    {
+      size_t begin = tasks.size() * i / thread_count;
+      size_t end = tasks.size() * (i + 1) / thread_count;
+
+      std::lock_guard<std::mutex> queue_lock(workers[i]->mutex);
+      // owners pop from the back, so store the run reversed
+      workers[i]->queue.assign(tasks.rbegin() + (tasks.size() - end),
+                               tasks.rbegin() + (tasks.size() - begin));
+    }
+
+    job = &function;
+    finished_workers = 0;
+    generation++;
+    job_start.notify_all();
+
+    job_done.wait(lock, [this]() { return finished_workers == workers.size(); });
+    job = nullptr;
+  }
+
+  void Scheduler::ParallelFor(uint32_t count, const Task& function)
+  {
+    std::vector<uint32_t> tasks(count);
+    for (uint32_t i = 0; i < count; ++i) tasks[i] = i;
+    Run(tasks, function);
+  }
+
+  void Scheduler::ResetStats()
+  {
+    for (std::unique_ptr<Worker>& worker : workers)
+    {
+      uint32_t numa_node = worker->stats.numa_node;
+      worker->stats = ThreadStats {};
+      worker->stats.numa_node = numa_node;
+    }
+  }
+
+  void Scheduler::ReportStats() const
+  {
+    uint64_t total_work = 0;
+    uint64_t total_steals = 0;
+    for (uint32_t i = 0; i < workers.size(); ++i)
+    {
+      const ThreadStats& stats = workers[i]->stats;
+      double seconds = stats.busy_milliseconds * 1e-3;
+      DEBUG_LOG(Scheduler, "Thread %u (node %u): %llu tasks, %llu steals, %llu work, %.1f work/s",
+                i, stats.numa_node, static_cast<unsigned long long>(stats.tasks),
+                static_cast<unsigned long long>(stats.steals),
+                static_cast<unsigned long long>(stats.work),
+                seconds > 0.0 ? static_cast<double>(stats.work) / seconds : 0.0);
+      total_work += stats.work;
+      total_steals += stats.steals;
+    }
+
+    Profiler::Count("scheduler.work", total_work);
+    Profiler::Count("scheduler.steals", total_steals);
+  }
+
+  void Scheduler::WorkerLoop(uint32_t index)
+  {
+    uint64_t seen_generation = 0;
+
+    while (true)
+    {
+      {
+        std::unique_lock<std::mutex> lock(job_mutex);
+        job_start.wait(lock, [&]() { return stopping || generation != seen_generation; });
+        if (stopping) return;
+        seen_generation = generation;
+      }
+
+      // no tasks get added while a job runs, so once every deque is empty
+      // this thread is done with the job
+      uint32_t task;
+      while (true)
+      {
+        if (Pop(index, task)) Execute(index, task, false);
+        else if (Steal(index, task)) Execute(index, task, true);
+        else break;
+      }
+
+      {
+        std::lock_guard<std::mutex> lock(job_mutex);
+        finished_workers++;
+      }
+      job_done.notify_one();
+    }
+  }
+
+  bool Scheduler::Pop(uint32_t index, uint32_t& task)
+  {
+    Worker& worker = *workers[index];
+    std::lock_guard<std::mutex> lock(worker.mutex);
+    if (worker.queue.empty()) return false;
+
+    task = worker.queue.back();
+    worker.queue.pop_back();
+    return true;
+  }
+
+  bool Scheduler::Steal(uint32_t index, uint32_t& task)
+  {
+    uint32_t thread_count = static_cast<uint32_t>(workers.size());
+    uint32_t numa_node = workers[index]->stats.numa_node;
+
+    // first pass only looks at the local node
+    for (uint32_t pass = 0; pass < 2; ++pass)
+    {
+      for (uint32_t offset = 1; offset < thread_count; ++offset)
+      {
+        Worker& victim = *workers[(index + offset) % thread_count];
+        if ((victim.stats.numa_node == numa_node) != (pass == 0)) continue;
+
+        std::lock_guard<std::mutex> lock(victim.mutex);
+        if (victim.queue.empty()) continue;
+
+        task = victim.queue.front();
+        victim.queue.pop_front();
+        return true;
+      }
+    }
+
+    return false;
+  }
+
+  void Scheduler::Execute(uint32_t index, uint32_t task, bool stolen)
+  {
+    ThreadStats& stats = workers[index]->stats;
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+    (*job)(task, index);
+
+    std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+    stats.busy_milliseconds += elapsed.count();
+    stats.tasks++;
+    if (stolen) stats.steals++;
+  }
+
+} // namespace PathTracer
@@ -0,0 +1,206 @@
+
+#include <VulkanPT/texture.hpp>
+#include <VulkanPT/profiler.hpp>
+#include <VulkanPT/texture_compression.hpp>
+
+namespace PathTracer
+{
+  struct SrgbTable
+  {
+    float linear[256];
+
+    SrgbTable()
+    {
+      for (int i = 0; i < 256; ++i)
+      {
+        float value = i / 255.0f;
+        linear[i] = value <= 0.04045f ? value / 12.92f : std::pow((value + 0.055f) / 1.055f, 2.4f);
+      }
+    }
+  };
+
+  static const SrgbTable srgb_table;
+
+  static uint8_t EncodeUnorm(float value)
+  {
+    return static_cast<uint8_t>(std::min(std::max(value, 0.0f), 1.0f) * 255.0f + 0.5f);
+  }
+
+  static uint8_t EncodeSrgb(float value)
+  {
+    value = std::min(std::max(value, 0.0f), 1.0f);
+    return EncodeUnorm(value <= 0.0031308f ? value * 12.92f : 1.055f * std::pow(value, 1.0f / 2.4f) - 0.055f);
+  }
+
+  glm::vec4 DecodeTexel(const uint8_t* texel, bool srgb)
+  {
+    if (srgb)
+      return { srgb_table.linear[texel[0]], srgb_table.linear[texel[1]], srgb_table.linear[texel[2]], texel[3] / 255.0f };
+    return glm::vec4(texel[0], texel[1], texel[2], texel[3]) / 255.0f;
+  }
+
+  // The source texels one destination texel covers along an axis, weighted by
+  // the covered fraction. A box of up to 3 texels can straddle 4.
+  struct BoxTap
+  {
+    uint32_t first { 0 };
+    uint32_t count { 0 };
+    float weights[4] {};
+  };
+
+  static std::vector<BoxTap> BoxTaps(uint32_t source, uint32_t destination)
+  {
+    std::vector<BoxTap> taps(destination);
+    double ratio = static_cast<double>(source) / destination;
+    for (uint32_t x = 0; x < destination; ++x)
+    {
+      double begin = x * ratio;
+      double end = std::min((x + 1) * ratio, static_cast<double>(source));
+      BoxTap& tap = taps[x];
+      tap.first = static_cast<uint32_t>(begin);
+      for (uint32_t texel = tap.first; texel < end && tap.count < 4; ++texel)
+      {
+        double covered = std::min<double>(texel + 1, end) - std::max<double>(texel, begin);
+        tap.weights[tap.count++] = static_cast<float>(covered / ratio);
+      }
+    }
+    return taps;
+  }
+
+  static void Downsample(const std::vector<glm::vec4>& source, uint32_t width, uint32_t height,
+                         std::vector<glm::vec4>& destination, uint32_t next_width, uint32_t next_height)
+  {
+    std::vector<BoxTap> columns = BoxTaps(width, next_width);
+    std::vector<BoxTap> rows = BoxTaps(height, next_height);
+
+    std::vector<glm::vec4> horizontal(static_cast<size_t>(next_width) * height);
+    for (uint32_t y = 0; y < height; ++y)
+    {
+      const glm::vec4* row = &source[static_cast<size_t>(y) * width];
+      for (uint32_t x = 0; x < next_width; ++x)
+      {
+        glm::vec4 sum(0.0f);
+        for (uint32_t i = 0; i < columns[x].count; ++i) sum += columns[x].weights[i] * row[columns[x].first + i];
+        horizontal[static_cast<size_t>(y) * next_width + x] = sum;
+      }
+    }
+
+    destination.assign(static_cast<size_t>(next_width) * next_height, glm::vec4(0.0f));
+    for (uint32_t y = 0; y < next_height; ++y)
+    {
+      glm::vec4* row = &destination[static_cast<size_t>(y) * next_width];
+      for (uint32_t i = 0; i < rows[y].count; ++i)
+      {
+        const glm::vec4* source_row = &horizontal[static_cast<size_t>(rows[y].first + i) * next_width];
+        for (uint32_t x = 0; x < next_width; ++x) row[x] += rows[y].weights[i] * source_row[x];
+      }
+    }
+  }
+
+  uint32_t MipLevelCount(uint32_t width, uint32_t height)
+  {
+    uint32_t levels = 1;
+    for (uint32_t size = std::max(width, height); size > 1; size >>= 1) levels++;
+    return levels;
+  }
+
+  void GenerateMipmaps(Image&& image, bool srgb, Texture& texture)
+  {
+    Profiler::Scope scope("texture.mipmaps");
+
+    texture.srgb = srgb;
+    texture.levels.clear();
+    if (!image.Valid()) return;
+
+    uint32_t width = image.width;
+    uint32_t height = image.height;
+    std::vector<glm::vec4> current(static_cast<size_t>(width) * height);
+    for (size_t i = 0; i < current.size(); ++i) current[i] = DecodeTexel(&image.texels[i * 4], srgb);
+
+    texture.levels.reserve(MipLevelCount(width, height));
+    texture.levels.push_back(std::move(image));
+
+    std::vector<glm::vec4> next;
+    while (width > 1 || height > 1)
+    {
+      uint32_t next_width = std::max(width / 2, 1u);
+      uint32_t next_height = std::max(height / 2, 1u);
+      Downsample(current, width, height, next, next_width, next_height);
+
+      Image level;
+      level.width = next_width;
+      level.height = next_height;
+      level.texels.resize(next.size() * 4);
+      for (size_t i = 0; i < next.size(); ++i)
+      {
+        for (int channel = 0; channel < 3; ++channel)
+          level.texels[i * 4 + channel] = srgb ? EncodeSrgb(next[i][channel]) : EncodeUnorm(next[i][channel]);
+        level.texels[i * 4 + 3] = EncodeUnorm(next[i].a);
+      }
+      texture.levels.push_back(std::move(level));
+
+      current.swap(next);
+      width = next_width;
+      height = next_height;
+    }
+  }
+
+  static glm::vec4 FetchTexel(const Texture& texture, const Image& level, int32_t x, int32_t y)
+  {
+    if (!BlockCompressed(texture.format))
+      return DecodeTexel(&level.texels[(static_cast<size_t>(y) * level.width + x) * 4], texture.srgb);
+
+    size_t blocks_x = (level.width + 3) / 4;
+    const uint8_t* block = &level.texels[(y / 4 * blocks_x + x / 4) * BlockBytes(texture.format)];
+    uint8_t texel[4];
+    DecodeBlockTexel(texture.format, block, (y & 3) * 4 + (x & 3), texel);
+    return DecodeTexel(texel, texture.srgb);
+  }
+
+  static glm::vec4 SampleBilinear(const Texture& texture, const Image& level, const glm::vec2& uv)
+  {
+    float x = uv.x * level.width - 0.5f;
+    float y = uv.y * level.height - 0.5f;
+    float fx = std::floor(x);
+    float fy = std::floor(y);
+    float tx = x - fx;
+    float ty = y - fy;
+
+    // repeat addressing, uv can be any distance outside [0, 1)
+    int32_t width = static_cast<int32_t>(level.width);
+    int32_t height = static_cast<int32_t>(level.height);
+    int32_t x0 = static_cast<int32_t>(fx - std::floor(fx / width) * width);
+    int32_t y0 = static_cast<int32_t>(fy - std::floor(fy / height) * height);
+    x0 = std::min(std::max(x0, 0), width - 1);
+    y0 = std::min(std::max(y0, 0), height - 1);
+    int32_t x1 = x0 + 1 < width ? x0 + 1 : 0;
+    int32_t y1 = y0 + 1 < height ? y0 + 1 : 0;
+
+    glm::vec4 top = glm::mix(FetchTexel(texture, level, x0, y0), FetchTexel(texture, level, x1, y0), tx);
+    glm::vec4 bottom = glm::mix(FetchTexel(texture, level, x0, y1), FetchTexel(texture, level, x1, y1), tx);
+    return glm::mix(top, bottom, ty);
+  }
+
+  glm::vec4 Texture::Sample(const glm::vec2& uv, float lod) const
+  {
+    if (!Valid()) return glm::vec4(1.0f);
+    if (!std::isfinite(uv.x) || !std::isfinite(uv.y)) return FetchTexel(*this, levels[0], 0, 0);
+
+    // also catches NaN from degenerate footprints
+    if (!(lod > 0.0f)) return SampleBilinear(*this, levels[0], uv);
+    float last = static_cast<float>(levels.size() - 1);
+    if (lod >= last) return SampleBilinear(*this, levels.back(), uv);
+
+    uint32_t level = static_cast<uint32_t>(lod);
+    float blend = lod - level;
+    return glm::mix(SampleBilinear(*this, levels[level], uv), SampleBilinear(*this, levels[level + 1], uv), blend);
+  }
+
+  size_t Texture::Size() const
+  {
+    size_t size = 0;
+    for (const Image& level : levels) size += level.texels.size();
+    return size;
+  }
+
+} // namespace PathTracer
@@ -0,0 +1,740 @@
+
+#include <VulkanPT/texture_compression.hpp>
+#include <VulkanPT/debug.hpp>
+#include <VulkanPT/hash.hpp>
+#include <VulkanPT/mapped_file.hpp>
+#include <VulkanPT/profiler.hpp>
+#include <VulkanPT/scene.hpp>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <unordered_set>
+
+namespace PathTracer
+{
+  // Bumped whenever the encoders change, old cache entries then miss.
+  static constexpr uint32_t encoder_version = 1;
+  static const char texture_magic[8] = { 'V', 'P', 'T', 'T', 'E', 'X', 'T', 'R' };
+  // how the materials use an image
+  static constexpr uint8_t color_usage = 1;
+  static constexpr uint8_t normal_usage = 2;
+
+  struct TextureCacheHeader
+  {
+    char magic[8];
+    uint32_t version;
+    uint32_t format;
+    uint32_t width;
+    uint32_t height;
+    uint32_t level_count;
+    uint32_t srgb;
+    uint64_t content_hash;
+    uint64_t file_size;
+  };
+
+  // Principal axis of count points with channels components around mean, by
+  // power iteration. Falls back to the diagonal for flat blocks.
+  static void PrincipalAxis(const float* points, int count, int channels, const float* mean, float* axis)
+  {
+    float covariance[4][4] {};
+    for (int i = 0; i < count; ++i)
+    {
+      for (int a = 0; a < channels; ++a)
+        for (int b = 0; b < channels; ++b)
+          covariance[a][b] += (points[i * 4 + a] - mean[a]) * (points[i * 4 + b] - mean[b]);
+    }
+
+    for (int c = 0; c < channels; ++c) axis[c] = 1.0f;
+    for (int iteration = 0; iteration < 8; ++iteration)
+    {
+      float next[4] {};
+      float length = 0.0f;
+      for (int a = 0; a < channels; ++a)
+      {
+        for (int b = 0; b < channels; ++b) next[a] += covariance[a][b] * axis[b];
+        length = std::max(length, std::abs(next[a]));
+      }
+      if (length < 1e-6f) break;
+      for (int c = 0; c < channels; ++c) axis[c] = next[c] / length;
+    }
+  }
+
+  // Endpoints that minimise the error for fixed interpolation weights, weight
+  // 0 picks the first endpoint. False for a singular system.
+  static bool LeastSquares(const float* points, const float* weights, int count, int channels, float* first,
+                           float* second)
+  {
+    float aa = 0.0f, ab = 0.0f, bb = 0.0f;
+    float ax[4] {}, bx[4] {};
+    for (int i = 0; i < count; ++i)
+    {
+      float a = 1.0f - weights[i];
+      float b = weights[i];
+      aa += a * a;
+      ab += a * b;
+      bb += b * b;
+      for (int c = 0; c < channels; ++c)
+      {
+        ax[c] += a * points[i * 4 + c];
+        bx[c] += b * points[i * 4 + c];
+      }
+    }
+
+    float determinant = aa * bb - ab * ab;
+    if (std::abs(determinant) < 1e-6f) return false;
+    for (int c = 0; c < channels; ++c)
+    {
+      first[c] = std::min(std::max((ax[c] * bb - bx[c] * ab) / determinant, 0.0f), 255.0f);
+      second[c] = std::min(std::max((bx[c] * aa - ax[c] * ab) / determinant, 0.0f), 255.0f);
+    }
+    return true;
+  }
+
+  static void EndpointsAlongAxis(const float* points, int count, int channels, float* first, float* second)
+  {
+    float mean[4] {};
+    for (int i = 0; i < count; ++i)
+      for (int c = 0; c < channels; ++c) mean[c] += points[i * 4 + c] / count;
+
+    float axis[4];
+    PrincipalAxis(points, count, channels, mean, axis);
+
+    float low = 0.0f, high = 0.0f;
+    for (int i = 0; i < count; ++i)
+    {
+      float projection = 0.0f;
+      for (int c = 0; c < channels; ++c) projection += (points[i * 4 + c] - mean[c]) * axis[c];
+      low = std::min(low, projection);
+      high = std::max(high, projection);
+    }
+
+    for (int c = 0; c < channels; ++c)
+    {
+      first[c] = std::min(std::max(mean[c] + axis[c] * low, 0.0f), 255.0f);
+      second[c] = std::min(std::max(mean[c] + axis[c] * high, 0.0f), 255.0f);
+    }
+  }
+
+  // BC1
+
+  static uint16_t Pack565(const float* color)
+  {
+    uint32_t r = static_cast<uint32_t>(color[0] * 31.0f / 255.0f + 0.5f);
+    uint32_t g = static_cast<uint32_t>(color[1] * 63.0f / 255.0f + 0.5f);
+    uint32_t b = static_cast<uint32_t>(color[2] * 31.0f / 255.0f + 0.5f);
+    return static_cast<uint16_t>(r << 11 | g << 5 | b);
+  }
+
+  static void Unpack565(uint16_t packed, int* color)
+  {
+    int r = packed >> 11, g = (packed >> 5) & 63, b = packed & 31;
+    color[0] = r << 3 | r >> 2;
+    color[1] = g << 2 | g >> 4;
+    color[2] = b << 3 | b >> 2;
+  }
+
+  static void Bc1Palette(uint16_t color0, uint16_t color1, int palette[4][4])
+  {
+    Unpack565(color0, palette[0]);
+    Unpack565(color1, palette[1]);
+    palette[0][3] = palette[1][3] = 255;
+    for (int c = 0; c < 3; ++c)
+    {
+      if (color0 > color1)
+      {
+        palette[2][c] = (2 * palette[0][c] + palette[1][c] + 1) / 3;
+        palette[3][c] = (palette[0][c] + 2 * palette[1][c] + 1) / 3;
+      }
+      else
+      {
+        palette[2][c] = (palette[0][c] + palette[1][c]) / 2;
+        palette[3][c] = 0;
+      }
+    }
+    palette[2][3] = 255;
+    palette[3][3] = color0 > color1 ? 255 : 0;
+  }
+
+  // Returns the squared error, indices is packed two bits per texel.
+  static uint32_t Bc1Indices(const float* points, uint16_t color0, uint16_t color1, uint32_t& indices)
+  {
+    int palette[4][4];
+    Bc1Palette(color0, color1, palette);
+    uint32_t total = 0;
+    indices = 0;
+    for (int i = 0; i < 16; ++i)
+    {
+      uint32_t best = ~0u;
+      uint32_t best_index = 0;
+      for (uint32_t entry = 0; entry < (color0 > color1 ? 4u : 3u); ++entry)
+      {
+        uint32_t error = 0;
+        for (int c = 0; c < 3; ++c)
+        {
+          int difference = static_cast<int>(points[i * 4 + c] + 0.5f) - palette[entry][c];
+          error += difference * difference;
+        }
+        if (error < best)
+        {
+          best = error;
+          best_index = entry;
+        }
+      }
+      total += best;
+      indices |= best_index << (i * 2);
+    }
+    return total;
+  }
+
+  static void EncodeBc1(const float* points, uint8_t* block)
+  {
+    float first[4], second[4];
+    EndpointsAlongAxis(points, 16, 3, first, second);
+    uint16_t color0 = Pack565(second);
+    uint16_t color1 = Pack565(first);
+    if (color0 < color1) std::swap(color0, color1);
+
+    uint32_t indices;
+    uint32_t error = Bc1Indices(points, color0, color1, indices);
+
+    // one least squares pass over the chosen palette positions
+    static const float weights_of[4] = { 0.0f, 1.0f, 1.0f / 3.0f, 2.0f / 3.0f };
+    float weights[16];
+    for (int i = 0; i < 16; ++i) weights[i] = weights_of[(indices >> (i * 2)) & 3];
+    if (color0 > color1 && LeastSquares(points, weights, 16, 3, first, second))
+    {
+      uint16_t refined0 = Pack565(first);
+      uint16_t refined1 = Pack565(second);
+      if (refined0 < refined1) std::swap(refined0, refined1);
+      uint32_t refined_indices;
+      uint32_t refined_error = Bc1Indices(points, refined0, refined1, refined_indices);
+      if (refined_error < error)
+      {
+        color0 = refined0;
+        color1 = refined1;
+        indices = refined_indices;
+      }
+    }
+
+    block[0] = static_cast<uint8_t>(color0);
+    block[1] = static_cast<uint8_t>(color0 >> 8);
+    block[2] = static_cast<uint8_t>(color1);
+    block[3] = static_cast<uint8_t>(color1 >> 8);
+    for (int i = 0; i < 4; ++i) block[4 + i] = static_cast<uint8_t>(indices >> (i * 8));
+  }
+
+  // BC4, one channel of BC5
+
+  static void Bc4Palette(int first, int second, int palette[8])
+  {
+    palette[0] = first;
+    palette[1] = second;
+    if (first > second)
+    {
+      for (int i = 2; i < 8; ++i) palette[i] = ((8 - i) * first + (i - 1) * second + 3) / 7;
+    }
+    else
+    {
+      for (int i = 2; i < 6; ++i) palette[i] = ((6 - i) * first + (i - 1) * second + 2) / 5;
+      palette[6] = 0;
+      palette[7] = 255;
+    }
+  }
+
+  static void EncodeBc4(const uint8_t* texels, int channel, uint8_t* block)
+  {
+    int low = 255, high = 0;
+    for (int i = 0; i < 16; ++i)
+    {
+      low = std::min<int>(low, texels[i * 4 + channel]);
+      high = std::max<int>(high, texels[i * 4 + channel]);
+    }
+
+    int palette[8];
+    Bc4Palette(high, low, palette);
+    uint64_t indices = 0;
+    for (int i = 0; i < 16; ++i)
+    {
+      int value = texels[i * 4 + channel];
+      int best = 256;
+      uint64_t best_index = 0;
+      for (int entry = 0; entry < 8; ++entry)
+      {
+        if (std::abs(value - palette[entry]) < best)
+        {
+          best = std::abs(value - palette[entry]);
+          best_index = entry;
+        }
+      }
+      indices |= best_index << (i * 3);
+    }
+
+    block[0] = static_cast<uint8_t>(high);
+    block[1] = static_cast<uint8_t>(low);
+    for (int i = 0; i < 6; ++i) block[2 + i] = static_cast<uint8_t>(indices >> (i * 8));
+  }
+
+  static uint8_t DecodeBc4(const uint8_t* block, uint32_t index)
+  {
+    int palette[8];
+    Bc4Palette(block[0], block[1], palette);
+    uint64_t indices = 0;
+    for (int i = 0; i < 6; ++i) indices |= static_cast<uint64_t>(block[2 + i]) << (i * 8);
+    return static_cast<uint8_t>(palette[(indices >> (index * 3)) & 7]);
+  }
+
+  // BC7 mode 6: RGBA endpoints with 7 bits and a shared lowest bit per
+  // endpoint, 4-bit indices.
+
+  static const int bc7_weights[16] = { 0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64 };
+
+  struct Bc7Endpoints
+  {
+    uint8_t color[2][4];
+    uint8_t parity[2];
+  };
+
+  static void QuantizeBc7(const float* value, uint8_t* color, uint8_t& parity)
+  {
+    float best = infinity;
+    for (uint8_t bit = 0; bit < 2; ++bit)
+    {
+      uint8_t candidate[4];
+      float error = 0.0f;
+      for (int c = 0; c < 4; ++c)
+      {
+        candidate[c] = static_cast<uint8_t>(std::min(std::max((value[c] - bit) * 0.5f + 0.5f, 0.0f), 127.0f));
+        float difference = (candidate[c] << 1 | bit) - value[c];
+        error += difference * difference;
+      }
+      if (error < best)
+      {
+        best = error;
+        parity = bit;
+        std::memcpy(color, candidate, 4);
+      }
+    }
+  }
+
+  static void Bc7Palette(const Bc7Endpoints& endpoints, int palette[16][4])
+  {
+    for (int c = 0; c < 4; ++c)
+    {
+      int first = endpoints.color[0][c] << 1 | endpoints.parity[0];
+      int second = endpoints.color[1][c] << 1 | endpoints.parity[1];
+      for (int i = 0; i < 16; ++i)
+        palette[i][c] = ((64 - bc7_weights[i]) * first + bc7_weights[i] * second + 32) >> 6;
+    }
+  }
+
+  static uint32_t Bc7Indices(const float* points, const Bc7Endpoints& endpoints, uint8_t* indices)
+  {
+    int palette[16][4];
+    Bc7Palette(endpoints, palette);
+    uint32_t total = 0;
+    for (int i = 0; i < 16; ++i)
+    {
+      uint32_t best = ~0u;
+      for (uint8_t entry = 0; entry < 16; ++entry)
+      {
+        uint32_t error = 0;
+        for (int c = 0; c < 4; ++c)
+        {
+          int difference = static_cast<int>(points[i * 4 + c] + 0.5f) - palette[entry][c];
+          error += difference * difference;
+        }
+        if (error < best)
+        {
+          best = error;
+          indices[i] = entry;
+        }
+      }
+      total += best;
+    }
+    return total;
+  }
+
+  struct BitWriter
+  {
+    uint8_t* block;
+    uint32_t position { 0 };
+
+    void Write(uint32_t value, uint32_t bits)
+    {
+      for (uint32_t i = 0; i < bits; ++i, ++position)
+        block[position >> 3] |= static_cast<uint8_t>(((value >> i) & 1) << (position & 7));
+    }
+  };
+
+  static uint32_t ReadBits(const uint8_t* block, uint32_t position, uint32_t bits)
+  {
+    uint32_t value = 0;
+    for (uint32_t i = 0; i < bits; ++i, ++position) value |= ((block[position >> 3] >> (position & 7)) & 1u) << i;
+    return value;
+  }
+
+  static void EncodeBc7(const float* points, uint8_t* block)
+  {
+    float first[4], second[4];
+    EndpointsAlongAxis(points, 16, 4, first, second);
+
+    Bc7Endpoints endpoints;
+    QuantizeBc7(first, endpoints.color[0], endpoints.parity[0]);
+    QuantizeBc7(second, endpoints.color[1], endpoints.parity[1]);
+    uint8_t indices[16];
+    uint32_t error = Bc7Indices(points, endpoints, indices);
+
+    float weights[16];
+    for (int i = 0; i < 16; ++i) weights[i] = bc7_weights[indices[i]] / 64.0f;
+    if (LeastSquares(points, weights, 16, 4, first, second))
+    {
+      Bc7Endpoints refined;
+      QuantizeBc7(first, refined.color[0], refined.parity[0]);
+      QuantizeBc7(second, refined.color[1], refined.parity[1]);
+      uint8_t refined_indices[16];
+      uint32_t refined_error = Bc7Indices(points, refined, refined_indices);
+      if (refined_error < error)
+      {
+        endpoints = refined;
+        std::memcpy(indices, refined_indices, sizeof(indices));
+      }
+    }
+
+    // the first index is stored without its top bit, so it must be below 8
+    if (indices[0] >= 8)
+    {
+      std::swap(endpoints.color[0], endpoints.color[1]);
+      std::swap(endpoints.parity[0], endpoints.parity[1]);
+      for (uint8_t& index : indices) index = 15 - index;
+    }
+
+    std::memset(block, 0, 16);
+    BitWriter writer { block };
+    writer.Write(1u << 6, 7);
+    for (int c = 0; c < 4; ++c)
+    {
+      writer.Write(endpoints.color[0][c], 7);
+      writer.Write(endpoints.color[1][c], 7);
+    }
+    writer.Write(endpoints.parity[0], 1);
+    writer.Write(endpoints.parity[1], 1);
+    writer.Write(indices[0], 3);
+    for (int i = 1; i < 16; ++i) writer.Write(indices[i], 4);
+  }
+
+  void EncodeBlock(TextureFormat format, const uint8_t texels[64], uint8_t* block)
+  {
+    float points[64];
+    for (int i = 0; i < 64; ++i) points[i] = texels[i];
+
+    if (format == TextureFormat::BC1) EncodeBc1(points, block);
+    else if (format == TextureFormat::BC7) EncodeBc7(points, block);
+    else if (format == TextureFormat::BC5)
+    {
+      EncodeBc4(texels, 0, block);
+      EncodeBc4(texels, 1, block + 8);
+    }
+  }
+
+  void DecodeBlockTexel(TextureFormat format, const uint8_t* block, uint32_t index, uint8_t texel[4])
+  {
+    if (format == TextureFormat::BC1)
+    {
+      uint16_t color0 = static_cast<uint16_t>(block[0] | block[1] << 8);
+      uint16_t color1 = static_cast<uint16_t>(block[2] | block[3] << 8);
+      int palette[4][4];
+      Bc1Palette(color0, color1, palette);
+      uint32_t entry = (block[4 + index / 4] >> ((index & 3) * 2)) & 3;
+      for (int c = 0; c < 4; ++c) texel[c] = static_cast<uint8_t>(palette[entry][c]);
+    }
+    else if (format == TextureFormat::BC5)
+    {
+      texel[0] = DecodeBc4(block, index);
+      texel[1] = DecodeBc4(block + 8, index);
+      texel[2] = 0;
+      texel[3] = 255;
+    }
+    else if (format == TextureFormat::BC7 && (block[0] & 0x7F) == 0x40)
+    {
+      Bc7Endpoints endpoints;
+      for (uint32_t c = 0; c < 4; ++c)
+      {
+        endpoints.color[0][c] = static_cast<uint8_t>(ReadBits(block, 7 + c * 14, 7));
+        endpoints.color[1][c] = static_cast<uint8_t>(ReadBits(block, 14 + c * 14, 7));
+      }
+      endpoints.parity[0] = static_cast<uint8_t>(ReadBits(block, 63, 1));
+      endpoints.parity[1] = static_cast<uint8_t>(ReadBits(block, 64, 1));
+      uint32_t entry = index == 0 ? ReadBits(block, 65, 3) : ReadBits(block, 64 + index * 4, 4);
+
+      int palette[16][4];
+      Bc7Palette(endpoints, palette);
+      for (int c = 0; c < 4; ++c) texel[c] = static_cast<uint8_t>(palette[entry][c]);
+    }
+    else std::memset(texel, 0, 4);
+  }
+
+  struct CompressionJob
+  {
+    const Texture* source;
+    Texture* destination;
+    TextureFormat format;
+  };
+
+  // One task per band of block rows across every level of every job, so a
+  // single large texture still spreads over all threads.
+  static void RunCompressionJobs(const std::vector<CompressionJob>& jobs, Scheduler& scheduler)
+  {
+    const uint32_t band_rows = 16;
+    struct Band { uint32_t job; uint32_t level; uint32_t first_row; };
+    std::vector<Band> bands;
+
+    for (uint32_t job = 0; job < jobs.size(); ++job)
+    {
+      const Texture& source = *jobs[job].source;
+      Texture& destination = *jobs[job].destination;
+      destination.format = jobs[job].format;
+      destination.srgb = source.srgb;
+      destination.levels.resize(source.levels.size());
+
+      for (uint32_t level = 0; level < source.levels.size(); ++level)
+      {
+        const Image& image = source.levels[level];
+        destination.levels[level].width = image.width;
+        destination.levels[level].height = image.height;
+        destination.levels[level].texels.resize(LevelSize(jobs[job].format, image.width, image.height));
+        for (uint32_t row = 0; row < (image.height + 3) / 4; row += band_rows) bands.push_back({ job, level, row });
+      }
+    }
+
+    scheduler.ParallelFor(static_cast<uint32_t>(bands.size()), [&](uint32_t task, uint32_t)
+    {
+      const Band& band = bands[task];
+      const CompressionJob& job = jobs[band.job];
+      const Image& image = job.source->levels[band.level];
+      uint8_t* output = job.destination->levels[band.level].texels.data();
+      const uint32_t blocks_x = (image.width + 3) / 4;
+      const uint32_t rows_end = std::min(band.first_row + band_rows, (image.height + 3) / 4);
+      const uint32_t block_bytes = BlockBytes(job.format);
+
+      uint8_t texels[64];
+      for (uint32_t by = band.first_row; by < rows_end; ++by)
+      {
+        for (uint32_t bx = 0; bx < blocks_x; ++bx)
+        {
+          // edge blocks repeat the last row and column
+          for (uint32_t y = 0; y < 4; ++y)
+          {
+            uint32_t source_y = std::min(by * 4 + y, image.height - 1);
+            for (uint32_t x = 0; x < 4; ++x)
+            {
+              uint32_t source_x = std::min(bx * 4 + x, image.width - 1);
+              size_t offset = (static_cast<size_t>(source_y) * image.width + source_x) * 4;
+              std::memcpy(&texels[(y * 4 + x) * 4], &image.texels[offset], 4);
+            }
+          }
+          EncodeBlock(job.format, texels, output + (static_cast<size_t>(by) * blocks_x + bx) * block_bytes);
+        }
+      }
+    });
+  }
+
+  void CompressTexture(const Texture& texture, TextureFormat format, Texture& compressed, Scheduler& scheduler)
+  {
+    Profiler::Scope scope("texture.compress");
+    RunCompressionJobs({ { &texture, &compressed, format } }, scheduler);
+  }
+
+  void DecompressTexture(const Texture& texture, Texture& decompressed)
+  {
+    decompressed.format = TextureFormat::RGBA8;
+    decompressed.srgb = texture.srgb;
+    decompressed.levels.resize(texture.levels.size());
+    if (!BlockCompressed(texture.format))
+    {
+      decompressed.levels = texture.levels;
+      return;
+    }
+
+    const uint32_t block_bytes = BlockBytes(texture.format);
+    for (size_t level = 0; level < texture.levels.size(); ++level)
+    {
+      const Image& source = texture.levels[level];
+      Image& image = decompressed.levels[level];
+      image.width = source.width;
+      image.height = source.height;
+      image.texels.resize(static_cast<size_t>(source.width) * source.height * 4);
+
+      const uint32_t blocks_x = (source.width + 3) / 4;
+      for (uint32_t y = 0; y < source.height; ++y)
+      {
+        for (uint32_t x = 0; x < source.width; ++x)
+        {
+          const uint8_t* block = &source.texels[(static_cast<size_t>(y / 4) * blocks_x + x / 4) * block_bytes];
+          uint8_t* texel = &image.texels[(static_cast<size_t>(y) * source.width + x) * 4];
+          DecodeBlockTexel(texture.format, block, (y & 3) * 4 + (x & 3), texel);
+        }
+      }
+    }
+  }
+
+  static std::string CachePath(const std::string& directory, uint64_t hash)
+  {
+    char name[32];
+    std::snprintf(name, sizeof(name), "%016llx.vpttex", static_cast<unsigned long long>(hash));
+    return directory + "/" + name;
+  }
+
+  static bool ReadCachedTexture(const std::string& path, uint64_t hash, Texture& texture)
+  {
+    MappedFile file;
+    if (!file.Open(path) || file.getSize() < sizeof(TextureCacheHeader)) return false;
+
+    TextureCacheHeader header;
+    std::memcpy(&header, file.getData(), sizeof(header));
+    if (std::memcmp(header.magic, texture_magic, sizeof(texture_magic)) != 0 || header.version != encoder_version ||
+        header.content_hash != hash || header.file_size != file.getSize() ||
+        header.level_count != MipLevelCount(header.width, header.height))
+      return false;
+
+    texture.format = static_cast<TextureFormat>(header.format);
+    texture.srgb = header.srgb != 0;
+    texture.levels.resize(header.level_count);
+    size_t offset = sizeof(header);
+    for (uint32_t level = 0; level < header.level_count; ++level)
+    {
+      Image& image = texture.levels[level];
+      image.width = std::max(header.width >> level, 1u);
+      image.height = std::max(header.height >> level, 1u);
+      size_t size = LevelSize(texture.format, image.width, image.height);
+      if (offset + size > file.getSize()) return false;
+      image.texels.assign(file.getData() + offset, file.getData() + offset + size);
+      offset += size;
+    }
+    return true;
+  }
+
+  // Same temporary file and rename as the scene cache.
+  static bool WriteCachedTexture(const std::string& path, uint64_t hash, const Texture& texture)
+  {
+    TextureCacheHeader header {};
+    std::memcpy(header.magic, texture_magic, sizeof(texture_magic));
+    header.version = encoder_version;
+    header.format = static_cast<uint32_t>(texture.format);
+    header.width = texture.getWidth();
+    header.height = texture.getHeight();
+    header.level_count = texture.LevelCount();
+    header.srgb = texture.srgb;
+    header.content_hash = hash;
+    header.file_size = sizeof(header) + texture.Size();
+
+    std::string temporary_path = path + ".tmp";
+    FILE* output = std::fopen(temporary_path.c_str(), "wb");
+    if (!output) return false;
+
+    bool success = std::fwrite(&header, sizeof(header), 1, output) == 1;
+    for (const Image& level : texture.levels)
+      success = success && std::fwrite(level.texels.data(), 1, level.texels.size(), output) == level.texels.size();
+    success = std::fclose(output) == 0 && success;
+
+    std::error_code error;
+    if (success) std::filesystem::rename(temporary_path, path, error);
+    if (!success || error)
+    {
+      std::filesystem::remove(temporary_path, error);
+      return false;
+    }
+    return true;
+  }
+
+  static TextureFormat ChooseFormat(const Image& image, uint8_t usage, const TextureCompressionSettings& settings)
+  {
+    if (usage & normal_usage) return TextureFormat::BC5;
+    if (!(usage & color_usage) || !settings.bc1_for_opaque) return TextureFormat::BC7;
+    for (size_t i = 3; i < image.texels.size(); i += 4)
+      if (image.texels[i] != 255) return TextureFormat::BC7;
+    return TextureFormat::BC1;
+  }
+
+  TextureCompressionStats CompressTextures(Scene& scene, Scheduler& scheduler,
+                                           const TextureCompressionSettings& settings)
+  {
+    Profiler::Scope scope("texture.compress_scene");
+
+    std::vector<uint8_t> usage(scene.images.size(), 0);
+    auto use = [&](int32_t texture, uint8_t flag)
+    {
+      if (texture >= 0 && static_cast<size_t>(texture) < usage.size()) usage[texture] |= flag;
+    };
+    for (const Material& material : scene.materials)
+    {
+      use(material.base_color_texture, color_usage);
+      use(material.emission_texture, color_usage);
+      use(material.normal_texture, normal_usage);
+    }
+
+    std::error_code error;
+    if (!settings.cache_directory.empty()) std::filesystem::create_directories(settings.cache_directory, error);
+
+    // hash, look up and on a miss build the mip chain, per image
+    const size_t count = scene.images.size();
+    std::vector<uint64_t> hashes(count, 0);
+    std::vector<TextureFormat> formats(count, TextureFormat::RGBA8);
+    std::vector<uint8_t> hits(count, 0);
+    std::vector<Texture> sources(count);
+    scene.mip_chains.assign(count, Texture {});
+    scheduler.ParallelFor(static_cast<uint32_t>(count), [&](uint32_t task, uint32_t)
+    {
+      Image& image = scene.images[task];
+      if (!image.Valid()) return;
+
+      const bool srgb = (usage[task] & color_usage) != 0;
+      formats[task] = ChooseFormat(image, usage[task], settings);
+      uint64_t hash = HashBytes(image.texels.data(), image.texels.size());
+      hash = HashCombine(hash, static_cast<uint64_t>(image.width) << 32 | image.height);
+      hash = HashCombine(hash, static_cast<uint64_t>(formats[task]) << 1 | srgb);
+      hashes[task] = HashCombine(hash, encoder_version);
+
+      if (!settings.cache_directory.empty() &&
+          ReadCachedTexture(CachePath(settings.cache_directory, hashes[task]), hashes[task], scene.mip_chains[task]))
+      {
+        hits[task] = 1;
+        image = Image {};
+        return;
+      }
+
+      GenerateMipmaps(std::move(image), srgb, sources[task]);
+      image = Image {};
+    });
+
+    std::vector<CompressionJob> jobs;
+    for (size_t i = 0; i < count; ++i)
+      if (sources[i].Valid()) jobs.push_back({ &sources[i], &scene.mip_chains[i], formats[i] });
+    {
+      Profiler::Scope compress_scope("texture.compress");
+      RunCompressionJobs(jobs, scheduler);
+    }
+
+    TextureCompressionStats stats;
+    std::unordered_set<uint64_t> written;
+    for (size_t i = 0; i < count; ++i)
+    {
+      const Texture& texture = scene.mip_chains[i];
+      if (!texture.Valid()) continue;
+      for (const Image& level : texture.levels)
+        stats.source_bytes += LevelSize(TextureFormat::RGBA8, level.width, level.height);
+      stats.compressed_bytes += texture.Size();
+      stats.cache_hits += hits[i];
+      stats.encoded += !hits[i];
+
+      if (!hits[i] && !settings.cache_directory.empty() && written.insert(hashes[i]).second &&
+          !WriteCachedTexture(CachePath(settings.cache_directory, hashes[i]), hashes[i], texture))
+        DEBUG_WARNING(IO, "Failed to write texture cache entry for image %zu", i);
+    }
+
+    DEBUG_LOG(IO, "Compressed %u textures, %u from the cache, %llu -> %llu bytes", stats.encoded + stats.cache_hits,
+              stats.cache_hits, static_cast<unsigned long long>(stats.source_bytes),
+              static_cast<unsigned long long>(stats.compressed_bytes));
+    return stats;
+  }
+
+} // namespace PathTracer
@@ -0,0 +1,815 @@
+
+#include <VulkanPT/upload.hpp>
+#include <VulkanPT/profiler.hpp>
+#include <VulkanPT/texture_compression.hpp>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+namespace VulkanUtils
+{
+  uint32_t FindMemoryType(vk::PhysicalDevice physical_device, uint32_t type_bits,
+                          vk::MemoryPropertyFlags properties)
+  {
+    vk::PhysicalDeviceMemoryProperties memory_properties = physical_device.getMemoryProperties();
+    for (uint32_t i = 0; i < memory_properties.memoryTypeCount; ++i)
+    {
+      if ((type_bits & (1u << i)) && (memory_properties.memoryTypes[i].propertyFlags & properties) == properties)
+        return i;
+    }
+
+    DEBUG_ERROR(Vulkan, "No memory type matches %s!", vk::to_string(properties).c_str());
+    return 0;
+  }
+
+  DeviceBuffer CreateBuffer(vk::PhysicalDevice physical_device, vk::Device device, vk::DeviceSize size,
+                            vk::BufferUsageFlags usage, vk::MemoryPropertyFlags properties)
+  {
+    DeviceBuffer buffer;
+    buffer.size = size;
+    try
+    {
+      buffer.buffer = device.createBuffer(vk::BufferCreateInfo(vk::BufferCreateFlags(), size, usage,
+                                                               vk::SharingMode::eExclusive));
+      vk::MemoryRequirements requirements = device.getBufferMemoryRequirements(buffer.buffer);
+      buffer.memory = device.allocateMemory(vk::MemoryAllocateInfo(
+        requirements.size, FindMemoryType(physical_device, requirements.memoryTypeBits, properties)));
+      device.bindBufferMemory(buffer.buffer, buffer.memory, 0);
+    }
+    catch (vk::SystemError err)
+    {
+      DEBUG_ERROR(Vulkan, "Failed to create a buffer of %llu bytes: %s",
+                  static_cast<unsigned long long>(size), err.what());
+      DestroyBuffer(device, buffer);
+    }
+    return buffer;
+  }
+
+  void DestroyBuffer(vk::Device device, DeviceBuffer& buffer)
+  {
+    if (buffer.buffer) device.destroyBuffer(buffer.buffer);
+    if (buffer.memory) device.freeMemory(buffer.memory);
+    buffer = DeviceBuffer {};
+  }
+
+  void DestroyImage(vk::Device device, DeviceImage& image)
+  {
+    if (image.view) device.destroyImageView(image.view);
+    if (image.image) device.destroyImage(image.image);
+    if (image.memory) device.freeMemory(image.memory);
+    image = DeviceImage {};
+  }
+
+  UploadRing::UploadRing(vk::PhysicalDevice physical_device, vk::Device in_device, uint32_t queue_family,
+                         vk::Queue in_queue, vk::DeviceSize capacity, uint32_t slot_count)
+    : device{ in_device }, queue{ in_queue }
+  {
+    if (slot_count == 0 || capacity < slot_count)
+    {
+      DEBUG_ERROR(Vulkan, "An upload ring needs at least one slot of one byte!");
+      return;
+    }
+    slot_size = capacity / slot_count;
+
+    staging = CreateBuffer(physical_device, device, slot_size * slot_count, vk::BufferUsageFlagBits::eTransferSrc,
+                           vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent);
+    if (!staging.buffer)
+    {
+      DEBUG_ERROR(Vulkan, "Failed to create the staging buffer of the upload ring!");
+      return;
+    }
+
+    try
+    {
+      mapped = static_cast<uint8_t*>(device.mapMemory(staging.memory, 0, staging.size));
+      command_pool = device.createCommandPool(vk::CommandPoolCreateInfo(
+        vk::CommandPoolCreateFlagBits::eResetCommandBuffer | vk::CommandPoolCreateFlagBits::eTransient, queue_family));
+      std::vector<vk::CommandBuffer> command_buffers = device.allocateCommandBuffers(
+        vk::CommandBufferAllocateInfo(command_pool, vk::CommandBufferLevel::ePrimary, slot_count));
+
+      slots.resize(slot_count);
+      for (uint32_t i = 0; i < slot_count; ++i)
+      {
+        slots[i].command_buffer = command_buffers[i];
+        slots[i].fence = device.createFence(vk::FenceCreateInfo(vk::FenceCreateFlagBits::eSignaled));
+      }
+    }
+    catch (vk::SystemError err)
+    {
+      DEBUG_ERROR(Vulkan, "Failed to set up the upload ring: %s", err.what());
+      Release();
+      return;
+    }
+
+    DEBUG_LOG(Vulkan, "Upload ring with %u slots of %llu bytes", slot_count,
+              static_cast<unsigned long long>(slot_size));
+  }
+
+  UploadRing::~UploadRing()
+  {
+    if (Valid()) Wait();
+    Release();
+  }
+
+  void UploadRing::Release()
+  {
+    for (Slot& slot : slots)
+    {
+      if (slot.fence) device.destroyFence(slot.fence);
+    }
+    slots.clear();
+    if (command_pool) device.destroyCommandPool(command_pool);
+    command_pool = nullptr;
+    if (mapped) device.unmapMemory(staging.memory);
+    mapped = nullptr;
+    DestroyBuffer(device, staging);
+  }
+
+  UploadRing::Slot& UploadRing::Acquire()
+  {
+    Slot& slot = slots[current];
+    if (slot.recording) return slot;
+
+    {
+      Profiler::Scope scope("upload.wait");
+      (void)device.waitForFences(slot.fence, VK_TRUE, UINT64_MAX);
+    }
+    device.resetFences(slot.fence);
+    slot.command_buffer.reset();
+    slot.command_buffer.begin(vk::CommandBufferBeginInfo(vk::CommandBufferUsageFlagBits::eOneTimeSubmit));
+    slot.used = 0;
+    slot.recording = true;
+    return slot;
+  }
+
+  void UploadRing::Submit(Slot& slot)
+  {
+    slot.command_buffer.end();
+
+    vk::SubmitInfo submit_info;
+    submit_info.commandBufferCount = 1;
+    submit_info.pCommandBuffers = &slot.command_buffer;
+    queue.submit(submit_info, slot.fence);
+
+    slot.recording = false;
+    current = (current + 1) % static_cast<uint32_t>(slots.size());
+  }
+
+  void UploadRing::Upload(vk::Buffer destination, vk::DeviceSize offset, const void* data, vk::DeviceSize size)
+  {
+    if (!Valid()) return;
+    std::lock_guard<std::mutex> lock(mutex);
+    const uint8_t* bytes = static_cast<const uint8_t*>(data);
+
+    while (size > 0)
+    {
+      Slot& slot = Acquire();
+      vk::DeviceSize copy_size = std::min(size, slot_size - slot.used);
+      vk::DeviceSize staging_offset = current * slot_size + slot.used;
+
+      std::memcpy(mapped + staging_offset, bytes, copy_size);
+      slot.command_buffer.copyBuffer(staging.buffer, destination,
+                                     vk::BufferCopy(staging_offset, offset, copy_size));
+
+      slot.used += copy_size;
+      bytes += copy_size;
+      offset += copy_size;
+      size -= copy_size;
+      uploaded_bytes += copy_size;
+      if (slot.used == slot_size) Submit(slot);
+    }
+  }
+
+  void UploadRing::UploadImage(vk::Image destination, uint32_t level, uint32_t width, uint32_t height,
+                               const void* data, PathTracer::TextureFormat format)
+  {
+    if (!Valid()) return;
+    std::lock_guard<std::mutex> lock(mutex);
+    const uint8_t* bytes = static_cast<const uint8_t*>(data);
+    const vk::ImageSubresourceRange range(vk::ImageAspectFlagBits::eColor, level, 1, 0, 1);
+
+    // rows of texels or of 4x4 blocks
+    const uint32_t row_texels = PathTracer::BlockCompressed(format) ? 4 : 1;
+    const uint32_t row_count = (height + row_texels - 1) / row_texels;
+    const vk::DeviceSize row_size = PathTracer::LevelSize(format, width, row_texels);
+
+    uint32_t row = 0;
+    while (row < row_count)
+    {
+      Slot& slot = Acquire();
+      // buffer offsets of image copies must be texel aligned, 16 also suits
+      // every optimalBufferCopyOffsetAlignment in practice
+      vk::DeviceSize start = (slot.used + 15) & ~static_cast<vk::DeviceSize>(15);
+      vk::DeviceSize fitting = start < slot_size ? (slot_size - start) / row_size : 0;
+      uint32_t rows = static_cast<uint32_t>(std::min<vk::DeviceSize>(row_count - row, fitting));
+      if (rows == 0)
+      {
+        if (slot.used == 0)
+        {
+          DEBUG_ERROR(Vulkan, "A row of %u texels doesn't fit into an upload slot!", width);
+          return;
+        }
+        Submit(slot);
+        continue;
+      }
+
+      if (row == 0)
+      {
+        vk::ImageMemoryBarrier barrier(vk::AccessFlags(), vk::AccessFlagBits::eTransferWrite,
+                                       vk::ImageLayout::eUndefined, vk::ImageLayout::eTransferDstOptimal,
+                                       VK_QUEUE_FAMILY_IGNORED, VK_QUEUE_FAMILY_IGNORED, destination, range);
+        slot.command_buffer.pipelineBarrier(vk::PipelineStageFlagBits::eTopOfPipe, vk::PipelineStageFlagBits::eTransfer,
+                                            vk::DependencyFlags(), nullptr, nullptr, barrier);
+      }
+
+      vk::DeviceSize staging_offset = current * slot_size + start;
+      vk::DeviceSize size = row_size * rows;
+      std::memcpy(mapped + staging_offset, bytes, size);
+      slot.command_buffer.copyBufferToImage(
+        staging.buffer, destination, vk::ImageLayout::eTransferDstOptimal,
+        vk::BufferImageCopy(staging_offset, 0, 0, vk::ImageSubresourceLayers(vk::ImageAspectFlagBits::eColor, level, 0, 1),
+                            vk::Offset3D(0, static_cast<int32_t>(row * row_texels), 0),
+                            vk::Extent3D(width, std::min((row + rows) * row_texels, height) - row * row_texels, 1)));
+
+      slot.used = start + size;
+      bytes += size;
+      row += rows;
+      uploaded_bytes += size;
+
+      if (row == row_count)
+      {
+        vk::ImageMemoryBarrier barrier(vk::AccessFlagBits::eTransferWrite, vk::AccessFlagBits::eShaderRead,
+                                       vk::ImageLayout::eTransferDstOptimal, vk::ImageLayout::eShaderReadOnlyOptimal,
+                                       VK_QUEUE_FAMILY_IGNORED, VK_QUEUE_FAMILY_IGNORED, destination, range);
+        slot.command_buffer.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer,
+                                            vk::PipelineStageFlagBits::eAllCommands, vk::DependencyFlags(), nullptr,
+                                            nullptr, barrier);
+      }
+      if (slot.used == slot_size) Submit(slot);
+    }
+  }
+
+  void UploadRing::PrepareImage(vk::Image destination, uint32_t levels, vk::ImageLayout layout)
+  {
+    if (!Valid()) return;
+    std::lock_guard<std::mutex> lock(mutex);
+    Slot& slot = Acquire();
+    vk::ImageMemoryBarrier barrier(vk::AccessFlags(),
+                                   vk::AccessFlagBits::eTransferWrite | vk::AccessFlagBits::eShaderRead,
+                                   vk::ImageLayout::eUndefined, layout, VK_QUEUE_FAMILY_IGNORED,
+                                   VK_QUEUE_FAMILY_IGNORED, destination,
+                                   vk::ImageSubresourceRange(vk::ImageAspectFlagBits::eColor, 0, levels, 0, 1));
+    slot.command_buffer.pipelineBarrier(vk::PipelineStageFlagBits::eTopOfPipe, vk::PipelineStageFlagBits::eAllCommands,
+                                        vk::DependencyFlags(), nullptr, nullptr, barrier);
+  }
+
+  void UploadRing::UploadImageRegion(vk::Image destination, vk::Offset2D offset, uint32_t width, uint32_t height,
+                                     const void* data)
+  {
+    if (!Valid()) return;
+    std::lock_guard<std::mutex> lock(mutex);
+    const vk::DeviceSize size = static_cast<vk::DeviceSize>(width) * height * 4;
+    if (size > slot_size)
+    {
+      DEBUG_ERROR(Vulkan, "A %ux%u region doesn't fit into an upload slot!", width, height);
+      return;
+    }
+
+    Slot* slot = &Acquire();
+    vk::DeviceSize start = (slot->used + 15) & ~static_cast<vk::DeviceSize>(15);
+    if (start + size > slot_size)
+    {
+      Submit(*slot);
+      slot = &Acquire();
+      start = 0;
+    }
+
+    vk::DeviceSize staging_offset = current * slot_size + start;
+    std::memcpy(mapped + staging_offset, data, size);
+    slot->command_buffer.copyBufferToImage(
+      staging.buffer, destination, vk::ImageLayout::eGeneral,
+      vk::BufferImageCopy(staging_offset, 0, 0, vk::ImageSubresourceLayers(vk::ImageAspectFlagBits::eColor, 0, 0, 1),
+                          vk::Offset3D(offset.x, offset.y, 0), vk::Extent3D(width, height, 1)));
+
+    // the layout stays, only the writes are made visible
+    vk::ImageMemoryBarrier barrier(vk::AccessFlagBits::eTransferWrite, vk::AccessFlagBits::eShaderRead,
+                                   vk::ImageLayout::eGeneral, vk::ImageLayout::eGeneral, VK_QUEUE_FAMILY_IGNORED,
+                                   VK_QUEUE_FAMILY_IGNORED, destination,
+                                   vk::ImageSubresourceRange(vk::ImageAspectFlagBits::eColor, 0, 1, 0, 1));
+    slot->command_buffer.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer,
+                                         vk::PipelineStageFlagBits::eAllCommands, vk::DependencyFlags(), nullptr,
+                                         nullptr, barrier);
+
+    slot->used = start + size;
+    uploaded_bytes += size;
+    if (slot->used == slot_size) Submit(*slot);
+  }
+
+  void UploadRing::Flush()
+  {
+    if (!Valid()) return;
+    std::lock_guard<std::mutex> lock(mutex);
+    if (slots[current].recording) Submit(slots[current]);
+  }
+
+  void UploadRing::Wait()
+  {
+    if (!Valid()) return;
+    Flush();
+
+    std::lock_guard<std::mutex> lock(mutex);
+    for (Slot& slot : slots) (void)device.waitForFences(slot.fence, VK_TRUE, UINT64_MAX);
+  }
+
+  PathTracer::SceneStreamFunction StreamToDevice(vk::PhysicalDevice physical_device, vk::Device device,
+                                                 UploadRing& ring, SceneBuffers& buffers)
+  {
+    return [physical_device, device, &ring, &buffers](PathTracer::SceneSection section, const void* data,
+                                                      uint64_t offset, uint64_t size, uint64_t total_size)
+    {
+      if (section == PathTracer::SceneSection::Textures) return;
+
+      DeviceBuffer& buffer = buffers.sections[static_cast<uint32_t>(section)];
+      if (!buffer.buffer)
+      {
+        vk::BufferUsageFlags usage = vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eTransferDst;
+        if (section == PathTracer::SceneSection::Positions || section == PathTracer::SceneSection::QuantizedPositions)
+          usage |= vk::BufferUsageFlagBits::eVertexBuffer;
+        if (section == PathTracer::SceneSection::Indices) usage |= vk::BufferUsageFlagBits::eIndexBuffer;
+        buffer = CreateBuffer(physical_device, device, total_size, usage, vk::MemoryPropertyFlagBits::eDeviceLocal);
+      }
+
+      if (buffer.buffer) ring.Upload(buffer.buffer, offset, data, size);
+    };
+  }
+
+  void DestroySceneBuffers(vk::Device device, SceneBuffers& buffers)
+  {
+    for (DeviceBuffer& buffer : buffers.sections) DestroyBuffer(device, buffer);
+  }
+
+  vk::Format TextureFormatFor(PathTracer::TextureFormat format, bool srgb)
+  {
+    switch (format)
+    {
+      case PathTracer::TextureFormat::BC1: return srgb ? vk::Format::eBc1RgbSrgbBlock : vk::Format::eBc1RgbUnormBlock;
+      case PathTracer::TextureFormat::BC5: return vk::Format::eBc5UnormBlock;
+      case PathTracer::TextureFormat::BC7: return srgb ? vk::Format::eBc7SrgbBlock : vk::Format::eBc7UnormBlock;
+      default: return srgb ? vk::Format::eR8G8B8A8Srgb : vk::Format::eR8G8B8A8Unorm;
+    }
+  }
+
+  bool SupportsTextureFormat(vk::PhysicalDevice physical_device, PathTracer::TextureFormat format, bool srgb)
+  {
+    vk::FormatProperties properties = physical_device.getFormatProperties(TextureFormatFor(format, srgb));
+    const vk::FormatFeatureFlags required = vk::FormatFeatureFlagBits::eSampledImage |
+                                            vk::FormatFeatureFlagBits::eSampledImageFilterLinear |
+                                            vk::FormatFeatureFlagBits::eTransferDst;
+    return (properties.optimalTilingFeatures & required) == required;
+  }
+
+  DeviceImage CreateTexture(vk::PhysicalDevice physical_device, vk::Device device, UploadRing& ring,
+                            const PathTracer::Texture& texture)
+  {
+    DeviceImage result;
+    if (!texture.Valid()) return result;
+
+    if (PathTracer::BlockCompressed(texture.format) &&
+        !SupportsTextureFormat(physical_device, texture.format, texture.srgb))
+    {
+      DEBUG_WARNING(Vulkan, "%s is not supported, uploading decoded texels",
+                    vk::to_string(TextureFormatFor(texture.format, texture.srgb)).c_str());
+      PathTracer::Texture decoded;
+      PathTracer::DecompressTexture(texture, decoded);
+      return CreateTexture(physical_device, device, ring, decoded);
+    }
+
+    vk::Format format = TextureFormatFor(texture.format, texture.srgb);
+    vk::ImageSubresourceRange range(vk::ImageAspectFlagBits::eColor, 0, texture.LevelCount(), 0, 1);
+    try
+    {
+      result.image = device.createImage(vk::ImageCreateInfo(
+        vk::ImageCreateFlags(), vk::ImageType::e2D, format, vk::Extent3D(texture.getWidth(), texture.getHeight(), 1),
+        texture.LevelCount(), 1, vk::SampleCountFlagBits::e1, vk::ImageTiling::eOptimal,
+        vk::ImageUsageFlagBits::eSampled | vk::ImageUsageFlagBits::eTransferDst));
+      vk::MemoryRequirements requirements = device.getImageMemoryRequirements(result.image);
+      result.memory = device.allocateMemory(vk::MemoryAllocateInfo(
+        requirements.size, FindMemoryType(physical_device, requirements.memoryTypeBits,
+                                          vk::MemoryPropertyFlagBits::eDeviceLocal)));
+      device.bindImageMemory(result.image, result.memory, 0);
+      result.view = device.createImageView(vk::ImageViewCreateInfo(vk::ImageViewCreateFlags(), result.image,
+                                                                   vk::ImageViewType::e2D, format,
+                                                                   vk::ComponentMapping(), range));
+    }
+    catch (vk::SystemError err)
+    {
+      DEBUG_ERROR(Vulkan, "Failed to create a %ux%u texture: %s", texture.getWidth(), texture.getHeight(), err.what());
+      DestroyImage(device, result);
+      return result;
+    }
+
+    result.levels = texture.LevelCount();
+    for (uint32_t level = 0; level < texture.LevelCount(); ++level)
+    {
+      const PathTracer::Image& image = texture.levels[level];
+      ring.UploadImage(result.image, level, image.width, image.height, image.texels.data(), texture.format);
+    }
+    return result;
+  }
+
+  VirtualTexturePool CreateVirtualTexturePool(vk::PhysicalDevice physical_device, vk::Device device, UploadRing& ring,
+                                              const PathTracer::VirtualTextureSettings& settings)
+  {
+    VirtualTexturePool pool;
+    uint32_t columns = static_cast<uint32_t>(std::ceil(std::sqrt(static_cast<double>(settings.pool_tiles))));
+    uint32_t rows = (settings.pool_tiles + columns - 1) / columns;
+    uint32_t width = columns * PathTracer::virtual_tile_size;
+    uint32_t height = rows * PathTracer::virtual_tile_size;
+
+    uint32_t max_size = physical_device.getProperties().limits.maxImageDimension2D;
+    if (width > max_size || height > max_size)
+    {
+      DEBUG_ERROR(Vulkan, "A pool of %u tiles needs a %ux%u image, the device allows %u", settings.pool_tiles, width,
+                  height, max_size);
+      return pool;
+    }
+
+    const vk::Format format = vk::Format::eR8G8B8A8Unorm;
+    try
+    {
+      pool.tiles.image = device.createImage(vk::ImageCreateInfo(
+        vk::ImageCreateFlags(), vk::ImageType::e2D, format, vk::Extent3D(width, height, 1), 1, 1,
+        vk::SampleCountFlagBits::e1, vk::ImageTiling::eOptimal,
+        vk::ImageUsageFlagBits::eSampled | vk::ImageUsageFlagBits::eTransferDst));
+      vk::MemoryRequirements requirements = device.getImageMemoryRequirements(pool.tiles.image);
+      pool.tiles.memory = device.allocateMemory(vk::MemoryAllocateInfo(
+        requirements.size, FindMemoryType(physical_device, requirements.memoryTypeBits,
+                                          vk::MemoryPropertyFlagBits::eDeviceLocal)));
+      device.bindImageMemory(pool.tiles.image, pool.tiles.memory, 0);
+      pool.tiles.view = device.createImageView(vk::ImageViewCreateInfo(
+        vk::ImageViewCreateFlags(), pool.tiles.image, vk::ImageViewType::e2D, format, vk::ComponentMapping(),
+        vk::ImageSubresourceRange(vk::ImageAspectFlagBits::eColor, 0, 1, 0, 1)));
+    }
+    catch (vk::SystemError err)
+    {
+      DEBUG_ERROR(Vulkan, "Failed to create the virtual texture pool: %s", err.what());
+      DestroyImage(device, pool.tiles);
+      return pool;
+    }
+
+    pool.tiles.levels = 1;
+    pool.columns = columns;
+    ring.PrepareImage(pool.tiles.image, 1, vk::ImageLayout::eGeneral);
+    return pool;
+  }
+
+  PathTracer::VirtualTextureCache::TileUpload UploadTiles(UploadRing& ring, const VirtualTexturePool& pool)
+  {
+    vk::Image image = pool.tiles.image;
+    uint32_t columns = pool.columns;
+    return [&ring, image, columns](uint32_t slot, const uint8_t* tile)
+    {
+      vk::Offset2D offset(static_cast<int32_t>((slot % columns) * PathTracer::virtual_tile_size),
+                          static_cast<int32_t>((slot / columns) * PathTracer::virtual_tile_size));
+      ring.UploadImageRegion(image, offset, PathTracer::virtual_tile_size, PathTracer::virtual_tile_size, tile);
+    };
+  }
+
+  void UpdateVirtualTexturePool(vk::PhysicalDevice physical_device, vk::Device device, UploadRing& ring,
+                                VirtualTexturePool& pool, PathTracer::VirtualTextureCache& cache)
+  {
+    const vk::BufferUsageFlags usage = vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eTransferDst;
+    if (!pool.page_table.buffer && cache.getPageCount() > 0)
+    {
+      pool.page_table = CreateBuffer(physical_device, device, cache.getPageCount() * sizeof(uint32_t), usage,
+                                     vk::MemoryPropertyFlagBits::eDeviceLocal);
+      pool.descriptors = CreateBuffer(physical_device, device,
+                                      cache.getDescriptors().size() * sizeof(PathTracer::VirtualTextureDescriptor),
+                                      usage, vk::MemoryPropertyFlagBits::eDeviceLocal);
+      if (pool.descriptors.buffer)
+        ring.Upload(pool.descriptors.buffer, 0, cache.getDescriptors().data(), pool.descriptors.size);
+    }
+    if (!pool.page_table.buffer) return;
+
+    uint32_t first, count;
+    if (cache.TakeDirtyRange(first, count))
+      ring.Upload(pool.page_table.buffer, first * sizeof(uint32_t), &cache.getPageTable()[first],
+                  count * sizeof(uint32_t));
+  }
+
+  void DestroyVirtualTexturePool(vk::Device device, VirtualTexturePool& pool)
+  {
+    DestroyImage(device, pool.tiles);
+    DestroyBuffer(device, pool.page_table);
+    DestroyBuffer(device, pool.descriptors);
+    pool.columns = 0;
+  }
+
+  EnvironmentBuffers CreateEnvironmentBuffers(vk::PhysicalDevice physical_device, vk::Device device, UploadRing& ring,
+                                              const PathTracer::EnvironmentLight& light)
+  {
+    EnvironmentBuffers buffers;
+    if (!light.Valid()) return buffers;
+
+    const PathTracer::EnvironmentMap& map = light.getMap();
+    std::vector<glm::vec4> radiance(map.texels.size());
+    for (size_t i = 0; i < radiance.size(); ++i) radiance[i] = glm::vec4(map.texels[i] * light.getIntensity(), 0.0f);
+
+    const vk::BufferUsageFlags usage = vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eTransferDst;
+    const vk::DeviceSize sizes[] = { radiance.size() * sizeof(glm::vec4),
+                                     light.getMarginal().size() * sizeof(PathTracer::AliasEntry),
+                                     light.getConditional().size() * sizeof(PathTracer::AliasEntry) };
+    const void* data[] = { radiance.data(), light.getMarginal().data(), light.getConditional().data() };
+    DeviceBuffer* targets[] = { &buffers.radiance, &buffers.marginal, &buffers.conditional };
+    for (int i = 0; i < 3; ++i)
+    {
+      *targets[i] = CreateBuffer(physical_device, device, sizes[i], usage, vk::MemoryPropertyFlagBits::eDeviceLocal);
+      if (!targets[i]->buffer)
+      {
+        DestroyEnvironmentBuffers(device, buffers);
+        return buffers;
+      }
+      ring.Upload(targets[i]->buffer, 0, data[i], sizes[i]);
+    }
+    return buffers;
+  }
+
+  void DestroyEnvironmentBuffers(vk::Device device, EnvironmentBuffers& buffers)
+  {
+    DestroyBuffer(device, buffers.radiance);
+    DestroyBuffer(device, buffers.marginal);
+    DestroyBuffer(device, buffers.conditional);
+  }
+
+  LightBVHBuffers CreateLightBVHBuffers(vk::PhysicalDevice physical_device, vk::Device device, UploadRing& ring,
+                                        const std::vector<PathTracer::Light>& lights,
+                                        const PathTracer::LightBVH& bvh)
+  {
+    LightBVHBuffers buffers;
+    if (bvh.getNodes().empty()) return buffers;
+
+    const vk::BufferUsageFlags usage = vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eTransferDst;
+    const vk::DeviceSize sizes[] = { lights.size() * sizeof(PathTracer::Light),
+                                     bvh.getNodes().size() * sizeof(PathTracer::LightBVHNode),
+                                     bvh.getLightLeaves().size() * sizeof(uint32_t) };
+    const void* data[] = { lights.data(), bvh.getNodes().data(), bvh.getLightLeaves().data() };
+    DeviceBuffer* targets[] = { &buffers.lights, &buffers.nodes, &buffers.light_leaves };
+    for (int i = 0; i < 3; ++i)
+    {
+      *targets[i] = CreateBuffer(physical_device, device, sizes[i], usage, vk::MemoryPropertyFlagBits::eDeviceLocal);
+      if (!targets[i]->buffer)
+      {
+        DestroyLightBVHBuffers(device, buffers);
+        return buffers;
+      }
+      ring.Upload(targets[i]->buffer, 0, data[i], sizes[i]);
+    }
+    return buffers;
+  }
+
+  void UpdateLightBVHBuffers(UploadRing& ring, LightBVHBuffers& buffers, const std::vector<PathTracer::Light>& lights,
+                             const PathTracer::LightBVH& bvh)
+  {
+    vk::DeviceSize light_size = lights.size() * sizeof(PathTracer::Light);
+    vk::DeviceSize node_size = bvh.getNodes().size() * sizeof(PathTracer::LightBVHNode);
+    if (!buffers.lights.buffer || light_size != buffers.lights.size || node_size != buffers.nodes.size)
+    {
+      DEBUG_ERROR(Vulkan, "Light BVH buffers don't match the refitted tree, rebuild them instead");
+      return;
+    }
+    ring.Upload(buffers.lights.buffer, 0, lights.data(), light_size);
+    ring.Upload(buffers.nodes.buffer, 0, bvh.getNodes().data(), node_size);
+  }
+
+  void DestroyLightBVHBuffers(vk::Device device, LightBVHBuffers& buffers)
+  {
+    DestroyBuffer(device, buffers.lights);
+    DestroyBuffer(device, buffers.nodes);
+    DestroyBuffer(device, buffers.light_leaves);
+  }
+
+  ReSTIRBuffers CreateReSTIRBuffers(vk::PhysicalDevice physical_device, vk::Device device, uint32_t width,
+                                    uint32_t height, uint32_t frames_in_flight)
+  {
+    ReSTIRBuffers buffers;
+    const uint32_t sets = PathTracer::ReSTIRBufferSets(frames_in_flight);
+    const vk::DeviceSize pixels = static_cast<vk::DeviceSize>(width) * height;
+    if (pixels == 0) return buffers;
+
+    const vk::BufferUsageFlags usage = vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eTransferDst;
+    for (uint32_t i = 0; i < sets * 4; ++i)
+    {
+      bool reservoir = i < sets * 3;
+      vk::DeviceSize size = pixels * (reservoir ? sizeof(PathTracer::Reservoir) : sizeof(PathTracer::ReSTIRSurface));
+      DeviceBuffer buffer = CreateBuffer(physical_device, device, size, usage,
+                                         vk::MemoryPropertyFlagBits::eDeviceLocal);
+      if (!buffer.buffer)
+      {
+        DestroyReSTIRBuffers(device, buffers);
+        return buffers;
+      }
+      (reservoir ? buffers.reservoirs : buffers.surfaces).push_back(buffer);
+    }
+    return buffers;
+  }
+
+  void DestroyReSTIRBuffers(vk::Device device, ReSTIRBuffers& buffers)
+  {
+    for (DeviceBuffer& buffer : buffers.reservoirs) DestroyBuffer(device, buffer);
+    for (DeviceBuffer& buffer : buffers.surfaces) DestroyBuffer(device, buffer);
+    buffers.reservoirs.clear();
+    buffers.surfaces.clear();
+  }
+
+  SamplerBuffers CreateSamplerBuffers(vk::PhysicalDevice physical_device, vk::Device device, UploadRing& ring,
+                                      const PathTracer::SamplerTables& tables)
+  {
+    SamplerBuffers buffers;
+    if (tables.sobol.empty() || tables.blue_noise.empty()) return buffers;
+
+    const vk::BufferUsageFlags usage = vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eTransferDst;
+    const vk::DeviceSize sizes[] = { tables.sobol.size() * sizeof(uint32_t),
+                                     tables.blue_noise.size() * sizeof(uint32_t) };
+    const void* data[] = { tables.sobol.data(), tables.blue_noise.data() };
+    DeviceBuffer* targets[] = { &buffers.sobol, &buffers.blue_noise };
+    for (int i = 0; i < 2; ++i)
+    {
+      *targets[i] = CreateBuffer(physical_device, device, sizes[i], usage, vk::MemoryPropertyFlagBits::eDeviceLocal);
+      if (!targets[i]->buffer)
+      {
+        DestroySamplerBuffers(device, buffers);
+        return buffers;
+      }
+      ring.Upload(targets[i]->buffer, 0, data[i], sizes[i]);
+    }
+    return buffers;
+  }
+
+  void DestroySamplerBuffers(vk::Device device, SamplerBuffers& buffers)
+  {
+    DestroyBuffer(device, buffers.sobol);
+    DestroyBuffer(device, buffers.blue_noise);
+  }
+
+  DenoiserBuffers CreateDenoiserBuffers(vk::PhysicalDevice physical_device, vk::Device device, uint32_t width,
+                                        uint32_t height)
+  {
+    DenoiserBuffers buffers;
+    const vk::DeviceSize pixels = static_cast<vk::DeviceSize>(width) * height;
+    if (pixels == 0) return buffers;
+
+    const vk::BufferUsageFlags usage = vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eTransferDst;
+    DeviceBuffer* planes[] = { buffers.guides, buffers.history, buffers.moments, buffers.filter };
+    const vk::DeviceSize texel_sizes[] = { sizeof(PathTracer::DenoiseGuide), sizeof(float) * 4, sizeof(float) * 2,
+                                           sizeof(float) * 4 };
+    for (int plane = 0; plane < 4; ++plane)
+    {
+      for (int i = 0; i < 2; ++i)
+      {
+        planes[plane][i] = CreateBuffer(physical_device, device, pixels * texel_sizes[plane], usage,
+                                        vk::MemoryPropertyFlagBits::eDeviceLocal);
+        if (!planes[plane][i].buffer)
+        {
+          DestroyDenoiserBuffers(device, buffers);
+          return buffers;
+        }
+      }
+    }
+    return buffers;
+  }
+
+  void DestroyDenoiserBuffers(vk::Device device, DenoiserBuffers& buffers)
+  {
+    for (int i = 0; i < 2; ++i)
+    {
+      DestroyBuffer(device, buffers.guides[i]);
+      DestroyBuffer(device, buffers.history[i]);
+      DestroyBuffer(device, buffers.moments[i]);
+      DestroyBuffer(device, buffers.filter[i]);
+    }
+  }
+
+  RadianceCacheBuffers CreateRadianceCacheBuffers(vk::PhysicalDevice physical_device, vk::Device device,
+                                                  UploadRing& ring, const PathTracer::RadianceCache& cache)
+  {
+    RadianceCacheBuffers buffers;
+    const std::vector<PathTracer::RadianceCacheEntry>& entries = cache.getEntries();
+    if (entries.empty()) return buffers;
+
+    const vk::BufferUsageFlags usage = vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eTransferDst;
+    const vk::DeviceSize entry_size = entries.size() * sizeof(PathTracer::RadianceCacheEntry);
+    const vk::DeviceSize sums_size = entries.size() * sizeof(uint32_t) * 4;
+    buffers.entries = CreateBuffer(physical_device, device, entry_size, usage,
+                                   vk::MemoryPropertyFlagBits::eDeviceLocal);
+    buffers.sums = CreateBuffer(physical_device, device, sums_size, usage, vk::MemoryPropertyFlagBits::eDeviceLocal);
+    if (!buffers.entries.buffer || !buffers.sums.buffer)
+    {
+      DestroyRadianceCacheBuffers(device, buffers);
+      return buffers;
+    }
+    ring.Upload(buffers.entries.buffer, 0, entries.data(), entry_size);
+
+    // zeros in pieces rather than one copy of the whole table
+    const std::vector<uint32_t> zeros(16384, 0);
+    const vk::DeviceSize piece = zeros.size() * sizeof(uint32_t);
+    for (vk::DeviceSize offset = 0; offset < sums_size; offset += piece)
+      ring.Upload(buffers.sums.buffer, offset, zeros.data(), std::min(piece, sums_size - offset));
+    return buffers;
+  }
+
+  void DestroyRadianceCacheBuffers(vk::Device device, RadianceCacheBuffers& buffers)
+  {
+    DestroyBuffer(device, buffers.entries);
+    DestroyBuffer(device, buffers.sums);
+  }
+
+  DeviceBuffer CreatePathCounterBuffer(vk::PhysicalDevice physical_device, vk::Device device, UploadRing& ring)
+  {
+    const vk::BufferUsageFlags usage = vk::BufferUsageFlagBits::eStorageBuffer |
+                                       vk::BufferUsageFlagBits::eTransferDst | vk::BufferUsageFlagBits::eTransferSrc;
+    const PathTracer::PathCounters counters;
+    DeviceBuffer buffer = CreateBuffer(physical_device, device, sizeof(counters), usage,
+                                       vk::MemoryPropertyFlagBits::eDeviceLocal);
+    if (buffer.buffer) ring.Upload(buffer.buffer, 0, &counters, sizeof(counters));
+    return buffer;
+  }
+
+  VolumeBuffers CreateVolumeBuffers(vk::PhysicalDevice physical_device, vk::Device device, UploadRing& ring,
+                                    const PathTracer::SparseVolume& volume)
+  {
+    VolumeBuffers buffers;
+    if (volume.getCells().Empty() || volume.getBrickCount() == 0) return buffers;
+
+    const vk::BufferUsageFlags usage = vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eTransferDst;
+    const vk::DeviceSize sizes[] = { volume.getCells().SizeBytes(), volume.getMajorants().SizeBytes(),
+                                     volume.getBricks().SizeBytes(), volume.getPageTable().size() * sizeof(uint32_t),
+                                     std::max<vk::DeviceSize>(volume.getPool().size(), 4) };
+    const void* data[] = { volume.getCells().data, volume.getMajorants().data, volume.getBricks().data,
+                           volume.getPageTable().data(), volume.getPool().data() };
+    DeviceBuffer* targets[] = { &buffers.cells, &buffers.majorants, &buffers.bricks, &buffers.page_table,
+                                &buffers.pool };
+    for (int i = 0; i < 5; ++i)
+    {
+      *targets[i] = CreateBuffer(physical_device, device, sizes[i], usage, vk::MemoryPropertyFlagBits::eDeviceLocal);
+      if (!targets[i]->buffer)
+      {
+        DestroyVolumeBuffers(device, buffers);
+        return buffers;
+      }
+      // the pool may be empty with a budget of zero bricks
+      if (i < 4) ring.Upload(targets[i]->buffer, 0, data[i], sizes[i]);
+      else if (!volume.getPool().empty()) ring.Upload(targets[i]->buffer, 0, data[i], volume.getPool().size());
+    }
+    return buffers;
+  }
+
+  void UpdateVolumeBuffers(UploadRing& ring, VolumeBuffers& buffers, const PathTracer::SparseVolume& volume)
+  {
+    if (!buffers.page_table.buffer || volume.getLoadedSlots().empty()) return;
+    ring.Upload(buffers.page_table.buffer, 0, volume.getPageTable().data(),
+                volume.getPageTable().size() * sizeof(uint32_t));
+    for (uint32_t slot : volume.getLoadedSlots())
+    {
+      const vk::DeviceSize offset = static_cast<vk::DeviceSize>(slot) * PathTracer::volume_brick_voxels;
+      ring.Upload(buffers.pool.buffer, offset, volume.getPool().data() + offset, PathTracer::volume_brick_voxels);
+    }
+  }
+
+  void DestroyVolumeBuffers(vk::Device device, VolumeBuffers& buffers)
+  {
+    DestroyBuffer(device, buffers.cells);
+    DestroyBuffer(device, buffers.majorants);
+    DestroyBuffer(device, buffers.bricks);
+    DestroyBuffer(device, buffers.page_table);
+    DestroyBuffer(device, buffers.pool);
+  }
+
+  CurveBuffers CreateCurveBuffers(vk::PhysicalDevice physical_device, vk::Device device, UploadRing& ring,
+                                  const PathTracer::CurveBVH& bvh)
+  {
+    CurveBuffers buffers;
+    if (bvh.getNodes().empty()) return buffers;
+
+    const std::vector<PathTracer::GpuCurvePiece> pieces = bvh.GpuPieces();
+    const vk::BufferUsageFlags usage = vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eTransferDst;
+    const vk::DeviceSize node_size = bvh.getNodes().size() * sizeof(PathTracer::BVHNode);
+    const vk::DeviceSize piece_size = pieces.size() * sizeof(PathTracer::GpuCurvePiece);
+    buffers.nodes = CreateBuffer(physical_device, device, node_size, usage, vk::MemoryPropertyFlagBits::eDeviceLocal);
+    buffers.pieces = CreateBuffer(physical_device, device, piece_size, usage, vk::MemoryPropertyFlagBits::eDeviceLocal);
+    if (!buffers.nodes.buffer || !buffers.pieces.buffer)
+    {
+      DestroyCurveBuffers(device, buffers);
+      return buffers;
+    }
+    ring.Upload(buffers.nodes.buffer, 0, bvh.getNodes().data(), node_size);
+    ring.Upload(buffers.pieces.buffer, 0, pieces.data(), piece_size);
+    return buffers;
+  }
+
+  void DestroyCurveBuffers(vk::Device device, CurveBuffers& buffers)
+  {
+    DestroyBuffer(device, buffers.nodes);
+    DestroyBuffer(device, buffers.pieces);
+  }
+
+} // namespace VulkanUtils
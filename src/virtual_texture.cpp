@@ -0,0 +1,518 @@
+
+#include <VulkanPT/virtual_texture.hpp>
+#include <VulkanPT/debug.hpp>
+#include <VulkanPT/profiler.hpp>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+namespace PathTracer
+{
+  static const char tile_magic[8] = { 'V', 'P', 'T', 'T', 'I', 'L', 'E', 'S' };
+  static constexpr uint32_t tile_file_version = 1;
+
+  struct TileFileHeader
+  {
+    char magic[8];
+    uint32_t version;
+    uint32_t width;
+    uint32_t height;
+    uint32_t level_count;
+    uint32_t srgb;
+    uint32_t reserved;
+  };
+
+  static uint32_t Wrap(int64_t value, uint32_t size)
+  {
+    int64_t wrapped = value % static_cast<int64_t>(size);
+    return static_cast<uint32_t>(wrapped < 0 ? wrapped + size : wrapped);
+  }
+
+  static uint32_t Ctz(uint32_t bits)
+  {
+#if defined(_MSC_VER)
+    unsigned long index;
+    _BitScanForward(&index, bits);
+    return static_cast<uint32_t>(index);
+#else
+    return static_cast<uint32_t>(__builtin_ctz(bits));
+#endif
+  }
+
+  void ExtractTile(const Image& level, uint32_t page_x, uint32_t page_y, uint8_t* tile)
+  {
+    const int64_t origin_x = static_cast<int64_t>(page_x) * virtual_page_size - virtual_page_border;
+    const int64_t origin_y = static_cast<int64_t>(page_y) * virtual_page_size - virtual_page_border;
+    for (uint32_t y = 0; y < virtual_tile_size; ++y)
+    {
+      const uint8_t* row = &level.texels[static_cast<size_t>(Wrap(origin_y + y, level.height)) * level.width * 4];
+      for (uint32_t x = 0; x < virtual_tile_size; ++x)
+        std::memcpy(tile + (y * virtual_tile_size + x) * 4, row + Wrap(origin_x + x, level.width) * 4, 4);
+    }
+  }
+
+  bool TileFile::Write(const std::string& path, const Texture& texture)
+  {
+    if (!texture.Valid() || BlockCompressed(texture.format)) return false;
+
+    TileFileHeader header {};
+    std::memcpy(header.magic, tile_magic, sizeof(tile_magic));
+    header.version = tile_file_version;
+    header.width = texture.getWidth();
+    header.height = texture.getHeight();
+    header.level_count = texture.LevelCount();
+    header.srgb = texture.srgb;
+
+    std::string temporary_path = path + ".tmp";
+    FILE* output = std::fopen(temporary_path.c_str(), "wb");
+    if (!output)
+    {
+      DEBUG_ERROR(IO, "Failed to create tile file %s", temporary_path.c_str());
+      return false;
+    }
+
+    std::vector<uint8_t> tile(virtual_tile_bytes);
+    bool success = std::fwrite(&header, sizeof(header), 1, output) == 1;
+    for (uint32_t level = 0; success && level < texture.LevelCount(); ++level)
+    {
+      for (uint32_t y = 0; success && y < PagesAcross(header.height, level); ++y)
+      {
+        for (uint32_t x = 0; success && x < PagesAcross(header.width, level); ++x)
+        {
+          ExtractTile(texture.levels[level], x, y, tile.data());
+          success = std::fwrite(tile.data(), 1, tile.size(), output) == tile.size();
+        }
+      }
+    }
+    success = std::fclose(output) == 0 && success;
+
+    std::error_code error;
+    if (success) std::filesystem::rename(temporary_path, path, error);
+    if (!success || error)
+    {
+      DEBUG_ERROR(IO, "Failed to write tile file %s", path.c_str());
+      std::filesystem::remove(temporary_path, error);
+      return false;
+    }
+    return true;
+  }
+
+  bool TileFile::Open(const std::string& path)
+  {
+    if (!file.Open(path) || file.getSize() < sizeof(TileFileHeader)) return false;
+
+    TileFileHeader header;
+    std::memcpy(&header, file.getData(), sizeof(header));
+    if (std::memcmp(header.magic, tile_magic, sizeof(tile_magic)) != 0 || header.version != tile_file_version ||
+        header.level_count == 0 || header.level_count > virtual_max_levels)
+    {
+      DEBUG_ERROR(IO, "%s is not a tile file of version %u", path.c_str(), tile_file_version);
+      file.Close();
+      return false;
+    }
+
+    width = header.width;
+    height = header.height;
+    level_count = header.level_count;
+    srgb = header.srgb != 0;
+    level_offsets.resize(level_count + 1);
+    level_offsets[0] = sizeof(header);
+    for (uint32_t level = 0; level < level_count; ++level)
+    {
+      uint64_t pages = static_cast<uint64_t>(PagesAcross(width, level)) * PagesAcross(height, level);
+      level_offsets[level + 1] = level_offsets[level] + pages * virtual_tile_bytes;
+    }
+
+    if (level_offsets.back() > file.getSize())
+    {
+      DEBUG_ERROR(IO, "Tile file %s is truncated", path.c_str());
+      file.Close();
+      return false;
+    }
+    return true;
+  }
+
+  bool TileFile::ReadTile(uint32_t level, uint32_t page_x, uint32_t page_y, uint8_t* tile) const
+  {
+    if (level >= level_count || page_x >= PagesAcross(width, level) || page_y >= PagesAcross(height, level))
+      return false;
+    uint64_t offset = level_offsets[level] +
+                      (static_cast<uint64_t>(page_y) * PagesAcross(width, level) + page_x) * virtual_tile_bytes;
+    std::memcpy(tile, file.getData() + offset, virtual_tile_bytes);
+    return true;
+  }
+
+  VirtualTextureCache::VirtualTextureCache(VirtualTextureSettings in_settings, TileSource in_source,
+                                           TileUpload in_upload)
+    : settings{ in_settings }, source{ std::move(in_source) }, upload{ std::move(in_upload) }
+  {
+    const uint32_t slots = settings.pool_tiles;
+    pool.resize(static_cast<size_t>(slots) * virtual_tile_bytes);
+    slot_pages.assign(slots, non_resident_page);
+    slot_frames.assign(slots, 0);
+    slot_pinned.assign(slots, 0);
+    previous.assign(slots, non_resident_page);
+    next.assign(slots, non_resident_page);
+    for (uint32_t slot = slots; slot > 0; --slot) free_slots.push_back(slot - 1);
+  }
+
+  VirtualTextureCache::~VirtualTextureCache()
+  {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      stopping = true;
+    }
+    wake.notify_all();
+    if (loader.joinable()) loader.join();
+  }
+
+  uint32_t VirtualTextureCache::AddTexture(uint32_t width, uint32_t height, uint32_t level_count, bool srgb)
+  {
+    level_count = std::min(std::min(level_count, MipLevelCount(width, height)), virtual_max_levels);
+
+    VirtualTextureDescriptor descriptor;
+    descriptor.width = width;
+    descriptor.height = height;
+    descriptor.first_page = static_cast<uint32_t>(page_table.size());
+    descriptor.flags = level_count | (srgb ? 1u << 16 : 0u);
+
+    uint32_t page = descriptor.first_page;
+    level_pages.resize(level_pages.size() + virtual_max_levels, page);
+    for (uint32_t level = 0; level < level_count; ++level)
+    {
+      level_pages[descriptors.size() * virtual_max_levels + level] = page;
+      page += PagesAcross(width, level) * PagesAcross(height, level);
+    }
+    page_table.resize(page, non_resident_page);
+    descriptors.push_back(descriptor);
+    return static_cast<uint32_t>(descriptors.size() - 1);
+  }
+
+  bool VirtualTextureCache::Start()
+  {
+    Profiler::Scope scope("virtual_texture.start");
+
+    feedback_words = (page_table.size() + 31) / 32;
+    feedback.reset(new std::atomic<uint32_t>[feedback_words]);
+    for (size_t i = 0; i < feedback_words; ++i) feedback[i].store(0, std::memory_order_relaxed);
+    pending_pages.assign(page_table.size(), 0);
+
+    // levels of a single page are the fallback of every lookup
+    for (uint32_t texture = 0; texture < descriptors.size(); ++texture)
+    {
+      const VirtualTextureDescriptor& descriptor = descriptors[texture];
+      for (uint32_t level = 0; level < (descriptor.flags & 0xFFFF); ++level)
+      {
+        if (PagesAcross(descriptor.width, level) > 1 || PagesAcross(descriptor.height, level) > 1) continue;
+        if (free_slots.empty())
+        {
+          DEBUG_ERROR(IO, "The virtual texture pool of %u tiles can't hold the pinned levels", settings.pool_tiles);
+          return false;
+        }
+
+        uint32_t slot = free_slots.back();
+        free_slots.pop_back();
+        uint8_t* tile = &pool[static_cast<size_t>(slot) * virtual_tile_bytes];
+        if (!source(texture, level, 0, 0, tile)) std::memset(tile, 255, virtual_tile_bytes);
+        if (upload) upload(slot, tile);
+
+        uint32_t page = PageIndex(texture, level, 0, 0);
+        page_table[page] = slot;
+        slot_pages[slot] = page;
+        slot_pinned[slot] = 1;
+        MarkDirty(page);
+        stats.resident++;
+      }
+    }
+
+    loader = std::thread(&VirtualTextureCache::LoaderLoop, this);
+    DEBUG_LOG(IO, "Virtual textures: %zu textures, %zu pages, %u pool tiles (%.1f MB)", descriptors.size(),
+              page_table.size(), settings.pool_tiles, pool.size() / (1024.0 * 1024.0));
+    return true;
+  }
+
+  uint32_t VirtualTextureCache::PageIndex(uint32_t texture, uint32_t level, uint32_t page_x, uint32_t page_y) const
+  {
+    return level_pages[texture * virtual_max_levels + level] +
+           page_y * PagesAcross(descriptors[texture].width, level) + page_x;
+  }
+
+  VirtualTextureCache::PageAddress VirtualTextureCache::Address(uint32_t page) const
+  {
+    auto found = std::upper_bound(descriptors.begin(), descriptors.end(), page,
+                                  [](uint32_t value, const VirtualTextureDescriptor& descriptor)
+                                  { return value < descriptor.first_page; });
+    PageAddress address;
+    address.texture = static_cast<uint32_t>(found - descriptors.begin()) - 1;
+    const VirtualTextureDescriptor& descriptor = descriptors[address.texture];
+
+    const uint32_t* levels = &level_pages[address.texture * virtual_max_levels];
+    address.level = 0;
+    while (address.level + 1 < (descriptor.flags & 0xFFFF) && levels[address.level + 1] <= page) address.level++;
+
+    uint32_t index = page - levels[address.level];
+    uint32_t across = PagesAcross(descriptor.width, address.level);
+    address.x = index % across;
+    address.y = index / across;
+    return address;
+  }
+
+  void VirtualTextureCache::AddFeedback(const uint32_t* words, size_t count)
+  {
+    for (size_t i = 0; i < std::min(count, feedback_words); ++i)
+      if (words[i]) feedback[i].fetch_or(words[i], std::memory_order_relaxed);
+  }
+
+  glm::vec4 VirtualTextureCache::SampleLevel(uint32_t texture, const glm::vec2& uv, uint32_t level, bool request)
+  {
+    const VirtualTextureDescriptor& descriptor = descriptors[texture];
+    const uint32_t level_count = descriptor.flags & 0xFFFF;
+    const bool srgb = (descriptor.flags >> 16) & 1;
+
+    // walk up the chain until a resident page covers uv
+    for (; level < level_count; ++level)
+    {
+      const uint32_t width = std::max(descriptor.width >> level, 1u);
+      const uint32_t height = std::max(descriptor.height >> level, 1u);
+      float x = uv.x * width - 0.5f;
+      float y = uv.y * height - 0.5f;
+      float fx = std::floor(x);
+      float fy = std::floor(y);
+      uint32_t x0 = Wrap(static_cast<int64_t>(fx), width);
+      uint32_t y0 = Wrap(static_cast<int64_t>(fy), height);
+
+      uint32_t page_x = x0 / virtual_page_size;
+      uint32_t page_y = y0 / virtual_page_size;
+      uint32_t page = PageIndex(texture, level, page_x, page_y);
+      if (request)
+      {
+        Request(page);
+        request = false;
+      }
+
+      uint32_t slot = page_table[page];
+      if (slot == non_resident_page) continue;
+
+      // the border holds the right and bottom neighbours
+      const uint8_t* tile = getTile(slot);
+      uint32_t local_x = x0 - page_x * virtual_page_size + virtual_page_border;
+      uint32_t local_y = y0 - page_y * virtual_page_size + virtual_page_border;
+      const uint8_t* row0 = tile + (local_y * virtual_tile_size + local_x) * 4;
+      const uint8_t* row1 = row0 + virtual_tile_size * 4;
+      float tx = x - fx;
+      float ty = y - fy;
+      glm::vec4 top = glm::mix(DecodeTexel(row0, srgb), DecodeTexel(row0 + 4, srgb), tx);
+      glm::vec4 bottom = glm::mix(DecodeTexel(row1, srgb), DecodeTexel(row1 + 4, srgb), tx);
+      return glm::mix(top, bottom, ty);
+    }
+    return glm::vec4(1.0f);
+  }
+
+  glm::vec4 VirtualTextureCache::Sample(uint32_t texture, const glm::vec2& uv, float lod)
+  {
+    if (!std::isfinite(uv.x) || !std::isfinite(uv.y)) return glm::vec4(1.0f);
+    const float last = static_cast<float>((descriptors[texture].flags & 0xFFFF) - 1);
+
+    if (!(lod > 0.0f)) return SampleLevel(texture, uv, 0, true);
+    if (lod >= last) return SampleLevel(texture, uv, static_cast<uint32_t>(last), true);
+
+    uint32_t level = static_cast<uint32_t>(lod);
+    float blend = lod - level;
+    return glm::mix(SampleLevel(texture, uv, level, true), SampleLevel(texture, uv, level + 1, true), blend);
+  }
+
+  uint32_t VirtualTextureCache::ResidentLevel(uint32_t texture, const glm::vec2& uv, uint32_t level) const
+  {
+    const VirtualTextureDescriptor& descriptor = descriptors[texture];
+    for (; level + 1 < (descriptor.flags & 0xFFFF); ++level)
+    {
+      uint32_t x = Wrap(static_cast<int64_t>(std::floor(uv.x * std::max(descriptor.width >> level, 1u) - 0.5f)),
+                        std::max(descriptor.width >> level, 1u));
+      uint32_t y = Wrap(static_cast<int64_t>(std::floor(uv.y * std::max(descriptor.height >> level, 1u) - 0.5f)),
+                        std::max(descriptor.height >> level, 1u));
+      if (page_table[PageIndex(texture, level, x / virtual_page_size, y / virtual_page_size)] != non_resident_page)
+        break;
+    }
+    return level;
+  }
+
+  void VirtualTextureCache::Unlink(uint32_t slot)
+  {
+    if (previous[slot] != non_resident_page) next[previous[slot]] = next[slot];
+    else head = next[slot];
+    if (next[slot] != non_resident_page) previous[next[slot]] = previous[slot];
+    else tail = previous[slot];
+    previous[slot] = next[slot] = non_resident_page;
+  }
+
+  void VirtualTextureCache::PushFront(uint32_t slot)
+  {
+    previous[slot] = non_resident_page;
+    next[slot] = head;
+    if (head != non_resident_page) previous[head] = slot;
+    head = slot;
+    if (tail == non_resident_page) tail = slot;
+  }
+
+  void VirtualTextureCache::Touch(uint32_t slot)
+  {
+    slot_frames[slot] = frame;
+    if (slot_pinned[slot] || head == slot) return;
+    Unlink(slot);
+    PushFront(slot);
+  }
+
+  void VirtualTextureCache::MarkDirty(uint32_t page)
+  {
+    dirty_first = std::min(dirty_first, page);
+    dirty_last = std::max(dirty_last, page);
+  }
+
+  // Tiles wanted by this frame are never evicted for each other, the rest of
+  // the requests wait for the next frames.
+  bool VirtualTextureCache::Allocate(uint32_t& slot)
+  {
+    if (!free_slots.empty())
+    {
+      slot = free_slots.back();
+      free_slots.pop_back();
+      return true;
+    }
+    if (tail == non_resident_page || slot_frames[tail] >= frame) return false;
+
+    slot = tail;
+    Unlink(slot);
+    page_table[slot_pages[slot]] = non_resident_page;
+    MarkDirty(slot_pages[slot]);
+    slot_pages[slot] = non_resident_page;
+    stats.evictions++;
+    stats.resident--;
+    return true;
+  }
+
+  void VirtualTextureCache::PublishFinished()
+  {
+    std::vector<Load> loads;
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      loads.swap(finished);
+      stats.pending = in_flight;
+    }
+
+    for (const Load& load : loads)
+    {
+      pending_pages[load.page] = 0;
+      if (!load.success)
+      {
+        DEBUG_WARNING(IO, "Failed to load virtual texture page %u", load.page);
+        free_slots.push_back(load.slot);
+        continue;
+      }
+
+      page_table[load.page] = load.slot;
+      slot_pages[load.slot] = load.page;
+      slot_frames[load.slot] = frame;
+      PushFront(load.slot);
+      MarkDirty(load.page);
+      stats.resident++;
+    }
+  }
+
+  void VirtualTextureCache::Update()
+  {
+    Profiler::Scope scope("virtual_texture.update");
+    PublishFinished();
+
+    std::vector<std::pair<uint32_t, uint32_t>> requests;
+    for (size_t word = 0; word < feedback_words; ++word)
+    {
+      uint32_t bits = feedback[word].exchange(0, std::memory_order_relaxed);
+      while (bits)
+      {
+        uint32_t page = static_cast<uint32_t>(word * 32) + Ctz(bits);
+        bits &= bits - 1;
+        stats.requests++;
+
+        if (page_table[page] != non_resident_page) Touch(page_table[page]);
+        else if (!pending_pages[page]) requests.push_back({ Address(page).level, page });
+      }
+    }
+
+    // coarse levels first, they refine the fallback of the most texels
+    std::sort(requests.begin(), requests.end(), [](const std::pair<uint32_t, uint32_t>& a,
+                                                   const std::pair<uint32_t, uint32_t>& b)
+    { return a.first != b.first ? a.first > b.first : a.second < b.second; });
+
+    std::vector<Load> loads;
+    for (const std::pair<uint32_t, uint32_t>& request : requests)
+    {
+      uint32_t slot;
+      if (loads.size() >= settings.max_loads_per_update || !Allocate(slot)) break;
+      pending_pages[request.second] = 1;
+      loads.push_back({ request.second, slot, false });
+    }
+    stats.loads += loads.size();
+
+    if (!loads.empty())
+    {
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        queue.insert(queue.end(), loads.begin(), loads.end());
+        in_flight += static_cast<uint32_t>(loads.size());
+        stats.pending = in_flight;
+      }
+      wake.notify_one();
+    }
+    frame++;
+  }
+
+  void VirtualTextureCache::Flush()
+  {
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+      idle.wait(lock, [this]() { return in_flight == 0; });
+    }
+    PublishFinished();
+  }
+
+  bool VirtualTextureCache::TakeDirtyRange(uint32_t& first, uint32_t& count)
+  {
+    if (dirty_first == non_resident_page) return false;
+    first = dirty_first;
+    count = dirty_last - dirty_first + 1;
+    dirty_first = non_resident_page;
+    dirty_last = 0;
+    return true;
+  }
+
+  void VirtualTextureCache::LoaderLoop()
+  {
+    while (true)
+    {
+      Load load;
+      {
+        std::unique_lock<std::mutex> lock(mutex);
+        wake.wait(lock, [this]() { return stopping || !queue.empty(); });
+        if (stopping) return;
+        load = queue.front();
+        queue.pop_front();
+      }
+
+      PageAddress address = Address(load.page);
+      uint8_t* tile = &pool[static_cast<size_t>(load.slot) * virtual_tile_bytes];
+      load.success = source(address.texture, address.level, address.x, address.y, tile);
+      if (load.success && upload) upload(load.slot, tile);
+
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        finished.push_back(load);
+        in_flight--;
+      }
+      idle.notify_all();
+    }
+  }
+
+} // namespace PathTracer
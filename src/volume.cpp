@@ -0,0 +1,371 @@
+
+#include <VulkanPT/volume.hpp>
+#include <VulkanPT/debug.hpp>
+#include <VulkanPT/profiler.hpp>
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+
+namespace PathTracer
+{
+  static const char volume_magic[8] = { 'V', 'P', 'T', 'V', 'O', 'L', 'U', 'M' };
+  static constexpr uint32_t volume_file_version = 1;
+  // Sections start at multiples of this, like the scene cache, so each can be
+  // copied to the device straight from the mapping.
+  static constexpr uint64_t volume_alignment = 256;
+
+  struct VolumeFileHeader
+  {
+    char magic[8];
+    uint32_t version;
+    uint32_t brick_count;
+    uint32_t size[3];
+    uint32_t reserved;
+    VolumeDescriptor descriptor;
+  };
+
+  // Offsets of the cell table, the majorants, the bricks and their voxels,
+  // then the file size.
+  static void VolumeSections(uint64_t cell_count, uint64_t brick_count, uint64_t offsets[5])
+  {
+    auto align = [](uint64_t offset) { return (offset + volume_alignment - 1) / volume_alignment * volume_alignment; };
+    offsets[0] = align(sizeof(VolumeFileHeader));
+    offsets[1] = align(offsets[0] + cell_count * sizeof(uint32_t));
+    offsets[2] = align(offsets[1] + cell_count * sizeof(float));
+    offsets[3] = align(offsets[2] + brick_count * sizeof(VolumeBrick));
+    offsets[4] = offsets[3] + brick_count * volume_brick_voxels;
+  }
+
+  bool SparseVolume::Write(const std::string& path, const DensityGrid& grid)
+  {
+    const uint32_t size[3] = { grid.width, grid.height, grid.depth };
+    if (!size[0] || !size[1] || !size[2] || grid.density.size() != static_cast<size_t>(size[0]) * size[1] * size[2])
+      return false;
+
+    VolumeFileHeader header {};
+    std::memcpy(header.magic, volume_magic, sizeof(volume_magic));
+    header.version = volume_file_version;
+    header.descriptor.origin = grid.origin;
+    header.descriptor.voxel_size = grid.voxel_size;
+    for (int axis = 0; axis < 3; ++axis)
+    {
+      header.size[axis] = size[axis];
+      header.descriptor.cells[axis] = (size[axis] + volume_brick_size - 1) / volume_brick_size;
+    }
+    const uint32_t* counts = header.descriptor.cells;
+    const size_t cell_count = static_cast<size_t>(counts[0]) * counts[1] * counts[2];
+
+    std::vector<uint32_t> cell_table(cell_count, empty_brick);
+    std::vector<float> majorant_grid(cell_count, 0.0f);
+    std::vector<VolumeBrick> brick_list;
+    std::vector<uint8_t> voxel_data;
+    float values[volume_brick_voxels];
+    for (size_t cell = 0; cell < cell_count; ++cell)
+    {
+      const uint32_t cx = static_cast<uint32_t>(cell % counts[0]);
+      const uint32_t cy = static_cast<uint32_t>(cell / counts[0] % counts[1]);
+      const uint32_t cz = static_cast<uint32_t>(cell / counts[0] / counts[1]);
+      float minimum = infinity, maximum = 0.0f;
+      for (uint32_t i = 0; i < volume_brick_voxels; ++i)
+      {
+        const uint32_t x = cx * volume_brick_size + i % volume_brick_size;
+        const uint32_t y = cy * volume_brick_size + i / volume_brick_size % volume_brick_size;
+        const uint32_t z = cz * volume_brick_size + i / (volume_brick_size * volume_brick_size);
+        values[i] = x < size[0] && y < size[1] && z < size[2] ?
+                    std::max(grid.density[(static_cast<size_t>(z) * size[1] + y) * size[0] + x], 0.0f) : 0.0f;
+        minimum = std::min(minimum, values[i]);
+        maximum = std::max(maximum, values[i]);
+      }
+      if (!(maximum > 0.0f)) continue;
+
+      VolumeBrick brick;
+      brick.minimum = minimum;
+      brick.scale = (maximum - minimum) / 255.0f;
+      float sum = 0.0f;
+      for (uint32_t i = 0; i < volume_brick_voxels; ++i)
+      {
+        const float step = brick.scale > 0.0f ? std::round((values[i] - minimum) / brick.scale) : 0.0f;
+        voxel_data.push_back(static_cast<uint8_t>(std::min(step, 255.0f)));
+        sum += brick.minimum + voxel_data.back() * brick.scale;
+      }
+      brick.average = sum / volume_brick_voxels;
+      cell_table[cell] = static_cast<uint32_t>(brick_list.size());
+      majorant_grid[cell] = brick.minimum + 255.0f * brick.scale;
+      header.descriptor.maximum = std::max(header.descriptor.maximum, majorant_grid[cell]);
+      brick_list.push_back(brick);
+    }
+    header.brick_count = static_cast<uint32_t>(brick_list.size());
+
+    uint64_t offsets[5];
+    VolumeSections(cell_count, brick_list.size(), offsets);
+    std::string temporary_path = path + ".tmp";
+    FILE* output = std::fopen(temporary_path.c_str(), "wb");
+    if (!output)
+    {
+      DEBUG_ERROR(IO, "Failed to create volume file %s", temporary_path.c_str());
+      return false;
+    }
+
+    const void* sections[4] = { cell_table.data(), majorant_grid.data(), brick_list.data(), voxel_data.data() };
+    const size_t section_sizes[4] = { cell_count * sizeof(uint32_t), cell_count * sizeof(float),
+                                      brick_list.size() * sizeof(VolumeBrick), voxel_data.size() };
+    bool success = std::fwrite(&header, sizeof(header), 1, output) == 1;
+    uint64_t written = sizeof(header);
+    const std::vector<uint8_t> zeros(volume_alignment, 0);
+    for (int section = 0; success && section < 4; ++section)
+    {
+      success = std::fwrite(zeros.data(), 1, offsets[section] - written, output) == offsets[section] - written &&
+                std::fwrite(sections[section], 1, section_sizes[section], output) == section_sizes[section];
+      written = offsets[section] + section_sizes[section];
+    }
+    success = std::fclose(output) == 0 && success;
+
+    std::error_code error;
+    if (success) std::filesystem::rename(temporary_path, path, error);
+    if (!success || error)
+    {
+      DEBUG_ERROR(IO, "Failed to write volume file %s", path.c_str());
+      std::filesystem::remove(temporary_path, error);
+      return false;
+    }
+    return true;
+  }
+
+  bool SparseVolume::Open(const std::string& path, VolumeSettings in_settings)
+  {
+    settings = in_settings;
+    if (!file.Open(path) || file.getSize() < sizeof(VolumeFileHeader)) return false;
+
+    VolumeFileHeader header;
+    std::memcpy(&header, file.getData(), sizeof(header));
+    const uint32_t* counts = header.descriptor.cells;
+    const uint64_t cell_count = static_cast<uint64_t>(counts[0]) * counts[1] * counts[2];
+    uint64_t offsets[5];
+    VolumeSections(cell_count, header.brick_count, offsets);
+    if (std::memcmp(header.magic, volume_magic, sizeof(volume_magic)) != 0 || header.version != volume_file_version)
+    {
+      DEBUG_ERROR(IO, "%s is not a volume file of version %u", path.c_str(), volume_file_version);
+      file.Close();
+      return false;
+    }
+    if (offsets[4] > file.getSize())
+    {
+      DEBUG_ERROR(IO, "Volume file %s is truncated", path.c_str());
+      file.Close();
+      return false;
+    }
+
+    descriptor = header.descriptor;
+    std::memcpy(size, header.size, sizeof(size));
+    bounds = AABB();
+    bounds.Grow(descriptor.origin);
+    bounds.Grow(descriptor.origin + glm::vec3(size[0], size[1], size[2]) * descriptor.voxel_size);
+    const uint8_t* data = file.getData();
+    cells = { reinterpret_cast<const uint32_t*>(data + offsets[0]), static_cast<size_t>(cell_count) };
+    majorants = { reinterpret_cast<const float*>(data + offsets[1]), static_cast<size_t>(cell_count) };
+    bricks = { reinterpret_cast<const VolumeBrick*>(data + offsets[2]), header.brick_count };
+    voxels = { data + offsets[3], static_cast<size_t>(header.brick_count) * volume_brick_voxels };
+
+    page_table.assign(header.brick_count, non_resident_brick);
+    request_words = (header.brick_count + 31) / 32;
+    requests.reset(new std::atomic<uint32_t>[std::max<size_t>(request_words, 1)]);
+    for (size_t i = 0; i < request_words; ++i) requests[i].store(0, std::memory_order_relaxed);
+
+    const uint32_t slots = std::min(settings.pool_bricks, header.brick_count);
+    pool.assign(static_cast<size_t>(slots) * volume_brick_voxels, 0);
+    slot_bricks.assign(slots, empty_brick);
+    slot_frames.assign(slots, 0);
+    free_slots.clear();
+    for (uint32_t slot = slots; slot > 0; --slot) free_slots.push_back(slot - 1);
+    loaded_slots.clear();
+    stats = VolumeStats();
+    return true;
+  }
+
+  float SparseVolume::Density(const glm::vec3& position)
+  {
+    const glm::vec3 local = (position - descriptor.origin) / descriptor.voxel_size;
+    if (!(local.x >= 0.0f && local.y >= 0.0f && local.z >= 0.0f)) return 0.0f;
+    const uint32_t x = static_cast<uint32_t>(local.x), y = static_cast<uint32_t>(local.y);
+    const uint32_t z = static_cast<uint32_t>(local.z);
+    if (x >= size[0] || y >= size[1] || z >= size[2]) return 0.0f;
+
+    const uint32_t cell = (z / volume_brick_size * descriptor.cells[1] + y / volume_brick_size) *
+                          descriptor.cells[0] + x / volume_brick_size;
+    const uint32_t brick = cells[cell];
+    if (brick == empty_brick) return 0.0f;
+
+    // a relaxed load first keeps the common case from writing the word
+    const uint32_t bit = 1u << (brick & 31);
+    std::atomic<uint32_t>& word = requests[brick >> 5];
+    if (!(word.load(std::memory_order_relaxed) & bit)) word.fetch_or(bit, std::memory_order_relaxed);
+
+    const VolumeBrick& range = bricks[brick];
+    const uint32_t slot = page_table[brick];
+    if (slot == non_resident_brick) return range.average;
+    const uint32_t voxel = ((z % volume_brick_size) * volume_brick_size + y % volume_brick_size) *
+                           volume_brick_size + x % volume_brick_size;
+    return range.minimum + pool[static_cast<size_t>(slot) * volume_brick_voxels + voxel] * range.scale;
+  }
+
+  bool SparseVolume::Clip(const Ray& ray, float& t_enter, float& t_exit) const
+  {
+    const float cell_size = descriptor.voxel_size * volume_brick_size;
+    const glm::vec3 extent = glm::vec3(descriptor.cells[0], descriptor.cells[1], descriptor.cells[2]) * cell_size;
+    const glm::vec3 inverse = 1.0f / ray.direction;
+    const glm::vec3 near = (descriptor.origin - ray.origin) * inverse;
+    const glm::vec3 far = (descriptor.origin + extent - ray.origin) * inverse;
+    const glm::vec3 low = glm::min(near, far), high = glm::max(near, far);
+    t_enter = std::max(std::max(std::max(low.x, low.y), low.z), ray.tmin);
+    t_exit = std::min(std::min(std::min(high.x, high.y), high.z), ray.tmax);
+    return t_enter < t_exit;
+  }
+
+  template <typename Visit>
+  void SparseVolume::Traverse(const Ray& ray, Visit&& visit) const
+  {
+    float t, t_end;
+    if (!Clip(ray, t, t_end)) return;
+
+    const float cell_size = descriptor.voxel_size * volume_brick_size;
+    const glm::vec3 inverse = 1.0f / ray.direction;
+    int32_t cell[3], step[3];
+    float next[3], delta[3];
+    const glm::vec3 entry = (ray.origin + ray.direction * t - descriptor.origin) / cell_size;
+    for (int axis = 0; axis < 3; ++axis)
+    {
+      const int32_t last = static_cast<int32_t>(descriptor.cells[axis]) - 1;
+      cell[axis] = std::min(std::max(static_cast<int32_t>(std::floor(entry[axis])), 0), last);
+      step[axis] = ray.direction[axis] < 0.0f ? -1 : 1;
+      delta[axis] = std::abs(cell_size * inverse[axis]);
+      const float boundary = descriptor.origin[axis] + (cell[axis] + (step[axis] > 0 ? 1 : 0)) * cell_size;
+      next[axis] = ray.direction[axis] != 0.0f ? (boundary - ray.origin[axis]) * inverse[axis] : infinity;
+    }
+
+    for (;;)
+    {
+      const int axis = next[0] < next[1] ? (next[0] < next[2] ? 0 : 2) : (next[1] < next[2] ? 1 : 2);
+      const float t_exit = std::min(next[axis], t_end);
+      const uint32_t index = (static_cast<uint32_t>(cell[2]) * descriptor.cells[1] + cell[1]) * descriptor.cells[0] +
+                             cell[0];
+      if (t_exit > t && !visit(index, t, t_exit)) return;
+      t = t_exit;
+      cell[axis] += step[axis];
+      if (t >= t_end || cell[axis] < 0 || cell[axis] >= static_cast<int32_t>(descriptor.cells[axis])) return;
+      next[axis] += delta[axis];
+    }
+  }
+
+  template <typename Event>
+  void SparseVolume::Track(const Ray& ray, float sigma, Sampler& sampler, TrackingStats* stats, Event&& event)
+  {
+    // free flights restart at cell borders, exponential steps are memoryless
+    auto segment = [&](float majorant, float t_enter, float t_exit)
+    {
+      if (stats) stats->cells++;
+      if (!(majorant > 0.0f)) return true;
+      for (float t = t_enter;;)
+      {
+        t -= std::log(1.0f - sampler.Get1D()) / majorant;
+        if (t >= t_exit) return true;
+        if (stats) stats->lookups++;
+        if (!event(t, sigma * Density(ray.origin + ray.direction * t), majorant)) return false;
+      }
+    };
+
+    float t_enter, t_exit;
+    if (!settings.majorant_grid)
+    {
+      if (Clip(ray, t_enter, t_exit)) segment(sigma * descriptor.maximum, t_enter, t_exit);
+      return;
+    }
+    Traverse(ray, [&](uint32_t cell, float t_enter, float t_exit)
+    { return segment(sigma * majorants[cell], t_enter, t_exit); });
+  }
+
+  bool SparseVolume::SampleCollision(const Ray& ray, float sigma, Sampler& sampler, float& t, TrackingStats* stats)
+  {
+    bool collided = false;
+    Track(ray, sigma, sampler, stats, [&](float s, float density, float majorant)
+    {
+      collided = sampler.Get1D() * majorant < density;
+      if (collided) t = s;
+      return !collided;
+    });
+    return collided;
+  }
+
+  float SparseVolume::Transmittance(const Ray& ray, float sigma, Sampler& sampler, TrackingStats* stats)
+  {
+    float transmittance = 1.0f;
+    Track(ray, sigma, sampler, stats, [&](float, float density, float majorant)
+    {
+      transmittance *= 1.0f - density / majorant;
+      return true;
+    });
+    return transmittance;
+  }
+
+  void SparseVolume::Update()
+  {
+    Profiler::Scope scope("volume.update");
+    loaded_slots.clear();
+
+    std::vector<uint32_t> wanted;
+    for (size_t word = 0; word < request_words; ++word)
+    {
+      uint32_t bits = requests[word].exchange(0, std::memory_order_relaxed);
+      for (uint32_t bit = 0; bits; ++bit, bits >>= 1)
+      {
+        if (!(bits & 1)) continue;
+        const uint32_t brick = static_cast<uint32_t>(word * 32) + bit;
+        stats.requests++;
+        if (page_table[brick] != non_resident_brick) slot_frames[page_table[brick]] = frame;
+        else wanted.push_back(brick);
+      }
+    }
+
+    // slots unused this frame, least recently used first
+    std::vector<uint32_t> victims;
+    if (wanted.size() > free_slots.size())
+    {
+      for (uint32_t slot = 0; slot < slot_bricks.size(); ++slot)
+        if (slot_bricks[slot] != empty_brick && slot_frames[slot] < frame) victims.push_back(slot);
+      std::sort(victims.begin(), victims.end(), [&](uint32_t a, uint32_t b)
+      { return slot_frames[a] != slot_frames[b] ? slot_frames[a] < slot_frames[b] : a < b; });
+    }
+
+    size_t victim = 0;
+    for (uint32_t brick : wanted)
+    {
+      if (loaded_slots.size() >= settings.max_loads_per_update) break;
+      uint32_t slot;
+      if (!free_slots.empty())
+      {
+        slot = free_slots.back();
+        free_slots.pop_back();
+      }
+      else if (victim < victims.size())
+      {
+        slot = victims[victim++];
+        page_table[slot_bricks[slot]] = non_resident_brick;
+        stats.evictions++;
+      }
+      else break;
+
+      std::memcpy(&pool[static_cast<size_t>(slot) * volume_brick_voxels],
+                  &voxels[static_cast<size_t>(brick) * volume_brick_voxels], volume_brick_voxels);
+      slot_bricks[slot] = brick;
+      slot_frames[slot] = frame;
+      page_table[brick] = slot;
+      loaded_slots.push_back(slot);
+      stats.loads++;
+    }
+
+    stats.resident = static_cast<uint32_t>(slot_bricks.size() - free_slots.size());
+    frame++;
+  }
+
+} // namespace PathTracer
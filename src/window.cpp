@@ -21,10 +21,10 @@ void Window::Init()
   glfwWindowHint(GLFW_RESIZABLE, GLFW_FALSE);
 
   if (window = glfwCreateWindow(width, height, name.c_str(), nullptr, nullptr))
-    Debug::Log("Successfully made a GLFW Window called %s, witdh: %i, height: %i",
-               name.c_str(), width, height);
+    DEBUG_LOG(General, "Successfully made a GLFW Window called %s, witdh: %i, height: %i",
+              name.c_str(), width, height);
   else
-    Debug::Error("GLFW Window creation failed!");
+    DEBUG_ERROR(General, "GLFW Window creation failed!");
 }
 
 GLFWwindow* Window::getInstance() { return window; }